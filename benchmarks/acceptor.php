@@ -0,0 +1,191 @@
+<?php
+/*
+ * Acceptor throughput and latency
+ *
+ * Every worker initiates its contexts up front, waits for the others and
+ * then accepts them back to back, so only the acceptor side is measured.
+ * Reports accepts per second over the wall clock time of the accept phase,
+ * p50/p99 latency of a single accept and the peak memory of the busiest
+ * worker (Zend heap and resident set size).
+ *
+ * Expects the environment set up by kdc.sh (see README):
+ *
+ *   php -d krb5.rcache_shm_size=16777216 acceptor.php \
+ *       [--mode=negotiate,gssapi] [--concurrency=1,4,16] [--requests=500] [--rcache=default,shm]
+ */
+
+if(!extension_loaded('krb5') || !extension_loaded('pcntl')) {
+	die("KRB5 and pcntl extensions required\n");
+}
+
+foreach(array('BENCH_CLIENT', 'BENCH_PASSWORD', 'BENCH_SERVICE', 'BENCH_KEYTAB') as $var) {
+	if(getenv($var) === false) {
+		die("$var not set, start the KDC with: eval \"\$(benchmarks/kdc.sh start)\"\n");
+	}
+}
+
+$options = getopt('', array('mode:', 'concurrency:', 'requests:', 'rcache:'));
+$modes = explode(',', isset($options['mode']) ? $options['mode'] : 'negotiate,gssapi');
+$concurrency = array_map('intval', explode(',', isset($options['concurrency']) ? $options['concurrency'] : '1,4,16'));
+$requests = isset($options['requests']) ? (int) $options['requests'] : 500;
+$rcaches = explode(',', isset($options['rcache']) ? $options['rcache'] : 'default');
+
+$client_principal = getenv('BENCH_CLIENT');
+$service = getenv('BENCH_SERVICE');
+$keytab = getenv('BENCH_KEYTAB');
+
+function now()
+{
+	return function_exists('hrtime') ? hrtime(true) : (int) (microtime(true) * 1e9);
+}
+
+function percentile(array $sorted, $p)
+{
+	return $sorted[min(count($sorted) - 1, (int) ceil($p / 100 * count($sorted)) - 1)];
+}
+
+function tokens($client, $client_principal, $service, $count)
+{
+	$tokens = array();
+	for($i = 0; $i < $count; $i++) {
+		$ctx = new GSSAPIContext();
+		$ctx->acquireCredentials($client, $client_principal, GSS_C_INITIATE);
+		$token = '';
+		$ctx->initSecContext($service, null, null, null, $token);
+		$tokens[] = $token;
+	}
+	return $tokens;
+}
+
+function worker($mode, $rcache, $requests, $dir, $id)
+{
+	global $client_principal, $service, $keytab;
+
+	ini_set('krb5.rcache', $rcache);
+
+	$client = new KRB5CCache();
+	$client->initPassword($client_principal, getenv('BENCH_PASSWORD'));
+	$tokens = tokens($client, $client_principal, $service, $requests + 1);
+
+	if($mode == 'negotiate') {
+		$auth = new KRB5NegotiateAuth($keytab, $service);
+		$auth->setReplayCache($rcache);
+		foreach($tokens as &$token) {
+			$token = 'Negotiate ' . base64_encode($token);
+		}
+		unset($token);
+		$accept = function($token) use ($auth) {
+			$auth->authenticate($token);
+		};
+	} else {
+		$server = new KRB5CCache();
+		$server->initKeytab($service, $keytab);
+		$accept = function($token) use ($server, $service) {
+			$ctx = new GSSAPIContext();
+			$ctx->acquireCredentials($server, $service, GSS_C_ACCEPT);
+			$ctx->acceptSecContext($token);
+		};
+	}
+
+	/* warm up caches outside of the measurement */
+	$accept(array_pop($tokens));
+
+	touch("$dir/ready.$id");
+	while(!file_exists("$dir/go")) {
+		usleep(1000);
+	}
+
+	$latencies = array();
+	$start = now();
+	foreach($tokens as $token) {
+		$t = now();
+		$accept($token);
+		$latencies[] = now() - $t;
+	}
+	$end = now();
+
+	$usage = getrusage();
+	file_put_contents("$dir/result.$id", serialize(array(
+		'start' => $start,
+		'end' => $end,
+		'latencies' => $latencies,
+		'heap' => memory_get_peak_usage(true),
+		'rss' => $usage['ru_maxrss'] * 1024,
+	)));
+}
+
+function run($mode, $rcache, $workers, $requests)
+{
+	$dir = sys_get_temp_dir() . '/php-krb5-bench.' . getmypid();
+	mkdir($dir);
+
+	$pids = array();
+	for($i = 0; $i < $workers; $i++) {
+		$pid = pcntl_fork();
+		if($pid == 0) {
+			try {
+				worker($mode, $rcache, $requests, $dir, $i);
+			} catch(Exception $e) {
+				fwrite(STDERR, "worker $i: " . $e->getMessage() . "\n");
+				exit(1);
+			}
+			exit(0);
+		}
+		$pids[] = $pid;
+	}
+
+	while(count(glob("$dir/ready.*")) < $workers) {
+		if(pcntl_waitpid(-1, $status, WNOHANG) > 0 && pcntl_wexitstatus($status)) {
+			break;
+		}
+		usleep(1000);
+	}
+	touch("$dir/go");
+
+	foreach($pids as $pid) {
+		pcntl_waitpid($pid, $status);
+	}
+
+	$results = array();
+	foreach(glob("$dir/result.*") as $file) {
+		$results[] = unserialize(file_get_contents($file));
+	}
+	array_map('unlink', glob("$dir/*"));
+	rmdir($dir);
+
+	if(count($results) != $workers) {
+		fprintf(STDERR, "%s/%s/%d: %d of %d workers failed\n", $mode, $rcache, $workers, $workers - count($results), $workers);
+		return;
+	}
+
+	$latencies = array();
+	$start = PHP_INT_MAX;
+	$end = 0;
+	$heap = $rss = 0;
+	foreach($results as $result) {
+		$latencies = array_merge($latencies, $result['latencies']);
+		$start = min($start, $result['start']);
+		$end = max($end, $result['end']);
+		$heap = max($heap, $result['heap']);
+		$rss = max($rss, $result['rss']);
+	}
+	sort($latencies);
+
+	printf("%-10s %-8s %5d %10.1f %10.3f %10.3f %10.1f %10.1f\n",
+		$mode, $rcache, $workers,
+		count($latencies) / (($end - $start) / 1e9),
+		percentile($latencies, 50) / 1e6,
+		percentile($latencies, 99) / 1e6,
+		$heap / 1048576, $rss / 1048576);
+}
+
+printf("%-10s %-8s %5s %10s %10s %10s %10s %10s\n",
+	'mode', 'rcache', 'conc', 'accepts/s', 'p50 ms', 'p99 ms', 'heap MB', 'rss MB');
+
+foreach($modes as $mode) {
+	foreach($rcaches as $rcache) {
+		foreach($concurrency as $workers) {
+			run($mode, $rcache, $workers, $requests);
+		}
+	}
+}
@@ -0,0 +1,83 @@
+<?php
+/*
+ * Credential acquisition scaling across threads
+ *
+ * Runs GSSAPIContext::acquireCredentials() back to back in a number of
+ * threads (ZTS build with ext/parallel) and reports the calls per second
+ * and the speedup over a single thread. With credential store support
+ * ("GSSAPI credential stores" in phpinfo) acquisition takes no lock and
+ * should scale with the number of cores.
+ *
+ * Expects the environment set up by kdc.sh (see README):
+ *
+ *   php acquire_threads.php [--threads=1,2,4,8] [--requests=2000]
+ */
+
+if(!extension_loaded('krb5') || !extension_loaded('parallel')) {
+	die("KRB5 and parallel extensions required (ZTS build)\n");
+}
+
+foreach(array('BENCH_CLIENT', 'BENCH_PASSWORD', 'BENCH_SERVICE', 'BENCH_KEYTAB') as $var) {
+	if(getenv($var) === false) {
+		die("$var not set, start the KDC with: eval \"\$(benchmarks/kdc.sh start)\"\n");
+	}
+}
+
+$options = getopt('', array('threads:', 'requests:'));
+$threads = array_map('intval', explode(',', isset($options['threads']) ? $options['threads'] : '1,2,4,8'));
+$requests = isset($options['requests']) ? (int) $options['requests'] : 2000;
+
+$worker = function($requests) {
+	$client_principal = getenv('BENCH_CLIENT');
+	$service = getenv('BENCH_SERVICE');
+
+	$client = new KRB5CCache();
+	$client->initPassword($client_principal, getenv('BENCH_PASSWORD'));
+	$server = new KRB5CCache();
+	$server->initKeytab($service, getenv('BENCH_KEYTAB'));
+
+	$start = hrtime(true);
+	for($i = 0; $i < $requests; $i++) {
+		$ctx = new GSSAPIContext();
+		if($i % 2) {
+			$ctx->acquireCredentials($client, $client_principal, GSS_C_INITIATE);
+		} else {
+			$ctx->acquireCredentials($server, $service, GSS_C_ACCEPT);
+		}
+	}
+
+	return array($start, hrtime(true));
+};
+
+printf("%7s %12s %8s\n", 'threads', 'acquires/s', 'speedup');
+
+$single = null;
+foreach($threads as $count) {
+	$runtimes = array();
+	for($i = 0; $i < $count; $i++) {
+		$runtimes[] = new parallel\Runtime();
+	}
+
+	$futures = array();
+	foreach($runtimes as $runtime) {
+		$futures[] = $runtime->run($worker, array($requests));
+	}
+
+	$start = PHP_INT_MAX;
+	$end = 0;
+	foreach($futures as $future) {
+		list($s, $e) = $future->value();
+		$start = min($start, $s);
+		$end = max($end, $e);
+	}
+
+	foreach($runtimes as $runtime) {
+		$runtime->close();
+	}
+
+	$rate = $count * $requests / (($end - $start) / 1e9);
+	if($single === null) {
+		$single = $rate / $count;
+	}
+	printf("%7d %12.1f %7.2fx\n", $count, $rate, $rate / $single);
+}
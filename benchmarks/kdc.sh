@@ -0,0 +1,93 @@
+#!/bin/bash
+#
+# Starts a throwaway MIT krb5kdc for the benchmarks
+#
+#   eval "$(benchmarks/kdc.sh start)"   # exports KRB5_CONFIG, BENCH_* variables
+#   benchmarks/kdc.sh stop "$BENCH_KDC_DIR"
+#
+# Needs krb5kdc, kdb5_util and kadmin.local (MIT krb5 server packages) in
+# PATH or in $KRB5_SBIN.
+
+set -e
+
+REALM=BENCH.TEST
+PORT=${BENCH_KDC_PORT:-$((20000 + RANDOM % 20000))}
+SBIN=${KRB5_SBIN:-}
+
+tool() {
+	if [ -n "$SBIN" ]; then echo "$SBIN/$1"; else command -v "$1" || echo "/usr/sbin/$1"; fi
+}
+
+start() {
+	DIR=$(mktemp -d "${TMPDIR:-/tmp}/php-krb5-bench.XXXXXX")
+
+	cat > "$DIR/krb5.conf" <<CONF
+[libdefaults]
+	default_realm = $REALM
+	dns_lookup_kdc = false
+	dns_lookup_realm = false
+	rdns = false
+	ticket_lifetime = 10h
+
+[realms]
+	$REALM = {
+		kdc = 127.0.0.1:$PORT
+	}
+CONF
+
+	cat > "$DIR/kdc.conf" <<CONF
+[kdcdefaults]
+	kdc_ports = $PORT
+	kdc_tcp_ports = $PORT
+
+[realms]
+	$REALM = {
+		database_name = $DIR/principal
+		key_stash_file = $DIR/stash
+		acl_file = $DIR/kadm5.acl
+		max_life = 10h
+	}
+
+[logging]
+	kdc = FILE:$DIR/kdc.log
+CONF
+	touch "$DIR/kadm5.acl"
+
+	export KRB5_CONFIG="$DIR/krb5.conf" KRB5_KDC_PROFILE="$DIR/kdc.conf"
+
+	"$(tool kdb5_util)" create -r $REALM -s -P bench-master > /dev/null
+	"$(tool kadmin.local)" -r $REALM -q "addprinc -pw bench-client client@$REALM" > /dev/null
+	"$(tool kadmin.local)" -r $REALM -q "addprinc -randkey HTTP/localhost@$REALM" > /dev/null
+	"$(tool kadmin.local)" -r $REALM -q "ktadd -k $DIR/server.keytab HTTP/localhost@$REALM" > /dev/null
+
+	"$(tool krb5kdc)" -n > /dev/null 2>&1 &
+	echo $! > "$DIR/kdc.pid"
+	sleep 1
+
+	echo "export KRB5_CONFIG='$DIR/krb5.conf'"
+	echo "export BENCH_KDC_DIR='$DIR'"
+	echo "export BENCH_CLIENT='client@$REALM'"
+	echo "export BENCH_PASSWORD='bench-client'"
+	echo "export BENCH_SERVICE='HTTP/localhost@$REALM'"
+	echo "export BENCH_KEYTAB='$DIR/server.keytab'"
+	echo "export BENCH_KDC='udp://127.0.0.1:$PORT'"
+}
+
+stop() {
+	DIR=$1
+	if [ -z "$DIR" ] || [ ! -f "$DIR/kdc.conf" ]; then
+		echo "usage: $0 stop <kdc directory>" >&2
+		exit 1
+	fi
+
+	if [ -f "$DIR/kdc.pid" ]; then
+		kill "$(cat "$DIR/kdc.pid")" 2> /dev/null || true
+	fi
+	rm -rf "$DIR"
+}
+
+case "$1" in
+	start) start ;;
+	stop) stop "$2" ;;
+	*) echo "usage: $0 start|stop <kdc directory>" >&2; exit 1 ;;
+esac
@@ -0,0 +1,18 @@
+#!/bin/bash
+#
+# Runs the acceptor benchmarks against a throwaway KDC
+#
+#   benchmarks/run.sh [acceptor.php options]
+#
+# PHP defaults to the php in PATH with the freshly built modules/krb5.so,
+# override with $PHP (e.g. PHP="php -d extension=krb5.so").
+
+set -e
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+PHP=${PHP:-php -d extension=$DIR/../modules/krb5.so}
+
+eval "$("$DIR/kdc.sh" start)"
+trap '"$DIR/kdc.sh" stop "$BENCH_KDC_DIR"' EXIT
+
+$PHP -d krb5.rcache_shm_size=${RCACHE_SHM_SIZE:-16777216} "$DIR/acceptor.php" "$@"
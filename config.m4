@@ -73,9 +73,40 @@ if test "$PHP_KRB5" != "no" -o "$PHP_KRB5KADM" != "no"; then
 	AC_MSG_RESULT($KRB5_VERSION)
 	AC_DEFINE_UNQUOTED(KRB5_VERSION, ["$KRB5_VERSION"], [Kerberos library version])
 
+	dnl the "rcache" credential store key was added in MIT krb5 1.13
+	AC_MSG_CHECKING([for the rcache credential store key])
+	krb5_release=`echo "$KRB5_VERSION" | sed -n -e 's#^Kerberos 5 release \([[0-9]]*\)\.\([[0-9]]*\).*#\1 \2#p'`
+	if test -n "$krb5_release"; then
+		set $krb5_release
+		if test "[$]1" -gt 1 -o "[$]2" -ge 13; then
+			AC_DEFINE(HAVE_KRB5_CRED_STORE_RCACHE, 1, [gss_acquire_cred_from() accepts the rcache key])
+			AC_MSG_RESULT([yes])
+		else
+			AC_MSG_RESULT([no])
+		fi
+	else
+		AC_MSG_RESULT([no])
+	fi
+
+	dnl name attributes (PAC access) and credential stores are not available in every GSSAPI library
+	old_LIBS=$LIBS
+	old_CPPFLAGS=$CPPFLAGS
+	LIBS="$LIBS $KRB5_LDFLAGS"
+	CPPFLAGS="$CPPFLAGS $KRB5_CFLAGS"
+	AC_CHECK_HEADERS([gssapi/gssapi_ext.h])
+	AC_CHECK_FUNCS([gss_get_name_attribute gss_acquire_cred_from gss_wrap_iov gss_get_mic_iov])
+	LIBS=$old_LIBS
+	CPPFLAGS=$old_CPPFLAGS
+
+	dnl robust process-shared mutexes, PTHREAD_MUTEX_ROBUST is an enum in glibc so it cannot be tested with #ifdef
+	old_LIBS=$LIBS
+	LIBS="$LIBS -lpthread"
+	AC_CHECK_FUNCS([pthread_mutexattr_setrobust])
+	LIBS=$old_LIBS
+
 	if test "$hs_php_version" -ge "7000000"; then
 dnl	  	SOURCE_FILES="php7/krb5.c php7/negotiate_auth.c php7/gssapi.c"
-	  	SOURCE_FILES="php7/krb5.c php7/negotiate_auth.c php7/gssapi.c"
+	  	SOURCE_FILES="php7/krb5.c php7/negotiate_auth.c php7/gssapi.c php7/ccache_format.c php7/shm_ccache.c php7/kdc_exchange.c php7/creds_operation.c php7/keytab_cache.c php7/shm_rcache.c php7/base64.c php7/name_attributes.c php7/name_cache.c php7/exception.c php7/sasl_gssapi.c"
 	else
 	  	SOURCE_FILES="php5/krb5.c php5/negotiate_auth.c php5/gssapi.c"
 	fi
@@ -86,10 +117,11 @@ dnl	  	SOURCE_FILES="php7/krb5.c php7/negotiate_auth.c php7/gssapi.c"
 	fi
 
 	CFLAGS="-Wall ${CFLAGS} ${KRB5_CFLAGS}"
-	LDFLAGS="${LDFLAGS} ${KRB5_LDFLAGS}"
+	LDFLAGS="${LDFLAGS} ${KRB5_LDFLAGS} -lpthread"
 	PHP_SUBST(CFLAGS)
 	PHP_SUBST(LDFLAGS)
 
 	PHP_NEW_EXTENSION(krb5, $SOURCE_FILES, $ext_shared)
+	PHP_ADD_EXTENSION_DEP(krb5, hash)
 	PHP_INSTALL_HEADERS([ext/krb5], [php_krb5.h])
 fi
@@ -0,0 +1,112 @@
+<?php
+/*
+ * Reference transport for KRB5InitCredsOperation / KRB5TktCredsOperation
+ *
+ * Each exchange runs as a generator which yields the socket it is waiting
+ * on; the loop below multiplexes any number of them with stream_select().
+ * To plug into an event loop (ReactPHP, Amp, Swoole, Fibers) resume the
+ * generator from the loop's readable callback for the yielded stream
+ * instead.
+ */
+
+if(!extension_loaded('krb5')) {
+	die('KRB5 Extension not installed');
+}
+
+// KDC per realm, as in the [realms] section of krb5.conf
+$kdcs = array(
+	'EXAMPLE.COM' => 'udp://kdc.example.com:88',
+);
+
+function kdc_exchange($op, array $kdcs, $timeout = 1.0, $tries = 3)
+{
+	while(!$op->isComplete()) {
+		$realm = $op->getRealm();
+		if(!isset($kdcs[$realm])) {
+			throw new Exception('No KDC known for realm ' . $realm);
+		}
+
+		$sock = stream_socket_client($kdcs[$realm], $errno, $errstr);
+		if(!$sock) {
+			throw new Exception('Cannot reach KDC: ' . $errstr);
+		}
+		stream_set_blocking($sock, false);
+
+		$reply = '';
+		for($try = 0; $try < $tries && $reply === ''; $try++) {
+			fwrite($sock, $op->getRequest());
+			$deadline = microtime(true) + $timeout;
+
+			while($reply === '' && microtime(true) < $deadline) {
+				// suspend until the loop reports the socket readable (or the retry timer fires)
+				yield $sock => $deadline;
+				$reply = (string) fread($sock, 65536);
+			}
+		}
+		fclose($sock);
+
+		if($reply === '') {
+			throw new Exception('KDC did not answer');
+		}
+
+		$op->step($reply);
+	}
+}
+
+function run_all(array $exchanges)
+{
+	foreach($exchanges as $id => $gen) {
+		try {
+			$gen->current();
+		} catch(Exception $e) {
+			echo $id, ': ', $e->getMessage(), "\n";
+			unset($exchanges[$id]);
+		}
+	}
+
+	while($exchanges) {
+		$read = array();
+		$timeout = 1.0;
+		foreach($exchanges as $id => $gen) {
+			if(!$gen->valid()) {
+				unset($exchanges[$id]);
+				continue;
+			}
+			$read[$id] = $gen->key();
+			$timeout = min($timeout, max(0, $gen->current() - microtime(true)));
+		}
+		if(!$read) break;
+
+		$write = $except = null;
+		stream_select($read, $write, $except, 0, (int) ($timeout * 1000000));
+
+		// resume everything that is readable or whose timer expired
+		foreach($exchanges as $id => $gen) {
+			if(isset($read[$id]) || $gen->current() <= microtime(true)) {
+				try {
+					$gen->next();
+				} catch(Exception $e) {
+					echo $id, ': ', $e->getMessage(), "\n";
+					unset($exchanges[$id]);
+				}
+			}
+		}
+	}
+}
+
+// hundreds of logins can be kept in flight this way
+$caches = array();
+$exchanges = array();
+foreach(array('alice@EXAMPLE.COM' => 'secret1', 'bob@EXAMPLE.COM' => 'secret2') as $principal => $password) {
+	$caches[$principal] = new KRB5CCache();
+	$op = new KRB5InitCredsOperation($caches[$principal], $principal, array('password' => $password));
+	$exchanges[$principal] = kdc_exchange($op, $kdcs);
+}
+
+run_all($exchanges);
+
+foreach($caches as $principal => $ccache) {
+	echo $principal, ': ', ($ccache->isValid() ? 'logged in' : 'failed'), "\n";
+}
+
+?>
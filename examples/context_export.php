@@ -0,0 +1,36 @@
+<?php
+/*
+ * Keeps an established service-to-service context in APCu so following
+ * requests wrap their messages without another AP-REQ round trip.
+ * The exported context contains the session keys, only park it in
+ * storage private to this host and user.
+ */
+if(!extension_loaded('krb5') || !extension_loaded('apcu')) {
+	die('KRB5 and APCu extensions required');
+}
+
+$target = 'HTTP/backend.example.com@EXAMPLE.COM';
+$context = new GSSAPIContext();
+
+if(($exported = apcu_fetch('krb5ctx:' . $target)) !== false) {
+	$context->import($exported);
+}
+
+if($context->getTimeRemaining() < 60) {
+	$ccache = new KRB5CCache();
+	$ccache->initKeytab('client@EXAMPLE.COM', '/etc/client.keytab');
+	$context = new GSSAPIContext();
+	$context->acquireCredentials($ccache, 'client@EXAMPLE.COM', GSS_C_INITIATE);
+
+	$token = '';
+	$context->initSecContext($target, null, null, null, $token);
+	// ... send $token to the backend once
+}
+
+$sealed = '';
+$context->wrap('request payload', $sealed, true);
+// ... send $sealed to the backend
+
+// export() invalidates the local context, park it for the next request
+$lifetime = $context->getTimeRemaining();
+apcu_store('krb5ctx:' . $target, $context->export(), $lifetime);
@@ -0,0 +1,41 @@
+<?php
+/*
+ * Negotiate authentication in a long-running server (here the plain
+ * stream server, the same applies to Swoole, RoadRunner or ReactPHP).
+ * One KRB5NegotiateAuth serves all requests, so its acceptor credentials
+ * are acquired once.
+ */
+if(!extension_loaded('krb5')) {
+	die('KRB5 Extension not installed');
+}
+
+$auth = new KRB5NegotiateAuth('/etc/krb5.keytab', 'HTTP@www.example.com');
+$server = stream_socket_server('tcp://0.0.0.0:8080');
+
+while($conn = stream_socket_accept($server, -1)) {
+	$authorization = null;
+	while(($line = fgets($conn)) !== false && rtrim($line) !== '') {
+		if(stripos($line, 'Authorization:') === 0) {
+			$authorization = trim(substr($line, 14));
+		}
+	}
+
+	try {
+		if($authorization === null) {
+			throw new Exception('No authorization');
+		}
+		$result = $auth->authenticate($authorization);
+
+		$body = 'Hello ' . $result->getPrincipal() . "\n";
+		$headers = "HTTP/1.1 200 OK\r\n";
+		if($result->getResponseToken() !== null) {
+			$headers .= 'WWW-Authenticate: Negotiate ' . $result->getResponseToken() . "\r\n";
+		}
+	} catch(Exception $e) {
+		$body = "Authentication required\n";
+		$headers = "HTTP/1.1 401 Unauthorized\r\nWWW-Authenticate: Negotiate\r\n";
+	}
+
+	fwrite($conn, $headers . 'Content-Length: ' . strlen($body) . "\r\nConnection: close\r\n\r\n" . $body);
+	fclose($conn);
+}
@@ -0,0 +1,51 @@
+<?php
+/*
+ * SASL GSSAPI client over a plain TCP stream where every SASL message is
+ * prefixed with its 4 octet length (Kafka's GSSAPI handshake). Protocols
+ * carrying SASL in their own PDUs (LDAP bind, IMAP AUTHENTICATE) pass the
+ * challenges to step() themselves and call wrapStream() afterwards.
+ */
+if(!extension_loaded('krb5')) {
+	die('KRB5 extension required');
+}
+
+// Kafka request: size, api key, api version, correlation id, client id, body
+function kafka_request($stream, $api_key, $api_version, $correlation_id, $body) {
+	$client_id = 'php-krb5';
+	$request = pack('nnNn', $api_key, $api_version, $correlation_id, strlen($client_id)) . $client_id . $body;
+	fwrite($stream, pack('N', strlen($request)) . $request);
+}
+
+function kafka_response($stream) {
+	$length = unpack('N', fread($stream, 4));
+	$response = '';
+	while(strlen($response) < $length[1] && !feof($stream)) {
+		$response .= fread($stream, $length[1] - strlen($response));
+	}
+	return $response;
+}
+
+$ccache = new KRB5CCache();
+$ccache->initKeytab('client@EXAMPLE.COM', '/etc/client.keytab');
+
+$stream = stream_socket_client('tcp://broker.example.com:9092');
+
+// SaslHandshake v0 (api key 17) selects GSSAPI, the broker then expects
+// the raw length prefixed SASL messages
+kafka_request($stream, 17, 0, 1, pack('n', strlen('GSSAPI')) . 'GSSAPI');
+$handshake = unpack('Ncorrelation_id/nerror_code', kafka_response($stream));
+if($handshake['error_code'] != 0) {
+	die('GSSAPI not enabled on the broker');
+}
+
+// Kafka brokers only offer the "auth" quality of protection
+$sasl = new KRB5SaslGssapi($ccache, 'kafka@broker.example.com', KRB5SaslGssapi::LAYER_NONE);
+$sasl->negotiate($stream);
+
+// with a security layer everything written from here on would be wrapped
+// and everything read unwrapped, without one the stream stays as it is
+$sasl->wrapStream($stream);
+
+// ApiVersions v0 (api key 18) on the authenticated connection
+kafka_request($stream, 18, 0, 2, '');
+$reply = kafka_response($stream);
@@ -0,0 +1,21 @@
+<?php
+if(!extension_loaded('krb5')) {
+	die('KRB5 Extension not installed');
+}
+
+$auth = new KRB5NegotiateAuth('/etc/krb5.keytab');
+
+// the first key signs new tokens; keep the previous one listed while rotating
+$auth->setSessionKeys(array(
+	'2024b' => getenv('SESSION_KEY_CURRENT'),
+	'2024a' => getenv('SESSION_KEY_PREVIOUS'),
+), 3600);
+
+if(!empty($_COOKIE['krb5session']) && $auth->validateSessionToken($_COOKIE['krb5session'])) {
+	echo 'Success - session of ' . $auth->getAuthenticatedUser();
+} else if($auth->doAuthentication()) {
+	setcookie('krb5session', $auth->getSessionToken(), 0, '/', '', true, true);
+	echo 'Success - authenticated as ' . $auth->getAuthenticatedUser();
+}
+
+?>
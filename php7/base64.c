@@ -0,0 +1,325 @@
+/**
+* Copyright (c) 2008 Moritz Bechler
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+**/
+
+
+/*
+ * Base64 for Negotiate headers
+ *
+ * Decodes into and encodes from caller provided buffers, so the header
+ * value goes straight into the GSS input token and the output token
+ * straight into the response header line. Kerberos tickets carrying a
+ * PAC are often 10-40 KB, so x86 CPUs with AVX2 process 32 characters
+ * per step (after Wojciech Muła's and Alfred Klomp's vectorised codecs);
+ * everything else and the tails use the scalar code.
+ */
+
+#include "php_krb5.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define PHP_KRB5_BASE64_AVX2 1
+# include <immintrin.h>
+#endif
+
+static const char php_krb5_base64_chars[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static signed char php_krb5_base64_values[256];
+
+/* RFC 4648 5, for session tokens */
+static const char php_krb5_base64url_chars[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+static signed char php_krb5_base64url_values[256];
+
+#ifdef PHP_KRB5_BASE64_AVX2
+static int php_krb5_base64_have_avx2 = 0;
+#endif
+
+/* {{{ Called from MINIT */
+void php_krb5_base64_init()
+{
+	int i;
+
+	memset(php_krb5_base64_values, -1, sizeof(php_krb5_base64_values));
+	memset(php_krb5_base64url_values, -1, sizeof(php_krb5_base64url_values));
+	for(i = 0; i < 64; i++) {
+		php_krb5_base64_values[(unsigned char) php_krb5_base64_chars[i]] = i;
+		php_krb5_base64url_values[(unsigned char) php_krb5_base64url_chars[i]] = i;
+	}
+
+#ifdef PHP_KRB5_BASE64_AVX2
+	__builtin_cpu_init();
+	php_krb5_base64_have_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+/* }}} */
+
+#ifdef PHP_KRB5_BASE64_AVX2
+/* {{{ Encodes 24 byte blocks while at least 28 bytes are readable, returns the bytes consumed */
+__attribute__((target("avx2")))
+static size_t php_krb5_base64_encode_avx2(const unsigned char *in, size_t len, char *out)
+{
+	const unsigned char *start = in;
+	const __m256i shuffle = _mm256_setr_epi8(
+			1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+			1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m256i lut = _mm256_setr_epi8(
+			65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0,
+			65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+
+	while(len >= 28) {
+		__m256i str, t0, t1, t2, t3, idx;
+
+		/* bytes 0..11 to the low lane, 12..23 to the high lane */
+		str = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*) in)),
+				_mm_loadu_si128((const __m128i*) (in + 12)), 1);
+		str = _mm256_shuffle_epi8(str, shuffle);
+
+		/* split each 3 bytes into four 6 bit indices */
+		t0 = _mm256_and_si256(str, _mm256_set1_epi32(0x0fc0fc00));
+		t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+		t2 = _mm256_and_si256(str, _mm256_set1_epi32(0x003f03f0));
+		t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+		str = _mm256_or_si256(t1, t3);
+
+		/* indices to characters */
+		idx = _mm256_subs_epu8(str, _mm256_set1_epi8(51));
+		idx = _mm256_sub_epi8(idx, _mm256_cmpgt_epi8(str, _mm256_set1_epi8(25)));
+		str = _mm256_add_epi8(str, _mm256_shuffle_epi8(lut, idx));
+
+		_mm256_storeu_si256((__m256i*) out, str);
+
+		in += 24;
+		len -= 24;
+		out += 32;
+	}
+
+	return in - start;
+}
+/* }}} */
+
+/* {{{ Decodes 32 character blocks while at least 45 characters remain, returns
+       the characters consumed. Stops early at the first block containing
+       anything but the base64 alphabet, the scalar code deals with that */
+__attribute__((target("avx2")))
+static size_t php_krb5_base64_decode_avx2(const char *in, size_t len, unsigned char *out)
+{
+	const char *start = in;
+	const __m256i lut_lo = _mm256_setr_epi8(
+			0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+			0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m256i lut_hi = _mm256_setr_epi8(
+			0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+			0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m256i lut_roll = _mm256_setr_epi8(
+			0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+			0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+
+	/* the 32 byte store writes 8 bytes past the 24 decoded ones */
+	while(len >= 45) {
+		__m256i str, hi_nibbles, lo_nibbles, hi, lo, roll;
+
+		str = _mm256_loadu_si256((const __m256i*) in);
+
+		hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+		lo_nibbles = _mm256_and_si256(str, mask_2f);
+		hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+		lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+		if(!_mm256_testz_si256(lo, hi)) {
+			break;
+		}
+
+		/* characters to 6 bit values */
+		roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(str, mask_2f), hi_nibbles));
+		str = _mm256_add_epi8(str, roll);
+
+		/* pack four 6 bit values into 3 bytes */
+		str = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+		str = _mm256_madd_epi16(str, _mm256_set1_epi32(0x00011000));
+		str = _mm256_shuffle_epi8(str, _mm256_setr_epi8(
+				2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+				2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+		str = _mm256_permutevar8x32_epi32(str, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1));
+
+		_mm256_storeu_si256((__m256i*) out, str);
+
+		in += 32;
+		len -= 32;
+		out += 24;
+	}
+
+	return in - start;
+}
+/* }}} */
+#endif
+
+/* {{{ Encodes whole and trailing blocks with the alphabet chars, padding the
+       last block if pad is set */
+static char *php_krb5_base64_encode_scalar(const unsigned char *in, size_t len, char *out, const char *chars, int pad)
+{
+	size_t done;
+
+	for(done = 0; len - done >= 3; done += 3) {
+		*out++ = chars[in[done] >> 2];
+		*out++ = chars[((in[done] & 0x03) << 4) | (in[done + 1] >> 4)];
+		*out++ = chars[((in[done + 1] & 0x0f) << 2) | (in[done + 2] >> 6)];
+		*out++ = chars[in[done + 2] & 0x3f];
+	}
+
+	if(len - done == 1) {
+		*out++ = chars[in[done] >> 2];
+		*out++ = chars[(in[done] & 0x03) << 4];
+		if(pad) {
+			*out++ = '=';
+			*out++ = '=';
+		}
+	} else if(len - done == 2) {
+		*out++ = chars[in[done] >> 2];
+		*out++ = chars[((in[done] & 0x03) << 4) | (in[done + 1] >> 4)];
+		*out++ = chars[(in[done + 1] & 0x0f) << 2];
+		if(pad) {
+			*out++ = '=';
+		}
+	}
+
+	return out;
+}
+/* }}} */
+
+/* {{{ Encodes len bytes into out, which must hold php_krb5_base64_encoded_len(len)
+       characters. Returns the number of characters written, no terminating NUL */
+size_t php_krb5_base64_encode(const unsigned char *in, size_t len, char *out)
+{
+	char *start = out;
+#ifdef PHP_KRB5_BASE64_AVX2
+	size_t done;
+
+	if(php_krb5_base64_have_avx2) {
+		done = php_krb5_base64_encode_avx2(in, len, out);
+		in += done;
+		len -= done;
+		out += done / 3 * 4;
+	}
+#endif
+
+	return php_krb5_base64_encode_scalar(in, len, out, php_krb5_base64_chars, 1) - start;
+}
+/* }}} */
+
+/* {{{ base64url without padding, out must hold php_krb5_base64_encoded_len(len)
+       characters. Returns the number of characters written */
+size_t php_krb5_base64url_encode(const unsigned char *in, size_t len, char *out)
+{
+	return php_krb5_base64_encode_scalar(in, len, out, php_krb5_base64url_chars, 0) - out;
+}
+/* }}} */
+
+/* {{{ Decodes the unpadded characters in[done..len) with the values table */
+static int php_krb5_base64_decode_scalar(const unsigned char *p, size_t done, size_t len, unsigned char *out, unsigned char **end, const signed char *values)
+{
+	int a, b, c, d;
+
+	for(; len - done >= 4; done += 4) {
+		a = values[p[done]];
+		b = values[p[done + 1]];
+		c = values[p[done + 2]];
+		d = values[p[done + 3]];
+		if((a | b | c | d) < 0) {
+			return FAILURE;
+		}
+
+		*out++ = (a << 2) | (b >> 4);
+		*out++ = (b << 4) | (c >> 2);
+		*out++ = (c << 6) | d;
+	}
+
+	if(len - done >= 2) {
+		a = values[p[done]];
+		b = values[p[done + 1]];
+		if((a | b) < 0) {
+			return FAILURE;
+		}
+		*out++ = (a << 2) | (b >> 4);
+
+		if(len - done == 3) {
+			c = values[p[done + 2]];
+			if(c < 0) {
+				return FAILURE;
+			}
+			*out++ = (b << 4) | (c >> 2);
+		}
+	}
+
+	*end = out;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ Decodes len characters into out, which must hold php_krb5_base64_decoded_len(len)
+       bytes. Padding is optional, anything outside the alphabet (including
+       whitespace) is rejected */
+int php_krb5_base64_decode(const char *in, size_t len, unsigned char *out, size_t *out_len)
+{
+	unsigned char *start = out, *end;
+	size_t done = 0;
+
+	if(len >= 1 && in[len - 1] == '=') len--;
+	if(len >= 1 && in[len - 1] == '=') len--;
+	if(len % 4 == 1) {
+		return FAILURE;
+	}
+
+#ifdef PHP_KRB5_BASE64_AVX2
+	if(php_krb5_base64_have_avx2) {
+		done = php_krb5_base64_decode_avx2(in, len, out);
+		out += done / 4 * 3;
+	}
+#endif
+
+	if(php_krb5_base64_decode_scalar((const unsigned char*) in, done, len, out, &end, php_krb5_base64_values) == FAILURE) {
+		return FAILURE;
+	}
+
+	*out_len = end - start;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ base64url without padding, out must hold php_krb5_base64_decoded_len(len)
+       bytes. '=', '+', '/' and whitespace are rejected */
+int php_krb5_base64url_decode(const char *in, size_t len, unsigned char *out, size_t *out_len)
+{
+	unsigned char *end;
+
+	if(len % 4 == 1) {
+		return FAILURE;
+	}
+
+	if(php_krb5_base64_decode_scalar((const unsigned char*) in, 0, len, out, &end, php_krb5_base64url_values) == FAILURE) {
+		return FAILURE;
+	}
+
+	*out_len = end - out;
+	return SUCCESS;
+}
+/* }}} */
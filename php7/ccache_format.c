@@ -0,0 +1,608 @@
+/**
+* Copyright (c) 2008 Moritz Bechler
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+**/
+
+/*
+ * Conversion between credential caches and the (MIT) FILE ccache format,
+ * version 3 and 4. Everything is written big-endian:
+ *
+ *   uint16 version, [v4: uint16 header length, header]
+ *   principal default_principal
+ *   credential *
+ *
+ * The v4 header is a list of (uint16 tag, uint16 length, data) fields, the
+ * only one defined is the KDC time offset (tag 1: uint32 seconds, uint32
+ * microseconds), which is carried over to and from the context.
+ */
+
+#include "php_krb5.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define PHP_KRB5_FCC_V3 0x0503
+#define PHP_KRB5_FCC_V4 0x0504
+
+#define PHP_KRB5_FCC_TAG_DELTATIME 1
+
+#ifndef HAVE_KRB5_HEIMDAL
+
+/* Writer */
+
+/* {{{ */
+static void php_krb5_fcc_put16(smart_str *out, uint16_t val)
+{
+	unsigned char buf[2];
+
+	buf[0] = (val >> 8) & 0xff;
+	buf[1] = val & 0xff;
+	smart_str_appendl(out, (char*) buf, sizeof(buf));
+}
+/* }}} */
+
+/* {{{ */
+static void php_krb5_fcc_put32(smart_str *out, uint32_t val)
+{
+	unsigned char buf[4];
+
+	buf[0] = (val >> 24) & 0xff;
+	buf[1] = (val >> 16) & 0xff;
+	buf[2] = (val >> 8) & 0xff;
+	buf[3] = val & 0xff;
+	smart_str_appendl(out, (char*) buf, sizeof(buf));
+}
+/* }}} */
+
+/* {{{ */
+static void php_krb5_fcc_put_bytes(smart_str *out, const void *data, unsigned int length)
+{
+	php_krb5_fcc_put32(out, length);
+	if(length > 0) {
+		smart_str_appendl(out, (const char*) data, length);
+	}
+}
+/* }}} */
+
+/* {{{ */
+static void php_krb5_fcc_put_principal(smart_str *out, krb5_const_principal princ)
+{
+	krb5_int32 i;
+
+	php_krb5_fcc_put32(out, princ->type);
+	php_krb5_fcc_put32(out, princ->length);
+	php_krb5_fcc_put_bytes(out, princ->realm.data, princ->realm.length);
+
+	for(i = 0; i < princ->length; i++) {
+		php_krb5_fcc_put_bytes(out, princ->data[i].data, princ->data[i].length);
+	}
+}
+/* }}} */
+
+/* {{{ */
+static void php_krb5_fcc_put_creds(smart_str *out, const krb5_creds *creds)
+{
+	uint32_t count;
+
+	php_krb5_fcc_put_principal(out, creds->client);
+	php_krb5_fcc_put_principal(out, creds->server);
+
+	php_krb5_fcc_put16(out, creds->keyblock.enctype);
+	php_krb5_fcc_put_bytes(out, creds->keyblock.contents, creds->keyblock.length);
+
+	php_krb5_fcc_put32(out, creds->times.authtime);
+	php_krb5_fcc_put32(out, creds->times.starttime);
+	php_krb5_fcc_put32(out, creds->times.endtime);
+	php_krb5_fcc_put32(out, creds->times.renew_till);
+
+	smart_str_appendc(out, creds->is_skey ? 1 : 0);
+	php_krb5_fcc_put32(out, creds->ticket_flags);
+
+	for(count = 0; creds->addresses && creds->addresses[count]; count++);
+	php_krb5_fcc_put32(out, count);
+	for(count = 0; creds->addresses && creds->addresses[count]; count++) {
+		php_krb5_fcc_put16(out, creds->addresses[count]->addrtype);
+		php_krb5_fcc_put_bytes(out, creds->addresses[count]->contents, creds->addresses[count]->length);
+	}
+
+	for(count = 0; creds->authdata && creds->authdata[count]; count++);
+	php_krb5_fcc_put32(out, count);
+	for(count = 0; creds->authdata && creds->authdata[count]; count++) {
+		php_krb5_fcc_put16(out, creds->authdata[count]->ad_type);
+		php_krb5_fcc_put_bytes(out, creds->authdata[count]->contents, creds->authdata[count]->length);
+	}
+
+	php_krb5_fcc_put_bytes(out, creds->ticket.data, creds->ticket.length);
+	php_krb5_fcc_put_bytes(out, creds->second_ticket.data, creds->second_ticket.length);
+}
+/* }}} */
+
+/* Reader, all returned data points into the input buffer */
+
+typedef struct _php_krb5_fcc_reader {
+	const unsigned char *pos;
+	const unsigned char *end;
+	uint16_t version;
+} php_krb5_fcc_reader;
+
+#define PHP_KRB5_FCC_AVAIL(r, n) ((size_t)((r)->end - (r)->pos) >= (size_t)(n))
+
+/* {{{ */
+static int php_krb5_fcc_get16(php_krb5_fcc_reader *r, uint16_t *val)
+{
+	if(!PHP_KRB5_FCC_AVAIL(r, 2)) return FAILURE;
+	*val = ((uint16_t) r->pos[0] << 8) | r->pos[1];
+	r->pos += 2;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ */
+static int php_krb5_fcc_get32(php_krb5_fcc_reader *r, uint32_t *val)
+{
+	if(!PHP_KRB5_FCC_AVAIL(r, 4)) return FAILURE;
+	*val = ((uint32_t) r->pos[0] << 24) | ((uint32_t) r->pos[1] << 16) | ((uint32_t) r->pos[2] << 8) | r->pos[3];
+	r->pos += 4;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ */
+static int php_krb5_fcc_get_bytes(php_krb5_fcc_reader *r, krb5_data *data)
+{
+	uint32_t length;
+
+	if(php_krb5_fcc_get32(r, &length) == FAILURE || !PHP_KRB5_FCC_AVAIL(r, length)) {
+		return FAILURE;
+	}
+
+	data->magic = KV5M_DATA;
+	data->length = length;
+	data->data = (char*) r->pos;
+	r->pos += length;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ fills princ, components are emalloc'd and must be efree'd by the caller */
+static int php_krb5_fcc_get_principal(php_krb5_fcc_reader *r, krb5_principal_data *princ)
+{
+	uint32_t type, count, i;
+
+	memset(princ, 0, sizeof(krb5_principal_data));
+
+	if(php_krb5_fcc_get32(r, &type) == FAILURE || php_krb5_fcc_get32(r, &count) == FAILURE) {
+		return FAILURE;
+	}
+
+	/* every component needs at least its length field */
+	if(!PHP_KRB5_FCC_AVAIL(r, (size_t) count * 4)) {
+		return FAILURE;
+	}
+
+	princ->magic = KV5M_PRINCIPAL;
+	princ->type = type;
+	if(php_krb5_fcc_get_bytes(r, &princ->realm) == FAILURE) {
+		return FAILURE;
+	}
+
+	princ->data = count ? ecalloc(count, sizeof(krb5_data)) : NULL;
+	princ->length = count;
+	for(i = 0; i < count; i++) {
+		if(php_krb5_fcc_get_bytes(r, &princ->data[i]) == FAILURE) {
+			return FAILURE;
+		}
+	}
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ reads a counted list of (uint16 type, data) pairs into a NULL terminated array */
+static int php_krb5_fcc_get_typed_list(php_krb5_fcc_reader *r, void ***list, int is_authdata)
+{
+	uint32_t count, i;
+	uint16_t type;
+	krb5_data data;
+	size_t elsize = is_authdata ? sizeof(krb5_authdata) : sizeof(krb5_address);
+	char *elements;
+
+	*list = NULL;
+	if(php_krb5_fcc_get32(r, &count) == FAILURE || !PHP_KRB5_FCC_AVAIL(r, (size_t) count * 6)) {
+		return FAILURE;
+	}
+
+	if(count == 0) {
+		return SUCCESS;
+	}
+
+	/* pointer array followed by the elements themselves */
+	*list = ecalloc(1, (count + 1) * sizeof(void*) + count * elsize);
+	elements = (char*) ((*list) + count + 1);
+
+	for(i = 0; i < count; i++) {
+		if(php_krb5_fcc_get16(r, &type) == FAILURE || php_krb5_fcc_get_bytes(r, &data) == FAILURE) {
+			return FAILURE;
+		}
+
+		if(is_authdata) {
+			krb5_authdata *ad = (krb5_authdata*) (elements + i * elsize);
+			ad->magic = KV5M_AUTHDATA;
+			ad->ad_type = type;
+			ad->length = data.length;
+			ad->contents = (krb5_octet*) data.data;
+			(*list)[i] = ad;
+		} else {
+			krb5_address *addr = (krb5_address*) (elements + i * elsize);
+			addr->magic = KV5M_ADDRESS;
+			addr->addrtype = type;
+			addr->length = data.length;
+			addr->contents = (krb5_octet*) data.data;
+			(*list)[i] = addr;
+		}
+	}
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ */
+static int php_krb5_fcc_get_creds(php_krb5_fcc_reader *r, krb5_creds *creds, krb5_principal_data *client, krb5_principal_data *server)
+{
+	uint16_t enctype;
+	uint32_t val;
+	krb5_data data;
+
+	memset(creds, 0, sizeof(krb5_creds));
+	creds->magic = KV5M_CREDS;
+
+	if(php_krb5_fcc_get_principal(r, client) == FAILURE) return FAILURE;
+	creds->client = client;
+	if(php_krb5_fcc_get_principal(r, server) == FAILURE) return FAILURE;
+	creds->server = server;
+
+	if(php_krb5_fcc_get16(r, &enctype) == FAILURE) return FAILURE;
+	/* version 3 stores the enctype twice */
+	if(r->version == PHP_KRB5_FCC_V3 && php_krb5_fcc_get16(r, &enctype) == FAILURE) return FAILURE;
+	if(php_krb5_fcc_get_bytes(r, &data) == FAILURE) return FAILURE;
+	creds->keyblock.magic = KV5M_KEYBLOCK;
+	creds->keyblock.enctype = enctype;
+	creds->keyblock.length = data.length;
+	creds->keyblock.contents = (krb5_octet*) data.data;
+
+	if(php_krb5_fcc_get32(r, &val) == FAILURE) return FAILURE;
+	creds->times.authtime = val;
+	if(php_krb5_fcc_get32(r, &val) == FAILURE) return FAILURE;
+	creds->times.starttime = val;
+	if(php_krb5_fcc_get32(r, &val) == FAILURE) return FAILURE;
+	creds->times.endtime = val;
+	if(php_krb5_fcc_get32(r, &val) == FAILURE) return FAILURE;
+	creds->times.renew_till = val;
+
+	if(!PHP_KRB5_FCC_AVAIL(r, 1)) return FAILURE;
+	creds->is_skey = *(r->pos++) ? 1 : 0;
+	if(php_krb5_fcc_get32(r, &val) == FAILURE) return FAILURE;
+	creds->ticket_flags = val;
+
+	if(php_krb5_fcc_get_typed_list(r, (void***) &creds->addresses, 0) == FAILURE) return FAILURE;
+	if(php_krb5_fcc_get_typed_list(r, (void***) &creds->authdata, 1) == FAILURE) return FAILURE;
+
+	if(php_krb5_fcc_get_bytes(r, &creds->ticket) == FAILURE) return FAILURE;
+	if(php_krb5_fcc_get_bytes(r, &creds->second_ticket) == FAILURE) return FAILURE;
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ */
+static void php_krb5_fcc_free_creds(krb5_creds *creds, krb5_principal_data *client, krb5_principal_data *server)
+{
+	if(client->data) efree(client->data);
+	if(server->data) efree(server->data);
+	if(creds->addresses) efree(creds->addresses);
+	if(creds->authdata) efree(creds->authdata);
+	client->data = server->data = NULL;
+	creds->addresses = NULL;
+	creds->authdata = NULL;
+}
+/* }}} */
+
+/* {{{ Applies the KDC time offset from the v4 header tags to ctx, unknown tags are skipped */
+static int php_krb5_fcc_get_header(krb5_context ctx, const unsigned char *buf, uint16_t len)
+{
+	php_krb5_fcc_reader r;
+	uint16_t tag, tlen;
+	uint32_t offset, usec_offset;
+	struct timeval tv;
+
+	r.pos = buf;
+	r.end = buf + len;
+	r.version = PHP_KRB5_FCC_V4;
+
+	while(r.pos < r.end) {
+		if(php_krb5_fcc_get16(&r, &tag) == FAILURE || php_krb5_fcc_get16(&r, &tlen) == FAILURE ||
+				!PHP_KRB5_FCC_AVAIL(&r, tlen)) {
+			return FAILURE;
+		}
+
+		if(tag == PHP_KRB5_FCC_TAG_DELTATIME && tlen == 8) {
+			php_krb5_fcc_get32(&r, &offset);
+			php_krb5_fcc_get32(&r, &usec_offset);
+
+			/* the library only takes the corrected time, not the offset itself */
+			gettimeofday(&tv, NULL);
+			tv.tv_sec += (krb5_int32) offset;
+			tv.tv_usec += (krb5_int32) usec_offset;
+			if(tv.tv_usec >= 1000000) {
+				tv.tv_sec++;
+				tv.tv_usec -= 1000000;
+			} else if(tv.tv_usec < 0) {
+				tv.tv_sec--;
+				tv.tv_usec += 1000000;
+			}
+			krb5_set_real_time(ctx, tv.tv_sec, tv.tv_usec);
+		} else {
+			r.pos += tlen;
+		}
+	}
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ Appends the contents of cc to out in FILE ccache (v4) format */
+krb5_error_code php_krb5_ccache_serialize(krb5_context ctx, krb5_ccache cc, smart_str *out TSRMLS_DC)
+{
+	krb5_error_code retval = 0;
+	krb5_principal princ;
+	krb5_cc_cursor cursor;
+	krb5_creds creds;
+	krb5_timestamp offset = 0;
+	krb5_int32 usec_offset = 0;
+
+	if((retval = krb5_cc_get_principal(ctx, cc, &princ))) {
+		return retval;
+	}
+
+	php_krb5_fcc_put16(out, PHP_KRB5_FCC_V4);
+	if(krb5_get_time_offsets(ctx, &offset, &usec_offset) == 0 && (offset || usec_offset)) {
+		php_krb5_fcc_put16(out, 12);
+		php_krb5_fcc_put16(out, PHP_KRB5_FCC_TAG_DELTATIME);
+		php_krb5_fcc_put16(out, 8);
+		php_krb5_fcc_put32(out, offset);
+		php_krb5_fcc_put32(out, usec_offset);
+	} else {
+		php_krb5_fcc_put16(out, 0);
+	}
+	php_krb5_fcc_put_principal(out, princ);
+	krb5_free_principal(ctx, princ);
+
+	if((retval = krb5_cc_start_seq_get(ctx, cc, &cursor))) {
+		return retval;
+	}
+
+	while(krb5_cc_next_cred(ctx, cc, &cursor, &creds) == 0) {
+		php_krb5_fcc_put_creds(out, &creds);
+		krb5_free_cred_contents(ctx, &creds);
+	}
+
+	krb5_cc_end_seq_get(ctx, cc, &cursor);
+	smart_str_0(out);
+
+	return retval;
+}
+/* }}} */
+
+/* {{{ Initializes cc with the FILE ccache (v3/v4) image in buf */
+krb5_error_code php_krb5_ccache_unserialize(krb5_context ctx, const char *buf, size_t len, krb5_ccache cc TSRMLS_DC)
+{
+	krb5_error_code retval = 0;
+	php_krb5_fcc_reader r;
+	krb5_principal_data princ, client, server;
+	krb5_creds creds;
+	uint16_t hlen;
+
+	r.pos = (const unsigned char*) buf;
+	r.end = r.pos + len;
+
+	if(php_krb5_fcc_get16(&r, &r.version) == FAILURE) {
+		return KRB5_CC_FORMAT;
+	}
+
+	if(r.version != PHP_KRB5_FCC_V3 && r.version != PHP_KRB5_FCC_V4) {
+		return KRB5_CCACHE_BADVNO;
+	}
+
+	if(r.version == PHP_KRB5_FCC_V4) {
+		if(php_krb5_fcc_get16(&r, &hlen) == FAILURE || !PHP_KRB5_FCC_AVAIL(&r, hlen)) {
+			return KRB5_CC_FORMAT;
+		}
+		if(php_krb5_fcc_get_header(ctx, r.pos, hlen) == FAILURE) {
+			return KRB5_CC_FORMAT;
+		}
+		r.pos += hlen;
+	}
+
+	if(php_krb5_fcc_get_principal(&r, &princ) == FAILURE) {
+		if(princ.data) efree(princ.data);
+		return KRB5_CC_FORMAT;
+	}
+
+	retval = krb5_cc_initialize(ctx, cc, &princ);
+	if(princ.data) efree(princ.data);
+	if(retval) {
+		return retval;
+	}
+
+	while(r.pos < r.end) {
+		memset(&client, 0, sizeof(client));
+		memset(&server, 0, sizeof(server));
+
+		if(php_krb5_fcc_get_creds(&r, &creds, &client, &server) == FAILURE) {
+			retval = KRB5_CC_FORMAT;
+		} else {
+			retval = krb5_cc_store_cred(ctx, cc, &creds);
+		}
+
+		php_krb5_fcc_free_creds(&creds, &client, &server);
+		if(retval) {
+			break;
+		}
+	}
+
+	return retval;
+}
+/* }}} */
+
+#else /* HAVE_KRB5_HEIMDAL */
+
+/* {{{ */
+krb5_error_code php_krb5_ccache_serialize(krb5_context ctx, krb5_ccache cc, smart_str *out TSRMLS_DC)
+{
+	return KRB5_CC_NOSUPP;
+}
+/* }}} */
+
+/* {{{ */
+krb5_error_code php_krb5_ccache_unserialize(krb5_context ctx, const char *buf, size_t len, krb5_ccache cc TSRMLS_DC)
+{
+	return KRB5_CC_NOSUPP;
+}
+/* }}} */
+
+#endif /* HAVE_KRB5_HEIMDAL */
+
+/* File I/O */
+
+/* {{{ Initializes cc from the FILE ccache at path, read with a single mapping.
+       The library updates FILE caches in place under an fcntl() write lock,
+       a shared one is held while the mapping is parsed */
+krb5_error_code php_krb5_ccache_file_load(krb5_context ctx, const char *path, krb5_ccache cc TSRMLS_DC)
+{
+	krb5_error_code retval = 0;
+	struct stat st;
+	struct flock lock;
+	void *map;
+	int fd;
+
+	if((fd = open(path, O_RDONLY)) < 0) {
+		return errno == ENOENT ? KRB5_FCC_NOFILE : KRB5_CC_IO;
+	}
+
+	memset(&lock, 0, sizeof(lock));
+	lock.l_type = F_RDLCK;
+	lock.l_whence = SEEK_SET;
+	while(fcntl(fd, F_SETLKW, &lock) < 0) {
+		if(errno != EINTR) {
+			close(fd);
+			return KRB5_CC_IO;
+		}
+	}
+
+	if(fstat(fd, &st) < 0) {
+		close(fd);
+		return KRB5_CC_IO;
+	}
+
+	if(st.st_size == 0) {
+		close(fd);
+		return KRB5_CC_FORMAT;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(map == MAP_FAILED) {
+		close(fd);
+		return KRB5_CC_IO;
+	}
+
+	retval = php_krb5_ccache_unserialize(ctx, map, st.st_size, cc TSRMLS_CC);
+	munmap(map, st.st_size);
+	/* closing the descriptor releases the lock */
+	close(fd);
+
+	return retval;
+}
+/* }}} */
+
+/* {{{ Replaces the FILE ccache at path with the contents of cc.
+       The image is written to a temporary file next to it and renamed into
+       place, readers see either the old or the new cache, never a partial one.
+       KRB5_CC_NOSUPP if cc cannot be written in the FILE format */
+krb5_error_code php_krb5_ccache_file_store(krb5_context ctx, krb5_ccache cc, const char *path TSRMLS_DC)
+{
+	krb5_error_code retval = 0;
+	smart_str buf = {0};
+	const char *data;
+	size_t left;
+	ssize_t written;
+	char *tmpname;
+	int fd;
+
+	if((retval = php_krb5_ccache_serialize(ctx, cc, &buf TSRMLS_CC))) {
+		smart_str_free(&buf);
+		return retval;
+	}
+
+	spprintf(&tmpname, 0, "%s.XXXXXX", path);
+	if((fd = mkstemp(tmpname)) < 0) {
+		efree(tmpname);
+		smart_str_free(&buf);
+		return KRB5_CC_IO;
+	}
+
+	data = ZSTR_VAL(buf.s);
+	left = ZSTR_LEN(buf.s);
+	while(left > 0) {
+		written = write(fd, data, left);
+		if(written < 0) {
+			if(errno == EINTR) continue;
+			retval = KRB5_CC_IO;
+			break;
+		}
+		data += written;
+		left -= written;
+	}
+
+	/* the rename must not become visible before the data */
+	if(!retval && fsync(fd) < 0) {
+		retval = KRB5_CC_IO;
+	}
+
+	if(close(fd) < 0 && !retval) {
+		retval = KRB5_CC_IO;
+	}
+
+	if(!retval && rename(tmpname, path) < 0) {
+		retval = KRB5_CC_IO;
+	}
+
+	if(retval) {
+		unlink(tmpname);
+	}
+
+	efree(tmpname);
+	smart_str_free(&buf);
+	return retval;
+}
+/* }}} */
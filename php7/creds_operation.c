@@ -0,0 +1,501 @@
+/**
+* Copyright (c) 2008 Moritz Bechler
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+**/
+
+
+/*
+ * Step driven AS and TGS exchanges
+ *
+ * The objects wrap krb5_init_creds_step() and krb5_tkt_creds_step(); they
+ * never touch the network themselves. The caller sends getRequest() to a
+ * KDC of getRealm() by whatever means suit its event loop and feeds the
+ * reply to step() until the operation is complete, at which point the
+ * credentials have been stored in the KRB5CCache passed at construction.
+ */
+
+#include "php_krb5.h"
+
+/* Class definition */
+zend_object_handlers krb5_creds_operation_handlers;
+
+zend_class_entry *krb5_ce_init_creds_operation;
+zend_class_entry *krb5_ce_tkt_creds_operation;
+
+typedef struct _krb5_creds_operation_object {
+	zval ccache;
+#ifndef HAVE_KRB5_HEIMDAL
+	krb5_init_creds_context ictx;
+	krb5_tkt_creds_context tctx;
+#endif
+	krb5_get_init_creds_opt *cred_opts;
+	krb5_keytab keytab;
+	krb5_principal client;
+	krb5_principal server;
+	char *vfy_keytab;
+	krb5_data request;
+	krb5_data realm;
+	int complete;
+	zend_object std;
+} krb5_creds_operation_object;
+
+static inline krb5_creds_operation_object *php_krb5_creds_operation_object(zend_object *obj) {
+	return (krb5_creds_operation_object *)((char*)(obj) - XtOffsetOf(krb5_creds_operation_object, std));
+}
+#define Z_KRB5_CREDS_OPERATION_OBJ_P(zv) php_krb5_creds_operation_object(Z_OBJ_P(zv));
+
+static void php_krb5_creds_operation_object_dtor(zend_object *obj);
+zend_object *php_krb5_creds_operation_object_new(zend_class_entry *ce);
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5CredsOperation_none, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5InitCredsOperation__construct, 0, 0, 2)
+	ZEND_ARG_OBJ_INFO(0, ccache, KRB5CCache, 0)
+	ZEND_ARG_INFO(0, principal)
+	ZEND_ARG_ARRAY_INFO(0, options, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5TktCredsOperation__construct, 0, 0, 2)
+	ZEND_ARG_OBJ_INFO(0, ccache, KRB5CCache, 0)
+	ZEND_ARG_INFO(0, server)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5CredsOperation_step, 0, 0, 1)
+	ZEND_ARG_INFO(0, reply)
+ZEND_END_ARG_INFO()
+
+PHP_METHOD(KRB5InitCredsOperation, __construct);
+PHP_METHOD(KRB5TktCredsOperation, __construct);
+PHP_METHOD(KRB5CredsOperation, getRequest);
+PHP_METHOD(KRB5CredsOperation, getRealm);
+PHP_METHOD(KRB5CredsOperation, isComplete);
+PHP_METHOD(KRB5CredsOperation, step);
+
+static zend_function_entry krb5_init_creds_operation_functions[] = {
+	PHP_ME(KRB5InitCredsOperation, __construct, arginfo_KRB5InitCredsOperation__construct, ZEND_ACC_PUBLIC | ZEND_ACC_CTOR)
+	PHP_MALIAS(KRB5CredsOperation, getRequest, getRequest, arginfo_KRB5CredsOperation_none, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(KRB5CredsOperation, getRealm,   getRealm,   arginfo_KRB5CredsOperation_none, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(KRB5CredsOperation, isComplete, isComplete, arginfo_KRB5CredsOperation_none, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(KRB5CredsOperation, step,       step,       arginfo_KRB5CredsOperation_step, ZEND_ACC_PUBLIC)
+	PHP_FE_END
+};
+
+static zend_function_entry krb5_tkt_creds_operation_functions[] = {
+	PHP_ME(KRB5TktCredsOperation, __construct, arginfo_KRB5TktCredsOperation__construct, ZEND_ACC_PUBLIC | ZEND_ACC_CTOR)
+	PHP_MALIAS(KRB5CredsOperation, getRequest, getRequest, arginfo_KRB5CredsOperation_none, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(KRB5CredsOperation, getRealm,   getRealm,   arginfo_KRB5CredsOperation_none, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(KRB5CredsOperation, isComplete, isComplete, arginfo_KRB5CredsOperation_none, ZEND_ACC_PUBLIC)
+	PHP_MALIAS(KRB5CredsOperation, step,       step,       arginfo_KRB5CredsOperation_step, ZEND_ACC_PUBLIC)
+	PHP_FE_END
+};
+
+
+/** Registration **/
+/* {{{ */
+static void php_krb5_creds_operation_object_dtor(zend_object *obj)
+{
+	krb5_creds_operation_object *object = php_krb5_creds_operation_object(obj);
+	krb5_ccache_object *ccache;
+
+	if(Z_TYPE(object->ccache) == IS_OBJECT) {
+		ccache = Z_KRB5_CCACHE_OBJ_P(&object->ccache);
+
+#ifndef HAVE_KRB5_HEIMDAL
+		if(object->ictx) krb5_init_creds_free(ccache->ctx, object->ictx);
+		if(object->tctx) krb5_tkt_creds_free(ccache->ctx, object->tctx);
+#endif
+		if(object->cred_opts) krb5_get_init_creds_opt_free(ccache->ctx, object->cred_opts);
+		if(object->keytab) krb5_kt_close(ccache->ctx, object->keytab);
+		if(object->client) krb5_free_principal(ccache->ctx, object->client);
+		if(object->server) krb5_free_principal(ccache->ctx, object->server);
+		krb5_free_data_contents(ccache->ctx, &object->request);
+		krb5_free_data_contents(ccache->ctx, &object->realm);
+
+		zval_ptr_dtor(&object->ccache);
+	}
+
+	if(object->vfy_keytab) efree(object->vfy_keytab);
+
+	zend_object_std_dtor(&object->std);
+} /* }}} */
+
+/* {{{ */
+zend_object *php_krb5_creds_operation_object_new(zend_class_entry *ce)
+{
+	krb5_creds_operation_object *object;
+
+	object = ecalloc(1, sizeof(krb5_creds_operation_object) + zend_object_properties_size(ce));
+
+	ZVAL_UNDEF(&object->ccache);
+
+	zend_object_std_init(&object->std, ce TSRMLS_CC);
+	object_properties_init(&(object->std), ce);
+
+	object->std.handlers = &krb5_creds_operation_handlers;
+	return &object->std;
+} /* }}} */
+
+/* {{{ */
+int php_krb5_creds_operation_register_classes(TSRMLS_D) {
+	zend_class_entry init_creds_operation;
+	zend_class_entry tkt_creds_operation;
+
+	INIT_CLASS_ENTRY(init_creds_operation, "KRB5InitCredsOperation", krb5_init_creds_operation_functions);
+	krb5_ce_init_creds_operation = zend_register_internal_class(&init_creds_operation);
+	krb5_ce_init_creds_operation->create_object = php_krb5_creds_operation_object_new;
+	krb5_ce_init_creds_operation->ce_flags |= ZEND_ACC_FINAL;
+
+	INIT_CLASS_ENTRY(tkt_creds_operation, "KRB5TktCredsOperation", krb5_tkt_creds_operation_functions);
+	krb5_ce_tkt_creds_operation = zend_register_internal_class(&tkt_creds_operation);
+	krb5_ce_tkt_creds_operation->create_object = php_krb5_creds_operation_object_new;
+	krb5_ce_tkt_creds_operation->ce_flags |= ZEND_ACC_FINAL;
+
+	memcpy(&krb5_creds_operation_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	krb5_creds_operation_handlers.offset = XtOffsetOf(krb5_creds_operation_object, std);
+	krb5_creds_operation_handlers.free_obj = php_krb5_creds_operation_object_dtor;
+	krb5_creds_operation_handlers.clone_obj = NULL;
+
+	return SUCCESS;
+} /* }}} */
+
+
+#ifndef HAVE_KRB5_HEIMDAL
+/* {{{ Stores the obtained TGT once the AS exchange has completed */
+static krb5_error_code php_krb5_creds_operation_finish(krb5_creds_operation_object *object, char **errstr TSRMLS_DC)
+{
+	krb5_ccache_object *ccache = Z_KRB5_CCACHE_OBJ_P(&object->ccache);
+	krb5_error_code retval = 0;
+	krb5_creds creds;
+	int have_creds = 0;
+
+	if(object->tctx) {
+		/* the library already stored the ticket in the cache */
+		return 0;
+	}
+
+    do {
+	memset(&creds, 0, sizeof(creds));
+	if ((retval = krb5_init_creds_get_creds(ccache->ctx, object->ictx, &creds))) {
+		*errstr = "Cannot get ticket (%s)";
+		break;
+	}
+	have_creds = 1;
+
+	if ((retval = krb5_cc_initialize(ccache->ctx, ccache->cc, object->client))) {
+		*errstr = "Failed to initialize credential cache (%s)";
+		break;
+	}
+
+	if ((retval = krb5_cc_store_cred(ccache->ctx, ccache->cc, &creds))) {
+		*errstr = "Failed to store ticket in credential cache (%s)";
+		break;
+	}
+
+	if (object->vfy_keytab && *object->vfy_keytab && (retval = php_krb5_verify_tgt(ccache, &creds, object->vfy_keytab TSRMLS_CC))) {
+		*errstr = "Failed to verify ticket (%s)";
+		break;
+	}
+    } while (0);
+
+	if (have_creds) krb5_free_cred_contents(ccache->ctx, &creds);
+	return retval;
+}
+/* }}} */
+
+/* {{{ Advances the exchange with reply (empty for the initial request) */
+static krb5_error_code php_krb5_creds_operation_step(krb5_creds_operation_object *object, krb5_data *reply, char **errstr TSRMLS_DC)
+{
+	krb5_ccache_object *ccache = Z_KRB5_CCACHE_OBJ_P(&object->ccache);
+	krb5_error_code retval = 0;
+	unsigned int flags = 0;
+
+	krb5_free_data_contents(ccache->ctx, &object->request);
+	krb5_free_data_contents(ccache->ctx, &object->realm);
+
+	if (object->tctx) {
+		retval = krb5_tkt_creds_step(ccache->ctx, object->tctx, reply, &object->request, &object->realm, &flags);
+		flags = flags & KRB5_TKT_CREDS_STEP_FLAG_CONTINUE;
+	} else {
+		retval = krb5_init_creds_step(ccache->ctx, object->ictx, reply, &object->request, &object->realm, &flags);
+		flags = flags & KRB5_INIT_CREDS_STEP_FLAG_CONTINUE;
+	}
+
+	if (retval) {
+		*errstr = "Cannot get ticket (%s)";
+		object->complete = 1;
+	} else if (!flags) {
+		object->complete = 1;
+		retval = php_krb5_creds_operation_finish(object, errstr TSRMLS_CC);
+	}
+
+	if (object->complete) {
+		php_krb5_ccache_invalidate(ccache);
+	}
+
+	return retval;
+}
+/* }}} */
+#endif
+
+
+/** KRB5InitCredsOperation / KRB5TktCredsOperation Methods **/
+/* {{{ proto KRB5InitCredsOperation::__construct( KRB5CCache $ccache, string $principal [, array $options ] )
+   Starts an AS exchange for principal, authenticating with options["password"] or options["keytab"] */
+PHP_METHOD(KRB5InitCredsOperation, __construct)
+{
+	krb5_creds_operation_object *object = Z_KRB5_CREDS_OPERATION_OBJ_P(getThis());
+	krb5_ccache_object *ccache;
+	zval *zccache = NULL;
+	zval *opts = NULL;
+	zval *tmp;
+	char *sprinc = NULL;
+	size_t sprinc_len;
+	char *in_tkt_svc = NULL;
+	krb5_error_code retval = 0;
+	char *errstr = "";
+	krb5_data empty;
+
+	KRB5_SET_ERROR_HANDLING(EH_THROW);
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "Os|a", &zccache, krb5_ce_ccache, &sprinc, &sprinc_len, &opts) == FAILURE) {
+		RETURN_FALSE;
+	}
+	KRB5_SET_ERROR_HANDLING(EH_NORMAL);
+
+	ZVAL_COPY(&object->ccache, zccache);
+	ccache = Z_KRB5_CCACHE_OBJ_P(zccache);
+
+#ifndef HAVE_KRB5_HEIMDAL
+    do {
+	if ((retval = krb5_parse_name(ccache->ctx, sprinc, &object->client))) {
+		errstr = "Cannot parse Kerberos principal (%s)";
+		break;
+	}
+
+	if ((retval = krb5_get_init_creds_opt_alloc(ccache->ctx, &object->cred_opts))) {
+		errstr = "Cannot allocate cred_opts (%s)";
+		break;
+	}
+
+	if (opts != NULL) {
+		if ((retval = php_krb5_parse_init_creds_opts(opts, object->cred_opts, &in_tkt_svc, &object->vfy_keytab TSRMLS_CC))) {
+			errstr = "Cannot parse credential options (%s)";
+			break;
+		}
+	}
+
+	if ((retval = krb5_init_creds_init(ccache->ctx, object->client, NULL, NULL, 0, object->cred_opts, &object->ictx))) {
+		errstr = "Cannot initialize AS exchange (%s)";
+		break;
+	}
+
+	if (in_tkt_svc && (retval = krb5_init_creds_set_service(ccache->ctx, object->ictx, in_tkt_svc))) {
+		errstr = "Cannot set service name (%s)";
+		break;
+	}
+
+	if (opts != NULL && (tmp = zend_hash_str_find(Z_ARRVAL_P(opts), "keytab", sizeof("keytab") - 1)) != NULL) {
+		zend_string *sval = zval_get_string(tmp);
+		retval = php_krb5_keytab_cache_resolve(ccache->ctx, ZSTR_VAL(sval), &object->keytab TSRMLS_CC);
+		zend_string_release(sval);
+		if (retval) {
+			errstr = "Cannot load keytab (%s)";
+			break;
+		}
+
+		if ((retval = krb5_init_creds_set_keytab(ccache->ctx, object->ictx, object->keytab))) {
+			errstr = "Cannot use keytab (%s)";
+			break;
+		}
+	} else if (opts != NULL && (tmp = zend_hash_str_find(Z_ARRVAL_P(opts), "password", sizeof("password") - 1)) != NULL) {
+		zend_string *sval = zval_get_string(tmp);
+		retval = krb5_init_creds_set_password(ccache->ctx, object->ictx, ZSTR_VAL(sval));
+		zend_string_release(sval);
+		if (retval) {
+			errstr = "Cannot use password (%s)";
+			break;
+		}
+	} else {
+		if (in_tkt_svc) efree(in_tkt_svc);
+		zend_throw_exception(NULL, "Either a password or a keytab option is required", 0 TSRMLS_CC);
+		return;
+	}
+
+	memset(&empty, 0, sizeof(empty));
+	retval = php_krb5_creds_operation_step(object, &empty, &errstr TSRMLS_CC);
+    } while (0);
+
+	if (in_tkt_svc) efree(in_tkt_svc);
+
+	if (retval) {
+		php_krb5_display_error(ccache->ctx, retval, errstr TSRMLS_CC);
+		return;
+	}
+#else
+	zend_throw_exception(NULL, "Step driven exchanges are not supported by this Kerberos library", 0 TSRMLS_CC);
+#endif
+} /* }}} */
+
+/* {{{ proto KRB5TktCredsOperation::__construct( KRB5CCache $ccache, string $server )
+   Starts a TGS exchange for a ticket to server using the TGT in ccache */
+PHP_METHOD(KRB5TktCredsOperation, __construct)
+{
+	krb5_creds_operation_object *object = Z_KRB5_CREDS_OPERATION_OBJ_P(getThis());
+	krb5_ccache_object *ccache;
+	zval *zccache = NULL;
+	char *sprinc = NULL;
+	size_t sprinc_len;
+	krb5_error_code retval = 0;
+	char *errstr = "";
+	krb5_creds in_creds;
+
+	KRB5_SET_ERROR_HANDLING(EH_THROW);
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "Os", &zccache, krb5_ce_ccache, &sprinc, &sprinc_len) == FAILURE) {
+		RETURN_FALSE;
+	}
+	KRB5_SET_ERROR_HANDLING(EH_NORMAL);
+
+	ZVAL_COPY(&object->ccache, zccache);
+	ccache = Z_KRB5_CCACHE_OBJ_P(zccache);
+
+#ifndef HAVE_KRB5_HEIMDAL
+	php_krb5_ccache_auto_renew(ccache TSRMLS_CC);
+
+    do {
+	if ((retval = krb5_cc_get_principal(ccache->ctx, ccache->cc, &object->client))) {
+		errstr = "Failed to retrieve principal from source ccache (%s)";
+		break;
+	}
+
+	if ((retval = krb5_parse_name(ccache->ctx, sprinc, &object->server))) {
+		errstr = "Cannot parse Kerberos principal (%s)";
+		break;
+	}
+
+	memset(&in_creds, 0, sizeof(in_creds));
+	in_creds.client = object->client;
+	in_creds.server = object->server;
+
+	if ((retval = krb5_tkt_creds_init(ccache->ctx, ccache->cc, &in_creds, 0, &object->tctx))) {
+		errstr = "Cannot initialize TGS exchange (%s)";
+		break;
+	}
+
+	retval = php_krb5_creds_operation_step(object, NULL, &errstr TSRMLS_CC);
+    } while (0);
+
+	if (retval) {
+		php_krb5_display_error(ccache->ctx, retval, errstr TSRMLS_CC);
+		return;
+	}
+#else
+	zend_throw_exception(NULL, "Step driven exchanges are not supported by this Kerberos library", 0 TSRMLS_CC);
+#endif
+} /* }}} */
+
+/* {{{ proto string KRB5InitCredsOperation::getRequest(  )
+   Returns the message to send to a KDC, NULL once complete */
+PHP_METHOD(KRB5CredsOperation, getRequest)
+{
+	krb5_creds_operation_object *object = Z_KRB5_CREDS_OPERATION_OBJ_P(getThis());
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if (object->complete || !object->request.data) {
+		RETURN_NULL();
+	}
+
+	RETURN_STRINGL(object->request.data, object->request.length);
+} /* }}} */
+
+/* {{{ proto string KRB5InitCredsOperation::getRealm(  )
+   Returns the realm whose KDC the request has to be sent to, NULL once complete */
+PHP_METHOD(KRB5CredsOperation, getRealm)
+{
+	krb5_creds_operation_object *object = Z_KRB5_CREDS_OPERATION_OBJ_P(getThis());
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if (object->complete || !object->realm.data) {
+		RETURN_NULL();
+	}
+
+	RETURN_STRINGL(object->realm.data, object->realm.length);
+} /* }}} */
+
+/* {{{ proto bool KRB5InitCredsOperation::isComplete(  )
+   Returns whether the credentials have been obtained */
+PHP_METHOD(KRB5CredsOperation, isComplete)
+{
+	krb5_creds_operation_object *object = Z_KRB5_CREDS_OPERATION_OBJ_P(getThis());
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	RETURN_BOOL(object->complete);
+} /* }}} */
+
+/* {{{ proto bool KRB5InitCredsOperation::step( string $reply )
+   Processes a KDC reply, returns TRUE once complete or FALSE if another request has to be sent */
+PHP_METHOD(KRB5CredsOperation, step)
+{
+	krb5_creds_operation_object *object = Z_KRB5_CREDS_OPERATION_OBJ_P(getThis());
+	char *sreply = NULL;
+	size_t sreply_len = 0;
+#ifndef HAVE_KRB5_HEIMDAL
+	krb5_error_code retval = 0;
+	char *errstr = "";
+	krb5_data reply;
+#endif
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &sreply, &sreply_len) == FAILURE) {
+		zend_throw_exception(NULL, "Failed to parse arglist", 0 TSRMLS_CC);
+		RETURN_FALSE;
+	}
+
+	if (Z_TYPE(object->ccache) != IS_OBJECT || object->complete) {
+		zend_throw_exception(NULL, "Operation is not in progress", 0 TSRMLS_CC);
+		RETURN_FALSE;
+	}
+
+#ifndef HAVE_KRB5_HEIMDAL
+	if (sreply_len == 0) {
+		zend_throw_exception(NULL, "Empty KDC reply", 0 TSRMLS_CC);
+		RETURN_FALSE;
+	}
+
+	reply.magic = KV5M_DATA;
+	reply.data = sreply;
+	reply.length = sreply_len;
+
+	if ((retval = php_krb5_creds_operation_step(object, &reply, &errstr TSRMLS_CC))) {
+		krb5_ccache_object *ccache = Z_KRB5_CCACHE_OBJ_P(&object->ccache);
+		php_krb5_display_error(ccache->ctx, retval, errstr TSRMLS_CC);
+		RETURN_FALSE;
+	}
+#endif
+
+	RETURN_BOOL(object->complete);
+} /* }}} */
@@ -0,0 +1,254 @@
+/**
+* Copyright (c) 2008 Moritz Bechler
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+**/
+
+
+
+/*
+ * KRB5Exception and GSSAPIException
+ *
+ * KRB5Exception carries the Kerberos error code of a failed library call,
+ * its message is formatted when thrown since extended error messages are
+ * kept in the krb5_context and are gone once the context is reused.
+ *
+ * GSSAPIException carries the major and minor status instead (the minor
+ * status is the Kerberos error code for the krb5 mechanism). Status codes
+ * can be displayed at any time, so only the codes are recorded when thrown
+ * and the message is rendered with gss_display_status() the first time the
+ * message property is read (getMessage(), __toString(), var_dump()). Until
+ * then the private context property holds the prefix supplied by the caller.
+ */
+
+#include "php_krb5.h"
+
+zend_class_entry *krb5_ce_exception;
+zend_class_entry *krb5_ce_gssapi_exception;
+zend_object_handlers krb5_gssapi_exception_handlers;
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5Exception_none, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+PHP_METHOD(KRB5Exception, getKrb5Code);
+PHP_METHOD(GSSAPIException, getMajorStatus);
+PHP_METHOD(GSSAPIException, getMinorStatus);
+
+static zend_function_entry krb5_exception_functions[] = {
+	PHP_ME(KRB5Exception, getKrb5Code, arginfo_KRB5Exception_none, ZEND_ACC_PUBLIC)
+	PHP_FE_END
+};
+
+static zend_function_entry krb5_gssapi_exception_functions[] = {
+	PHP_ME(GSSAPIException, getMajorStatus, arginfo_KRB5Exception_none, ZEND_ACC_PUBLIC)
+	PHP_ME(GSSAPIException, getMinorStatus, arginfo_KRB5Exception_none, ZEND_ACC_PUBLIC)
+	PHP_FE_END
+};
+
+/* {{{ Appends the display text of a status code, multiple messages are
+       separated by "; " */
+static void php_krb5_gssapi_status_append(smart_str *out, OM_uint32 code, int type)
+{
+	OM_uint32 minor_status = 0;
+	OM_uint32 message_context = 0;
+	gss_buffer_desc buffer;
+	int first = 1;
+
+	do {
+		if(GSS_ERROR(gss_display_status(&minor_status, code, type, GSS_C_NO_OID, &message_context, &buffer))) {
+			break;
+		}
+		if(!first) {
+			smart_str_appendl(out, "; ", 2);
+		}
+		smart_str_appendl(out, buffer.value, buffer.length);
+		gss_release_buffer(&minor_status, &buffer);
+		first = 0;
+	} while(message_context);
+}
+/* }}} */
+
+/* {{{ "[<context>: ]<major status text>[ (<minor status text>)]" */
+static void php_krb5_gssapi_exception_render(zval *object TSRMLS_DC)
+{
+	zval *context, *major, *minor, rv;
+	smart_str message = {0};
+
+	context = zend_read_property(krb5_ce_gssapi_exception, object, "context", sizeof("context") - 1, 1, &rv TSRMLS_CC);
+	if(Z_TYPE_P(context) != IS_STRING) {
+		return;
+	}
+	if(Z_STRLEN_P(context) > 0) {
+		smart_str_appendl(&message, Z_STRVAL_P(context), Z_STRLEN_P(context));
+		smart_str_appendl(&message, ": ", 2);
+	}
+
+	major = zend_read_property(krb5_ce_gssapi_exception, object, "majorStatus", sizeof("majorStatus") - 1, 1, &rv TSRMLS_CC);
+	php_krb5_gssapi_status_append(&message, (OM_uint32) zval_get_long(major), GSS_C_GSS_CODE);
+
+	minor = zend_read_property(krb5_ce_gssapi_exception, object, "minorStatus", sizeof("minorStatus") - 1, 1, &rv TSRMLS_CC);
+	if(zval_get_long(minor) != 0) {
+		smart_str_appendl(&message, " (", 2);
+		php_krb5_gssapi_status_append(&message, (OM_uint32) zval_get_long(minor), GSS_C_MECH_CODE);
+		smart_str_appendc(&message, ')');
+	}
+	smart_str_0(&message);
+
+	/* rendered, also keeps the property write below from coming back here */
+	zend_update_property_null(krb5_ce_gssapi_exception, object, "context", sizeof("context") - 1 TSRMLS_CC);
+	if(message.s) {
+		zend_update_property_str(zend_ce_exception, object, "message", sizeof("message") - 1, message.s TSRMLS_CC);
+	}
+}
+/* }}} */
+
+/* {{{ */
+static zval *php_krb5_gssapi_exception_read_property(zval *object, zval *member, int type, void **cache_slot, zval *rv)
+{
+	if(Z_TYPE_P(member) == IS_STRING && zend_string_equals_literal(Z_STR_P(member), "message")) {
+		TSRMLS_FETCH();
+		php_krb5_gssapi_exception_render(object TSRMLS_CC);
+		/* no cache slot, the engine would read the property directly
+		   for other (unrendered) exceptions at the same opcode */
+		cache_slot = NULL;
+	}
+
+	return zend_std_read_property(object, member, type, cache_slot, rv);
+}
+/* }}} */
+
+/* {{{ */
+static HashTable *php_krb5_gssapi_exception_get_debug_info(zval *object, int *is_temp)
+{
+	TSRMLS_FETCH();
+	php_krb5_gssapi_exception_render(object TSRMLS_CC);
+	*is_temp = 0;
+	return zend_std_get_properties(object);
+}
+/* }}} */
+
+/* {{{ */
+static zend_object *php_krb5_gssapi_exception_new(zend_class_entry *ce)
+{
+	/* Exception's own constructor records file, line and trace */
+	zend_object *object = zend_ce_exception->create_object(ce);
+	object->handlers = &krb5_gssapi_exception_handlers;
+	return object;
+}
+/* }}} */
+
+/* {{{ */
+int php_krb5_exception_register_classes(TSRMLS_D)
+{
+	zend_class_entry krb5_exception;
+	zend_class_entry gssapi_exception;
+
+	INIT_CLASS_ENTRY(krb5_exception, "KRB5Exception", krb5_exception_functions);
+	krb5_ce_exception = zend_register_internal_class_ex(&krb5_exception, zend_ce_exception);
+	zend_declare_property_long(krb5_ce_exception, "krb5Code", sizeof("krb5Code") - 1, 0, ZEND_ACC_PROTECTED TSRMLS_CC);
+
+	INIT_CLASS_ENTRY(gssapi_exception, "GSSAPIException", krb5_gssapi_exception_functions);
+	krb5_ce_gssapi_exception = zend_register_internal_class_ex(&gssapi_exception, krb5_ce_exception);
+	krb5_ce_gssapi_exception->create_object = php_krb5_gssapi_exception_new;
+	zend_declare_property_long(krb5_ce_gssapi_exception, "majorStatus", sizeof("majorStatus") - 1, 0, ZEND_ACC_PROTECTED TSRMLS_CC);
+	zend_declare_property_long(krb5_ce_gssapi_exception, "minorStatus", sizeof("minorStatus") - 1, 0, ZEND_ACC_PROTECTED TSRMLS_CC);
+	zend_declare_property_null(krb5_ce_gssapi_exception, "context", sizeof("context") - 1, ZEND_ACC_PRIVATE TSRMLS_CC);
+
+	memcpy(&krb5_gssapi_exception_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	krb5_gssapi_exception_handlers.clone_obj = NULL;
+	krb5_gssapi_exception_handlers.read_property = php_krb5_gssapi_exception_read_property;
+	krb5_gssapi_exception_handlers.get_debug_info = php_krb5_gssapi_exception_get_debug_info;
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ Throws a KRB5Exception for a failed krb5 call, str is a format with
+       a single %s for the library message */
+void php_krb5_throw_krb5_exception(krb5_context ctx, krb5_error_code code, const char *str TSRMLS_DC)
+{
+	const char *errstr = krb5_get_error_message(ctx, code);
+	zval exception;
+
+	ZVAL_OBJ(&exception, zend_throw_exception_ex(krb5_ce_exception, 0 TSRMLS_CC, str, errstr));
+	krb5_free_error_message(ctx, errstr);
+
+	zend_update_property_long(krb5_ce_exception, &exception, "krb5Code", sizeof("krb5Code") - 1, code TSRMLS_CC);
+}
+/* }}} */
+
+/* {{{ Throws a GSSAPIException, context (may be NULL) prefixes the message
+       once it is rendered */
+void php_krb5_throw_gssapi_exception(OM_uint32 major, OM_uint32 minor, const char *context TSRMLS_DC)
+{
+	zval exception;
+
+	ZVAL_OBJ(&exception, zend_throw_exception(krb5_ce_gssapi_exception, NULL, (zend_long) major TSRMLS_CC));
+
+	zend_update_property_long(krb5_ce_exception, &exception, "krb5Code", sizeof("krb5Code") - 1, (krb5_error_code) minor TSRMLS_CC);
+	zend_update_property_long(krb5_ce_gssapi_exception, &exception, "majorStatus", sizeof("majorStatus") - 1, major TSRMLS_CC);
+	zend_update_property_long(krb5_ce_gssapi_exception, &exception, "minorStatus", sizeof("minorStatus") - 1, minor TSRMLS_CC);
+	zend_update_property_string(krb5_ce_gssapi_exception, &exception, "context", sizeof("context") - 1, context ? context : "" TSRMLS_CC);
+}
+/* }}} */
+
+/* {{{ proto int KRB5Exception::getKrb5Code( )
+   Returns the Kerberos error code (krb5_error_code) */
+PHP_METHOD(KRB5Exception, getKrb5Code)
+{
+	zval *code, rv;
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		return;
+	}
+
+	code = zend_read_property(krb5_ce_exception, getThis(), "krb5Code", sizeof("krb5Code") - 1, 1, &rv TSRMLS_CC);
+	RETURN_LONG(zval_get_long(code));
+}
+/* }}} */
+
+/* {{{ proto int GSSAPIException::getMajorStatus( )
+   Returns the GSSAPI major status */
+PHP_METHOD(GSSAPIException, getMajorStatus)
+{
+	zval *status, rv;
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		return;
+	}
+
+	status = zend_read_property(krb5_ce_gssapi_exception, getThis(), "majorStatus", sizeof("majorStatus") - 1, 1, &rv TSRMLS_CC);
+	RETURN_LONG(zval_get_long(status));
+}
+/* }}} */
+
+/* {{{ proto int GSSAPIException::getMinorStatus( )
+   Returns the mechanism specific minor status */
+PHP_METHOD(GSSAPIException, getMinorStatus)
+{
+	zval *status, rv;
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		return;
+	}
+
+	status = zend_read_property(krb5_ce_gssapi_exception, getThis(), "minorStatus", sizeof("minorStatus") - 1, 1, &rv TSRMLS_CC);
+	RETURN_LONG(zval_get_long(status));
+}
+/* }}} */
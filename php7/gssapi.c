@@ -23,6 +23,9 @@
 
 #include "php.h"
 #include "php_krb5.h"
+#ifdef HAVE_GSSAPI_GSSAPI_EXT_H
+#include <gssapi/gssapi_ext.h>
+#endif
 
 /* Class definition */
 
@@ -31,6 +34,10 @@ zend_class_entry *krb5_ce_gssapi_context;
 typedef struct _krb5_gssapi_context_object {
 		gss_cred_id_t creds;
 		gss_ctx_id_t context;
+		zend_bool rcache_shm;
+		zend_string *pool_key;
+		/* KRB5CCache the credentials were acquired from, initSecContext stores tickets there */
+		zval ccache;
 		zend_object std;
 } krb5_gssapi_context_object;
 
@@ -94,6 +101,26 @@ ZEND_BEGIN_ARG_INFO_EX(krb5_GSSAPIContext_unwrapArgs, 0, 0, 2)
 	ZEND_ARG_INFO(1, output)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(krb5_GSSAPIContext_import, 0, 0, 1)
+	ZEND_ARG_INFO(0, token)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(krb5_GSSAPIContext_checkoutContext, 0, 0, 2)
+	ZEND_ARG_OBJ_INFO(0, ccache, KRB5CCache, 0)
+	ZEND_ARG_INFO(0, target)
+	ZEND_ARG_INFO(0, req_flags)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(krb5_GSSAPIContext_getMicIov, 0, 0, 1)
+	ZEND_ARG_ARRAY_INFO(0, buffers, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(krb5_GSSAPIContext_wrapIovArgs, 0, 0, 2)
+	ZEND_ARG_ARRAY_INFO(0, buffers, 0)
+	ZEND_ARG_INFO(1, output)
+	ZEND_ARG_INFO(0, encrypt)
+ZEND_END_ARG_INFO()
+
 
 PHP_METHOD(GSSAPIContext, registerAcceptorIdentity);
 PHP_METHOD(GSSAPIContext, acquireCredentials);
@@ -105,6 +132,17 @@ PHP_METHOD(GSSAPIContext, verifyMic);
 PHP_METHOD(GSSAPIContext, wrap);
 PHP_METHOD(GSSAPIContext, unwrap);
 PHP_METHOD(GSSAPIContext, getTimeRemaining);
+PHP_METHOD(GSSAPIContext, export);
+PHP_METHOD(GSSAPIContext, import);
+PHP_METHOD(GSSAPIContext, checkoutContext);
+PHP_METHOD(GSSAPIContext, returnContext);
+#ifdef HAVE_GSS_GET_MIC_IOV
+PHP_METHOD(GSSAPIContext, getMicIov);
+#endif
+#ifdef HAVE_GSS_WRAP_IOV
+PHP_METHOD(GSSAPIContext, wrapIov);
+PHP_METHOD(GSSAPIContext, unwrapIov);
+#endif
 
 static zend_function_entry krb5_gssapi_context_functions[] = {
 	PHP_ME(GSSAPIContext, registerAcceptorIdentity, krb5_GSSAPIContext_registerAcceptorIdentity, ZEND_ACC_PUBLIC)
@@ -117,12 +155,30 @@ static zend_function_entry krb5_gssapi_context_functions[] = {
 	PHP_ME(GSSAPIContext, wrap,                     krb5_GSSAPIContext_wrapArgs,                 ZEND_ACC_PUBLIC)
 	PHP_ME(GSSAPIContext, unwrap,                   krb5_GSSAPIContext_unwrapArgs,               ZEND_ACC_PUBLIC)
 	PHP_ME(GSSAPIContext, getTimeRemaining,         krb5_GSSAPIContext_none,                     ZEND_ACC_PUBLIC)
+	PHP_ME(GSSAPIContext, export,                   krb5_GSSAPIContext_none,                     ZEND_ACC_PUBLIC)
+	PHP_ME(GSSAPIContext, import,                   krb5_GSSAPIContext_import,                   ZEND_ACC_PUBLIC)
+	PHP_ME(GSSAPIContext, checkoutContext,          krb5_GSSAPIContext_checkoutContext,          ZEND_ACC_PUBLIC)
+	PHP_ME(GSSAPIContext, returnContext,            krb5_GSSAPIContext_none,                     ZEND_ACC_PUBLIC)
+#ifdef HAVE_GSS_GET_MIC_IOV
+	PHP_ME(GSSAPIContext, getMicIov,                krb5_GSSAPIContext_getMicIov,                ZEND_ACC_PUBLIC)
+#endif
+#ifdef HAVE_GSS_WRAP_IOV
+	PHP_ME(GSSAPIContext, wrapIov,                  krb5_GSSAPIContext_wrapIovArgs,              ZEND_ACC_PUBLIC)
+	PHP_ME(GSSAPIContext, unwrapIov,                krb5_GSSAPIContext_unwrapArgs,               ZEND_ACC_PUBLIC)
+#endif
 	PHP_FE_END
 };
 
 zend_object_handlers krb5_gssapi_context_handlers;
 
-#ifdef ZTS
+/* credential names, or before MIT krb5 1.13 the replay cache type, can only
+   be passed through the environment */
+#if !defined(HAVE_GSS_ACQUIRE_CRED_FROM) || !defined(HAVE_KRB5_CRED_STORE_RCACHE)
+#define PHP_KRB5_GSSAPI_SWAP_ENV
+#endif
+
+#if defined(ZTS) && defined(PHP_KRB5_GSSAPI_SWAP_ENV)
+/* serialises the environment changes in php_krb5_gssapi_acquire_cred() */
 MUTEX_T gssapi_mutex;
 #endif
 
@@ -133,41 +189,330 @@ MUTEX_T gssapi_mutex;
 	return retval; \
 }
 
-/* {{{ */
+/* {{{ Throws a GSSAPIException, its message is only rendered when read */
 void php_krb5_gssapi_handle_error(OM_uint32 major, OM_uint32 minor TSRMLS_DC)
 {
-	OM_uint32 error_context = 0;
+	php_krb5_throw_gssapi_exception(major, minor, NULL TSRMLS_CC);
+}
+/* }}} */
+
+#ifdef PHP_KRB5_GSSAPI_SWAP_ENV
+/* {{{ Takes the module mutex guarding environment changes */
+static int php_krb5_gssapi_lock_env(OM_uint32 *minor_status TSRMLS_DC)
+{
+#ifdef ZTS
+	if(tsrm_mutex_lock(gssapi_mutex)) {
+		php_error_docref(NULL TSRMLS_CC,  E_ERROR, "Failed to obtain mutex lock in GSSAPI module");
+		*minor_status = 0;
+		return FAILURE;
+	}
+#endif
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ */
+static void php_krb5_gssapi_unlock_env(TSRMLS_D)
+{
+#ifdef ZTS
+	if(tsrm_mutex_unlock(gssapi_mutex)) {
+		php_error_docref(NULL TSRMLS_CC,  E_ERROR, "Failed to release mutex lock in GSSAPI module");
+	}
+#endif
+}
+/* }}} */
+
+/* {{{ Sets an environment variable, returns the previous value for
+       php_krb5_gssapi_restore_env() */
+static char *php_krb5_gssapi_swap_env(const char *var, const char *value)
+{
+	const char *old = getenv(var);
+	char *saved = old ? estrdup(old) : NULL;
+
+	setenv(var, value, 1);
+	return saved;
+}
+/* }}} */
+
+/* {{{ */
+static void php_krb5_gssapi_restore_env(const char *var, char *saved)
+{
+	if(saved) {
+		setenv(var, saved, 1);
+		efree(saved);
+	} else {
+		unsetenv(var);
+	}
+}
+/* }}} */
+#endif
+
+/* {{{ Acquires credentials from the named credential cache and/or keytab.
+       With skip_rcache replays are left to the shared replay cache.
+       gss_acquire_cred_from() takes the names as a credential store, older
+       libraries only read them from the environment, which then has to be
+       swapped under the module mutex. So does the replay cache type before
+       MIT krb5 1.13, which has no "rcache" store key */
+OM_uint32 php_krb5_gssapi_acquire_cred(OM_uint32 *minor_status, gss_name_t name, gss_cred_usage_t usage,
+		const char *ccname, const char *ktname, int skip_rcache, gss_cred_id_t *cred TSRMLS_DC)
+{
+#ifdef HAVE_GSS_ACQUIRE_CRED_FROM
+	gss_key_value_element_desc elements[3];
+	gss_key_value_set_desc store;
+#ifndef HAVE_KRB5_CRED_STORE_RCACHE
+	OM_uint32 status;
+	char *oldrcachetype;
+#endif
+
+	store.count = 0;
+	store.elements = elements;
+
+	if(ccname) {
+		elements[store.count].key = "ccache";
+		elements[store.count++].value = ccname;
+	}
+
+	if(ktname && usage != GSS_C_INITIATE) {
+		elements[store.count].key = "keytab";
+		elements[store.count++].value = ktname;
+	}
+
+#ifdef HAVE_KRB5_CRED_STORE_RCACHE
+	if(skip_rcache) {
+		elements[store.count].key = "rcache";
+		elements[store.count++].value = PHP_KRB5_RCACHE_NONE ":";
+	}
+#else
+	if(skip_rcache) {
+		if(php_krb5_gssapi_lock_env(minor_status TSRMLS_CC) == FAILURE) {
+			return GSS_S_FAILURE;
+		}
+
+		oldrcachetype = php_krb5_gssapi_swap_env("KRB5RCACHETYPE", PHP_KRB5_RCACHE_NONE);
+		status = gss_acquire_cred_from(minor_status, name, GSS_C_INDEFINITE, GSS_C_NO_OID_SET, usage,
+				&store, cred, NULL, NULL);
+		php_krb5_gssapi_restore_env("KRB5RCACHETYPE", oldrcachetype);
+
+		php_krb5_gssapi_unlock_env(TSRMLS_C);
+		return status;
+	}
+#endif
+
+	return gss_acquire_cred_from(minor_status, name, GSS_C_INDEFINITE, GSS_C_NO_OID_SET, usage,
+			&store, cred, NULL, NULL);
+#else
+	OM_uint32 status;
+	char *oldccname = NULL, *oldktname = NULL, *oldrcachetype = NULL;
+
+	if(php_krb5_gssapi_lock_env(minor_status TSRMLS_CC) == FAILURE) {
+		return GSS_S_FAILURE;
+	}
+
+	if(ccname) {
+		oldccname = php_krb5_gssapi_swap_env("KRB5CCNAME", ccname);
+	}
+	if(ktname && usage != GSS_C_INITIATE) {
+		oldktname = php_krb5_gssapi_swap_env("KRB5_KTNAME", ktname);
+	}
+	if(skip_rcache) {
+		oldrcachetype = php_krb5_gssapi_swap_env("KRB5RCACHETYPE", PHP_KRB5_RCACHE_NONE);
+	}
+
+	status = gss_acquire_cred(minor_status, name, GSS_C_INDEFINITE, GSS_C_NO_OID_SET, usage,
+			cred, NULL, NULL);
+
+	if(ccname) {
+		php_krb5_gssapi_restore_env("KRB5CCNAME", oldccname);
+	}
+	if(ktname && usage != GSS_C_INITIATE) {
+		php_krb5_gssapi_restore_env("KRB5_KTNAME", oldktname);
+	}
+	if(skip_rcache) {
+		php_krb5_gssapi_restore_env("KRB5RCACHETYPE", oldrcachetype);
+	}
+
+	php_krb5_gssapi_unlock_env(TSRMLS_C);
+	return status;
+#endif
+}
+/* }}} */
+
+#if defined(HAVE_GSS_WRAP_IOV) || defined(HAVE_GSS_GET_MIC_IOV)
+/* {{{ Builds an IOV array with one DATA buffer per string in buffers, placed
+       after `before` unused entries and followed by `after` unused ones.
+       The DATA buffers point at the PHP strings themselves */
+static gss_iov_buffer_desc *php_krb5_gssapi_iov_from_array(HashTable *buffers, int before, int after, int *count, size_t *data_length TSRMLS_DC)
+{
+	gss_iov_buffer_desc *iov;
+	zval *buffer;
+	int i = before;
+
+	*count = zend_hash_num_elements(buffers) + before + after;
+	*data_length = 0;
+	iov = ecalloc(*count, sizeof(gss_iov_buffer_desc));
+
+	ZEND_HASH_FOREACH_VAL(buffers, buffer) {
+		ZVAL_DEREF(buffer);
+		if(Z_TYPE_P(buffer) != IS_STRING) {
+			efree(iov);
+			zend_throw_exception(NULL, "Buffers must be strings", 0 TSRMLS_CC);
+			return NULL;
+		}
+		iov[i].type = GSS_IOV_BUFFER_TYPE_DATA;
+		iov[i].buffer.value = Z_STRVAL_P(buffer);
+		iov[i].buffer.length = Z_STRLEN_P(buffer);
+		*data_length += Z_STRLEN_P(buffer);
+		i++;
+	} ZEND_HASH_FOREACH_END();
+
+	return iov;
+}
+/* }}} */
+#endif
+
+/* Initiator context pool */
+
+/* distinct (client, target, flags) keys kept per worker */
+#define PHP_KRB5_INITIATOR_POOL_KEYS 64
+
+typedef struct _php_krb5_initiator_pool {
+	gss_ctx_id_t *contexts;
+	int used;
+	int size;
+} php_krb5_initiator_pool;
+
+/* {{{ */
+void php_krb5_initiator_pool_dtor(zval *zv)
+{
+	php_krb5_initiator_pool *entry = Z_PTR_P(zv);
+	OM_uint32 minor_status = 0;
+	int i;
+
+	for(i = 0; i < entry->used; i++) {
+		gss_delete_sec_context(&minor_status, &entry->contexts[i], GSS_C_NO_BUFFER);
+	}
+	pefree(entry->contexts, 1);
+	pefree(entry, 1);
+}
+/* }}} */
+
+/* {{{ Whether a context is worth keeping: established, initiated by us and
+       valid for at least krb5.initiator_pool_min_lifetime seconds */
+static int php_krb5_initiator_pool_usable(gss_ctx_id_t ctx TSRMLS_DC)
+{
+	OM_uint32 status, minor_status = 0;
+	OM_uint32 lifetime = 0;
+	int initiator = 0, open = 0;
+
+	status = gss_inquire_context(&minor_status, ctx, NULL, NULL, &lifetime, NULL, NULL, &initiator, &open);
+	if(GSS_ERROR(status) || !initiator || !open) {
+		return 0;
+	}
+
+	return lifetime == GSS_C_INDEFINITE || lifetime >= KRB5_G(initiator_pool_min_lifetime);
+}
+/* }}} */
+
+/* {{{ Takes an idle context for key out of the pool, evicting the ones
+       about to expire on the way */
+static gss_ctx_id_t php_krb5_initiator_pool_checkout(zend_string *key TSRMLS_DC)
+{
+	php_krb5_initiator_pool *entry;
 	OM_uint32 minor_status = 0;
-	gss_buffer_desc error_buffer;
+	gss_ctx_id_t ctx;
 
-	gss_display_status (&minor_status, major, GSS_C_GSS_CODE,
-					GSS_C_NO_OID, &error_context, &error_buffer);
+	if(!(entry = zend_hash_find_ptr(&KRB5_G(initiator_pool), key))) {
+		return GSS_C_NO_CONTEXT;
+	}
 
+	while(entry->used > 0) {
+		ctx = entry->contexts[--entry->used];
+		if(php_krb5_initiator_pool_usable(ctx TSRMLS_CC)) {
+			return ctx;
+		}
+		gss_delete_sec_context(&minor_status, &ctx, GSS_C_NO_BUFFER);
+	}
+
+	return GSS_C_NO_CONTEXT;
+}
+/* }}} */
 
-	while(error_context) {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s (%ld,%ld)", (char*) error_buffer.value, (unsigned long int) major, (unsigned long int)minor);
-		gss_release_buffer(&minor_status, &error_buffer);
-		gss_display_status (&minor_status, major, GSS_C_GSS_CODE,
-				GSS_C_NO_OID, &error_context, &error_buffer);
+/* {{{ Whether ctx was established between the client and target of key
+       ("<client>\n<target>\n<flags>") */
+static int php_krb5_initiator_pool_matches(zend_string *key, gss_ctx_id_t ctx TSRMLS_DC)
+{
+	OM_uint32 status, minor_status = 0;
+	gss_name_t src_name = GSS_C_NO_NAME, targ_name = GSS_C_NO_NAME;
+	gss_name_t client = GSS_C_NO_NAME, target = GSS_C_NO_NAME;
+	const char *sep, *last;
+	int client_equal = 0, target_equal = 0;
+
+	sep = memchr(ZSTR_VAL(key), '\n', ZSTR_LEN(key));
+	last = zend_memrchr(ZSTR_VAL(key), '\n', ZSTR_LEN(key));
+	if(!sep || sep == last) {
+		return 0;
+	}
+
+	status = gss_inquire_context(&minor_status, ctx, &src_name, &targ_name, NULL, NULL, NULL, NULL, NULL);
+	if(GSS_ERROR(status)) {
+		return 0;
 	}
-	php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s (%ld,%ld)", (char*) error_buffer.value,  (unsigned long int) major,  (unsigned long int)minor);
-	gss_release_buffer(&minor_status, &error_buffer);
 
-	if(minor) {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "GSSAPI mechanism error #%ld",  (unsigned long int) minor);
-		gss_display_status (&minor_status, minor, GSS_C_MECH_CODE,
-					GSS_C_NO_OID, &error_context, &error_buffer);
+	do {
+		status = php_krb5_name_cache_import(&minor_status, ZSTR_VAL(key), sep - ZSTR_VAL(key),
+				(gss_OID) GSS_KRB5_NT_PRINCIPAL_NAME, 0, &client TSRMLS_CC);
+		if(GSS_ERROR(status)) break;
+		status = php_krb5_name_cache_import(&minor_status, sep + 1, last - sep - 1, GSS_C_NO_OID, 1, &target TSRMLS_CC);
+		if(GSS_ERROR(status)) break;
+
+		status = gss_compare_name(&minor_status, src_name, client, &client_equal);
+		if(GSS_ERROR(status)) break;
+		status = gss_compare_name(&minor_status, targ_name, target, &target_equal);
+	} while(0);
+
+	if(client != GSS_C_NO_NAME) gss_release_name(&minor_status, &client);
+	if(target != GSS_C_NO_NAME) gss_release_name(&minor_status, &target);
+	gss_release_name(&minor_status, &src_name);
+	gss_release_name(&minor_status, &targ_name);
 
-		while(error_context) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", (char*) error_buffer.value);
-			gss_release_buffer(&minor_status, &error_buffer);
+	return !GSS_ERROR(status) && client_equal && target_equal;
+}
+/* }}} */
+
+/* {{{ Puts a context back, FAILURE if it is unusable, was not established
+       for key or the pool is full */
+static int php_krb5_initiator_pool_return(zend_string *key, gss_ctx_id_t ctx TSRMLS_DC)
+{
+	php_krb5_initiator_pool *entry;
 
-			gss_display_status (&minor_status, minor_status, GSS_C_MECH_CODE,
-                                                GSS_C_NO_OID, &error_context, &error_buffer);
+	if(KRB5_G(initiator_pool_size) <= 0 || !php_krb5_initiator_pool_usable(ctx TSRMLS_CC)) {
+		return FAILURE;
+	}
+
+	/* a context established with other credentials or for another target
+	   would be handed out under the wrong identity */
+	if(!php_krb5_initiator_pool_matches(key, ctx TSRMLS_CC)) {
+		return FAILURE;
+	}
+
+	if(!(entry = zend_hash_find_ptr(&KRB5_G(initiator_pool), key))) {
+		if(zend_hash_num_elements(&KRB5_G(initiator_pool)) >= PHP_KRB5_INITIATOR_POOL_KEYS) {
+			return FAILURE;
 		}
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s (%ld)", (char*)  error_buffer.value,  (unsigned long int) minor);
-		gss_release_buffer(&minor_status, &error_buffer);
+
+		entry = pemalloc(sizeof(php_krb5_initiator_pool), 1);
+		entry->size = KRB5_G(initiator_pool_size);
+		entry->used = 0;
+		entry->contexts = pecalloc(entry->size, sizeof(gss_ctx_id_t), 1);
+		zend_hash_str_update_ptr(&KRB5_G(initiator_pool), ZSTR_VAL(key), ZSTR_LEN(key), entry);
 	}
+
+	if(entry->used >= entry->size) {
+		return FAILURE;
+	}
+
+	entry->contexts[entry->used++] = ctx;
+	return SUCCESS;
 }
 /* }}} */
 
@@ -186,6 +531,14 @@ void php_krb5_gssapi_context_object_dtor(zend_object *obj)
 	if(object->context != GSS_C_NO_CONTEXT) {
 		gss_delete_sec_context(&minor_status, &object->context,  GSS_C_NO_BUFFER);
 	}
+
+	if(object->pool_key) {
+		zend_string_release(object->pool_key);
+	}
+
+	zval_ptr_dtor(&object->ccache);
+
+	zend_object_std_dtor(&object->std);
 }
 /* }}} */
 
@@ -201,11 +554,9 @@ zend_object *php_krb5_gssapi_context_object_new(zend_class_entry *ce TSRMLS_DC)
 	object->context = GSS_C_NO_CONTEXT;
 	object->creds = GSS_C_NO_CREDENTIAL;
 
-	object_properties_init(&(object->std), ce);
 	zend_object_std_init(&object->std, ce);
+	object_properties_init(&(object->std), ce);
 
-
-	krb5_gssapi_context_handlers.offset = XtOffsetOf(krb5_gssapi_context_object, std);
 	object->std.handlers = &krb5_gssapi_context_handlers;
 
 	return &object->std;
@@ -218,7 +569,7 @@ int php_krb5_gssapi_register_classes(TSRMLS_D)
 	zend_class_entry gssapi_context;
 
 
-#ifdef ZTS
+#if defined(ZTS) && defined(PHP_KRB5_GSSAPI_SWAP_ENV)
 	/* initialize GSSAPI mutex */
 	gssapi_mutex = tsrm_mutex_alloc();
 	if(!gssapi_mutex) {
@@ -233,8 +584,9 @@ int php_krb5_gssapi_register_classes(TSRMLS_D)
 	krb5_ce_gssapi_context = zend_register_internal_class(&gssapi_context TSRMLS_CC);
 	krb5_ce_gssapi_context->create_object = php_krb5_gssapi_context_object_new;
 
-	krb5_gssapi_context_handlers.free_obj = php_krb5_gssapi_context_object_dtor;
 	memcpy(&krb5_gssapi_context_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	krb5_gssapi_context_handlers.offset = XtOffsetOf(krb5_gssapi_context_object, std);
+	krb5_gssapi_context_handlers.free_obj = php_krb5_gssapi_context_object_dtor;
 
 	return SUCCESS;
 }
@@ -243,7 +595,7 @@ int php_krb5_gssapi_register_classes(TSRMLS_D)
 /* {{{ */
 int php_krb5_gssapi_shutdown(TSRMLS_D)
 {
-#ifdef ZTS
+#if defined(ZTS) && defined(PHP_KRB5_GSSAPI_SWAP_ENV)
 	tsrm_mutex_free(gssapi_mutex);
 #endif
 
@@ -265,7 +617,7 @@ PHP_METHOD(GSSAPIContext, registerAcceptorIdentity)
 		RETURN_FALSE;
 	}
 
-	if(krb5_gss_register_acceptor_identity(keytab) != GSS_S_COMPLETE) {
+	if(php_krb5_keytab_cache_register_acceptor(keytab TSRMLS_CC) != GSS_S_COMPLETE) {
 		zend_throw_exception(NULL, "Failed to use credential cache", 0 TSRMLS_CC);
 		return;
 	}
@@ -283,6 +635,7 @@ PHP_METHOD(GSSAPIContext, acquireCredentials)
 	zval *zccache = NULL;
 	krb5_ccache_object *ccache = NULL;
 	char *ccname = NULL;
+	const char *ktname = NULL;
 	
 	long type = GSS_C_BOTH;
 	
@@ -294,13 +647,6 @@ PHP_METHOD(GSSAPIContext, acquireCredentials)
 
 	krb5_gssapi_context_object *context = Z_KRB5_GSSAPI_CONTEXT_OBJ_P(getThis());
 
-#ifdef ZTS
-	if(tsrm_mutex_lock(gssapi_mutex)) {
-		php_error_docref(NULL TSRMLS_CC,  E_ERROR, "Failed to obtain mutex lock in GSSAPI module");
-		return;
-	}
-#endif
-
 	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "O|sl", &zccache, krb5_ce_ccache,
 																&(nametmp.value), &(nametmp.length),
 																&type) == FAILURE) {
@@ -308,26 +654,18 @@ PHP_METHOD(GSSAPIContext, acquireCredentials)
 	}
 
 	ccache = Z_KRB5_CCACHE_OBJ_P(zccache);
-	const char *ccnametmp = krb5_cc_get_name(ccache->ctx, ccache->cc);
-	const char *cctypetmp = krb5_cc_get_type(ccache->ctx, ccache->cc);
-
-	ccname = malloc(strlen(ccnametmp) + strlen(cctypetmp) + 2);
-	memset(ccname,0, strlen(ccnametmp) + strlen(cctypetmp) + 2);
+	php_krb5_ccache_auto_renew(ccache TSRMLS_CC);
+	/* the mechanism may store service tickets in the cache from now on */
+	php_krb5_ccache_invalidate(ccache);
+	zval_ptr_dtor(&context->ccache);
+	ZVAL_COPY(&context->ccache, zccache);
 
-	strcat(ccname, cctypetmp);
-	strcat(ccname, ":");
-	strcat(ccname, ccnametmp);
-
-	/* save current KRB5CCNAME for resetting purposes */
-	char *oldkrb5ccname = getenv("KRB5CCNAME");
-	char *oldkrb5ktname = getenv("KRB5_KTNAME");
-
-	setenv("KRB5CCNAME", ccname, 1);
 	if(ccache->keytab) {
-		setenv("KRB5_KTNAME", ccache->keytab, 1);
+		ktname = php_krb5_keytab_cache_name(ccache->keytab TSRMLS_CC);
 	}
-	
-	free(ccname);
+
+	/* replays are detected in acceptSecContext instead */
+	context->rcache_shm = type != GSS_C_INITIATE && php_krb5_rcache_enabled() && php_krb5_rcache_configured(TSRMLS_C);
 
 	if(context->creds != GSS_C_NO_CREDENTIAL) {
 		gss_release_cred(&minor_status, &(context->creds));
@@ -335,47 +673,20 @@ PHP_METHOD(GSSAPIContext, acquireCredentials)
 
 	
 	if(nametmp.length != 0) { 
-		status = gss_import_name(&minor_status, &nametmp, GSS_C_NO_OID, &name);
-					
-		if(GSS_ERROR(status)) {
-#ifdef ZTS
-			if(tsrm_mutex_unlock(gssapi_mutex)) {
-				php_error_docref(NULL TSRMLS_CC,  E_ERROR, "Failed to release mutex lock in GSSAPI module");
-			}
-#endif
-			ASSERT_GSS_SUCCESS(status,minor_status,);
-		}
+		status = php_krb5_name_cache_import(&minor_status, nametmp.value, nametmp.length, GSS_C_NO_OID, type == GSS_C_INITIATE, &name TSRMLS_CC);
+		ASSERT_GSS_SUCCESS(status,minor_status,);
 	}
 
-	status =  gss_acquire_cred (
-	     &minor_status,
-	     name,
-	     GSS_C_INDEFINITE,
-	     GSS_C_NO_OID_SET,
-	     type,
-	     &(context->creds),
-	     NULL,
-	     NULL);
+	spprintf(&ccname, 0, "%s:%s", krb5_cc_get_type(ccache->ctx, ccache->cc), krb5_cc_get_name(ccache->ctx, ccache->cc));
 
-	/* reset KRB5CCNAME environment */
-	if(oldkrb5ccname) {
-		setenv("KRB5CCNAME", oldkrb5ccname, 1);
-	} else {
-		unsetenv("KRB5CCNAME");
-	}
+	status = php_krb5_gssapi_acquire_cred(&minor_status, name, type, ccname, ktname, context->rcache_shm, &(context->creds) TSRMLS_CC);
 
-	if(oldkrb5ktname) {
-		setenv("KRB5_KTNAME", oldkrb5ktname, 1);
-	} else {
-		unsetenv("KRB5_KTNAME");
+	efree(ccname);
+	if(name != GSS_C_NO_NAME) {
+		OM_uint32 tmp_status = 0;
+		gss_release_name(&tmp_status, &name);
 	}
 
-#ifdef ZTS
-	if(tsrm_mutex_unlock(gssapi_mutex)) {
-		php_error_docref(NULL TSRMLS_CC,  E_ERROR, "Failed to release mutex lock in GSSAPI module");
-		return;
-	}
-#endif
 	ASSERT_GSS_SUCCESS(status,minor_status,);
 } /* }}} */
 
@@ -496,7 +807,7 @@ PHP_METHOD(GSSAPIContext, initSecContext)
 
 
 	gss_name_t targetname;
-	status = gss_import_name(&minor_status, &target,GSS_C_NO_OID, &targetname);
+	status = php_krb5_name_cache_import(&minor_status, target.value, target.length, GSS_C_NO_OID, 1, &targetname TSRMLS_CC);
 	ASSERT_GSS_SUCCESS(status,minor_status,);
 
 	status =  gss_init_sec_context(
@@ -514,6 +825,12 @@ PHP_METHOD(GSSAPIContext, initSecContext)
 	     &ret_flags,
 	     &time_rec);
 
+	/* a service ticket obtained for the target has been stored in the cache */
+	if(Z_TYPE(context->ccache) == IS_OBJECT) {
+		krb5_ccache_object *ccache = Z_KRB5_CCACHE_OBJ_P(&context->ccache);
+		php_krb5_ccache_invalidate(ccache);
+	}
+
 	if(status & GSS_S_CONTINUE_NEEDED) {
 		RETVAL_FALSE;
 	} else if(status) {
@@ -596,6 +913,25 @@ PHP_METHOD(GSSAPIContext, acceptSecContext)
 			&time_rec,
 			&deleg_creds);
 
+	 /* any leg may carry the AP-REQ, e.g. the mechToken of a SPNEGO NegTokenResp
+	    following a NegTokenInit which only proposed mechanisms */
+	 if(!GSS_ERROR(status) && context->rcache_shm) {
+		 krb5_error_code retval = php_krb5_rcache_store(inputtoken.value, inputtoken.length, !(status & GSS_S_CONTINUE_NEEDED) TSRMLS_CC);
+
+		 if(retval) {
+			 OM_uint32 tmpstat = 0;
+			 gss_release_name(&tmpstat, &src_name);
+			 gss_release_buffer(&tmpstat, &tokenbuf);
+			 gss_delete_sec_context(&tmpstat, &context->context, GSS_C_NO_BUFFER);
+			 if(deleg_creds != GSS_C_NO_CREDENTIAL) {
+				 gss_release_cred(&tmpstat, &deleg_creds);
+			 }
+			 /* the library renders the message without a context */
+			 php_krb5_throw_krb5_exception(NULL, retval, retval == KRB5_RC_REPLAY ? "Replayed context token (%s)" : "Replay cache unavailable (%s)" TSRMLS_CC);
+			 RETURN_FALSE;
+		 }
+	 }
+
 	 if(status & GSS_S_CONTINUE_NEEDED) {
 		 RETVAL_FALSE;
 	 } else if(GSS_ERROR(status)) {
@@ -664,10 +1000,10 @@ PHP_METHOD(GSSAPIContext, acceptSecContext)
 
 		 /* copy credentials to ccache */ 
 		 status = gss_krb5_copy_ccache(&minor_status, deleg_creds, deleg_ccache->cc);
+		 php_krb5_ccache_invalidate(deleg_ccache);
 
 		 if(GSS_ERROR(status)) {
-			 php_krb5_gssapi_handle_error(status, minor_status TSRMLS_CC);
-			 zend_throw_exception(NULL, "Failure while imporing delegated ticket", 0 TSRMLS_CC);
+			 php_krb5_throw_gssapi_exception(status, minor_status, "Failure while imporing delegated ticket" TSRMLS_CC);
 			 RETURN_FALSE;
 		 }
 	 }
@@ -700,6 +1036,145 @@ PHP_METHOD(GSSAPIContext, getTimeRemaining)
 	RETURN_LONG(time_rec);
 } /* }}} */
 
+/* {{{ proto string GSSAPIContext::export( )
+   Exports the established context into an interprocess token for import(),
+   this context is unusable afterwards. The token contains the session keys
+   and must only be kept in storage that is as trusted as the process */
+PHP_METHOD(GSSAPIContext, export)
+{
+	OM_uint32 status = 0;
+	OM_uint32 minor_status = 0;
+	gss_buffer_desc token;
+	krb5_gssapi_context_object *context = Z_KRB5_GSSAPI_CONTEXT_OBJ_P(getThis());
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if(context->context == GSS_C_NO_CONTEXT) {
+		zend_throw_exception(NULL, "No security context to export", 0 TSRMLS_CC);
+		return;
+	}
+
+	memset(&token, 0, sizeof(token));
+	status = gss_export_sec_context(&minor_status, &context->context, &token);
+
+	ASSERT_GSS_SUCCESS(status,minor_status,);
+
+	RETVAL_STRINGL(token.value, token.length);
+	gss_release_buffer(&minor_status, &token);
+} /* }}} */
+
+/* {{{ proto void GSSAPIContext::import( string $token )
+   Resumes a context from a token created by export(), replacing the
+   current context */
+PHP_METHOD(GSSAPIContext, import)
+{
+	OM_uint32 status = 0;
+	OM_uint32 minor_status = 0;
+	gss_buffer_desc token;
+	gss_ctx_id_t imported = GSS_C_NO_CONTEXT;
+	krb5_gssapi_context_object *context = Z_KRB5_GSSAPI_CONTEXT_OBJ_P(getThis());
+
+	memset(&token, 0, sizeof(token));
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &(token.value), &(token.length)) == FAILURE) {
+		return;
+	}
+
+	status = gss_import_sec_context(&minor_status, &token, &imported);
+
+	ASSERT_GSS_SUCCESS(status,minor_status,);
+
+	if(context->context != GSS_C_NO_CONTEXT) {
+		gss_delete_sec_context(&minor_status, &context->context, GSS_C_NO_BUFFER);
+	}
+	context->context = imported;
+} /* }}} */
+
+/* {{{ proto bool GSSAPIContext::checkoutContext( KRB5CCache $ccache, string $target [, int $req_flags = 0 ])
+   Takes an established context of the ccache's principal with target from
+   this worker's pool. Returns false if there is none, the caller then
+   establishes one with acquireCredentials()/initSecContext(). Either way
+   returnContext() hands the context back for later requests */
+PHP_METHOD(GSSAPIContext, checkoutContext)
+{
+	OM_uint32 minor_status = 0;
+	zval *zccache = NULL;
+	krb5_ccache_object *ccache;
+	char *target;
+	size_t target_len;
+	zend_long req_flags = 0;
+	krb5_principal princ = NULL;
+	char *client = NULL;
+	krb5_error_code retval;
+	gss_ctx_id_t pooled;
+	krb5_gssapi_context_object *context = Z_KRB5_GSSAPI_CONTEXT_OBJ_P(getThis());
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "Os|l", &zccache, krb5_ce_ccache, &target, &target_len, &req_flags) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	ccache = Z_KRB5_CCACHE_OBJ_P(zccache);
+
+	if((retval = krb5_cc_get_principal(ccache->ctx, ccache->cc, &princ))) {
+		php_krb5_display_error(ccache->ctx, retval, "Failed to retrieve principal from source ccache (%s)" TSRMLS_CC);
+		RETURN_FALSE;
+	}
+
+	retval = krb5_unparse_name(ccache->ctx, princ, &client);
+	krb5_free_principal(ccache->ctx, princ);
+	if(retval) {
+		php_krb5_display_error(ccache->ctx, retval, "Failed to unparse principal name (%s)" TSRMLS_CC);
+		RETURN_FALSE;
+	}
+
+	if(context->pool_key) {
+		zend_string_release(context->pool_key);
+	}
+	context->pool_key = strpprintf(0, "%s\n%s\n" ZEND_LONG_FMT, client, target, req_flags);
+	krb5_free_unparsed_name(ccache->ctx, client);
+
+	pooled = php_krb5_initiator_pool_checkout(context->pool_key TSRMLS_CC);
+	if(pooled == GSS_C_NO_CONTEXT) {
+		KRB5_G(initiator_pool_misses)++;
+		RETURN_FALSE;
+	}
+
+	KRB5_G(initiator_pool_hits)++;
+	if(context->context != GSS_C_NO_CONTEXT) {
+		gss_delete_sec_context(&minor_status, &context->context, GSS_C_NO_BUFFER);
+	}
+	context->context = pooled;
+
+	RETURN_TRUE;
+} /* }}} */
+
+/* {{{ proto bool GSSAPIContext::returnContext( )
+   Returns the context to the pool under the key of the last
+   checkoutContext(); false if it is not kept (not established, close to
+   expiry, established for another client or target or the pool is full)
+   and stays with this object */
+PHP_METHOD(GSSAPIContext, returnContext)
+{
+	krb5_gssapi_context_object *context = Z_KRB5_GSSAPI_CONTEXT_OBJ_P(getThis());
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if(!context->pool_key || context->context == GSS_C_NO_CONTEXT) {
+		RETURN_FALSE;
+	}
+
+	if(php_krb5_initiator_pool_return(context->pool_key, context->context TSRMLS_CC) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	context->context = GSS_C_NO_CONTEXT;
+	RETURN_TRUE;
+} /* }}} */
+
 /* {{{ proto string GSSAPIContext::getMic( string message )
    Calculates a MIC for the given message */
 PHP_METHOD(GSSAPIContext, getMic)
@@ -764,6 +1239,11 @@ PHP_METHOD(GSSAPIContext, verifyMic)
 
 	RETVAL_FALSE;
 
+	/* a MIC that does not verify is an answer, not an error */
+	if(GSS_ROUTINE_ERROR(status) == GSS_S_BAD_SIG || GSS_ROUTINE_ERROR(status) == GSS_S_DEFECTIVE_TOKEN) {
+		return;
+	}
+
 	ASSERT_GSS_SUCCESS(status,minor_status,);
 
 	RETVAL_TRUE;
@@ -860,3 +1340,178 @@ PHP_METHOD(GSSAPIContext, unwrap)
 	status = gss_release_buffer(&minor_status, &output);
 	ASSERT_GSS_SUCCESS(status,minor_status,);
 } /* }}} */
+
+#ifdef HAVE_GSS_GET_MIC_IOV
+/* {{{ proto string GSSAPIContext::getMicIov( array $buffers )
+   Calculates a MIC over the concatenation of the given buffers without
+   joining them first, verifiable with verifyMic() */
+PHP_METHOD(GSSAPIContext, getMicIov)
+{
+	OM_uint32 status = 0;
+	OM_uint32 minor_status = 0;
+	HashTable *buffers;
+	gss_iov_buffer_desc *iov;
+	size_t data_length;
+	int count;
+	zend_string *mic;
+	krb5_gssapi_context_object *context = Z_KRB5_GSSAPI_CONTEXT_OBJ_P(getThis());
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "h", &buffers) == FAILURE) {
+		return;
+	}
+
+	if(!(iov = php_krb5_gssapi_iov_from_array(buffers, 0, 1, &count, &data_length TSRMLS_CC))) {
+		return;
+	}
+	iov[count - 1].type = GSS_IOV_BUFFER_TYPE_MIC_TOKEN;
+
+	status = gss_get_mic_iov_length(&minor_status, context->context, GSS_C_QOP_DEFAULT, iov, count);
+	if(GSS_ERROR(status)) {
+		efree(iov);
+		ASSERT_GSS_SUCCESS(status,minor_status,);
+	}
+
+	/* the MIC is written straight into the returned string */
+	mic = zend_string_alloc(iov[count - 1].buffer.length, 0);
+	iov[count - 1].buffer.value = ZSTR_VAL(mic);
+
+	status = gss_get_mic_iov(&minor_status, context->context, GSS_C_QOP_DEFAULT, iov, count);
+	if(GSS_ERROR(status)) {
+		efree(iov);
+		zend_string_free(mic);
+		ASSERT_GSS_SUCCESS(status,minor_status,);
+	}
+
+	ZSTR_LEN(mic) = iov[count - 1].buffer.length;
+	ZSTR_VAL(mic)[ZSTR_LEN(mic)] = '\0';
+	efree(iov);
+
+	RETURN_NEW_STR(mic);
+} /* }}} */
+#endif
+
+#ifdef HAVE_GSS_WRAP_IOV
+/* {{{ proto bool GSSAPIContext::wrapIov( array $buffers, string &$output [, bool $encrypt = false ])
+   Like wrap() for the concatenation of the given buffers. The token is
+   sized up front and the buffers are sealed in place inside it, the result
+   can be processed with unwrap() or unwrapIov() */
+PHP_METHOD(GSSAPIContext, wrapIov)
+{
+	OM_uint32 status = 0;
+	OM_uint32 minor_status = 0;
+	HashTable *buffers;
+	gss_iov_buffer_desc *iov;
+	size_t data_length, length;
+	int count, i;
+	zval *zoutput;
+	zend_bool encrypt = 0;
+	zend_string *token;
+	char *pos;
+	gss_iov_buffer_desc *header, *padding, *trailer;
+	krb5_gssapi_context_object *context = Z_KRB5_GSSAPI_CONTEXT_OBJ_P(getThis());
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "hz|b", &buffers, &zoutput, &encrypt) == FAILURE) {
+		return;
+	}
+
+	RETVAL_FALSE;
+
+	/* HEADER | DATA... | PADDING | TRAILER, which is the layout of a wrap() token */
+	if(!(iov = php_krb5_gssapi_iov_from_array(buffers, 1, 2, &count, &data_length TSRMLS_CC))) {
+		return;
+	}
+	header = &iov[0];
+	padding = &iov[count - 2];
+	trailer = &iov[count - 1];
+	header->type = GSS_IOV_BUFFER_TYPE_HEADER;
+	padding->type = GSS_IOV_BUFFER_TYPE_PADDING;
+	trailer->type = GSS_IOV_BUFFER_TYPE_TRAILER;
+
+	status = gss_wrap_iov_length(&minor_status, context->context, encrypt, GSS_C_QOP_DEFAULT, NULL, iov, count);
+	if(GSS_ERROR(status)) {
+		efree(iov);
+		ASSERT_GSS_SUCCESS(status,minor_status,);
+	}
+
+	length = header->buffer.length + data_length + padding->buffer.length + trailer->buffer.length;
+	token = zend_string_alloc(length, 0);
+
+	/* the only copy of the payload: gather it into the token */
+	pos = ZSTR_VAL(token);
+	header->buffer.value = pos;
+	pos += header->buffer.length;
+	for(i = 1; i < count - 2; i++) {
+		memcpy(pos, iov[i].buffer.value, iov[i].buffer.length);
+		iov[i].buffer.value = pos;
+		pos += iov[i].buffer.length;
+	}
+	padding->buffer.value = pos;
+	pos += padding->buffer.length;
+	trailer->buffer.value = pos;
+
+	status = gss_wrap_iov(&minor_status, context->context, encrypt, GSS_C_QOP_DEFAULT, NULL, iov, count);
+	if(GSS_ERROR(status)) {
+		efree(iov);
+		zend_string_free(token);
+		ASSERT_GSS_SUCCESS(status,minor_status,);
+	}
+
+	/* the mechanism may use less padding than announced */
+	if((char*) trailer->buffer.value != (char*) padding->buffer.value + padding->buffer.length) {
+		memmove((char*) padding->buffer.value + padding->buffer.length, trailer->buffer.value, trailer->buffer.length);
+		length = header->buffer.length + data_length + padding->buffer.length + trailer->buffer.length;
+	}
+	ZSTR_LEN(token) = length;
+	ZSTR_VAL(token)[length] = '\0';
+	efree(iov);
+
+	zval_dtor(zoutput);
+	ZVAL_NEW_STR(zoutput, token);
+
+	RETVAL_TRUE;
+} /* }}} */
+
+/* {{{ proto bool GSSAPIContext::unwrapIov( string $input, string &$output)
+   Like unwrap(), but verifies and decrypts the message in place inside a
+   single copy of the token instead of a library allocated buffer */
+PHP_METHOD(GSSAPIContext, unwrapIov)
+{
+	OM_uint32 status = 0;
+	OM_uint32 minor_status = 0;
+	zend_string *input;
+	zend_string *message;
+	zval *zoutput;
+	gss_iov_buffer_desc iov[2];
+	krb5_gssapi_context_object *context = Z_KRB5_GSSAPI_CONTEXT_OBJ_P(getThis());
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "Sz", &input, &zoutput) == FAILURE) {
+		return;
+	}
+
+	RETVAL_FALSE;
+
+	message = zend_string_init(ZSTR_VAL(input), ZSTR_LEN(input), 0);
+
+	memset(iov, 0, sizeof(iov));
+	iov[0].type = GSS_IOV_BUFFER_TYPE_STREAM;
+	iov[0].buffer.value = ZSTR_VAL(message);
+	iov[0].buffer.length = ZSTR_LEN(message);
+	iov[1].type = GSS_IOV_BUFFER_TYPE_DATA;
+
+	status = gss_unwrap_iov(&minor_status, context->context, NULL, NULL, iov, 2);
+	if(GSS_ERROR(status)) {
+		zend_string_free(message);
+		ASSERT_GSS_SUCCESS(status,minor_status,);
+	}
+
+	/* the DATA buffer points into the stream */
+	memmove(ZSTR_VAL(message), iov[1].buffer.value, iov[1].buffer.length);
+	ZSTR_LEN(message) = iov[1].buffer.length;
+	ZSTR_VAL(message)[ZSTR_LEN(message)] = '\0';
+
+	zval_dtor(zoutput);
+	ZVAL_NEW_STR(zoutput, message);
+
+	RETVAL_TRUE;
+} /* }}} */
+#endif
@@ -0,0 +1,467 @@
+/**
+* Copyright (c) 2008 Moritz Bechler
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+**/
+
+
+/*
+ * Non-blocking exchanges with the KDC
+ *
+ * The library's step interfaces (krb5_tkt_creds_step, krb5_init_creds_step)
+ * only produce and consume KDC messages; delivering them is left to the
+ * caller. This provides a minimal UDP transport for them, using the KDCs
+ * listed in the [realms] section of the configuration, and a driver
+ * running several TGS exchanges concurrently in a single poll loop. The
+ * KDC addresses are resolved before the loop is entered, a request that
+ * goes unanswered is moved on to the next address.
+ *
+ * Anything not covered here (DNS SRV lookups, TCP, KKDCP proxies) is left
+ * to the blocking library functions, which the callers fall back to.
+ */
+
+#include "php_krb5.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifndef HAVE_KRB5_HEIMDAL
+#include <profile.h>
+#endif
+
+#define PHP_KRB5_KDC_PORT     "88"
+#define PHP_KRB5_KDC_MAXREPLY 65536
+#define PHP_KRB5_KDC_TIMEOUT  1000 /* ms until a request is resent */
+#define PHP_KRB5_KDC_TRIES    3
+
+/* {{{ */
+static double php_krb5_kdc_now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+/* }}} */
+
+/* {{{ Appends the UDP addresses of entry, which may be "host", "host:port" or "[addr]:port" */
+static void php_krb5_kdc_add(php_krb5_kdc_list *list, const char *entry)
+{
+	struct addrinfo hints, *res = NULL, *ai;
+	char *host, *port = PHP_KRB5_KDC_PORT, *p;
+
+	if(strncmp(entry, "udp/", 4) == 0) {
+		entry += 4;
+	} else if(strncmp(entry, "tcp/", 4) == 0 || strstr(entry, "://")) {
+		/* not reachable over UDP */
+		return;
+	}
+
+	host = estrdup(entry);
+	if(*host == '[' && (p = strchr(host, ']'))) {
+		*p++ = '\0';
+		if(*p == ':') port = p + 1;
+		memmove(host, host + 1, strlen(host));
+	} else if((p = strchr(host, ':')) && !strchr(p + 1, ':')) {
+		*p = '\0';
+		port = p + 1;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	if(getaddrinfo(host, port, &hints, &res) == 0) {
+		for(ai = res; ai; ai = ai->ai_next) {
+			if(ai->ai_addrlen > sizeof(struct sockaddr_storage)) continue;
+
+			list->addrs = erealloc(list->addrs, (list->count + 1) * sizeof(php_krb5_kdc_addr));
+			memcpy(&list->addrs[list->count].addr, ai->ai_addr, ai->ai_addrlen);
+			list->addrs[list->count].addrlen = ai->ai_addrlen;
+			list->count++;
+		}
+		freeaddrinfo(res);
+	}
+
+	efree(host);
+}
+/* }}} */
+
+/* {{{ Resolves the addresses of all KDCs configured for realm, the lookups
+       block, so this is done once before any exchange is started */
+krb5_error_code php_krb5_kdc_resolve(krb5_context ctx, const krb5_data *realm, php_krb5_kdc_list *list)
+{
+#ifndef HAVE_KRB5_HEIMDAL
+	krb5_error_code retval = 0;
+	profile_t profile = NULL;
+	const char *names[4];
+	char **kdcs = NULL;
+	int i;
+
+	memset(list, 0, sizeof(*list));
+	if((retval = krb5_get_profile(ctx, &profile))) {
+		return retval;
+	}
+
+	list->realm = estrndup(realm->data, realm->length);
+	list->realm_len = realm->length;
+	names[0] = "realms";
+	names[1] = list->realm;
+	names[2] = "kdc";
+	names[3] = NULL;
+
+	retval = profile_get_values(profile, names, &kdcs);
+	profile_release(profile);
+
+	if(retval || !kdcs) {
+		return KRB5_REALM_CANT_RESOLVE;
+	}
+
+	for(i = 0; kdcs[i]; i++) {
+		php_krb5_kdc_add(list, kdcs[i]);
+	}
+	profile_free_list(kdcs);
+
+	return list->count ? 0 : KRB5_KDC_UNREACH;
+#else
+	memset(list, 0, sizeof(*list));
+	return KRB5_KDC_UNREACH;
+#endif
+}
+/* }}} */
+
+/* {{{ */
+void php_krb5_kdc_list_free(php_krb5_kdc_list *list)
+{
+	if(list->realm) efree(list->realm);
+	if(list->addrs) efree(list->addrs);
+	memset(list, 0, sizeof(*list));
+}
+/* }}} */
+
+/* {{{ Opens a UDP socket to the first usable KDC from *index on, which is
+       updated to the one connected to */
+int php_krb5_kdc_connect(const php_krb5_kdc_list *list, int *index)
+{
+	php_krb5_kdc_addr *kdc;
+	int sock;
+
+	for(; *index < list->count; (*index)++) {
+		kdc = &list->addrs[*index];
+		sock = socket(kdc->addr.ss_family, SOCK_DGRAM, 0);
+		if(sock < 0) continue;
+
+		if(fcntl(sock, F_SETFL, O_NONBLOCK) < 0 ||
+				connect(sock, (struct sockaddr *) &kdc->addr, kdc->addrlen) < 0) {
+			close(sock);
+			continue;
+		}
+
+		return sock;
+	}
+
+	return -1;
+}
+/* }}} */
+
+/* {{{ */
+krb5_error_code php_krb5_kdc_send(int fd, const krb5_data *request)
+{
+	if(send(fd, request->data, request->length, 0) != (ssize_t) request->length) {
+		return KRB5_KDC_UNREACH;
+	}
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ Reads a pending reply, reply->data must be released with efree() */
+krb5_error_code php_krb5_kdc_recv(int fd, krb5_data *reply)
+{
+	ssize_t len;
+
+	reply->data = emalloc(PHP_KRB5_KDC_MAXREPLY);
+	len = recv(fd, reply->data, PHP_KRB5_KDC_MAXREPLY, 0);
+
+	if(len <= 0) {
+		efree(reply->data);
+		reply->data = NULL;
+		reply->length = 0;
+		return (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) ? EAGAIN : KRB5_KDC_UNREACH;
+	}
+
+	reply->length = len;
+	return 0;
+}
+/* }}} */
+
+/* Concurrent TGS exchanges */
+
+typedef struct _php_krb5_tgs_op {
+	zend_string *spn;
+	krb5_creds in_creds;
+#ifndef HAVE_KRB5_HEIMDAL
+	krb5_tkt_creds_context tctx;
+#endif
+	krb5_data request;
+	int fd;
+	/* index of the KDC the request was sent to */
+	int kdc;
+	int tries;
+	double sent;
+	int done;
+	int fallback;
+	krb5_error_code retval;
+} php_krb5_tgs_op;
+
+#ifndef HAVE_KRB5_HEIMDAL
+/* {{{ Sends the pending request to the next reachable KDC after the current one */
+static krb5_error_code php_krb5_tgs_op_failover(const php_krb5_kdc_list *kdcs, php_krb5_tgs_op *op)
+{
+	if(op->fd >= 0) {
+		close(op->fd);
+		op->fd = -1;
+	}
+
+	op->kdc++;
+	while((op->fd = php_krb5_kdc_connect(kdcs, &op->kdc)) >= 0) {
+		if(php_krb5_kdc_send(op->fd, &op->request) == 0) {
+			op->tries = 1;
+			op->sent = php_krb5_kdc_now();
+			return 0;
+		}
+		close(op->fd);
+		op->fd = -1;
+		op->kdc++;
+	}
+
+	return KRB5_KDC_UNREACH;
+}
+/* }}} */
+
+/* {{{ Feeds reply (empty on the first call) to the exchange and sends the next request */
+static void php_krb5_tgs_op_step(krb5_context ctx, const php_krb5_kdc_list *kdcs, php_krb5_tgs_op *op, krb5_data *reply)
+{
+	krb5_data realm;
+	unsigned int flags = 0;
+
+	if(op->fd >= 0) {
+		close(op->fd);
+		op->fd = -1;
+	}
+	krb5_free_data_contents(ctx, &op->request);
+	memset(&realm, 0, sizeof(realm));
+
+	op->retval = krb5_tkt_creds_step(ctx, op->tctx, reply, &op->request, &realm, &flags);
+	if(op->retval || !(flags & KRB5_TKT_CREDS_STEP_FLAG_CONTINUE)) {
+		/* the reply may not fit a datagram, the blocking path will use TCP */
+		op->fallback = (op->retval == KRB5KRB_ERR_RESPONSE_TOO_BIG);
+		op->done = 1;
+		krb5_free_data_contents(ctx, &realm);
+		return;
+	}
+
+	/* only the client realm's KDCs are resolved up front, referrals to
+	   other realms are left to the blocking path */
+	if(realm.length != kdcs->realm_len || memcmp(realm.data, kdcs->realm, realm.length) != 0) {
+		krb5_free_data_contents(ctx, &realm);
+		op->fallback = 1;
+		op->done = 1;
+		return;
+	}
+	krb5_free_data_contents(ctx, &realm);
+
+	/* start with the KDC that answered the previous request */
+	op->kdc--;
+	if(php_krb5_tgs_op_failover(kdcs, op)) {
+		op->fallback = 1;
+		op->done = 1;
+	}
+}
+/* }}} */
+#endif
+
+/* {{{ Obtains service tickets for all principals in spns, storing them in cc.
+       status receives spn => true or an error message for each principal */
+krb5_error_code php_krb5_prefetch_service_tickets(krb5_context ctx, krb5_ccache cc, HashTable *spns, zval *status TSRMLS_DC)
+{
+	krb5_error_code retval = 0;
+	krb5_principal client = NULL;
+	krb5_creds *out_creds;
+	php_krb5_tgs_op *ops;
+	zval *spn;
+	int count = 0, i;
+	const char *msg;
+#ifndef HAVE_KRB5_HEIMDAL
+	struct pollfd *fds;
+	int *fdop, nfds, pending, timeout;
+	double now;
+	krb5_data reply;
+	php_krb5_kdc_list kdcs;
+#endif
+
+	if((retval = krb5_cc_get_principal(ctx, cc, &client))) {
+		return retval;
+	}
+
+#ifndef HAVE_KRB5_HEIMDAL
+	/* without any usable KDC every exchange takes the blocking path */
+	php_krb5_kdc_resolve(ctx, krb5_princ_realm(ctx, client), &kdcs);
+#endif
+
+	ops = ecalloc(zend_hash_num_elements(spns) + 1, sizeof(php_krb5_tgs_op));
+
+	ZEND_HASH_FOREACH_VAL(spns, spn) {
+		php_krb5_tgs_op *op = &ops[count++];
+
+		op->spn = zval_get_string(spn);
+		op->fd = -1;
+		op->in_creds.client = client;
+
+		if((op->retval = krb5_parse_name(ctx, ZSTR_VAL(op->spn), &op->in_creds.server))) {
+			op->done = 1;
+			continue;
+		}
+
+#ifndef HAVE_KRB5_HEIMDAL
+		/* cached, still valid tickets complete without any KDC traffic */
+		if((op->retval = krb5_tkt_creds_init(ctx, cc, &op->in_creds, 0, &op->tctx))) {
+			op->done = 1;
+			continue;
+		}
+
+		php_krb5_tgs_op_step(ctx, &kdcs, op, NULL);
+#else
+		op->fallback = 1;
+		op->done = 1;
+#endif
+	} ZEND_HASH_FOREACH_END();
+
+#ifndef HAVE_KRB5_HEIMDAL
+	fds = ecalloc(count + 1, sizeof(struct pollfd));
+	fdop = ecalloc(count + 1, sizeof(int));
+
+	for(;;) {
+		nfds = 0;
+		pending = 0;
+		timeout = PHP_KRB5_KDC_TIMEOUT;
+		now = php_krb5_kdc_now();
+
+		for(i = 0; i < count; i++) {
+			if(ops[i].done) continue;
+
+			fds[nfds].fd = ops[i].fd;
+			fds[nfds].events = POLLIN;
+			fds[nfds].revents = 0;
+			fdop[nfds++] = i;
+			pending++;
+
+			if(ops[i].sent + PHP_KRB5_KDC_TIMEOUT - now < timeout) {
+				timeout = ops[i].sent + PHP_KRB5_KDC_TIMEOUT - now;
+			}
+		}
+
+		if(!pending) break;
+
+		if(poll(fds, nfds, timeout < 0 ? 0 : timeout) < 0 && errno != EINTR) {
+			for(i = 0; i < nfds; i++) {
+				ops[fdop[i]].fallback = 1;
+				ops[fdop[i]].done = 1;
+			}
+			break;
+		}
+
+		now = php_krb5_kdc_now();
+		for(i = 0; i < nfds; i++) {
+			php_krb5_tgs_op *op = &ops[fdop[i]];
+
+			if(fds[i].revents & POLLIN) {
+				retval = php_krb5_kdc_recv(op->fd, &reply);
+				if(retval == EAGAIN) {
+					continue;
+				} else if(retval) {
+					op->fallback = 1;
+					op->done = 1;
+					continue;
+				}
+
+				php_krb5_tgs_op_step(ctx, &kdcs, op, &reply);
+				efree(reply.data);
+			} else if(fds[i].revents & (POLLERR | POLLHUP)) {
+				/* e.g. ICMP port unreachable */
+				if(php_krb5_tgs_op_failover(&kdcs, op)) {
+					op->fallback = 1;
+					op->done = 1;
+				}
+			} else if(now - op->sent >= PHP_KRB5_KDC_TIMEOUT) {
+				if(op->tries < PHP_KRB5_KDC_TRIES && php_krb5_kdc_send(op->fd, &op->request) == 0) {
+					op->tries++;
+					op->sent = now;
+				} else if(php_krb5_tgs_op_failover(&kdcs, op)) {
+					op->fallback = 1;
+					op->done = 1;
+				}
+			}
+		}
+	}
+
+	efree(fds);
+	efree(fdop);
+	php_krb5_kdc_list_free(&kdcs);
+#endif
+
+	retval = 0;
+	for(i = 0; i < count; i++) {
+		php_krb5_tgs_op *op = &ops[i];
+
+		if(op->fallback) {
+			out_creds = NULL;
+			op->retval = krb5_get_credentials(ctx, 0, cc, &op->in_creds, &out_creds);
+			if(out_creds) {
+				krb5_free_creds(ctx, out_creds);
+			}
+		}
+
+		if(op->retval) {
+			msg = krb5_get_error_message(ctx, op->retval);
+			add_assoc_string(status, ZSTR_VAL(op->spn), (char*) msg);
+			krb5_free_error_message(ctx, msg);
+		} else {
+			add_assoc_bool(status, ZSTR_VAL(op->spn), 1);
+		}
+
+#ifndef HAVE_KRB5_HEIMDAL
+		if(op->fd >= 0) close(op->fd);
+		if(op->tctx) krb5_tkt_creds_free(ctx, op->tctx);
+		krb5_free_data_contents(ctx, &op->request);
+#endif
+		if(op->in_creds.server) krb5_free_principal(ctx, op->in_creds.server);
+		zend_string_release(op->spn);
+	}
+
+	efree(ops);
+	krb5_free_principal(ctx, client);
+	return retval;
+}
+/* }}} */
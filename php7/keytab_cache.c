@@ -0,0 +1,271 @@
+/**
+* Copyright (c) 2008 Moritz Bechler
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+**/
+
+
+/*
+ * Keytab cache
+ *
+ * File keytabs are copied once per worker into a MEMORY: keytab which all
+ * users (initKeytab(), TGT verification, acceptor identities) resolve
+ * instead of the file. The file is stat()ed at most every
+ * krb5.keytab_cache_interval seconds; when its device, inode, size or
+ * mtime change it is read into a fresh MEMORY: keytab which then replaces
+ * the old one. Handles resolved from the old copy stay valid until closed.
+ * The acceptor identity registered with GSSAPI only holds the name, it is
+ * moved over to the new copy before the old one is closed.
+ */
+
+#include "php_krb5.h"
+
+#include <sys/stat.h>
+
+typedef struct _php_krb5_keytab_entry {
+	krb5_context ctx;
+	krb5_keytab kt; /* keeps the MEMORY: keytab alive */
+	char *memname;
+	unsigned long generation;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	time_t checked;
+	zend_bool acceptor; /* memname is the registered acceptor identity */
+} php_krb5_keytab_entry;
+
+/* {{{ stat()s the file behind a FILE: keytab name, fails for other types */
+int php_krb5_keytab_stat(const char *keytab, struct stat *st)
+{
+	if(strncmp(keytab, "FILE:", sizeof("FILE:") - 1) == 0) {
+		keytab += sizeof("FILE:") - 1;
+	} else if(strncmp(keytab, "WRFILE:", sizeof("WRFILE:") - 1) == 0) {
+		keytab += sizeof("WRFILE:") - 1;
+	} else if(*keytab != '/' && strchr(keytab, ':')) {
+		/* not file based, changes cannot be detected */
+		return FAILURE;
+	}
+
+	return stat(keytab, st) == 0 ? SUCCESS : FAILURE;
+}
+/* }}} */
+
+/* {{{ */
+void php_krb5_keytab_entry_dtor(zval *zv)
+{
+	php_krb5_keytab_entry *entry = Z_PTR_P(zv);
+
+	if(entry->kt) krb5_kt_close(entry->ctx, entry->kt);
+	if(entry->memname) pefree(entry->memname, 1);
+	if(entry->ctx) krb5_free_context(entry->ctx);
+	pefree(entry, 1);
+}
+/* }}} */
+
+/* {{{ Copies the keytab into a new MEMORY: keytab, returned in kt and memname */
+static krb5_error_code php_krb5_keytab_load(php_krb5_keytab_entry *entry, const char *keytab, krb5_keytab *kt, char **memname)
+{
+	krb5_error_code retval = 0;
+	krb5_keytab src;
+	int have_src = 0;
+	krb5_kt_cursor cursor;
+	int have_cursor = 0;
+	krb5_keytab_entry ktentry;
+	int count = 0;
+
+	*kt = NULL;
+	spprintf(memname, 0, "MEMORY:php_krb5_%p_%lu", (void*) entry, ++entry->generation);
+
+    do {
+	if ((retval = krb5_kt_resolve(entry->ctx, keytab, &src))) {
+		break;
+	}
+	have_src = 1;
+
+	if ((retval = krb5_kt_resolve(entry->ctx, *memname, kt))) {
+		*kt = NULL;
+		break;
+	}
+
+	if ((retval = krb5_kt_start_seq_get(entry->ctx, src, &cursor))) {
+		break;
+	}
+	have_cursor = 1;
+
+	while ((retval = krb5_kt_next_entry(entry->ctx, src, &ktentry, &cursor)) == 0) {
+		retval = krb5_kt_add_entry(entry->ctx, *kt, &ktentry);
+#ifdef HAVE_KRB5_HEIMDAL
+		krb5_kt_free_entry(entry->ctx, &ktentry);
+#else
+		krb5_free_keytab_entry_contents(entry->ctx, &ktentry);
+#endif
+		if (retval) {
+			break;
+		}
+		count++;
+	}
+
+	if (retval == KRB5_KT_END) {
+		/* an empty file is most likely being rewritten */
+		retval = count ? 0 : KRB5_KT_NOTFOUND;
+	}
+    } while (0);
+
+	if (have_cursor) krb5_kt_end_seq_get(entry->ctx, src, &cursor);
+	if (have_src) krb5_kt_close(entry->ctx, src);
+
+	if (retval) {
+		/* the partial copy is never handed out */
+		if (*kt) krb5_kt_close(entry->ctx, *kt);
+		*kt = NULL;
+		efree(*memname);
+		*memname = NULL;
+	}
+
+	return retval;
+}
+/* }}} */
+
+/* {{{ Returns the name of the in-memory copy of keytab, or keytab itself if
+       it cannot be cached. The returned name is valid until the next call */
+const char *php_krb5_keytab_cache_name(const char *keytab TSRMLS_DC)
+{
+	php_krb5_keytab_entry *entry;
+	size_t keytab_len = strlen(keytab);
+	time_t now = time(NULL);
+	struct stat st;
+	krb5_keytab kt;
+	char *memname;
+
+	if(!KRB5_G(keytab_cache)) {
+		return keytab;
+	}
+
+	entry = zend_hash_str_find_ptr(&KRB5_G(keytab_cache_entries), keytab, keytab_len);
+	if(entry && now - entry->checked < KRB5_G(keytab_cache_interval)) {
+		return entry->memname;
+	}
+
+	if(php_krb5_keytab_stat(keytab, &st) == FAILURE) {
+		/* a cached file which is (temporarily) unavailable keeps being served */
+		return entry ? entry->memname : keytab;
+	}
+
+	if(entry && entry->dev == st.st_dev && entry->ino == st.st_ino &&
+			entry->size == st.st_size && entry->mtime == st.st_mtime) {
+		entry->checked = now;
+		return entry->memname;
+	}
+
+	if(!entry) {
+		entry = pecalloc(1, sizeof(php_krb5_keytab_entry), 1);
+		if(krb5_init_context(&entry->ctx)) {
+			pefree(entry, 1);
+			return keytab;
+		}
+		zend_hash_str_update_ptr(&KRB5_G(keytab_cache_entries), keytab, keytab_len, entry);
+	}
+
+	if(php_krb5_keytab_load(entry, keytab, &kt, &memname)) {
+		if(entry->memname) {
+			return entry->memname;
+		}
+		zend_hash_str_del(&KRB5_G(keytab_cache_entries), keytab, keytab_len);
+		return keytab;
+	}
+
+	/* swap in the new copy */
+	if(entry->acceptor && krb5_gss_register_acceptor_identity(memname) != GSS_S_COMPLETE) {
+		/* keep serving the registered copy rather than pulling it away */
+		krb5_kt_close(entry->ctx, kt);
+		efree(memname);
+		entry->checked = now;
+		return entry->memname;
+	}
+	if(entry->kt) krb5_kt_close(entry->ctx, entry->kt);
+	if(entry->memname) pefree(entry->memname, 1);
+	entry->kt = kt;
+	entry->memname = pestrdup(memname, 1);
+	efree(memname);
+
+	entry->dev = st.st_dev;
+	entry->ino = st.st_ino;
+	entry->size = st.st_size;
+	entry->mtime = st.st_mtime;
+	entry->checked = now;
+
+	return entry->memname;
+}
+/* }}} */
+
+/* {{{ Registers keytab, through its in-memory copy, as the acceptor identity */
+OM_uint32 php_krb5_keytab_cache_register_acceptor(const char *keytab TSRMLS_DC)
+{
+	php_krb5_keytab_entry *entry;
+	const char *name = php_krb5_keytab_cache_name(keytab TSRMLS_CC);
+	OM_uint32 status;
+
+	if((status = krb5_gss_register_acceptor_identity(name)) != GSS_S_COMPLETE) {
+		return status;
+	}
+
+	ZEND_HASH_FOREACH_PTR(&KRB5_G(keytab_cache_entries), entry) {
+		entry->acceptor = (entry->memname == name);
+	} ZEND_HASH_FOREACH_END();
+
+	return status;
+}
+/* }}} */
+
+/* {{{ Checks that keytab can be read, an in-memory copy has already been */
+krb5_error_code php_krb5_keytab_cache_check(const char *keytab TSRMLS_DC)
+{
+	const char *name = php_krb5_keytab_cache_name(keytab TSRMLS_CC);
+	krb5_error_code retval;
+	krb5_context ctx;
+	krb5_keytab kt;
+	krb5_kt_cursor cursor;
+
+	if(name != keytab) {
+		return 0;
+	}
+
+	if((retval = krb5_init_context(&ctx))) {
+		return retval;
+	}
+
+	if((retval = krb5_kt_resolve(ctx, keytab, &kt)) == 0) {
+		if((retval = krb5_kt_start_seq_get(ctx, kt, &cursor)) == 0) {
+			krb5_kt_end_seq_get(ctx, kt, &cursor);
+		}
+		krb5_kt_close(ctx, kt);
+	}
+
+	krb5_free_context(ctx);
+	return retval;
+}
+/* }}} */
+
+/* {{{ krb5_kt_resolve() going through the keytab cache */
+krb5_error_code php_krb5_keytab_cache_resolve(krb5_context ctx, const char *keytab, krb5_keytab *kt TSRMLS_DC)
+{
+	return krb5_kt_resolve(ctx, php_krb5_keytab_cache_name(keytab TSRMLS_CC), kt);
+}
+/* }}} */
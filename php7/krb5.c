@@ -35,8 +35,10 @@
 
 #include "ext/standard/info.h"
 #include "ext/standard/base64.h"
+#include "Zend/zend_interfaces.h"
 
 #include <sys/time.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
 
 #ifdef HAVE_KADM5
@@ -61,6 +63,10 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5CCache_initKeytab, 0, 0, 2)
 	ZEND_ARG_ARRAY_INFO(0, options, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5CCache_persistent, 0, 0, 1)
+	ZEND_ARG_INFO(0, id)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5CCache_open, 0, 0, 1)
 	ZEND_ARG_INFO(0, src)
 ZEND_END_ARG_INFO()
@@ -73,6 +79,14 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5CCache_isValid, 0, 0, 0)
 	ZEND_ARG_INFO(0, timeRemain)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5CCache_setRenewThreshold, 0, 0, 1)
+	ZEND_ARG_INFO(0, fraction)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5CCache_prefetchServiceTickets, 0, 0, 1)
+	ZEND_ARG_ARRAY_INFO(0, spns, 0)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5CCache_getTktAttrs, 0, 0, 0)
 	ZEND_ARG_INFO(0, prefix)
 ZEND_END_ARG_INFO()
@@ -89,6 +103,10 @@ PHP_METHOD(KRB5CCache, save);
 PHP_METHOD(KRB5CCache, isValid);
 PHP_METHOD(KRB5CCache, getTktAttrs);
 PHP_METHOD(KRB5CCache, renew);
+PHP_METHOD(KRB5CCache, persistent);
+PHP_METHOD(KRB5CCache, setRenewThreshold);
+PHP_METHOD(KRB5CCache, tickets);
+PHP_METHOD(KRB5CCache, prefetchServiceTickets);
 
 static zend_function_entry krb5_ccache_functions[] = {
 		PHP_ME(KRB5CCache, initPassword, arginfo_KRB5CCache_initPassword, ZEND_ACC_PUBLIC)
@@ -103,12 +121,28 @@ static zend_function_entry krb5_ccache_functions[] = {
 		PHP_ME(KRB5CCache, isValid,      arginfo_KRB5CCache_isValid,      ZEND_ACC_PUBLIC)
 		PHP_ME(KRB5CCache, getTktAttrs,  arginfo_KRB5CCache_getTktAttrs,  ZEND_ACC_PUBLIC)
 		PHP_ME(KRB5CCache, renew,        arginfo_KRB5CCache_none,         ZEND_ACC_PUBLIC)
+		PHP_ME(KRB5CCache, persistent,   arginfo_KRB5CCache_persistent,   ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+		PHP_ME(KRB5CCache, setRenewThreshold, arginfo_KRB5CCache_setRenewThreshold, ZEND_ACC_PUBLIC)
+		PHP_ME(KRB5CCache, tickets,      arginfo_KRB5CCache_getTktAttrs,  ZEND_ACC_PUBLIC)
+		PHP_ME(KRB5CCache, prefetchServiceTickets, arginfo_KRB5CCache_prefetchServiceTickets, ZEND_ACC_PUBLIC)
 		PHP_FE_END
 };
 
 
+ZEND_DECLARE_MODULE_GLOBALS(krb5)
+
+static PHP_GINIT_FUNCTION(krb5);
+static PHP_GSHUTDOWN_FUNCTION(krb5);
+
+static const zend_module_dep krb5_deps[] = {
+	ZEND_MOD_REQUIRED("hash")
+	ZEND_MOD_END
+};
+
 zend_module_entry krb5_module_entry = {
-    STANDARD_MODULE_HEADER,
+    STANDARD_MODULE_HEADER_EX,
+    NULL,
+    krb5_deps,
     PHP_KRB5_EXT_NAME,
     NULL,
     PHP_MINIT(krb5),
@@ -117,31 +151,140 @@ zend_module_entry krb5_module_entry = {
     NULL,
     PHP_MINFO(krb5),
     PHP_KRB5_VERSION,
-    STANDARD_MODULE_PROPERTIES
+    PHP_MODULE_GLOBALS(krb5),
+    PHP_GINIT(krb5),
+    PHP_GSHUTDOWN(krb5),
+    NULL,
+    STANDARD_MODULE_PROPERTIES_EX
 };
 
 #ifdef COMPILE_DL_KRB5
+#ifdef ZTS
+	ZEND_TSRMLS_CACHE_DEFINE()
+#endif
 	ZEND_GET_MODULE(krb5)
 #endif
 
+/* INI entries */
+PHP_INI_BEGIN()
+	STD_PHP_INI_ENTRY("krb5.context_pool_size", "8", PHP_INI_SYSTEM, OnUpdateLong, context_pool_size, zend_krb5_globals, krb5_globals)
+	STD_PHP_INI_ENTRY("krb5.persistent_renew_threshold", "300", PHP_INI_ALL, OnUpdateLong, persistent_renew_threshold, zend_krb5_globals, krb5_globals)
+	STD_PHP_INI_ENTRY("krb5.shm_ccache_size", "0", PHP_INI_SYSTEM, OnUpdateLong, shm_ccache_size, zend_krb5_globals, krb5_globals)
+	STD_PHP_INI_ENTRY("krb5.negotiate_name_ttl", "300", PHP_INI_ALL, OnUpdateLong, negotiate_name_ttl, zend_krb5_globals, krb5_globals)
+	STD_PHP_INI_ENTRY("krb5.negotiate_name_negative_ttl", "10", PHP_INI_ALL, OnUpdateLong, negotiate_name_negative_ttl, zend_krb5_globals, krb5_globals)
+	STD_PHP_INI_ENTRY("krb5.keytab_cache", "1", PHP_INI_SYSTEM, OnUpdateBool, keytab_cache, zend_krb5_globals, krb5_globals)
+	STD_PHP_INI_ENTRY("krb5.keytab_cache_interval", "5", PHP_INI_ALL, OnUpdateLong, keytab_cache_interval, zend_krb5_globals, krb5_globals)
+	STD_PHP_INI_ENTRY("krb5.name_cache_size", "128", PHP_INI_ALL, OnUpdateLong, name_cache_size, zend_krb5_globals, krb5_globals)
+	STD_PHP_INI_ENTRY("krb5.name_cache_ttl", "300", PHP_INI_ALL, OnUpdateLong, name_cache_ttl, zend_krb5_globals, krb5_globals)
+	STD_PHP_INI_ENTRY("krb5.initiator_pool_size", "4", PHP_INI_SYSTEM, OnUpdateLong, initiator_pool_size, zend_krb5_globals, krb5_globals)
+	STD_PHP_INI_ENTRY("krb5.initiator_pool_min_lifetime", "60", PHP_INI_ALL, OnUpdateLong, initiator_pool_min_lifetime, zend_krb5_globals, krb5_globals)
+	STD_PHP_INI_ENTRY("krb5.rcache", "default", PHP_INI_ALL, OnUpdateString, rcache, zend_krb5_globals, krb5_globals)
+	STD_PHP_INI_ENTRY("krb5.rcache_shm_size", "0", PHP_INI_SYSTEM, OnUpdateLong, rcache_shm_size, zend_krb5_globals, krb5_globals)
+PHP_INI_END()
+
 
 krb5_error_code php_krb5_display_error(krb5_context ctx, krb5_error_code code, char* str TSRMLS_DC);
 static void php_krb5_ccache_object_dtor(zend_object *obj);
+static void php_krb5_ccache_snapshot_free(php_krb5_ccache_snapshot *snap);
+static int php_krb5_ccache_iterator_register_class(TSRMLS_D);
 
 /*  Initialization functions */
 zend_object_handlers krb5_ccache_handlers;
+
+/* KRB5CCacheIterator, walks a cache with a krb5_cc_cursor */
+zend_class_entry *krb5_ce_ccache_iterator;
+zend_object_handlers krb5_ccache_iterator_handlers;
+
+typedef struct _krb5_ccache_iterator_object {
+	zval ccache;
+	zend_string *prefix;
+	krb5_cc_cursor cursor;
+	int have_cursor;
+	zend_long index;
+	zval current;
+	zend_object std;
+} krb5_ccache_iterator_object;
+
+static inline krb5_ccache_iterator_object *php_krb5_ccache_iterator_fetch_object(zend_object *obj) {
+	return (krb5_ccache_iterator_object *)((char*)(obj) - XtOffsetOf(krb5_ccache_iterator_object, std));
+}
 zend_object * php_krb5_ticket_object_new( zend_class_entry *ce);
 
+/* {{{ */
+static void php_krb5_persistent_ccache_dtor(zval *zv)
+{
+	php_krb5_persistent_ccache *entry = Z_PTR_P(zv);
+
+	krb5_cc_destroy(entry->ctx, entry->cc);
+	krb5_free_context(entry->ctx);
+
+	if(entry->keytab) {
+		pefree(entry->keytab, 1);
+	}
+
+	pefree(entry, 1);
+}
+/* }}} */
+
+/* {{{ */
+static PHP_GINIT_FUNCTION(krb5)
+{
+#if defined(COMPILE_DL_KRB5) && defined(ZTS)
+	ZEND_TSRMLS_CACHE_UPDATE();
+#endif
+	memset(krb5_globals, 0, sizeof(*krb5_globals));
+	zend_hash_init(&krb5_globals->persistent_ccaches, 8, NULL, php_krb5_persistent_ccache_dtor, 1);
+	zend_hash_init(&krb5_globals->negotiate_names, 8, NULL, php_krb5_negotiate_name_dtor, 1);
+	zend_hash_init(&krb5_globals->negotiate_creds, 8, NULL, php_krb5_negotiate_cred_dtor, 1);
+	zend_hash_init(&krb5_globals->keytab_cache_entries, 8, NULL, php_krb5_keytab_entry_dtor, 1);
+	zend_hash_init(&krb5_globals->initiator_pool, 8, NULL, php_krb5_initiator_pool_dtor, 1);
+	zend_hash_init(&krb5_globals->name_cache, 8, NULL, NULL, 1);
+}
+/* }}} */
+
+/* {{{ */
+static PHP_GSHUTDOWN_FUNCTION(krb5)
+{
+	int i;
+
+	for(i = 0; i < krb5_globals->context_pool_used; i++) {
+		krb5_free_context(krb5_globals->context_pool[i]);
+	}
+
+	if(krb5_globals->context_pool) {
+		pefree(krb5_globals->context_pool, 1);
+	}
+
+	zend_hash_destroy(&krb5_globals->persistent_ccaches);
+	zend_hash_destroy(&krb5_globals->negotiate_names);
+	zend_hash_destroy(&krb5_globals->negotiate_creds);
+	zend_hash_destroy(&krb5_globals->keytab_cache_entries);
+	zend_hash_destroy(&krb5_globals->initiator_pool);
+	php_krb5_name_cache_clear(&krb5_globals->name_cache);
+	zend_hash_destroy(&krb5_globals->name_cache);
+}
+/* }}} */
+
 PHP_MINIT_FUNCTION(krb5)
 {
 	zend_class_entry krb5_ccache;
 
+	REGISTER_INI_ENTRIES();
+
 	INIT_CLASS_ENTRY(krb5_ccache, "KRB5CCache", krb5_ccache_functions);
 	krb5_ce_ccache = zend_register_internal_class(&krb5_ccache);
 	krb5_ce_ccache->create_object = php_krb5_ticket_object_new;
 
 	memcpy(&krb5_ccache_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
 	krb5_ccache_handlers.free_obj = php_krb5_ccache_object_dtor;
+
+	if(php_krb5_exception_register_classes(TSRMLS_C) != SUCCESS) {
+		return FAILURE;
+	}
+
+	if(php_krb5_ccache_iterator_register_class(TSRMLS_C) != SUCCESS) {
+		return FAILURE;
+	}
 #ifdef HAVE_KADM5
 	if(php_krb5_kadm5_register_classes(TSRMLS_C) != SUCCESS) {
 		return FAILURE;
@@ -167,29 +310,66 @@ PHP_MINIT_FUNCTION(krb5)
 	REGISTER_LONG_CONSTANT("KRB5_TL_DB_ARGS", KRB5_TL_DB_ARGS, CONST_CS | CONST_PERSISTENT );
 #endif
 
+	/* KRB5Exception::getKrb5Code() of a replayed token */
+	REGISTER_LONG_CONSTANT("KRB5_RC_REPLAY", KRB5_RC_REPLAY, CONST_CS | CONST_PERSISTENT );
+
 	if(php_krb5_gssapi_register_classes(TSRMLS_C) != SUCCESS) {
 		return FAILURE;
 	}
 
+	if(php_krb5_name_attributes_register_classes(TSRMLS_C) != SUCCESS) {
+		return FAILURE;
+	}
+
 	if(php_krb5_negotiate_auth_register_classes(TSRMLS_C) != SUCCESS) {
 		return FAILURE;
 	}
 
+	if(php_krb5_creds_operation_register_classes(TSRMLS_C) != SUCCESS) {
+		return FAILURE;
+	}
+
+	if(php_krb5_sasl_gssapi_register_classes(TSRMLS_C) != SUCCESS) {
+		return FAILURE;
+	}
+
+	if(php_krb5_shm_ccache_init(TSRMLS_C) != SUCCESS) {
+		return FAILURE;
+	}
+
+	if(php_krb5_rcache_init(TSRMLS_C) != SUCCESS) {
+		return FAILURE;
+	}
+
+	php_krb5_base64_init();
+
 	return SUCCESS;
 }
 
 PHP_MSHUTDOWN_FUNCTION(krb5)
 {
+	UNREGISTER_INI_ENTRIES();
+
 	if(php_krb5_gssapi_shutdown(TSRMLS_C) != SUCCESS) {
 		return FAILURE;
 	}
 
+	if(php_krb5_shm_ccache_shutdown(TSRMLS_C) != SUCCESS) {
+		return FAILURE;
+	}
+
+	if(php_krb5_rcache_shutdown(TSRMLS_C) != SUCCESS) {
+		return FAILURE;
+	}
+
 	return SUCCESS;
 }
 
 
 PHP_MINFO_FUNCTION(krb5)
 {
+	char buf[32];
+
 	php_info_print_table_start();
 	php_info_print_table_row(2, "Kerberos 5 support", "enabled");
 	php_info_print_table_row(2, "Extension version", PHP_KRB5_VERSION);
@@ -212,7 +392,49 @@ PHP_MINFO_FUNCTION(krb5)
 #endif
 
 	php_info_print_table_row(2, "GSSAPI/SPNEGO auth support", "yes");
+#if defined(HAVE_GSS_ACQUIRE_CRED_FROM) && defined(HAVE_KRB5_CRED_STORE_RCACHE)
+	php_info_print_table_row(2, "GSSAPI credential stores", "yes");
+#elif defined(HAVE_GSS_ACQUIRE_CRED_FROM)
+	php_info_print_table_row(2, "GSSAPI credential stores", "yes (replay cache type from the environment, serialised)");
+#else
+	php_info_print_table_row(2, "GSSAPI credential stores", "no (environment, serialised)");
+#endif
+
+	snprintf(buf, sizeof(buf), ZEND_LONG_FMT, KRB5_G(context_pool_hits));
+	php_info_print_table_row(2, "Context pool hits", buf);
+	snprintf(buf, sizeof(buf), ZEND_LONG_FMT, KRB5_G(context_pool_misses));
+	php_info_print_table_row(2, "Context pool misses", buf);
+	snprintf(buf, sizeof(buf), ZEND_LONG_FMT, KRB5_G(name_cache_hits));
+	php_info_print_table_row(2, "Name cache hits", buf);
+	snprintf(buf, sizeof(buf), ZEND_LONG_FMT, KRB5_G(name_cache_misses));
+	php_info_print_table_row(2, "Name cache misses", buf);
+	snprintf(buf, sizeof(buf), ZEND_LONG_FMT, KRB5_G(negotiate_name_hits));
+	php_info_print_table_row(2, "Negotiate host name cache hits", buf);
+	snprintf(buf, sizeof(buf), ZEND_LONG_FMT, KRB5_G(negotiate_name_misses));
+	php_info_print_table_row(2, "Negotiate host name cache misses", buf);
+	snprintf(buf, sizeof(buf), "%u", zend_hash_num_elements(&KRB5_G(negotiate_creds)));
+	php_info_print_table_row(2, "Negotiate acceptor credentials", buf);
+	snprintf(buf, sizeof(buf), ZEND_LONG_FMT, KRB5_G(initiator_pool_hits));
+	php_info_print_table_row(2, "Initiator context pool hits", buf);
+	snprintf(buf, sizeof(buf), ZEND_LONG_FMT, KRB5_G(initiator_pool_misses));
+	php_info_print_table_row(2, "Initiator context pool misses", buf);
+
+	if(php_krb5_shm_ccache_enabled()) {
+		snprintf(buf, sizeof(buf), "%zu bytes per cache", php_krb5_shm_ccache_slot_size());
+		php_info_print_table_row(2, "Shared memory ccache", buf);
+	} else {
+		php_info_print_table_row(2, "Shared memory ccache", "disabled");
+	}
+
+	if(php_krb5_rcache_enabled()) {
+		snprintf(buf, sizeof(buf), "%zu entries", php_krb5_rcache_capacity());
+		php_info_print_table_row(2, "Shared memory replay cache", buf);
+	} else {
+		php_info_print_table_row(2, "Shared memory replay cache", "disabled");
+	}
 	php_info_print_table_end();
+
+	DISPLAY_INI_ENTRIES();
 }
 
 
@@ -224,14 +446,19 @@ static void php_krb5_ccache_object_dtor(zend_object *obj)
 
 	if(ticket) {
 		zend_object_std_dtor(&ticket->std);
-		krb5_cc_destroy(ticket->ctx, ticket->cc);
-		krb5_free_context(ticket->ctx);
+
+		/* persistent caches are owned by the worker, not by the object */
+		if(!ticket->persistent) {
+			krb5_cc_destroy(ticket->ctx, ticket->cc);
+			php_krb5_context_release(ticket->ctx, ticket->ctx_generation TSRMLS_CC);
+		}
 
 		if(ticket->keytab) {
 			efree(ticket->keytab);
 		}
 
-		efree(ticket);
+		zval_ptr_dtor(&ticket->init_opts);
+		php_krb5_ccache_snapshot_free(&ticket->snapshot);
 	}
 }
 /* }}} */
@@ -244,8 +471,8 @@ zend_object * php_krb5_ticket_object_new(zend_class_entry *ce)
 
 	object = ecalloc(1, sizeof(krb5_ccache_object) + zend_object_properties_size(ce));
 
-	/* intialize context */
-	if((ret = krb5_init_context(&object->ctx))) {
+	/* borrow context from the pool */
+	if((ret = php_krb5_context_acquire(&object->ctx, &object->ctx_generation TSRMLS_CC))) {
 		zend_throw_exception(NULL, "Cannot initialize Kerberos5 context",0 TSRMLS_CC);
 	}
 
@@ -262,9 +489,122 @@ zend_object * php_krb5_ticket_object_new(zend_class_entry *ce)
 }
 /* }}} */
 
+/* Context pool */
+#define PHP_KRB5_DEFAULT_CONFIG "/etc/krb5.conf"
+
+/* {{{ Latest modification time of the library configuration files */
+static time_t php_krb5_config_mtime()
+{
+	const char *files = getenv("KRB5_CONFIG");
+	const char *p, *end;
+	char path[MAXPATHLEN];
+	struct stat st;
+	time_t mtime = 0;
+
+	if(!files || !*files) {
+		files = PHP_KRB5_DEFAULT_CONFIG;
+	}
+
+	for(p = files; *p; p = end) {
+		size_t len;
+
+		end = strchr(p, ':');
+		if(!end) {
+			end = p + strlen(p);
+		}
+		len = end - p;
+		if(*end) end++;
+
+		if(len == 0 || len >= sizeof(path)) {
+			continue;
+		}
+		memcpy(path, p, len);
+		path[len] = '\0';
+
+		if(stat(path, &st) == 0 && st.st_mtime > mtime) {
+			mtime = st.st_mtime;
+		}
+	}
+
+	return mtime;
+}
+/* }}} */
+
+/* {{{ Drop all idle contexts, e.g. because the configuration has changed */
+static void php_krb5_context_pool_flush(TSRMLS_D)
+{
+	int i;
+
+	for(i = 0; i < KRB5_G(context_pool_used); i++) {
+		krb5_free_context(KRB5_G(context_pool)[i]);
+	}
+	KRB5_G(context_pool_used) = 0;
+	KRB5_G(context_pool_generation)++;
+}
+/* }}} */
+
+/* {{{ Borrow a krb5 context from the pool, creating a new one if none is idle */
+krb5_error_code php_krb5_context_acquire(krb5_context *ctx, unsigned long *generation TSRMLS_DC)
+{
+	krb5_error_code retval = 0;
+	time_t mtime = php_krb5_config_mtime();
+
+	if(mtime != KRB5_G(context_pool_mtime)) {
+		php_krb5_context_pool_flush(TSRMLS_C);
+		KRB5_G(context_pool_mtime) = mtime;
+	}
+
+	*generation = KRB5_G(context_pool_generation);
+
+	if(KRB5_G(context_pool_used) > 0) {
+		*ctx = KRB5_G(context_pool)[--KRB5_G(context_pool_used)];
+		KRB5_G(context_pool_hits)++;
+		return 0;
+	}
+
+	KRB5_G(context_pool_misses)++;
+	if((retval = krb5_init_context(ctx))) {
+		*ctx = NULL;
+	}
+
+	return retval;
+}
+/* }}} */
+
+/* {{{ Return a borrowed context, freeing it if it is stale, the pool is full
+       or it carries a KDC time offset (set from a ccache header or by
+       kdc_timesync) which must not leak to the next borrower */
+void php_krb5_context_release(krb5_context ctx, unsigned long generation TSRMLS_DC)
+{
+	krb5_timestamp offset = 0;
+	krb5_int32 usec_offset = 0;
+
+	if(!ctx) {
+		return;
+	}
+
+	if(krb5_get_time_offsets(ctx, &offset, &usec_offset) != 0) {
+		offset = usec_offset = 0;
+	}
+
+	if(generation != KRB5_G(context_pool_generation) || offset || usec_offset ||
+			KRB5_G(context_pool_used) >= KRB5_G(context_pool_size)) {
+		krb5_free_context(ctx);
+		return;
+	}
+
+	if(!KRB5_G(context_pool)) {
+		KRB5_G(context_pool) = pecalloc(KRB5_G(context_pool_size), sizeof(krb5_context), 1);
+	}
+
+	krb5_clear_error_message(ctx);
+	KRB5_G(context_pool)[KRB5_G(context_pool_used)++] = ctx;
+}
+/* }}} */
+
 /* Helper functions */
 /* {{{ Parse options array for initKeytab()/initPassword() */
-static int php_krb5_parse_init_creds_opts(zval *opts, krb5_get_init_creds_opt *cred_opts, char **in_tkt_svc, char **vfy_keytab TSRMLS_DC)
+int php_krb5_parse_init_creds_opts(zval *opts, krb5_get_init_creds_opt *cred_opts, char **in_tkt_svc, char **vfy_keytab TSRMLS_DC)
 {
 	int retval = 0;
 	zval *tmp = NULL;
@@ -338,9 +678,7 @@ static int php_krb5_parse_init_creds_opts(zval *opts, krb5_get_init_creds_opt *c
 
 /* {{{ */
 krb5_error_code php_krb5_display_error(krb5_context ctx, krb5_error_code code, char* str TSRMLS_DC) {
-	const char *errstr = krb5_get_error_message(ctx,code);
-
-	zend_throw_exception_ex(NULL, 0 TSRMLS_CC, str, errstr);
+	php_krb5_throw_krb5_exception(ctx, code, str TSRMLS_CC);
 
 	return code;
 }
@@ -407,30 +745,28 @@ static char *php_krb5_get_realm(krb5_context ctx, krb5_principal princ TSRMLS_DC
 }
 /* }}} */
 
-/* {{{ Get expiration times for primary TGT in cache */
-static krb5_error_code php_krb5_get_tgt_expire(krb5_ccache_object *ccache, long *endtime, long *renew_until TSRMLS_DC)
+/* {{{ Look up expiration times for primary TGT in cache without reporting errors */
+static krb5_error_code php_krb5_lookup_tgt_expire(krb5_ccache_object *ccache, krb5_ticket_times *times, char **errstr TSRMLS_DC)
 {
 	krb5_error_code retval = 0;
-	char *errstr = NULL;
 	krb5_principal princ;
 	int have_princ = 0;
 	krb5_creds in_cred;
 	int have_in_cred = 0;
 	krb5_creds *credptr = NULL;
-	int have_credptr = 0;
 	char *realm;
 
 	do {
 		memset(&princ, 0, sizeof(princ));
 		if ((retval = krb5_cc_get_principal(ccache->ctx,ccache->cc, &princ))) {
-			errstr = "Failed to retrieve principal from source ccache (%s)";
+			*errstr = "Failed to retrieve principal from source ccache (%s)";
 			break;
 		}
 		have_princ = 1;
 
 		if (!(realm = php_krb5_get_realm(ccache->ctx, princ TSRMLS_CC))) {
 			retval = KRB5KRB_ERR_GENERIC;
-			errstr = "Failed to extract realm from principal (%s)";
+			*errstr = "Failed to extract realm from principal (%s)";
 			break;
 		}
 
@@ -438,40 +774,166 @@ static krb5_error_code php_krb5_get_tgt_expire(krb5_ccache_object *ccache, long
 		in_cred.client = princ;
 
 		if ((retval = krb5_build_principal(ccache->ctx, &in_cred.server, strlen(realm), realm, "krbtgt", realm, NULL))) {
-			errstr = "Failed to build krbtgt principal (%s)";
+			*errstr = "Failed to build krbtgt principal (%s)";
 			break;
 		}
 		have_in_cred = 1;
 
 		if ((retval = krb5_get_credentials(ccache->ctx, KRB5_GC_CACHED, ccache->cc, &in_cred, &credptr))) {
-			errstr = "Failed to retrieve krbtgt ticket from cache (%s)";
+			*errstr = "Failed to retrieve krbtgt ticket from cache (%s)";
 			break;
 		}
-		have_credptr = 1;
 
 	} while (0);
 
 	if (have_princ) krb5_free_principal(ccache->ctx, princ);
 	if (have_in_cred) krb5_free_principal(ccache->ctx, in_cred.server);
 
+	if (credptr) {
+		*times = credptr->times;
+		krb5_free_creds(ccache->ctx, credptr);
+	}
+
+	return retval;
+}
+/* }}} */
+
+/* Snapshot of parsed cache contents, valid until the cache generation changes */
+
+/* {{{ */
+static void php_krb5_ccache_snapshot_free(php_krb5_ccache_snapshot *snap)
+{
+	zval_ptr_dtor(&snap->entries);
+	zval_ptr_dtor(&snap->tktattrs);
+	ZVAL_UNDEF(&snap->entries);
+	ZVAL_UNDEF(&snap->tktattrs);
+	snap->have_tgt = 0;
+}
+/* }}} */
+
+/* {{{ Marks the cache contents as changed, dropping parsed data */
+void php_krb5_ccache_invalidate(krb5_ccache_object *ccache)
+{
+	ccache->generation++;
+	if (ccache->persistent) {
+		ccache->persistent->generation++;
+	}
+}
+/* }}} */
 
+/* {{{ Returns the snapshot, discarding it if the cache has changed since it was taken */
+static php_krb5_ccache_snapshot *php_krb5_ccache_snapshot_get(krb5_ccache_object *ccache)
+{
+	php_krb5_ccache_snapshot *snap = &ccache->snapshot;
+	/* both counters only grow, so their sum changes whenever either does */
+	unsigned long generation = ccache->generation + (ccache->persistent ? ccache->persistent->generation : 0);
 
-	if (have_credptr) {
-		krb5_free_cred_contents(ccache->ctx, credptr);
-		*endtime = credptr->times.endtime;
-		*renew_until = credptr->times.renew_till;
+	if (snap->generation != generation) {
+		php_krb5_ccache_snapshot_free(snap);
+		snap->generation = generation;
 	}
 
-	if (errstr != NULL) {
-		php_krb5_display_error(ccache->ctx, retval, errstr TSRMLS_CC);
+	return snap;
+}
+/* }}} */
+
+/* {{{ Primary TGT times, served from the snapshot when possible */
+static krb5_error_code php_krb5_ccache_tgt_times(krb5_ccache_object *ccache, krb5_ticket_times *times, char **errstr TSRMLS_DC)
+{
+	php_krb5_ccache_snapshot *snap = php_krb5_ccache_snapshot_get(ccache);
+	krb5_error_code retval = 0;
+
+	if (!snap->have_tgt) {
+		if ((retval = php_krb5_lookup_tgt_expire(ccache, &snap->tgt_times, errstr TSRMLS_CC))) {
+			return retval;
+		}
+		snap->have_tgt = 1;
+	}
+
+	*times = snap->tgt_times;
+	return 0;
+}
+/* }}} */
+
+/* {{{ Get expiration times for primary TGT in cache */
+static krb5_error_code php_krb5_get_tgt_expire(krb5_ccache_object *ccache, long *endtime, long *renew_until TSRMLS_DC)
+{
+	krb5_error_code retval = 0;
+	krb5_ticket_times times;
+	char *errstr = NULL;
+
+	if ((retval = php_krb5_ccache_tgt_times(ccache, &times, &errstr TSRMLS_CC))) {
+		if (errstr != NULL) {
+			php_krb5_display_error(ccache->ctx, retval, errstr TSRMLS_CC);
+		}
+		return retval;
 	}
 
+	*endtime = times.endtime;
+	*renew_until = times.renew_till;
 	return retval;
 }
 /* }}} */
 
+/* {{{ Check whether a persistent cache already holds a TGT for princ that outlives the renewal threshold */
+static int php_krb5_persistent_ccache_is_fresh(krb5_ccache_object *ccache, krb5_principal princ TSRMLS_DC)
+{
+	krb5_principal ccprinc;
+	krb5_timestamp now;
+	krb5_ticket_times times;
+	char *errstr = NULL;
+	int same;
+
+	if (krb5_cc_get_principal(ccache->ctx, ccache->cc, &ccprinc)) {
+		return 0;
+	}
+	same = krb5_principal_compare(ccache->ctx, ccprinc, princ);
+	krb5_free_principal(ccache->ctx, ccprinc);
+
+	if (!same || php_krb5_ccache_tgt_times(ccache, &times, &errstr TSRMLS_CC)) {
+		return 0;
+	}
+
+	if (krb5_timeofday(ccache->ctx, &now)) {
+		return 0;
+	}
+
+	return (times.endtime - now) > KRB5_G(persistent_renew_threshold);
+}
+/* }}} */
+
+/* {{{ Find or create the persistent cache registered under id */
+static krb5_error_code php_krb5_persistent_ccache_get(const char *id, size_t id_len, php_krb5_persistent_ccache **entry TSRMLS_DC)
+{
+	php_krb5_persistent_ccache *tmp;
+	krb5_error_code retval = 0;
+
+	if ((*entry = zend_hash_str_find_ptr(&KRB5_G(persistent_ccaches), id, id_len)) != NULL) {
+		return 0;
+	}
+
+	tmp = pecalloc(1, sizeof(php_krb5_persistent_ccache), 1);
+
+	if ((retval = krb5_init_context(&tmp->ctx))) {
+		pefree(tmp, 1);
+		zend_throw_exception(NULL, "Cannot initialize Kerberos5 context", 0 TSRMLS_CC);
+		return retval;
+	}
+
+	if ((retval = krb5_cc_new_unique(tmp->ctx, "MEMORY", "", &tmp->cc))) {
+		php_krb5_display_error(tmp->ctx, retval, "Cannot open credential cache (%s)" TSRMLS_CC);
+		krb5_free_context(tmp->ctx);
+		pefree(tmp, 1);
+		return retval;
+	}
+
+	*entry = zend_hash_str_add_ptr(&KRB5_G(persistent_ccaches), id, id_len, tmp);
+	return 0;
+}
+/* }}} */
+
 /* {{{ verify a (client's) new TGT using keytab */
-static krb5_error_code php_krb5_verify_tgt(krb5_ccache_object *ccache, krb5_creds *creds, char *vfy_keytab TSRMLS_DC)
+krb5_error_code php_krb5_verify_tgt(krb5_ccache_object *ccache, krb5_creds *creds, char *vfy_keytab TSRMLS_DC)
 {
 	krb5_error_code retval = 0;
 	krb5_error_code r2val;
@@ -492,7 +954,7 @@ static krb5_error_code php_krb5_verify_tgt(krb5_ccache_object *ccache, krb5_cred
 
     do {
 	memset(&ktab, 0, sizeof(ktab));
-	if ((retval = krb5_kt_resolve(ccache->ctx, vfy_keytab, &ktab))) {
+	if ((retval = php_krb5_keytab_cache_resolve(ccache->ctx, vfy_keytab, &ktab TSRMLS_CC))) {
 		break;
 	}
 	have_ktab = 1;
@@ -548,35 +1010,436 @@ static krb5_error_code php_krb5_verify_tgt(krb5_ccache_object *ccache, krb5_cred
 /* }}} */
 
 
-/* KRB5CCache Methods */
-
-/* {{{ proto string KRB5CCache::getName(  )
-   Gets the name/identifier of this credential cache */
-PHP_METHOD(KRB5CCache, getName)
+/* {{{ Get a TGT for princ from keytab and store it in the cache */
+static krb5_error_code php_krb5_init_keytab(krb5_ccache_object *ccache, krb5_principal princ, const char *skeytab, zval *opts, char **errstr TSRMLS_DC)
 {
-	krb5_ccache_object* ccache = Z_KRB5_CCACHE_OBJ_P(getThis());
+	krb5_error_code retval = 0;
+	krb5_keytab keytab;
+	int have_keytab = 0;
+	krb5_get_init_creds_opt *cred_opts;
+	int have_cred_opts = 0;
+	char *in_tkt_svc = NULL;
+	char *vfy_keytab = NULL;
+	krb5_creds creds;
+	int have_creds = 0;
 
-	const char *tmpname = krb5_cc_get_name(ccache->ctx, ccache->cc);
-	const char *tmptype = krb5_cc_get_type(ccache->ctx, ccache->cc);
-	char *name = NULL;
+#ifndef KRB5_GET_INIT_CREDS_OPT_CANONICALIZE
+	krb5_get_init_creds_opt cred_opts_struct;
+	cred_opts = &cred_opts_struct;
+#endif
 
-	if (zend_parse_parameters_none() == FAILURE) {
-		zend_throw_exception(NULL, "Failed to parse arglist", 0 TSRMLS_CC);
-		RETURN_FALSE;
+    do {
+	memset(&keytab, 0, sizeof(keytab));
+	if ((retval = php_krb5_keytab_cache_resolve(ccache->ctx, skeytab, &keytab TSRMLS_CC))) {
+		*errstr = "Cannot load keytab (%s)";
+		break;
 	}
+	have_keytab = 1;
 
-	name = emalloc(strlen(tmpname) + strlen(tmptype) + 2);
-	*name = 0;
-	strcat(name, tmptype);
-	strcat(name, ":");
-	strcat(name, tmpname);
+#ifdef KRB5_GET_INIT_CREDS_OPT_CANONICALIZE
+	if ((retval = krb5_get_init_creds_opt_alloc(ccache->ctx, &cred_opts))) {
+		*errstr = "Cannot allocate cred_opts (%s)";
+		break;
+	}
+#else
+	krb5_get_init_creds_opt_init(cred_opts);
+#endif
+	have_cred_opts = 1;
 
-	RETVAL_STRING(name);
-	efree(name);
-}
-/* }}} */
+	if(opts && Z_TYPE_P(opts) == IS_ARRAY) {
+		if ((retval = php_krb5_parse_init_creds_opts(opts, cred_opts, &in_tkt_svc, &vfy_keytab TSRMLS_CC))) {
+			*errstr = "Cannot parse credential options";
+			break;
+		}
+	}
 
-/* {{{ proto bool KRB5CCache::open( string $src )
+	memset(&creds, 0, sizeof(creds));
+	if ((retval = krb5_get_init_creds_keytab(ccache->ctx, &creds, princ, keytab, 0, in_tkt_svc, cred_opts))) {
+		*errstr = "Cannot get ticket (%s)";
+		break;
+	}
+	have_creds = 1;
+
+	if ((retval = krb5_cc_initialize(ccache->ctx, ccache->cc, princ))) {
+		*errstr = "Failed to initialize credential cache (%s)";
+		break;
+	}
+
+	if((retval = krb5_cc_store_cred(ccache->ctx, ccache->cc, &creds))) {
+		*errstr = "Failed to store ticket in credential cache (%s)";
+		break;
+	}
+
+	if (vfy_keytab && *vfy_keytab && (retval = php_krb5_verify_tgt(ccache, &creds, vfy_keytab TSRMLS_CC))) {
+		*errstr = "Failed to verify ticket (%s)";
+		break;
+	}
+
+    } while (0);
+
+	if (have_keytab) krb5_kt_close(ccache->ctx, keytab);
+
+#ifdef KRB5_GET_INIT_CREDS_OPT_CANONICALIZE
+	if (have_cred_opts) krb5_get_init_creds_opt_free(ccache->ctx, cred_opts);
+#endif
+
+	if (in_tkt_svc) efree(in_tkt_svc);
+	if (vfy_keytab) efree(vfy_keytab);
+	if (have_creds) krb5_free_cred_contents(ccache->ctx, &creds);
+
+	php_krb5_ccache_invalidate(ccache);
+	return retval;
+}
+/* }}} */
+
+/* {{{ Renew the primary TGT and purge other tickets from cache */
+static krb5_error_code php_krb5_renew_tgt(krb5_ccache_object *ccache, char **errstr TSRMLS_DC)
+{
+	krb5_error_code retval = 0;
+	krb5_ticket_times times;
+	krb5_timestamp now;
+	krb5_principal princ;
+	int have_princ = 0;
+	krb5_creds creds;
+	int have_creds = 0;
+
+    do {
+	if ((retval = php_krb5_ccache_tgt_times(ccache, &times, errstr TSRMLS_CC))) {
+		break;
+	}
+
+	if ((retval = krb5_timeofday(ccache->ctx, &now))) {
+		*errstr = "Failed to read clock in renew() (%s)";
+		break;
+	}
+
+	if (now > times.renew_till) {
+		/* ticket is not renewable, but... */
+		if (now >= times.endtime) retval = -1; /* ...is it still useful? */
+		break;
+	}
+
+	memset(&princ, 0, sizeof(princ));
+	if ((retval = krb5_cc_get_principal(ccache->ctx, ccache->cc, &princ))) {
+		*errstr = "Failed to get principal from cache (%s)";
+		break;
+	}
+	have_princ = 1;
+
+	memset(&creds, 0, sizeof(creds));
+	if ((retval = krb5_get_renewed_creds(ccache->ctx, &creds, princ, ccache->cc, NULL))) {
+		*errstr = "Failed to renew TGT in cache (%s)";
+		break;
+	}
+	have_creds = 1;
+
+	if ((retval = krb5_cc_initialize(ccache->ctx, ccache->cc, princ))) {
+		*errstr = "Failed to reinitialize ccache after TGT renewal (%s)";
+		break;
+	}
+
+	if((retval = krb5_cc_store_cred(ccache->ctx, ccache->cc, &creds))) {
+		*errstr = "Failed to store renewed TGT in ccache (%s)";
+		break;
+	}
+    } while (0);
+
+	if (have_princ) krb5_free_principal(ccache->ctx, princ);
+	if (have_creds) krb5_free_cred_contents(ccache->ctx, &creds);
+
+	if (have_creds) php_krb5_ccache_invalidate(ccache);
+	return retval;
+}
+/* }}} */
+
+/* seconds before a failed automatic renewal is attempted again */
+#define PHP_KRB5_RENEW_RETRY 30
+
+/* {{{ Renew or re-acquire the primary TGT once less than renew_threshold of its lifetime remains */
+void php_krb5_ccache_auto_renew(krb5_ccache_object *ccache TSRMLS_DC)
+{
+	krb5_ticket_times times;
+	krb5_timestamp now, start;
+	krb5_principal princ;
+	char *errstr = "";
+
+	if (ccache->renew_threshold <= 0) {
+		return;
+	}
+
+	if (php_krb5_ccache_tgt_times(ccache, &times, &errstr TSRMLS_CC) || krb5_timeofday(ccache->ctx, &now)) {
+		return;
+	}
+
+	/* starttime is left at 0 when the ticket carries no separate start time */
+	start = times.starttime ? times.starttime : times.authtime;
+	if ((times.endtime - now) > ccache->renew_threshold * (times.endtime - start)) {
+		return;
+	}
+
+	/* a failed attempt is not retried on every access */
+	if (now - ccache->renew_attempt < PHP_KRB5_RENEW_RETRY) {
+		return;
+	}
+	ccache->renew_attempt = now;
+
+	if (now < times.endtime && now < times.renew_till) {
+		errstr = "";
+		if (php_krb5_renew_tgt(ccache, &errstr TSRMLS_CC) == 0) {
+			return;
+		}
+	}
+
+	/* past renew_until (or renewal failed), start over from the keytab */
+	if (!ccache->keytab || krb5_cc_get_principal(ccache->ctx, ccache->cc, &princ)) {
+		return;
+	}
+
+	php_krb5_init_keytab(ccache, princ, ccache->keytab,
+			Z_TYPE(ccache->init_opts) == IS_ARRAY ? &ccache->init_opts : NULL, &errstr TSRMLS_CC);
+	krb5_free_principal(ccache->ctx, princ);
+}
+/* }}} */
+
+
+/* {{{ Fills tktinfo with the (readable) attributes of a single credential */
+static krb5_error_code php_krb5_ccache_tkt_attrs(krb5_ccache_object *ccache, krb5_creds *creds, const char *server, zval *tktinfo, char **errstr TSRMLS_DC)
+{
+	krb5_error_code retval = 0;
+	char *princname;
+	long tktflags;
+	char strflags[65];
+	char *q = strflags + sizeof(strflags) - 1;
+	char *p;
+	krb5_ticket *tkt;
+	char *encstr;
+#define ENCSTRMAX 256
+	krb5_address *tktaddr, **tkt_addrs;
+	zval addrlist;
+	struct in_addr ipaddr;
+#ifdef INET6_ADDRSTRLEN
+	struct in6_addr ip6addr;
+	char straddr[INET6_ADDRSTRLEN];
+#endif
+
+	array_init(tktinfo);
+
+	add_assoc_string(tktinfo, "server", (char*) server);
+
+	princname = NULL;
+	if((retval = krb5_unparse_name(ccache->ctx, creds->client, &princname))) {
+		*errstr = "Failed to unparse client principal name (%s)";
+		return retval;
+	}
+	add_assoc_string(tktinfo, "client", (princname?princname:""));
+	free(princname);
+
+	add_assoc_long(tktinfo, "authtime", creds->times.authtime);
+	add_assoc_long(tktinfo, "starttime", creds->times.starttime);
+	add_assoc_long(tktinfo, "endtime", creds->times.endtime);
+
+	/* Darn it, "till" is NOT an abbreviation of "until" */
+	add_assoc_long(tktinfo, "renew_until", creds->times.renew_till);
+
+	tktflags = creds->ticket_flags;
+	p = strflags;
+	*p = '\0';
+	if ((tktflags & TKT_FLG_FORWARDABLE) && (p < q)) *(p++) = 'F';
+	if ((tktflags & TKT_FLG_FORWARDED) && (p < q)) *(p++) = 'f';
+	if ((tktflags & TKT_FLG_PROXIABLE) && (p < q)) *(p++) = 'P';
+	if ((tktflags & TKT_FLG_PROXY) && (p < q)) *(p++) = 'p';
+	if ((tktflags & TKT_FLG_MAY_POSTDATE) && (p < q)) *(p++) = 'D';
+	if ((tktflags & TKT_FLG_POSTDATED) && (p < q)) *(p++) = 'd';
+	if ((tktflags & TKT_FLG_INVALID) && (p < q)) *(p++) = 'i';
+	if ((tktflags & TKT_FLG_RENEWABLE) && (p < q)) *(p++) = 'R';
+	if ((tktflags & TKT_FLG_INITIAL) && (p < q)) *(p++) = 'I';
+	if ((tktflags & TKT_FLG_PRE_AUTH) && (p < q)) *(p++) = 'A';
+	if ((tktflags & TKT_FLG_HW_AUTH) && (p < q)) *(p++) = 'H';
+	if ((tktflags & TKT_FLG_TRANSIT_POLICY_CHECKED) && (p < q)) *(p++) = 'T';
+	if ((tktflags & TKT_FLG_OK_AS_DELEGATE) && (p < q)) *(p++) = 'O';
+#ifdef TKT_FLG_ENC_PA_REP
+	if ((tktflags & TKT_FLG_ENC_PA_REP) && (p < q)) *(p++) = 'e';
+#endif
+	if ((tktflags & TKT_FLG_ANONYMOUS) && (p < q)) *(p++) = 'a';
+	*p = '\0';
+
+	add_assoc_string(tktinfo, "flags", strflags);
+
+#ifdef HAVE_KRB5_HEIMDAL
+	encstr = NULL;
+	if ((retval = krb5_enctype_to_string(ccache->ctx,creds->keyblock.enctype, &encstr)))
+#else
+	encstr = malloc(ENCSTRMAX);
+	if ((retval = krb5_enctype_to_string(creds->keyblock.enctype, encstr, ENCSTRMAX)))
+#endif
+	{
+		if (!encstr) encstr = malloc(ENCSTRMAX);
+		snprintf(encstr, ENCSTRMAX, "enctype %d", creds->keyblock.enctype);
+	}
+	add_assoc_string(tktinfo, "skey_enc", encstr);
+	free(encstr);
+
+	if ((retval = krb5_decode_ticket(&creds->ticket,&tkt))) {
+		*errstr = "Failed to decode ticket data (%s)";
+		return retval;
+	} else {
+#ifdef HAVE_KRB5_HEIMDAL
+		encstr = NULL;
+		if((retval = krb5_enctype_to_string(ccache->ctx,creds->keyblock.enctype, &encstr)))
+#else
+		encstr = malloc(ENCSTRMAX);
+		if((retval = krb5_enctype_to_string(tkt->enc_part.enctype, encstr, ENCSTRMAX)))
+#endif
+		{
+			if (!encstr) encstr = malloc(ENCSTRMAX);
+			snprintf(encstr, ENCSTRMAX, "enctype %d", tkt->enc_part.enctype);
+		}
+		add_assoc_string(tktinfo, "tkt_enc", encstr);
+		free(encstr);
+		krb5_free_ticket(ccache->ctx, tkt);
+	}
+
+	array_init(&addrlist);
+	tkt_addrs = creds->addresses;
+	if (tkt_addrs) while((tktaddr = *(tkt_addrs++))) {
+		if ((tktaddr->addrtype == ADDRTYPE_INET) && (tktaddr->length == 4)) {
+			memcpy(&(ipaddr.s_addr), tktaddr->contents, tktaddr->length);
+
+#ifndef INET6_ADDRSTRLEN
+			add_next_index_string(&addrlist, inet_ntoa(ipaddr));
+		}
+#if 0
+ { match curlies
+#endif
+#else /* ! INET6_ADDRSTRLEN */
+			if (inet_ntop(AF_INET, &ipaddr, straddr, sizeof(straddr))) {
+				add_next_index_string(&addrlist, straddr);
+			}
+		}
+		if ((tktaddr->addrtype == ADDRTYPE_INET6) && (tktaddr->length >= 4)) {
+			memcpy(ip6addr.s6_addr, tktaddr->contents, tktaddr->length);
+			if (inet_ntop(AF_INET6, &ipaddr, straddr, sizeof(straddr))) {
+				add_next_index_string(&addrlist, straddr);
+			}
+		}
+#endif /* INET6_ADDRSTRLEN */
+	}
+	add_assoc_zval(tktinfo, "addresses", &addrlist);
+
+	return 0;
+}
+#undef ENCSTRMAX
+/* }}} */
+
+/* {{{ Builds entry and attribute lists with a single cursor walk, unless already done */
+static php_krb5_ccache_snapshot *php_krb5_ccache_snapshot_walk(krb5_ccache_object *ccache TSRMLS_DC)
+{
+	php_krb5_ccache_snapshot *snap = php_krb5_ccache_snapshot_get(ccache);
+	krb5_error_code retval = 0;
+	char *errstr = "";
+	krb5_cc_cursor cursor;
+	int have_cursor = 0;
+	krb5_creds creds;
+	zval entries, tktattrs, tktinfo;
+	int entries_ok = 1, tktattrs_ok = 1;
+	char *princname;
+
+	if (Z_TYPE(snap->entries) != IS_UNDEF && Z_TYPE(snap->tktattrs) != IS_UNDEF) {
+		return snap;
+	}
+
+	array_init(&entries);
+	array_init(&tktattrs);
+
+	memset(&cursor, 0, sizeof(cursor));
+	if ((retval = krb5_cc_start_seq_get(ccache->ctx,ccache->cc,&cursor))) {
+		snap->entries_retval = snap->tktattrs_retval = retval;
+		snap->entries_errstr = snap->tktattrs_errstr = "Failed to initialize ccache iterator (%s)";
+		entries_ok = tktattrs_ok = 0;
+	} else {
+		have_cursor = 1;
+	}
+
+	memset(&creds, 0, sizeof(creds));
+	while (entries_ok && krb5_cc_next_cred(ccache->ctx,ccache->cc,&cursor,&creds) == 0) {
+		if (creds.server) {
+			princname = NULL;
+			if ((retval = krb5_unparse_name(ccache->ctx, creds.server, &princname))) {
+				snap->entries_retval = snap->tktattrs_retval = retval;
+				snap->entries_errstr = "Failed to unparse principal name (%s)";
+				snap->tktattrs_errstr = "Failed to unparse server principal name (%s)";
+				entries_ok = tktattrs_ok = 0;
+				krb5_free_cred_contents(ccache->ctx, &creds);
+				break;
+			}
+
+			add_next_index_string(&entries, princname);
+
+			if (tktattrs_ok) {
+				errstr = "";
+				if ((retval = php_krb5_ccache_tkt_attrs(ccache, &creds, princname, &tktinfo, &errstr TSRMLS_CC))) {
+					zval_ptr_dtor(&tktinfo);
+					snap->tktattrs_retval = retval;
+					snap->tktattrs_errstr = errstr;
+					tktattrs_ok = 0;
+				} else {
+					add_next_index_zval(&tktattrs, &tktinfo);
+				}
+			}
+			free(princname);
+		}
+		krb5_free_cred_contents(ccache->ctx, &creds);
+	}
+
+	if (have_cursor) krb5_cc_end_seq_get(ccache->ctx, ccache->cc, &cursor);
+
+	if (entries_ok) {
+		zval_ptr_dtor(&snap->entries);
+		ZVAL_COPY_VALUE(&snap->entries, &entries);
+	} else {
+		zval_ptr_dtor(&entries);
+	}
+
+	if (tktattrs_ok) {
+		zval_ptr_dtor(&snap->tktattrs);
+		ZVAL_COPY_VALUE(&snap->tktattrs, &tktattrs);
+	} else {
+		zval_ptr_dtor(&tktattrs);
+	}
+
+	return snap;
+}
+/* }}} */
+
+/* KRB5CCache Methods */
+
+/* {{{ proto string KRB5CCache::getName(  )
+   Gets the name/identifier of this credential cache */
+PHP_METHOD(KRB5CCache, getName)
+{
+	krb5_ccache_object* ccache = Z_KRB5_CCACHE_OBJ_P(getThis());
+
+	const char *tmpname = krb5_cc_get_name(ccache->ctx, ccache->cc);
+	const char *tmptype = krb5_cc_get_type(ccache->ctx, ccache->cc);
+	char *name = NULL;
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		zend_throw_exception(NULL, "Failed to parse arglist", 0 TSRMLS_CC);
+		RETURN_FALSE;
+	}
+
+	name = emalloc(strlen(tmpname) + strlen(tmptype) + 2);
+	*name = 0;
+	strcat(name, tmptype);
+	strcat(name, ":");
+	strcat(name, tmpname);
+
+	RETVAL_STRING(name);
+	efree(name);
+}
+/* }}} */
+
+/* {{{ proto bool KRB5CCache::open( string $src )
    Copies the contents of the credential cache given by $dest to this credential cache */
 PHP_METHOD(KRB5CCache, open)
 {
@@ -591,12 +1454,32 @@ PHP_METHOD(KRB5CCache, open)
 		RETURN_FALSE;
 	}
 
+	php_krb5_ccache_invalidate(ccache);
+
+	if(strncmp(sccname, PHP_KRB5_SHM_CCACHE_PREFIX, sizeof(PHP_KRB5_SHM_CCACHE_PREFIX) - 1) == 0) {
+		if((retval = php_krb5_shm_ccache_load(ccache->ctx, sccname + sizeof(PHP_KRB5_SHM_CCACHE_PREFIX) - 1, ccache->cc TSRMLS_CC))) {
+			php_krb5_display_error(ccache->ctx, retval,  "Failed to copy credential cache (%s)" TSRMLS_CC);
+			RETURN_FALSE;
+		}
+		RETURN_TRUE;
+	}
+
 	if((retval = krb5_cc_resolve(ccache->ctx, sccname, &src))) {
 		php_krb5_display_error(ccache->ctx, retval,  "Cannot open given credential cache (%s)" TSRMLS_CC);
 		RETURN_FALSE;
 	}
 
-	if((retval = php_krb5_copy_ccache(ccache->ctx, src, ccache->cc TSRMLS_CC))) {
+	/* FILE caches are parsed from a single mapping instead of one read per credential */
+	retval = KRB5_CC_NOSUPP;
+	if(strcmp(krb5_cc_get_type(ccache->ctx, src), "FILE") == 0) {
+		retval = php_krb5_ccache_file_load(ccache->ctx, krb5_cc_get_name(ccache->ctx, src), ccache->cc TSRMLS_CC);
+	}
+
+	if(retval == KRB5_CC_NOSUPP || retval == KRB5_CCACHE_BADVNO) {
+		retval = php_krb5_copy_ccache(ccache->ctx, src, ccache->cc TSRMLS_CC);
+	}
+
+	if(retval) {
 		krb5_cc_close(ccache->ctx, src);
 		php_krb5_display_error(ccache->ctx, retval,  "Failed to copy credential cache (%s)" TSRMLS_CC);
 		RETURN_FALSE;
@@ -621,13 +1504,34 @@ PHP_METHOD(KRB5CCache, save)
 		RETURN_FALSE;
 	}
 
+	php_krb5_ccache_auto_renew(ccache TSRMLS_CC);
+
+	if(strncmp(sccname, PHP_KRB5_SHM_CCACHE_PREFIX, sizeof(PHP_KRB5_SHM_CCACHE_PREFIX) - 1) == 0) {
+		if((retval = php_krb5_shm_ccache_store(ccache->ctx, ccache->cc, sccname + sizeof(PHP_KRB5_SHM_CCACHE_PREFIX) - 1 TSRMLS_CC))) {
+			php_krb5_display_error(ccache->ctx, retval,  "Failed to copy credential cache (%s)" TSRMLS_CC);
+			RETURN_FALSE;
+		}
+		RETURN_TRUE;
+	}
+
 	krb5_ccache dest = NULL;
 	if((retval = krb5_cc_resolve(ccache->ctx, sccname, &dest))) {
 		php_krb5_display_error(ccache->ctx, retval,  "Cannot open given credential cache (%s)" TSRMLS_CC);
 		RETURN_FALSE;
 	}
 
-	if((retval = php_krb5_copy_ccache(ccache->ctx, ccache->cc, dest TSRMLS_CC))) {
+	/* FILE caches are written in one go and renamed into place */
+	retval = KRB5_CC_NOSUPP;
+	if(strcmp(krb5_cc_get_type(ccache->ctx, dest), "FILE") == 0) {
+		retval = php_krb5_ccache_file_store(ccache->ctx, ccache->cc, krb5_cc_get_name(ccache->ctx, dest) TSRMLS_CC);
+	}
+
+	/* an I/O error must not turn into a non-atomic rewrite of the FILE cache */
+	if(retval == KRB5_CC_NOSUPP) {
+		retval = php_krb5_copy_ccache(ccache->ctx, ccache->cc, dest TSRMLS_CC);
+	}
+
+	if(retval) {
 		krb5_cc_close(ccache->ctx, dest);
 		php_krb5_display_error(ccache->ctx, retval,  "Failed to copy credential cache (%s)" TSRMLS_CC);
 		RETURN_FALSE;
@@ -730,6 +1634,8 @@ PHP_METHOD(KRB5CCache, initPassword)
 	if (vfy_keytab) efree(vfy_keytab);
 	if (have_creds) krb5_free_cred_contents(ccache->ctx, &creds);
 
+	php_krb5_ccache_invalidate(ccache);
+
 	if (retval) {
 		php_krb5_display_error(ccache->ctx, retval, errstr TSRMLS_CC);
 		RETURN_FALSE;
@@ -755,19 +1661,6 @@ PHP_METHOD(KRB5CCache, initKeytab)
 
 	krb5_principal princ;
 	int have_princ = 0;
-	krb5_keytab keytab;
-	int have_keytab = 0;
-	krb5_get_init_creds_opt *cred_opts;
-	int have_cred_opts = 0;
-	char *in_tkt_svc = NULL;
-	char *vfy_keytab = NULL;
-	krb5_creds creds;
-	int have_creds = 0;
-
-#ifndef KRB5_GET_INIT_CREDS_OPT_CANONICALIZE
-	krb5_get_init_creds_opt cred_opts_struct;
-	cred_opts = &cred_opts_struct;
-#endif
 
 	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s" ARG_PATH "|a", &sprinc, &sprinc_len, &skeytab, &skeytab_len, &opts) == FAILURE) {
 		zend_throw_exception(NULL, "Failed to parse arglist", 0 TSRMLS_CC);
@@ -786,71 +1679,36 @@ PHP_METHOD(KRB5CCache, initKeytab)
 	}
 	have_princ = 1;
 
-	memset(&keytab, 0, sizeof(keytab));
-	if ((retval = krb5_kt_resolve(ccache->ctx, skeytab, &keytab))) {
-		errstr = "Cannot load keytab (%s)";
-		break;
-	}
-	have_keytab = 1;
-
-#ifdef KRB5_GET_INIT_CREDS_OPT_CANONICALIZE
-	if ((retval = krb5_get_init_creds_opt_alloc(ccache->ctx, &cred_opts))) {
-		errstr = "Cannot allocate cred_opts (%s)";
-		break;
-	}
-#else
-	krb5_get_init_creds_opt_init(cred_opts);
-#endif
-	have_cred_opts = 1;
-
-	if(opts) {
-		if ((retval = php_krb5_parse_init_creds_opts(opts, cred_opts, &in_tkt_svc, &vfy_keytab TSRMLS_CC))) {
-			errstr = "Cannot parse credential options";
-			break;
-		}
-	}
-
-	memset(&creds, 0, sizeof(creds));
-	if ((retval = krb5_get_init_creds_keytab(ccache->ctx, &creds, princ, keytab, 0, in_tkt_svc, cred_opts))) {
-		errstr = "Cannot get ticket (%s)";
-		break;
-	}
-	have_creds = 1;
-
-	if ((retval = krb5_cc_initialize(ccache->ctx, ccache->cc, princ))) {
-		errstr = "Failed to initialize credential cache (%s)";
-		break;
-	}
-
-	if((retval = krb5_cc_store_cred(ccache->ctx, ccache->cc, &creds))) {
-		errstr = "Failed to store ticket in credential cache (%s)";
-		break;
-	}
-
-	if (vfy_keytab && *vfy_keytab && (retval = php_krb5_verify_tgt(ccache, &creds, vfy_keytab TSRMLS_CC))) {
-		errstr = "Failed to verify ticket (%s)";
+	/* a worker-persistent cache only needs a new TGT when the old one runs out */
+	if (ccache->persistent && php_krb5_persistent_ccache_is_fresh(ccache, princ TSRMLS_CC)) {
 		break;
 	}
 
+	retval = php_krb5_init_keytab(ccache, princ, skeytab, opts, &errstr TSRMLS_CC);
     } while (0);
 
 	if (have_princ) krb5_free_principal(ccache->ctx, princ);
-	if (have_keytab) krb5_kt_close(ccache->ctx, keytab);
-
-#ifdef KRB5_GET_INIT_CREDS_OPT_CANONICALIZE
-	if (have_cred_opts) krb5_get_init_creds_opt_free(ccache->ctx, cred_opts);
-#endif
-
-	if (in_tkt_svc) efree(in_tkt_svc);
-	if (vfy_keytab) efree(vfy_keytab);
-	if (have_creds) krb5_free_cred_contents(ccache->ctx, &creds);
 
 	if (retval) {
 		php_krb5_display_error(ccache->ctx, retval, errstr TSRMLS_CC);
 		RETURN_FALSE;
 	}
 
+	if (ccache->keytab) efree(ccache->keytab);
 	ccache->keytab = estrdup(skeytab);
+
+	/* remembered for transparent re-initialization */
+	zval_ptr_dtor(&ccache->init_opts);
+	if (opts) {
+		ZVAL_COPY(&ccache->init_opts, opts);
+	} else {
+		ZVAL_UNDEF(&ccache->init_opts);
+	}
+
+	if (ccache->persistent) {
+		if (ccache->persistent->keytab) pefree(ccache->persistent->keytab, 1);
+		ccache->persistent->keytab = pestrdup(skeytab, 1);
+	}
 	RETURN_TRUE;
 }
 /* }}} */
@@ -935,6 +1793,8 @@ PHP_METHOD(KRB5CCache, getLifetime)
 
 	array_init(return_value);
 
+	php_krb5_ccache_auto_renew(ccache TSRMLS_CC);
+
 	if ((retval = php_krb5_get_tgt_expire(ccache,&endtime,&renew_until TSRMLS_CC))) {
 		php_krb5_display_error(ccache->ctx, retval, "Failed to get TGT times (%s)" TSRMLS_CC);
 		return;
@@ -950,55 +1810,22 @@ PHP_METHOD(KRB5CCache, getLifetime)
 PHP_METHOD(KRB5CCache, getEntries)
 {
 	krb5_ccache_object* ccache = Z_KRB5_CCACHE_OBJ_P(getThis());
-	krb5_error_code retval = 0;
-	char *errstr = "";
-	krb5_cc_cursor cursor;
-	int have_cursor = 0;
-	krb5_creds creds;
-	int have_creds = 0;
-	char *princname;
+	php_krb5_ccache_snapshot *snap;
 
 	if (zend_parse_parameters_none() == FAILURE) {
 		zend_throw_exception(NULL, "Failed to parse arglist", 0 TSRMLS_CC);
 		RETURN_FALSE;
 	}
 
-	array_init(return_value);
-
-    do {
-	memset(&cursor, 0, sizeof(cursor));
-	if((retval = krb5_cc_start_seq_get(ccache->ctx,ccache->cc,&cursor))) {
-		errstr = "Failed to initialize ccache iterator (%s)";
-		break;
-	}
-	have_cursor = 1;
+	snap = php_krb5_ccache_snapshot_walk(ccache TSRMLS_CC);
 
-	memset(&creds, 0, sizeof(creds));
-	while(krb5_cc_next_cred(ccache->ctx,ccache->cc,&cursor,&creds) == 0) {
-		have_creds = 1;
-		if(creds.server) {
-			princname = NULL;
-			if((retval = krb5_unparse_name(ccache->ctx, creds.server, &princname))) {
-				errstr = "Failed to unparse principal name (%s)";
-				break;
-			}
-			add_next_index_string(return_value, princname);
-			free(princname);
-		}
-		krb5_free_cred_contents(ccache->ctx, &creds);
-		have_creds = 0;
-	}
-
-    } while (0);
-
-	if (have_creds) krb5_free_cred_contents(ccache->ctx, &creds);
-
-	if (have_cursor) krb5_cc_end_seq_get(ccache->ctx, ccache->cc, &cursor);
-
-	if (*errstr) {
-		php_krb5_display_error(ccache->ctx, retval, errstr TSRMLS_CC);
+	if (Z_TYPE(snap->entries) == IS_UNDEF) {
+		php_krb5_display_error(ccache->ctx, snap->entries_retval, snap->entries_errstr TSRMLS_CC);
 		array_init(return_value);
+		return;
 	}
+
+	RETURN_ZVAL(&snap->entries, 1, 0);
 }
 /* }}} */
 
@@ -1017,6 +1844,8 @@ PHP_METHOD(KRB5CCache, isValid)
 		RETURN_FALSE;
 	}
 
+	php_krb5_ccache_auto_renew(ccache TSRMLS_CC);
+
 	if ((retval = php_krb5_get_tgt_expire(ccache,&endtime,&renew_until TSRMLS_CC))) {
 		RETURN_FALSE;
 	}
@@ -1040,263 +1869,395 @@ PHP_METHOD(KRB5CCache, isValid)
 PHP_METHOD(KRB5CCache, getTktAttrs)
 {
 	krb5_ccache_object* ccache = Z_KRB5_CCACHE_OBJ_P(getThis());
-	krb5_error_code retval = 0;
-	char *errstr = "";
-	krb5_cc_cursor cursor;
-	int have_cursor = 0;
-	krb5_creds creds;
-	int have_creds = 0;
-	zval tktinfo;
-	char *princname;
-	long princ_len;
-	long tktflags;
-	char strflags[65];
-	char *q = strflags + sizeof(strflags) - 1;
-	char *p;
-	krb5_ticket *tkt;
-	char *encstr;
-#define ENCSTRMAX 256
-	krb5_address *tktaddr, **tkt_addrs;
-	zval addrlist;
-	struct in_addr ipaddr;
-#ifdef INET6_ADDRSTRLEN
-	struct in6_addr ip6addr;
-	char straddr[INET6_ADDRSTRLEN];
-#endif
+	php_krb5_ccache_snapshot *snap;
+	zval *tktinfo, *server;
 	char *prefix = NULL;
-	long pfx_len = 0;
+	size_t pfx_len = 0;
 
 	array_init(return_value);
 
 	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|s", &prefix, &pfx_len) == FAILURE) {
 		return;
 	}
-	if (pfx_len == 0) prefix = NULL;
 
-    do {
-	memset(&cursor, 0, sizeof(cursor));
-	if ((retval = krb5_cc_start_seq_get(ccache->ctx,ccache->cc,&cursor))) {
-		errstr = "Failed to initialize ccache iterator (%s)";
-		break;
+	snap = php_krb5_ccache_snapshot_walk(ccache TSRMLS_CC);
+
+	if (Z_TYPE(snap->tktattrs) == IS_UNDEF) {
+		php_krb5_display_error(ccache->ctx, snap->tktattrs_retval, snap->tktattrs_errstr TSRMLS_CC);
+		return;
 	}
-	have_cursor = 1;
 
-	memset(&creds, 0, sizeof(creds));
-	while (krb5_cc_next_cred(ccache->ctx,ccache->cc,&cursor,&creds) == 0) {
-		have_creds = 1;
-		if (creds.server) {
-			array_init(&tktinfo);
+	if (pfx_len == 0) {
+		zval_ptr_dtor(return_value);
+		RETURN_ZVAL(&snap->tktattrs, 1, 0);
+	}
 
-			princname = NULL;
-			if ((retval = krb5_unparse_name(ccache->ctx, creds.server, &princname))) {
-				errstr = "Failed to unparse server principal name (%s)";
-				break;
-			}
+	ZEND_HASH_FOREACH_VAL(Z_ARRVAL(snap->tktattrs), tktinfo) {
+		server = zend_hash_str_find(Z_ARRVAL_P(tktinfo), "server", sizeof("server") - 1);
+		if (server && Z_STRLEN_P(server) >= pfx_len && strncmp(Z_STRVAL_P(server), prefix, pfx_len) == 0) {
+			Z_TRY_ADDREF_P(tktinfo);
+			add_next_index_zval(return_value, tktinfo);
+		}
+	} ZEND_HASH_FOREACH_END();
+}
+/* }}} */
 
-			princ_len = princname ? strlen(princname) : 0;
-			if (prefix && ((princ_len < pfx_len) || strncmp(princname,prefix,pfx_len))) {
-				free(princname);
-				krb5_free_cred_contents(ccache->ctx, &creds);
-				have_creds = 0;
-				continue;
-			}
+/* {{{ proto bool KRB5CCache::renew( )
+   Renew default TGT and purge other tickets from cache, return FALSE on failure  */
+PHP_METHOD(KRB5CCache, renew)
+{
+	krb5_ccache_object* ccache = Z_KRB5_CCACHE_OBJ_P(getThis());
+	krb5_error_code retval = 0;
+	char *errstr = "";
 
-			add_assoc_string(&tktinfo, "server", (princname?princname:""));
-			free(princname);
+	if (zend_parse_parameters_none() == FAILURE) {
+		zend_throw_exception(NULL, "Failed to parse arglist", 0 TSRMLS_CC);
+		RETURN_FALSE;
+	}
 
-			princname = NULL;
-			if((retval = krb5_unparse_name(ccache->ctx, creds.client, &princname))) {
-				errstr = "Failed to unparse client principal name (%s)";
-				break;
-			}
-			add_assoc_string(&tktinfo, "client", (princname?princname:""));
-			free(princname);
+	if ((retval = php_krb5_renew_tgt(ccache, &errstr TSRMLS_CC))) {
+		if (*errstr) {
+			php_krb5_display_error(ccache->ctx, retval, errstr TSRMLS_CC);
+		}
+		RETURN_FALSE;
+	}
 
-			add_assoc_long(&tktinfo, "authtime", creds.times.authtime);
-			add_assoc_long(&tktinfo, "starttime", creds.times.starttime);
-			add_assoc_long(&tktinfo, "endtime", creds.times.endtime);
-
-			/* Darn it, "till" is NOT an abbreviation of "until" */
-			add_assoc_long(&tktinfo, "renew_until", creds.times.renew_till);
-
-			tktflags = creds.ticket_flags;
-			p = strflags;
-			*p = '\0';
-			if ((tktflags & TKT_FLG_FORWARDABLE) && (p < q)) *(p++) = 'F';
-			if ((tktflags & TKT_FLG_FORWARDED) && (p < q)) *(p++) = 'f';
-			if ((tktflags & TKT_FLG_PROXIABLE) && (p < q)) *(p++) = 'P';
-			if ((tktflags & TKT_FLG_PROXY) && (p < q)) *(p++) = 'p';
-			if ((tktflags & TKT_FLG_MAY_POSTDATE) && (p < q)) *(p++) = 'D';
-			if ((tktflags & TKT_FLG_POSTDATED) && (p < q)) *(p++) = 'd';
-			if ((tktflags & TKT_FLG_INVALID) && (p < q)) *(p++) = 'i';
-			if ((tktflags & TKT_FLG_RENEWABLE) && (p < q)) *(p++) = 'R';
-			if ((tktflags & TKT_FLG_INITIAL) && (p < q)) *(p++) = 'I';
-			if ((tktflags & TKT_FLG_PRE_AUTH) && (p < q)) *(p++) = 'A';
-			if ((tktflags & TKT_FLG_HW_AUTH) && (p < q)) *(p++) = 'H';
-		if ((tktflags & TKT_FLG_TRANSIT_POLICY_CHECKED) && (p < q)) *(p++) = 'T';
-			if ((tktflags & TKT_FLG_OK_AS_DELEGATE) && (p < q)) *(p++) = 'O';
-#ifdef TKT_FLG_ENC_PA_REP
-			if ((tktflags & TKT_FLG_ENC_PA_REP) && (p < q)) *(p++) = 'e';
-#endif
-			if ((tktflags & TKT_FLG_ANONYMOUS) && (p < q)) *(p++) = 'a';
-			*p = '\0';
+	/* otherwise */
+	RETURN_TRUE;
+}
+/* }}} */
 
-			add_assoc_string(&tktinfo, "flags", strflags);
+/* {{{ proto void KRB5CCache::setRenewThreshold( float $fraction )
+   Renew the TGT transparently on access once less than $fraction of its lifetime remains (0 disables) */
+PHP_METHOD(KRB5CCache, setRenewThreshold)
+{
+	krb5_ccache_object* ccache = Z_KRB5_CCACHE_OBJ_P(getThis());
+	double fraction = 0;
 
-#ifdef HAVE_KRB5_HEIMDAL
-			encstr = NULL;
-			if ((retval = krb5_enctype_to_string(ccache->ctx,creds.keyblock.enctype, &encstr)))
-#else
-			encstr = malloc(ENCSTRMAX);
-			if ((retval = krb5_enctype_to_string(creds.keyblock.enctype, encstr, ENCSTRMAX)))
-#endif
-			{
-				if (!encstr) encstr = malloc(ENCSTRMAX);
-				snprintf(encstr, ENCSTRMAX, "enctype %d", creds.keyblock.enctype);
-			}
-			add_assoc_string(&tktinfo, "skey_enc", encstr);
-			free(encstr);
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "d", &fraction) == FAILURE) {
+		zend_throw_exception(NULL, "Failed to parse arglist", 0 TSRMLS_CC);
+		RETURN_FALSE;
+	}
 
-			if ((retval = krb5_decode_ticket(&creds.ticket,&tkt))) {
-				errstr = "Failed to decode ticket data (%s)";
-				break;
-			} else {
-#ifdef HAVE_KRB5_HEIMDAL
-				encstr = NULL;
-				if((retval = krb5_enctype_to_string(ccache->ctx,creds.keyblock.enctype, &encstr)))
-#else
-				encstr = malloc(ENCSTRMAX);
-				if((retval = krb5_enctype_to_string(tkt->enc_part.enctype, encstr, ENCSTRMAX)))
-#endif
-				{
-					if (!encstr) encstr = malloc(ENCSTRMAX);
-					snprintf(encstr, ENCSTRMAX, "enctype %d", tkt->enc_part.enctype);
-				}
-				add_assoc_string(&tktinfo, "tkt_enc", encstr);
-				free(encstr);
-				krb5_free_ticket(ccache->ctx, tkt);
-			}
+	if (fraction < 0 || fraction >= 1) {
+		zend_throw_exception(NULL, "Renewal threshold must be between 0 and 1", 0 TSRMLS_CC);
+		RETURN_FALSE;
+	}
 
-			array_init(&addrlist);
-			tkt_addrs = creds.addresses;
-			if (tkt_addrs) while((tktaddr = *(tkt_addrs++))) {
-				if ((tktaddr->addrtype == ADDRTYPE_INET) && (tktaddr->length == 4)) {
-					memcpy(&(ipaddr.s_addr), tktaddr->contents, tktaddr->length);
+	ccache->renew_threshold = fraction;
+	ccache->renew_attempt = 0;
+}
+/* }}} */
 
-#ifndef INET6_ADDRSTRLEN
-					add_next_index_string(&addrlist, inet_ntoa(ipaddr));
-				}
-#if 0
- { match curlies
-#endif
-#else /* ! INET6_ADDRSTRLEN */
-					if (inet_ntop(AF_INET, &ipaddr, straddr, sizeof(straddr))) {
-						add_next_index_string(&addrlist, straddr);
-					}
-				}
-				if ((tktaddr->addrtype == ADDRTYPE_INET6) && (tktaddr->length >= 4)) {
-					memcpy(ip6addr.s6_addr, tktaddr->contents, tktaddr->length);
-					if (inet_ntop(AF_INET6, &ipaddr, straddr, sizeof(straddr))) {
-						add_next_index_string(&addrlist, straddr);
-					}
-				}
-#endif /* INET6_ADDRSTRLEN */
-			}
-			add_assoc_zval(&tktinfo, "addresses", &addrlist);
-			add_next_index_zval(return_value,&tktinfo);
+/* {{{ proto KRB5CCache KRB5CCache::persistent( string $id )
+   Returns a credential cache that is kept alive across requests served by this worker */
+PHP_METHOD(KRB5CCache, persistent)
+{
+	krb5_ccache_object *ccache;
+	php_krb5_persistent_ccache *entry = NULL;
+	char *id = NULL;
+	size_t id_len = 0;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &id, &id_len) == FAILURE) {
+		zend_throw_exception(NULL, "Failed to parse arglist", 0 TSRMLS_CC);
+		RETURN_FALSE;
+	}
+
+	if (php_krb5_persistent_ccache_get(id, id_len, &entry TSRMLS_CC)) {
+		RETURN_FALSE;
+	}
+
+	object_init_ex(return_value, krb5_ce_ccache);
+	ccache = Z_KRB5_CCACHE_OBJ_P(return_value);
+
+	/* replace the per-object cache with the worker's one */
+	krb5_cc_destroy(ccache->ctx, ccache->cc);
+	php_krb5_context_release(ccache->ctx, ccache->ctx_generation TSRMLS_CC);
+
+	ccache->ctx = entry->ctx;
+	ccache->cc = entry->cc;
+	ccache->persistent = entry;
+
+	if (entry->keytab) {
+		ccache->keytab = estrdup(entry->keytab);
+	}
+}
+/* }}} */
+
+/* {{{ proto KRB5CCacheIterator KRB5CCache::tickets( [string prefix])
+   Returns an iterator lazily yielding the (readable) attributes of ticket(s) in cache */
+PHP_METHOD(KRB5CCache, tickets)
+{
+	krb5_ccache_iterator_object *iter;
+	char *prefix = NULL;
+	size_t pfx_len = 0;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|s", &prefix, &pfx_len) == FAILURE) {
+		zend_throw_exception(NULL, "Failed to parse arglist", 0 TSRMLS_CC);
+		RETURN_FALSE;
+	}
+
+	object_init_ex(return_value, krb5_ce_ccache_iterator);
+	iter = php_krb5_ccache_iterator_fetch_object(Z_OBJ_P(return_value));
+
+	ZVAL_COPY(&iter->ccache, getThis());
+	if (pfx_len > 0) {
+		iter->prefix = zend_string_init(prefix, pfx_len, 0);
+	}
+}
+/* }}} */
+
+/* {{{ proto array KRB5CCache::prefetchServiceTickets(array spns)
+   Obtains service tickets for all given principals with concurrent TGS requests */
+PHP_METHOD(KRB5CCache, prefetchServiceTickets)
+{
+	krb5_ccache_object *ccache = Z_KRB5_CCACHE_OBJ_P(getThis());
+	krb5_error_code retval = 0;
+	zval *spns;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "a", &spns) == FAILURE) {
+		zend_throw_exception(NULL, "Failed to parse arglist", 0 TSRMLS_CC);
+		RETURN_FALSE;
+	}
+
+	php_krb5_ccache_auto_renew(ccache TSRMLS_CC);
+
+	array_init(return_value);
+	retval = php_krb5_prefetch_service_tickets(ccache->ctx, ccache->cc, Z_ARRVAL_P(spns), return_value TSRMLS_CC);
+	php_krb5_ccache_invalidate(ccache);
+
+	if (retval) {
+		zval_dtor(return_value);
+		php_krb5_display_error(ccache->ctx, retval, "Failed to prefetch service tickets (%s)" TSRMLS_CC);
+		RETURN_FALSE;
+	}
+}
+/* }}} */
+
+/* KRB5CCacheIterator */
+
+/* {{{ */
+static void php_krb5_ccache_iterator_close(krb5_ccache_iterator_object *iter)
+{
+	krb5_ccache_object *ccache;
+
+	zval_ptr_dtor(&iter->current);
+	ZVAL_UNDEF(&iter->current);
+
+	if (iter->have_cursor) {
+		ccache = Z_KRB5_CCACHE_OBJ_P(&iter->ccache);
+		krb5_cc_end_seq_get(ccache->ctx, ccache->cc, &iter->cursor);
+		iter->have_cursor = 0;
+	}
+}
+/* }}} */
+
+/* {{{ Advances to the next matching credential, building only its element */
+static void php_krb5_ccache_iterator_fetch(krb5_ccache_iterator_object *iter TSRMLS_DC)
+{
+	krb5_ccache_object *ccache = Z_KRB5_CCACHE_OBJ_P(&iter->ccache);
+	krb5_error_code retval = 0;
+	char *errstr = "";
+	krb5_creds creds;
+	char *princname;
+
+	zval_ptr_dtor(&iter->current);
+	ZVAL_UNDEF(&iter->current);
+
+	if (!iter->have_cursor) {
+		return;
+	}
+
+	memset(&creds, 0, sizeof(creds));
+	while (krb5_cc_next_cred(ccache->ctx, ccache->cc, &iter->cursor, &creds) == 0) {
+		if (!creds.server) {
+			krb5_free_cred_contents(ccache->ctx, &creds);
+			continue;
+		}
+
+		princname = NULL;
+		if ((retval = krb5_unparse_name(ccache->ctx, creds.server, &princname))) {
+			errstr = "Failed to unparse server principal name (%s)";
+			krb5_free_cred_contents(ccache->ctx, &creds);
+			break;
+		}
+
+		if (iter->prefix && (strlen(princname) < ZSTR_LEN(iter->prefix) ||
+				strncmp(princname, ZSTR_VAL(iter->prefix), ZSTR_LEN(iter->prefix)))) {
+			free(princname);
+			krb5_free_cred_contents(ccache->ctx, &creds);
+			continue;
 		}
 
+		retval = php_krb5_ccache_tkt_attrs(ccache, &creds, princname, &iter->current, &errstr TSRMLS_CC);
+		free(princname);
 		krb5_free_cred_contents(ccache->ctx, &creds);
-		have_creds = 0;
-	} /* while creds */
 
-	if (have_creds) krb5_free_cred_contents(ccache->ctx, &creds);
+		if (retval) {
+			zval_ptr_dtor(&iter->current);
+			ZVAL_UNDEF(&iter->current);
+			break;
+		}
 
-    } while (0);
+		iter->index++;
+		return;
+	}
 
-	if (have_cursor) krb5_cc_end_seq_get(ccache->ctx,ccache->cc,&cursor);
+	php_krb5_ccache_iterator_close(iter);
 
-	if (*errstr) {
+	if (retval) {
 		php_krb5_display_error(ccache->ctx, retval, errstr TSRMLS_CC);
-		array_init(return_value);
 	}
 }
-#undef ENCSTRMAX
 /* }}} */
 
-/* {{{ proto bool KRB5CCache::renew( )
-   Renew default TGT and purge other tickets from cache, return FALSE on failure  */
-PHP_METHOD(KRB5CCache, renew)
+/* {{{ */
+static void php_krb5_ccache_iterator_object_dtor(zend_object *obj)
 {
-	krb5_ccache_object* ccache = Z_KRB5_CCACHE_OBJ_P(getThis());
+	krb5_ccache_iterator_object *iter = php_krb5_ccache_iterator_fetch_object(obj);
+
+	php_krb5_ccache_iterator_close(iter);
+	zval_ptr_dtor(&iter->ccache);
+
+	if (iter->prefix) {
+		zend_string_release(iter->prefix);
+	}
+
+	zend_object_std_dtor(&iter->std);
+}
+/* }}} */
+
+/* {{{ */
+static zend_object *php_krb5_ccache_iterator_object_new(zend_class_entry *ce)
+{
+	krb5_ccache_iterator_object *iter;
+
+	iter = ecalloc(1, sizeof(krb5_ccache_iterator_object) + zend_object_properties_size(ce));
+
+	zend_object_std_init(&iter->std, ce TSRMLS_CC);
+	object_properties_init(&iter->std, ce);
+
+	iter->std.handlers = &krb5_ccache_iterator_handlers;
+	return &iter->std;
+}
+/* }}} */
+
+/* {{{ proto void KRB5CCacheIterator::rewind( ) */
+PHP_METHOD(KRB5CCacheIterator, rewind)
+{
+	krb5_ccache_iterator_object *iter = php_krb5_ccache_iterator_fetch_object(Z_OBJ_P(getThis()));
+	krb5_ccache_object *ccache;
 	krb5_error_code retval = 0;
-	char *errstr = "";
-	long endtime, renew_until;
-	krb5_timestamp now;
-	krb5_principal princ;
-	int have_princ = 0;
-	krb5_creds creds;
-	int have_creds = 0;
 
 	if (zend_parse_parameters_none() == FAILURE) {
-		zend_throw_exception(NULL, "Failed to parse arglist", 0 TSRMLS_CC);
-		RETURN_FALSE;
+		return;
 	}
 
-    do {
-	if ((retval = php_krb5_get_tgt_expire(ccache, &endtime, &renew_until TSRMLS_CC))) {
-		errstr = "Failed to get renew_until () (%s)";
-		break;
+	if (Z_TYPE(iter->ccache) != IS_OBJECT) {
+		zend_throw_exception(NULL, "Iterator is not attached to a credential cache", 0 TSRMLS_CC);
+		return;
 	}
 
-	if ((retval = krb5_timeofday(ccache->ctx, &now))) {
-		errstr = "Failed to read clock in renew() (%s)";
-		break;
+	php_krb5_ccache_iterator_close(iter);
+	iter->index = -1;
+
+	ccache = Z_KRB5_CCACHE_OBJ_P(&iter->ccache);
+	if ((retval = krb5_cc_start_seq_get(ccache->ctx, ccache->cc, &iter->cursor))) {
+		php_krb5_display_error(ccache->ctx, retval, "Failed to initialize ccache iterator (%s)" TSRMLS_CC);
+		return;
 	}
+	iter->have_cursor = 1;
 
-	if (now > renew_until) {
-		/* ticket is not renewable, but... */
-		if (now >= endtime) retval = -1; /* ...is it still useful? */
-		break;
+	php_krb5_ccache_iterator_fetch(iter TSRMLS_CC);
+}
+/* }}} */
+
+/* {{{ proto bool KRB5CCacheIterator::valid( ) */
+PHP_METHOD(KRB5CCacheIterator, valid)
+{
+	krb5_ccache_iterator_object *iter = php_krb5_ccache_iterator_fetch_object(Z_OBJ_P(getThis()));
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		return;
 	}
 
-	memset(&princ, 0, sizeof(princ));
-	if ((retval = krb5_cc_get_principal(ccache->ctx, ccache->cc, &princ))) {
-		errstr = "Failed to get principal from cache (%s)";
-		break;
+	RETURN_BOOL(Z_TYPE(iter->current) != IS_UNDEF);
+}
+/* }}} */
+
+/* {{{ proto array KRB5CCacheIterator::current( ) */
+PHP_METHOD(KRB5CCacheIterator, current)
+{
+	krb5_ccache_iterator_object *iter = php_krb5_ccache_iterator_fetch_object(Z_OBJ_P(getThis()));
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		return;
 	}
-	have_princ = 1;
 
-	memset(&creds, 0, sizeof(creds));
-	if ((retval = krb5_get_renewed_creds(ccache->ctx, &creds, princ, ccache->cc, NULL))) {
-		errstr = "Failed to renew TGT in cache (%s)";
-		break;
+	if (Z_TYPE(iter->current) == IS_UNDEF) {
+		RETURN_NULL();
 	}
-	have_creds = 1;
 
-	if ((retval = krb5_cc_initialize(ccache->ctx, ccache->cc, princ))) {
-		errstr = "Failed to reinitialize ccache after TGT renewal (%s)";
-		break;
+	RETURN_ZVAL(&iter->current, 1, 0);
+}
+/* }}} */
+
+/* {{{ proto int KRB5CCacheIterator::key( ) */
+PHP_METHOD(KRB5CCacheIterator, key)
+{
+	krb5_ccache_iterator_object *iter = php_krb5_ccache_iterator_fetch_object(Z_OBJ_P(getThis()));
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		return;
 	}
 
-	if((retval = krb5_cc_store_cred(ccache->ctx, ccache->cc, &creds))) {
-		errstr = "Failed to store renewed TGT in ccache (%s)";
-		break;
+	if (Z_TYPE(iter->current) == IS_UNDEF) {
+		RETURN_NULL();
 	}
-    } while (0);
 
-	if (have_princ) krb5_free_principal(ccache->ctx, princ);
-	if (have_creds) krb5_free_cred_contents(ccache->ctx, &creds);
+	RETURN_LONG(iter->index);
+}
+/* }}} */
 
-	if (retval) {
-		if (*errstr) {
-			php_krb5_display_error(ccache->ctx, retval, errstr TSRMLS_CC);
-		}
-		RETURN_FALSE;
+/* {{{ proto void KRB5CCacheIterator::next( ) */
+PHP_METHOD(KRB5CCacheIterator, next)
+{
+	krb5_ccache_iterator_object *iter = php_krb5_ccache_iterator_fetch_object(Z_OBJ_P(getThis()));
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		return;
 	}
 
-	/* otherwise */
-	RETURN_TRUE;
+	php_krb5_ccache_iterator_fetch(iter TSRMLS_CC);
+}
+/* }}} */
+
+static zend_function_entry krb5_ccache_iterator_functions[] = {
+	PHP_ME(KRB5CCacheIterator, rewind,  arginfo_KRB5CCache_none, ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5CCacheIterator, valid,   arginfo_KRB5CCache_none, ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5CCacheIterator, current, arginfo_KRB5CCache_none, ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5CCacheIterator, key,     arginfo_KRB5CCache_none, ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5CCacheIterator, next,    arginfo_KRB5CCache_none, ZEND_ACC_PUBLIC)
+	PHP_FE_END
+};
+
+/* {{{ */
+static int php_krb5_ccache_iterator_register_class(TSRMLS_D)
+{
+	zend_class_entry ccache_iterator;
+
+	INIT_CLASS_ENTRY(ccache_iterator, "KRB5CCacheIterator", krb5_ccache_iterator_functions);
+	krb5_ce_ccache_iterator = zend_register_internal_class(&ccache_iterator);
+	krb5_ce_ccache_iterator->create_object = php_krb5_ccache_iterator_object_new;
+	krb5_ce_ccache_iterator->ce_flags |= ZEND_ACC_FINAL;
+	zend_class_implements(krb5_ce_ccache_iterator TSRMLS_CC, 1, zend_ce_iterator);
+
+	memcpy(&krb5_ccache_iterator_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	krb5_ccache_iterator_handlers.offset = XtOffsetOf(krb5_ccache_iterator_object, std);
+	krb5_ccache_iterator_handlers.free_obj = php_krb5_ccache_iterator_object_dtor;
+	krb5_ccache_iterator_handlers.clone_obj = NULL;
+
+	return SUCCESS;
 }
 /* }}} */
 
@@ -0,0 +1,683 @@
+/**
+* Copyright (c) 2008 Moritz Bechler
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+**/
+
+
+/*
+ * Name attributes and PAC group SIDs
+ *
+ * Exposes the attributes of an accepted client name (gss_get_name_attribute,
+ * e.g. urn:mspac:logon-info) and decodes the group SIDs of the logon info
+ * PAC buffer (MS-PAC 2.5, an NDR serialised KERB_VALIDATION_INFO). SIDs are
+ * kept in binary form as hash keys, so KRB5SidSet lookups are a hash probe.
+ */
+
+#include "php_krb5.h"
+#ifdef HAVE_GSSAPI_GSSAPI_EXT_H
+#include <gssapi/gssapi_ext.h>
+#endif
+
+#define PHP_KRB5_PAC_LOGON_INFO "urn:mspac:logon-info"
+#define PHP_KRB5_SID_MAX_SUBAUTH 15
+/* MS-PAC 2.5 UserFlags: ResourceGroupIds are valid */
+#define PHP_KRB5_LOGON_RESOURCE_GROUPS 0x200
+
+zend_class_entry *krb5_ce_sid_set;
+zend_object_handlers krb5_sid_set_handlers;
+
+typedef struct _krb5_sid_set_object {
+	HashTable sids;
+	zend_object std;
+} krb5_sid_set_object;
+
+static inline krb5_sid_set_object *php_krb5_sid_set_object(zend_object *obj) {
+	return (krb5_sid_set_object *)((char*)(obj) - XtOffsetOf(krb5_sid_set_object, std));
+}
+#define KRB5_SID_SET_OBJ_P(zv) php_krb5_sid_set_object(Z_OBJ_P(zv))
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5SidSet__construct, 0, 0, 1)
+	ZEND_ARG_ARRAY_INFO(0, sids, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5SidSet_contains, 0, 0, 1)
+	ZEND_ARG_INFO(0, sid)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5SidSet_none, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5SidSet_fromLogonInfo, 0, 0, 1)
+	ZEND_ARG_INFO(0, logon_info)
+ZEND_END_ARG_INFO()
+
+PHP_METHOD(KRB5SidSet, __construct);
+PHP_METHOD(KRB5SidSet, contains);
+PHP_METHOD(KRB5SidSet, count);
+PHP_METHOD(KRB5SidSet, fromLogonInfo);
+
+static zend_function_entry krb5_sid_set_functions[] = {
+	PHP_ME(KRB5SidSet, __construct, arginfo_KRB5SidSet__construct, ZEND_ACC_PUBLIC | ZEND_ACC_CTOR)
+	PHP_ME(KRB5SidSet, contains,    arginfo_KRB5SidSet_contains,    ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5SidSet, count,       arginfo_KRB5SidSet_none,        ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5SidSet, fromLogonInfo, arginfo_KRB5SidSet_fromLogonInfo, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	PHP_FE_END
+};
+
+
+/** SID encoding **/
+/* {{{ Parses "S-1-5-21-..." into the binary form (revision, count,
+       48 bit big endian authority, little endian sub authorities) */
+static zend_string *php_krb5_sid_parse(const char *str, size_t len)
+{
+	unsigned char buf[8 + 4 * PHP_KRB5_SID_MAX_SUBAUTH];
+	const char *p = str, *end = str + len;
+	uint64_t authority = 0, value;
+	int count = -2, i;
+
+	if(len < 2 || (p[0] != 'S' && p[0] != 's') || p[1] != '-') {
+		return NULL;
+	}
+	p += 2;
+
+	/* revision, authority, then the sub authorities */
+	while(p < end) {
+		if(*p < '0' || *p > '9') return NULL;
+		for(value = 0; p < end && *p >= '0' && *p <= '9'; p++) {
+			value = value * 10 + (*p - '0');
+			if(value > 0xffffffffffffULL) return NULL;
+		}
+
+		if(count == -2) {
+			if(value > 0xff) return NULL;
+			buf[0] = (unsigned char) value;
+		} else if(count == -1) {
+			authority = value;
+		} else {
+			if(count >= PHP_KRB5_SID_MAX_SUBAUTH || value > 0xffffffffULL) return NULL;
+			buf[8 + 4 * count] = value & 0xff;
+			buf[9 + 4 * count] = (value >> 8) & 0xff;
+			buf[10 + 4 * count] = (value >> 16) & 0xff;
+			buf[11 + 4 * count] = (value >> 24) & 0xff;
+		}
+		count++;
+
+		if(p < end) {
+			if(*p != '-' || p + 1 == end) return NULL;
+			p++;
+		}
+	}
+
+	if(count < 0) {
+		return NULL;
+	}
+
+	buf[1] = (unsigned char) count;
+	for(i = 0; i < 6; i++) {
+		buf[2 + i] = (authority >> (8 * (5 - i))) & 0xff;
+	}
+
+	return zend_string_init((char*) buf, 8 + 4 * count, 0);
+}
+/* }}} */
+
+/* {{{ */
+static zend_string *php_krb5_sid_format(const zend_string *sid)
+{
+	const unsigned char *b = (const unsigned char*) ZSTR_VAL(sid);
+	uint64_t authority = 0;
+	smart_str out = {0};
+	int i;
+
+	for(i = 0; i < 6; i++) {
+		authority = (authority << 8) | b[2 + i];
+	}
+
+	smart_str_appends(&out, "S-");
+	smart_str_append_unsigned(&out, b[0]);
+	smart_str_appendc(&out, '-');
+	smart_str_append_unsigned(&out, (zend_ulong) authority);
+	for(i = 0; i < b[1]; i++) {
+		smart_str_appendc(&out, '-');
+		smart_str_append_unsigned(&out, (zend_ulong) b[8 + 4 * i] | ((zend_ulong) b[9 + 4 * i] << 8) |
+				((zend_ulong) b[10 + 4 * i] << 16) | ((zend_ulong) b[11 + 4 * i] << 24));
+	}
+	smart_str_0(&out);
+
+	return out.s;
+}
+/* }}} */
+
+
+/** NDR decoding of KERB_VALIDATION_INFO **/
+typedef struct _php_krb5_ndr {
+	const unsigned char *buf;
+	size_t len;
+	size_t pos;
+} php_krb5_ndr;
+
+/* {{{ */
+static int php_krb5_ndr_align(php_krb5_ndr *ndr, size_t n)
+{
+	ndr->pos = (ndr->pos + n - 1) & ~(n - 1);
+	return ndr->pos <= ndr->len ? SUCCESS : FAILURE;
+}
+/* }}} */
+
+/* {{{ */
+static int php_krb5_ndr_skip(php_krb5_ndr *ndr, size_t n)
+{
+	if(ndr->len - ndr->pos < n) return FAILURE;
+	ndr->pos += n;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ */
+static int php_krb5_ndr_u32(php_krb5_ndr *ndr, uint32_t *v)
+{
+	const unsigned char *p;
+
+	if(php_krb5_ndr_align(ndr, 4) == FAILURE || ndr->len - ndr->pos < 4) return FAILURE;
+	p = ndr->buf + ndr->pos;
+	*v = (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+	ndr->pos += 4;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ Skips the deferred part of an RPC_UNICODE_STRING */
+static int php_krb5_ndr_skip_string(php_krb5_ndr *ndr)
+{
+	uint32_t max, offset, actual;
+
+	if(php_krb5_ndr_u32(ndr, &max) == FAILURE || php_krb5_ndr_u32(ndr, &offset) == FAILURE ||
+			php_krb5_ndr_u32(ndr, &actual) == FAILURE || actual > max) {
+		return FAILURE;
+	}
+
+	return php_krb5_ndr_skip(ndr, (size_t) actual * 2);
+}
+/* }}} */
+
+/* {{{ Reads the deferred part of an RPC_SID into its binary form */
+static zend_string *php_krb5_ndr_sid(php_krb5_ndr *ndr)
+{
+	uint32_t count;
+	const unsigned char *p;
+	size_t len;
+
+	if(php_krb5_ndr_u32(ndr, &count) == FAILURE || count > PHP_KRB5_SID_MAX_SUBAUTH) return NULL;
+	len = 8 + 4 * (size_t) count;
+	if(ndr->len - ndr->pos < len) return NULL;
+
+	p = ndr->buf + ndr->pos;
+	if(p[1] != count) return NULL;
+	ndr->pos += len;
+
+	return zend_string_init((const char*) p, len, 0);
+}
+/* }}} */
+
+/* {{{ Adds domain + rid */
+static void php_krb5_sid_add_rid(HashTable *sids, const zend_string *domain, uint32_t rid)
+{
+	zend_string *sid;
+
+	if(!domain || ZSTR_VAL(domain)[1] >= PHP_KRB5_SID_MAX_SUBAUTH) return;
+
+	sid = zend_string_alloc(ZSTR_LEN(domain) + 4, 0);
+	memcpy(ZSTR_VAL(sid), ZSTR_VAL(domain), ZSTR_LEN(domain));
+	ZSTR_VAL(sid)[1]++;
+	ZSTR_VAL(sid)[ZSTR_LEN(domain)] = rid & 0xff;
+	ZSTR_VAL(sid)[ZSTR_LEN(domain) + 1] = (rid >> 8) & 0xff;
+	ZSTR_VAL(sid)[ZSTR_LEN(domain) + 2] = (rid >> 16) & 0xff;
+	ZSTR_VAL(sid)[ZSTR_LEN(domain) + 3] = (rid >> 24) & 0xff;
+	ZSTR_VAL(sid)[ZSTR_LEN(sid)] = '\0';
+
+	zend_hash_add_empty_element(sids, sid);
+	zend_string_release(sid);
+}
+/* }}} */
+
+/* {{{ Collects the group SIDs (primary group, groups, extra SIDs and, if
+       flagged in UserFlags, resource groups) of a logon info buffer */
+static int php_krb5_pac_logon_info_groups(const unsigned char *buf, size_t len, HashTable *sids)
+{
+	php_krb5_ndr ndr = { buf, len, 0 };
+	uint32_t ref, v, strings[8], primary_group, group_count, group_ptr, user_flags, domain_ptr;
+	uint32_t sid_count, extra_ptr, res_domain_ptr, res_count, res_ptr, i;
+	uint32_t *rids = NULL, *res_rids = NULL, *extra_ptrs = NULL;
+	zend_string *domain = NULL, *res_domain = NULL, *sid;
+	int retval = FAILURE, s;
+
+	/* type serialisation version 1, little endian, 8 byte common and private headers */
+	if(len < 20 || buf[0] != 1 || buf[1] != 0x10) return FAILURE;
+	ndr.pos = 16;
+
+	do {
+		if(php_krb5_ndr_u32(&ndr, &ref) == FAILURE || !ref) break;
+
+		/* LogonTime .. PasswordMustChange */
+		if(php_krb5_ndr_skip(&ndr, 6 * 8) == FAILURE) break;
+
+		/* EffectiveName .. HomeDirectoryDrive: Length, MaximumLength, Buffer */
+		for(s = 0; s < 6; s++) {
+			if(php_krb5_ndr_u32(&ndr, &v) == FAILURE || php_krb5_ndr_u32(&ndr, &strings[s]) == FAILURE) break;
+		}
+		if(s < 6) break;
+
+		/* LogonCount, BadPasswordCount, UserId */
+		if(php_krb5_ndr_skip(&ndr, 8) == FAILURE) break;
+		if(php_krb5_ndr_u32(&ndr, &primary_group) == FAILURE) break;
+		if(php_krb5_ndr_u32(&ndr, &group_count) == FAILURE) break;
+		if(php_krb5_ndr_u32(&ndr, &group_ptr) == FAILURE) break;
+
+		if(php_krb5_ndr_u32(&ndr, &user_flags) == FAILURE) break;
+		/* UserSessionKey */
+		if(php_krb5_ndr_skip(&ndr, 16) == FAILURE) break;
+
+		/* LogonServer, LogonDomainName */
+		if(php_krb5_ndr_u32(&ndr, &v) == FAILURE || php_krb5_ndr_u32(&ndr, &strings[6]) == FAILURE) break;
+		if(php_krb5_ndr_u32(&ndr, &v) == FAILURE || php_krb5_ndr_u32(&ndr, &strings[7]) == FAILURE) break;
+		if(php_krb5_ndr_u32(&ndr, &domain_ptr) == FAILURE) break;
+
+		/* Reserved1, UserAccountControl, SubAuthStatus, LastSuccessfulILogon,
+		   LastFailedILogon, FailedILogonCount, Reserved3 */
+		if(php_krb5_ndr_skip(&ndr, 8 + 4 + 4 + 8 + 8 + 4 + 4) == FAILURE) break;
+
+		if(php_krb5_ndr_u32(&ndr, &sid_count) == FAILURE) break;
+		if(php_krb5_ndr_u32(&ndr, &extra_ptr) == FAILURE) break;
+		if(php_krb5_ndr_u32(&ndr, &res_domain_ptr) == FAILURE) break;
+		if(php_krb5_ndr_u32(&ndr, &res_count) == FAILURE) break;
+		if(php_krb5_ndr_u32(&ndr, &res_ptr) == FAILURE) break;
+
+		/* deferred pointers, in order of appearance */
+		for(s = 0; s < 6; s++) {
+			if(strings[s] && php_krb5_ndr_skip_string(&ndr) == FAILURE) break;
+		}
+		if(s < 6) break;
+
+		if(group_ptr) {
+			if(php_krb5_ndr_u32(&ndr, &v) == FAILURE || v != group_count || group_count > (len - ndr.pos) / 8) break;
+			rids = safe_emalloc(group_count, sizeof(uint32_t), 0);
+			for(i = 0; i < group_count; i++) {
+				if(php_krb5_ndr_u32(&ndr, &rids[i]) == FAILURE || php_krb5_ndr_u32(&ndr, &v) == FAILURE) break;
+			}
+			if(i < group_count) break;
+		} else {
+			group_count = 0;
+		}
+
+		if(strings[6] && php_krb5_ndr_skip_string(&ndr) == FAILURE) break;
+		if(strings[7] && php_krb5_ndr_skip_string(&ndr) == FAILURE) break;
+
+		if(domain_ptr && !(domain = php_krb5_ndr_sid(&ndr))) break;
+
+		if(extra_ptr) {
+			if(php_krb5_ndr_u32(&ndr, &v) == FAILURE || v != sid_count || sid_count > (len - ndr.pos) / 8) break;
+			extra_ptrs = safe_emalloc(sid_count, sizeof(uint32_t), 0);
+			for(i = 0; i < sid_count; i++) {
+				if(php_krb5_ndr_u32(&ndr, &extra_ptrs[i]) == FAILURE || php_krb5_ndr_u32(&ndr, &v) == FAILURE) break;
+			}
+			if(i < sid_count) break;
+
+			for(i = 0; i < sid_count; i++) {
+				if(!extra_ptrs[i]) continue;
+				if(!(sid = php_krb5_ndr_sid(&ndr))) break;
+				zend_hash_add_empty_element(sids, sid);
+				zend_string_release(sid);
+			}
+			if(i < sid_count) break;
+		}
+
+		if(res_domain_ptr && !(res_domain = php_krb5_ndr_sid(&ndr))) break;
+
+		if(res_ptr) {
+			if(php_krb5_ndr_u32(&ndr, &v) == FAILURE || v != res_count || res_count > (len - ndr.pos) / 8) break;
+			res_rids = safe_emalloc(res_count, sizeof(uint32_t), 0);
+			for(i = 0; i < res_count; i++) {
+				if(php_krb5_ndr_u32(&ndr, &res_rids[i]) == FAILURE || php_krb5_ndr_u32(&ndr, &v) == FAILURE) break;
+			}
+			if(i < res_count) break;
+		} else {
+			res_count = 0;
+		}
+
+		php_krb5_sid_add_rid(sids, domain, primary_group);
+		for(i = 0; i < group_count; i++) {
+			php_krb5_sid_add_rid(sids, domain, rids[i]);
+		}
+		/* resource groups only count if the KDC says so */
+		if(user_flags & PHP_KRB5_LOGON_RESOURCE_GROUPS) {
+			for(i = 0; i < res_count; i++) {
+				php_krb5_sid_add_rid(sids, res_domain, res_rids[i]);
+			}
+		}
+
+		retval = SUCCESS;
+	} while(0);
+
+	if(rids) efree(rids);
+	if(res_rids) efree(res_rids);
+	if(extra_ptrs) efree(extra_ptrs);
+	if(domain) zend_string_release(domain);
+	if(res_domain) zend_string_release(res_domain);
+
+	return retval;
+}
+/* }}} */
+
+
+/** Name attributes **/
+/* {{{ Lists the attributes of name */
+void php_krb5_name_get_attributes(gss_name_t name, zval *return_value TSRMLS_DC)
+{
+#ifdef HAVE_GSS_GET_NAME_ATTRIBUTE
+	OM_uint32 status, minor_status = 0;
+	gss_buffer_set_t attrs = GSS_C_NO_BUFFER_SET;
+	int name_is_mn = 0;
+	size_t i;
+
+	status = gss_inquire_name(&minor_status, name, &name_is_mn, NULL, &attrs);
+	if(GSS_ERROR(status)) {
+		php_krb5_gssapi_handle_error(status, minor_status TSRMLS_CC);
+		RETURN_FALSE;
+	}
+
+	array_init(return_value);
+	if(attrs != GSS_C_NO_BUFFER_SET) {
+		for(i = 0; i < attrs->count; i++) {
+			add_next_index_stringl(return_value, attrs->elements[i].value, attrs->elements[i].length);
+		}
+		gss_release_buffer_set(&minor_status, &attrs);
+	}
+#else
+	zend_throw_exception(NULL, "Name attributes are not supported by the GSSAPI library", 0 TSRMLS_CC);
+#endif
+}
+/* }}} */
+
+/* {{{ Returns the values of attribute attr of name as a list of
+       array(value, display, authenticated, complete) */
+void php_krb5_name_get_attribute(gss_name_t name, const char *attr, size_t attr_len, zval *return_value TSRMLS_DC)
+{
+#ifdef HAVE_GSS_GET_NAME_ATTRIBUTE
+	OM_uint32 status, minor_status = 0;
+	gss_buffer_desc attrbuf, value, display;
+	int authenticated, complete, more = -1;
+	zval entry;
+
+	attrbuf.value = (void*) attr;
+	attrbuf.length = attr_len;
+
+	array_init(return_value);
+	while(more != 0) {
+		authenticated = complete = 0;
+		value.length = display.length = 0;
+		value.value = display.value = NULL;
+
+		status = gss_get_name_attribute(&minor_status, name, &attrbuf, &authenticated, &complete, &value, &display, &more);
+		if(status == GSS_S_UNAVAILABLE) {
+			break;
+		}
+		if(GSS_ERROR(status)) {
+			zval_dtor(return_value);
+			php_krb5_gssapi_handle_error(status, minor_status TSRMLS_CC);
+			RETURN_FALSE;
+		}
+
+		array_init(&entry);
+		add_assoc_stringl(&entry, "value", value.value ? value.value : "", value.length);
+		if(display.length > 0) {
+			add_assoc_stringl(&entry, "display", display.value, display.length);
+		} else {
+			add_assoc_null(&entry, "display");
+		}
+		add_assoc_bool(&entry, "authenticated", authenticated);
+		add_assoc_bool(&entry, "complete", complete);
+		add_next_index_zval(return_value, &entry);
+
+		gss_release_buffer(&minor_status, &value);
+		gss_release_buffer(&minor_status, &display);
+	}
+#else
+	zend_throw_exception(NULL, "Name attributes are not supported by the GSSAPI library", 0 TSRMLS_CC);
+#endif
+}
+/* }}} */
+
+/* {{{ Decodes the group SIDs from the authenticated logon info of name.
+       Returns NULL (and throws) if there is no such information */
+HashTable *php_krb5_name_group_sids(gss_name_t name TSRMLS_DC)
+{
+#ifdef HAVE_GSS_GET_NAME_ATTRIBUTE
+	OM_uint32 status, minor_status = 0;
+	gss_buffer_desc attrbuf, value, display;
+	int authenticated = 0, complete = 0, more = -1;
+	HashTable *sids;
+
+	attrbuf.value = PHP_KRB5_PAC_LOGON_INFO;
+	attrbuf.length = sizeof(PHP_KRB5_PAC_LOGON_INFO) - 1;
+	value.length = display.length = 0;
+	value.value = display.value = NULL;
+
+	status = gss_get_name_attribute(&minor_status, name, &attrbuf, &authenticated, &complete, &value, &display, &more);
+	if(GSS_ERROR(status)) {
+		zend_throw_exception(NULL, "No PAC logon information available", status TSRMLS_CC);
+		return NULL;
+	}
+	gss_release_buffer(&minor_status, &display);
+
+	/* only trust a PAC whose signature was verified */
+	if(!authenticated) {
+		gss_release_buffer(&minor_status, &value);
+		zend_throw_exception(NULL, "PAC logon information is not authenticated", 0 TSRMLS_CC);
+		return NULL;
+	}
+
+	ALLOC_HASHTABLE(sids);
+	zend_hash_init(sids, 32, NULL, NULL, 0);
+
+	if(php_krb5_pac_logon_info_groups(value.value, value.length, sids) == FAILURE) {
+		gss_release_buffer(&minor_status, &value);
+		zend_hash_destroy(sids);
+		FREE_HASHTABLE(sids);
+		zend_throw_exception(NULL, "Failed to decode PAC logon information", 0 TSRMLS_CC);
+		return NULL;
+	}
+
+	gss_release_buffer(&minor_status, &value);
+	return sids;
+#else
+	zend_throw_exception(NULL, "Name attributes are not supported by the GSSAPI library", 0 TSRMLS_CC);
+	return NULL;
+#endif
+}
+/* }}} */
+
+/* {{{ */
+void php_krb5_group_sids_free(HashTable *sids)
+{
+	zend_hash_destroy(sids);
+	FREE_HASHTABLE(sids);
+}
+/* }}} */
+
+/* {{{ */
+void php_krb5_group_sids_to_array(HashTable *sids, zval *return_value)
+{
+	zend_string *sid;
+
+	array_init_size(return_value, zend_hash_num_elements(sids));
+	ZEND_HASH_FOREACH_STR_KEY(sids, sid) {
+		add_next_index_str(return_value, php_krb5_sid_format(sid));
+	} ZEND_HASH_FOREACH_END();
+}
+/* }}} */
+
+/* {{{ Whether any of sids is in the KRB5SidSet zset */
+int php_krb5_group_sids_intersect(HashTable *sids, zval *zset)
+{
+	krb5_sid_set_object *set = KRB5_SID_SET_OBJ_P(zset);
+	HashTable *small = sids, *large = &set->sids;
+	zend_string *sid;
+
+	if(zend_hash_num_elements(small) > zend_hash_num_elements(large)) {
+		small = &set->sids;
+		large = sids;
+	}
+
+	ZEND_HASH_FOREACH_STR_KEY(small, sid) {
+		if(zend_hash_exists(large, sid)) {
+			return 1;
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	return 0;
+}
+/* }}} */
+
+
+/** KRB5SidSet **/
+/* {{{ */
+static void php_krb5_sid_set_object_dtor(zend_object *obj)
+{
+	krb5_sid_set_object *object = php_krb5_sid_set_object(obj);
+
+	zend_hash_destroy(&object->sids);
+	zend_object_std_dtor(&object->std);
+}
+/* }}} */
+
+/* {{{ */
+static zend_object *php_krb5_sid_set_object_new(zend_class_entry *ce)
+{
+	krb5_sid_set_object *object;
+
+	object = ecalloc(1, sizeof(krb5_sid_set_object) + zend_object_properties_size(ce));
+	zend_hash_init(&object->sids, 8, NULL, NULL, 0);
+
+	zend_object_std_init(&object->std, ce TSRMLS_CC);
+	object_properties_init(&(object->std), ce);
+	object->std.handlers = &krb5_sid_set_handlers;
+
+	return &object->std;
+}
+/* }}} */
+
+/* {{{ */
+int php_krb5_name_attributes_register_classes(TSRMLS_D)
+{
+	zend_class_entry sid_set;
+
+	INIT_CLASS_ENTRY(sid_set, "KRB5SidSet", krb5_sid_set_functions);
+	krb5_ce_sid_set = zend_register_internal_class(&sid_set);
+	krb5_ce_sid_set->create_object = php_krb5_sid_set_object_new;
+	krb5_ce_sid_set->ce_flags |= ZEND_ACC_FINAL;
+
+	memcpy(&krb5_sid_set_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	krb5_sid_set_handlers.offset = XtOffsetOf(krb5_sid_set_object, std);
+	krb5_sid_set_handlers.free_obj = php_krb5_sid_set_object_dtor;
+	krb5_sid_set_handlers.clone_obj = NULL;
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ proto KRB5SidSet::__construct( array $sids )
+   Precompiles a set of SIDs ("S-1-5-21-...") for hasGroup() checks */
+PHP_METHOD(KRB5SidSet, __construct)
+{
+	krb5_sid_set_object *object = KRB5_SID_SET_OBJ_P(getThis());
+	zval *zsids, *zsid;
+	zend_string *sid;
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "a", &zsids) == FAILURE) {
+		return;
+	}
+
+	zend_hash_clean(&object->sids);
+	ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(zsids), zsid) {
+		if(Z_TYPE_P(zsid) != IS_STRING || !(sid = php_krb5_sid_parse(Z_STRVAL_P(zsid), Z_STRLEN_P(zsid)))) {
+			zend_throw_exception(NULL, "Invalid SID given", 0 TSRMLS_CC);
+			return;
+		}
+		zend_hash_add_empty_element(&object->sids, sid);
+		zend_string_release(sid);
+	} ZEND_HASH_FOREACH_END();
+} /* }}} */
+
+/* {{{ proto bool KRB5SidSet::contains( string $sid )
+   Checks whether sid is in the set */
+PHP_METHOD(KRB5SidSet, contains)
+{
+	krb5_sid_set_object *object = KRB5_SID_SET_OBJ_P(getThis());
+	char *str;
+	size_t str_len;
+	zend_string *sid;
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &str, &str_len) == FAILURE) {
+		return;
+	}
+
+	if(!(sid = php_krb5_sid_parse(str, str_len))) {
+		RETURN_FALSE;
+	}
+
+	RETVAL_BOOL(zend_hash_exists(&object->sids, sid));
+	zend_string_release(sid);
+} /* }}} */
+
+/* {{{ proto int KRB5SidSet::count( )
+   Number of SIDs in the set */
+PHP_METHOD(KRB5SidSet, count)
+{
+	krb5_sid_set_object *object = KRB5_SID_SET_OBJ_P(getThis());
+
+	if(zend_parse_parameters_none() == FAILURE) {
+		return;
+	}
+
+	RETURN_LONG(zend_hash_num_elements(&object->sids));
+} /* }}} */
+
+/* {{{ proto KRB5SidSet KRB5SidSet::fromLogonInfo( string $logon_info )
+   Decodes the group SIDs of a PAC logon info buffer (urn:mspac:logon-info) */
+PHP_METHOD(KRB5SidSet, fromLogonInfo)
+{
+	krb5_sid_set_object *object;
+	char *buf;
+	size_t buf_len;
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &buf, &buf_len) == FAILURE) {
+		return;
+	}
+
+	object_init_ex(return_value, krb5_ce_sid_set);
+	object = KRB5_SID_SET_OBJ_P(return_value);
+
+	if(php_krb5_pac_logon_info_groups((const unsigned char*) buf, buf_len, &object->sids) == FAILURE) {
+		zval_dtor(return_value);
+		ZVAL_NULL(return_value);
+		zend_throw_exception(NULL, "Failed to decode PAC logon information", 0 TSRMLS_CC);
+		return;
+	}
+} /* }}} */
@@ -0,0 +1,188 @@
+/**
+* Copyright (c) 2008 Moritz Bechler
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+**/
+
+
+/*
+ * GSS name cache
+ *
+ * Target names of initSecContext(), credential names of
+ * acquireCredentials() and the acceptor names of KRB5NegotiateAuth are
+ * imported once per worker, callers get a duplicate of the cached name.
+ * Initiator names are also canonicalised for the Kerberos mechanism, which
+ * is where hostbased names get resolved; acceptor names are left as
+ * imported so the library's acceptor name matching is unchanged. Entries
+ * are keyed by name type, canonicalisation and string and live for
+ * krb5.name_cache_ttl seconds.
+ *
+ * The table is kept in least recently used order: hits are moved to the
+ * end and krb5.name_cache_size bounds it by dropping from the front.
+ */
+
+#include "php_krb5.h"
+
+typedef struct _php_krb5_name_entry {
+	gss_name_t name;
+	time_t expires;
+} php_krb5_name_entry;
+
+/* {{{ */
+static void php_krb5_name_entry_free(php_krb5_name_entry *entry)
+{
+	OM_uint32 minor_status = 0;
+
+	if(entry->name != GSS_C_NO_NAME) {
+		gss_release_name(&minor_status, &entry->name);
+	}
+	pefree(entry, 1);
+}
+/* }}} */
+
+/* {{{ Releases all entries, the table itself has no destructor so hits
+       can be moved to the end without freeing them */
+void php_krb5_name_cache_clear(HashTable *cache)
+{
+	php_krb5_name_entry *entry;
+
+	ZEND_HASH_FOREACH_PTR(cache, entry) {
+		php_krb5_name_entry_free(entry);
+	} ZEND_HASH_FOREACH_END();
+
+	zend_hash_clean(cache);
+}
+/* }}} */
+
+/* {{{ "<OID length, 4 octets big endian><name type OID bytes><'c' or 'i'><name>",
+       the OID is empty for GSS_C_NO_OID. With its length in front the OID
+       cannot run into the name, which takes the rest of the key */
+static zend_string *php_krb5_name_cache_key(const char *str, size_t len, gss_OID type, int canonicalize)
+{
+	OM_uint32 oid_len = type != GSS_C_NO_OID ? type->length : 0;
+	zend_string *key = zend_string_alloc(4 + oid_len + 1 + len, 0);
+	unsigned char *p = (unsigned char*) ZSTR_VAL(key);
+
+	p[0] = (oid_len >> 24) & 0xff;
+	p[1] = (oid_len >> 16) & 0xff;
+	p[2] = (oid_len >> 8) & 0xff;
+	p[3] = oid_len & 0xff;
+	if(oid_len) {
+		memcpy(p + 4, type->elements, oid_len);
+	}
+	p[4 + oid_len] = canonicalize ? 'c' : 'i';
+	memcpy(p + 4 + oid_len + 1, str, len);
+	ZSTR_VAL(key)[ZSTR_LEN(key)] = '\0';
+
+	return key;
+}
+/* }}} */
+
+/* {{{ Imports and optionally canonicalises a name, falls back to the plain
+       imported name should the mechanism be unable to canonicalise it */
+static OM_uint32 php_krb5_name_cache_load(OM_uint32 *minor_status, const char *str, size_t len, gss_OID type, int canonicalize, gss_name_t *name)
+{
+	gss_buffer_desc nametmp;
+	gss_name_t imported = GSS_C_NO_NAME;
+	OM_uint32 status, tmp_status = 0;
+
+	nametmp.value = (void*) str;
+	nametmp.length = len;
+
+	status = gss_import_name(minor_status, &nametmp, type, &imported);
+	if(GSS_ERROR(status) || !canonicalize) {
+		*name = imported;
+		return status;
+	}
+
+	if(GSS_ERROR(gss_canonicalize_name(&tmp_status, imported, (gss_OID) gss_mech_krb5, name))) {
+		*name = imported;
+		return status;
+	}
+
+	gss_release_name(&tmp_status, &imported);
+	return GSS_S_COMPLETE;
+}
+/* }}} */
+
+/* {{{ Returns a (caller owned) imported name for str, from the cache if
+       possible. canonicalize is for names used by initiators */
+OM_uint32 php_krb5_name_cache_import(OM_uint32 *minor_status, const char *str, size_t len, gss_OID type, int canonicalize, gss_name_t *name TSRMLS_DC)
+{
+	HashTable *cache = &KRB5_G(name_cache);
+	php_krb5_name_entry *entry;
+	zend_string *key;
+	time_t now;
+	OM_uint32 status;
+
+	*name = GSS_C_NO_NAME;
+
+	if(KRB5_G(name_cache_ttl) <= 0 || KRB5_G(name_cache_size) <= 0) {
+		gss_buffer_desc nametmp;
+		nametmp.value = (void*) str;
+		nametmp.length = len;
+		return gss_import_name(minor_status, &nametmp, type, name);
+	}
+
+	now = time(NULL);
+	key = php_krb5_name_cache_key(str, len, type, canonicalize);
+
+	entry = zend_hash_find_ptr(cache, key);
+	if(entry && entry->expires > now) {
+		KRB5_G(name_cache_hits)++;
+		/* move to the most recently used end */
+		zend_hash_del(cache, key);
+		zend_hash_str_add_ptr(cache, ZSTR_VAL(key), ZSTR_LEN(key), entry);
+		zend_string_release(key);
+		return gss_duplicate_name(minor_status, entry->name, name);
+	}
+
+	KRB5_G(name_cache_misses)++;
+	if(entry) {
+		php_krb5_name_entry_free(entry);
+		zend_hash_del(cache, key);
+	}
+
+	entry = pemalloc(sizeof(php_krb5_name_entry), 1);
+	status = php_krb5_name_cache_load(minor_status, str, len, type, canonicalize, &entry->name);
+	if(GSS_ERROR(status)) {
+		pefree(entry, 1);
+		zend_string_release(key);
+		return status;
+	}
+	entry->expires = now + KRB5_G(name_cache_ttl);
+
+	/* evict the least recently used entries */
+	while(zend_hash_num_elements(cache) >= (uint32_t) KRB5_G(name_cache_size)) {
+		HashPosition pos;
+		zend_string *oldest;
+		zend_ulong idx;
+
+		zend_hash_internal_pointer_reset_ex(cache, &pos);
+		php_krb5_name_entry_free(zend_hash_get_current_data_ptr_ex(cache, &pos));
+		zend_hash_get_current_key_ex(cache, &oldest, &idx, &pos);
+		zend_hash_del(cache, oldest);
+	}
+
+	zend_hash_str_add_ptr(cache, ZSTR_VAL(key), ZSTR_LEN(key), entry);
+	zend_string_release(key);
+
+	return gss_duplicate_name(minor_status, entry->name, name);
+}
+/* }}} */
@@ -23,10 +23,11 @@
 #include "php_krb5.h"
 #include "php_krb5_gssapi.h"
 #include "SAPI.h"
-#include "ext/standard/base64.h"
+#include "ext/hash/php_hash_sha.h"
 #include <math.h>
 #include <netdb.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 
 /* Class definition */
 zend_object_handlers krb5_negotiate_auth_handlers;
@@ -37,6 +38,17 @@ typedef struct _krb5_negotiate_auth_object {
 	gss_name_t servname;
 	gss_name_t authed_user;
 	gss_cred_id_t delegated;
+	char *keytab;
+	zend_string *cred_key;
+	zend_bool rcache_shm;
+	/* session tokens: keys by id (first one signs), last issued token,
+	   user of the last validated token */
+	zval session_keys;
+	zend_long session_lifetime;
+	zend_string *session_token;
+	zend_string *session_user;
+	/* decoded PAC group SIDs of authed_user */
+	HashTable *group_sids;
 	zend_object std;
 } krb5_negotiate_auth_object;
 
@@ -49,11 +61,61 @@ static inline krb5_negotiate_auth_object *php_krb5_negotiate_auth_object(zend_ob
 static void php_krb5_negotiate_auth_object_dtor(zend_object *obj);
 zend_object *php_krb5_negotiate_auth_object_new(zend_class_entry *ce);
 
+/* KRB5NegotiateResult, the outcome of KRB5NegotiateAuth::authenticate() */
+zend_object_handlers krb5_negotiate_result_handlers;
+
+zend_class_entry *krb5_ce_negotiate_result;
+
+typedef struct _krb5_negotiate_result_object {
+	zend_string *principal;
+	zend_string *token;
+	zend_string *session_token;
+	gss_cred_id_t delegated;
+	gss_name_t name;
+	HashTable *group_sids;
+	time_t expires;
+	/* partially established context awaiting the client's next token */
+	gss_ctx_id_t context;
+	zend_object std;
+} krb5_negotiate_result_object;
+
+static inline krb5_negotiate_result_object *php_krb5_negotiate_result_object(zend_object *obj) {
+	return (krb5_negotiate_result_object *)((char*)(obj) - XtOffsetOf(krb5_negotiate_result_object, std));
+}
+#define KRB5_NEGOTIATE_RESULT_OBJ_P(zv) php_krb5_negotiate_result_object(Z_OBJ_P(zv))
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5NegotiateAuth_none, 0, 0, 0)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5NegotiateAuth__construct, 0, 0, 1)
 	ZEND_ARG_INFO(0, keytab)
+	ZEND_ARG_INFO(0, spn)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5NegotiateAuth_setReplayCache, 0, 0, 1)
+	ZEND_ARG_INFO(0, type)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5NegotiateAuth_setSessionKeys, 0, 0, 1)
+	ZEND_ARG_ARRAY_INFO(0, keys, 0)
+	ZEND_ARG_INFO(0, lifetime)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5NegotiateAuth_validateSessionToken, 0, 0, 1)
+	ZEND_ARG_INFO(0, token)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5NegotiateAuth_authenticate, 0, 0, 1)
+	ZEND_ARG_INFO(0, authorizationHeader)
+	ZEND_ARG_OBJ_INFO(0, previous, KRB5NegotiateResult, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5NegotiateAuth_getNameAttribute, 0, 0, 1)
+	ZEND_ARG_INFO(0, attribute)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5NegotiateAuth_hasGroup, 0, 0, 1)
+	ZEND_ARG_OBJ_INFO(0, groups, KRB5SidSet, 0)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5NegotiateAuth_getDelegatedCredentials, 0, 0, 1)
@@ -64,12 +126,56 @@ PHP_METHOD(KRB5NegotiateAuth, __construct);
 PHP_METHOD(KRB5NegotiateAuth, doAuthentication);
 PHP_METHOD(KRB5NegotiateAuth, getDelegatedCredentials);
 PHP_METHOD(KRB5NegotiateAuth, getAuthenticatedUser);
+PHP_METHOD(KRB5NegotiateAuth, setReplayCache);
+PHP_METHOD(KRB5NegotiateAuth, setSessionKeys);
+PHP_METHOD(KRB5NegotiateAuth, getSessionToken);
+PHP_METHOD(KRB5NegotiateAuth, validateSessionToken);
+PHP_METHOD(KRB5NegotiateAuth, authenticate);
+PHP_METHOD(KRB5NegotiateAuth, getNameAttributes);
+PHP_METHOD(KRB5NegotiateAuth, getNameAttribute);
+PHP_METHOD(KRB5NegotiateAuth, getGroupSids);
+PHP_METHOD(KRB5NegotiateAuth, hasGroup);
+PHP_METHOD(KRB5NegotiateResult, isComplete);
+PHP_METHOD(KRB5NegotiateResult, getPrincipal);
+PHP_METHOD(KRB5NegotiateResult, getResponseToken);
+PHP_METHOD(KRB5NegotiateResult, getSessionToken);
+PHP_METHOD(KRB5NegotiateResult, getExpires);
+PHP_METHOD(KRB5NegotiateResult, hasDelegatedCredentials);
+PHP_METHOD(KRB5NegotiateResult, getDelegatedCredentials);
+PHP_METHOD(KRB5NegotiateResult, getNameAttributes);
+PHP_METHOD(KRB5NegotiateResult, getNameAttribute);
+PHP_METHOD(KRB5NegotiateResult, getGroupSids);
+PHP_METHOD(KRB5NegotiateResult, hasGroup);
 
 static zend_function_entry krb5_negotiate_auth_functions[] = {
 	PHP_ME(KRB5NegotiateAuth, __construct,             arginfo_KRB5NegotiateAuth__construct,              ZEND_ACC_PUBLIC | ZEND_ACC_CTOR)
 	PHP_ME(KRB5NegotiateAuth, doAuthentication,        arginfo_KRB5NegotiateAuth_none,                    ZEND_ACC_PUBLIC)
 	PHP_ME(KRB5NegotiateAuth, getDelegatedCredentials, arginfo_KRB5NegotiateAuth_getDelegatedCredentials, ZEND_ACC_PUBLIC)
 	PHP_ME(KRB5NegotiateAuth, getAuthenticatedUser,    arginfo_KRB5NegotiateAuth_none,                    ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateAuth, setReplayCache,          arginfo_KRB5NegotiateAuth_setReplayCache,          ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateAuth, setSessionKeys,          arginfo_KRB5NegotiateAuth_setSessionKeys,          ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateAuth, getSessionToken,         arginfo_KRB5NegotiateAuth_none,                    ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateAuth, validateSessionToken,    arginfo_KRB5NegotiateAuth_validateSessionToken,    ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateAuth, authenticate,            arginfo_KRB5NegotiateAuth_authenticate,            ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateAuth, getNameAttributes,       arginfo_KRB5NegotiateAuth_none,                    ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateAuth, getNameAttribute,        arginfo_KRB5NegotiateAuth_getNameAttribute,        ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateAuth, getGroupSids,            arginfo_KRB5NegotiateAuth_none,                    ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateAuth, hasGroup,                arginfo_KRB5NegotiateAuth_hasGroup,                ZEND_ACC_PUBLIC)
+	PHP_FE_END
+};
+
+static zend_function_entry krb5_negotiate_result_functions[] = {
+	PHP_ME(KRB5NegotiateResult, isComplete,              arginfo_KRB5NegotiateAuth_none,                    ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateResult, getPrincipal,            arginfo_KRB5NegotiateAuth_none,                    ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateResult, getResponseToken,        arginfo_KRB5NegotiateAuth_none,                    ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateResult, getSessionToken,         arginfo_KRB5NegotiateAuth_none,                    ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateResult, getExpires,              arginfo_KRB5NegotiateAuth_none,                    ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateResult, hasDelegatedCredentials, arginfo_KRB5NegotiateAuth_none,                    ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateResult, getDelegatedCredentials, arginfo_KRB5NegotiateAuth_getDelegatedCredentials, ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateResult, getNameAttributes,       arginfo_KRB5NegotiateAuth_none,                    ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateResult, getNameAttribute,        arginfo_KRB5NegotiateAuth_getNameAttribute,        ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateResult, getGroupSids,            arginfo_KRB5NegotiateAuth_none,                    ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5NegotiateResult, hasGroup,                arginfo_KRB5NegotiateAuth_hasGroup,                ZEND_ACC_PUBLIC)
 	PHP_FE_END
 };
 
@@ -78,60 +184,95 @@ static zend_function_entry krb5_negotiate_auth_functions[] = {
 /* {{{ */
 static void php_krb5_negotiate_auth_object_dtor(zend_object *obj)
 {
-//	krb5_negotiate_auth_object *object = php_krb5_negotiate_auth_object(obj);
+	krb5_negotiate_auth_object *object = php_krb5_negotiate_auth_object(obj);
+	OM_uint32 minor_status = 0;
+
+	if(object->servname != GSS_C_NO_NAME) {
+		gss_release_name(&minor_status, &object->servname);
+	}
+
+	if(object->authed_user != GSS_C_NO_NAME) {
+		gss_release_name(&minor_status, &object->authed_user);
+	}
+
+	if(object->delegated != GSS_C_NO_CREDENTIAL) {
+		gss_release_cred(&minor_status, &object->delegated);
+	}
+
+	if(object->keytab) efree(object->keytab);
+	if(object->cred_key) zend_string_release(object->cred_key);
+	if(object->session_token) zend_string_release(object->session_token);
+	if(object->session_user) zend_string_release(object->session_user);
+	if(object->group_sids) php_krb5_group_sids_free(object->group_sids);
+	zval_ptr_dtor(&object->session_keys);
+
+	zend_object_std_dtor(&object->std);
 } /* }}} */
 
 /* {{{ */
 zend_object *php_krb5_negotiate_auth_object_new(zend_class_entry *ce)
 {
 	krb5_negotiate_auth_object *object;
-	OM_uint32 status, minor_status;
-	/* lookup server's FQDN */
-	zval *server, *server_name;
-	gss_buffer_desc nametmp;
 
 	object = ecalloc(1, sizeof(krb5_negotiate_auth_object) + zend_object_properties_size(ce));
 
 	object->authed_user = GSS_C_NO_NAME;
 	object->servname = GSS_C_NO_NAME;
 	object->delegated = GSS_C_NO_CREDENTIAL;
+	object->rcache_shm = php_krb5_rcache_enabled() && php_krb5_rcache_configured(TSRMLS_C);
+	ZVAL_UNDEF(&object->session_keys);
 
-	server = zend_hash_str_find(&EG(symbol_table), "_SERVER", sizeof("_SERVER") - 1);
-	if(server != NULL) {
-		server_name = zend_hash_str_find(Z_ARRVAL_P(server), "SERVER_NAME", sizeof("SERVER_NAME") - 1);
-		if(server_name != NULL) {
-			zend_string *zs_servername =  zval_get_string(server_name);
-			char *hostname = ZSTR_VAL(zs_servername);
-			struct hostent* host = gethostbyname(hostname);
+	zend_object_std_init(&object->std, ce TSRMLS_CC);
 
-			if(!host) {
-				php_error_docref(NULL TSRMLS_CC, E_WARNING, "Failed to get server FQDN - Lookup failure");
-			}
+	object_properties_init(&(object->std), ce);
 
-			nametmp.length = strlen(host->h_name) + 6;
-			nametmp.value = emalloc(sizeof(char)*nametmp.length);
-			snprintf(nametmp.value, nametmp.length, "HTTP@%s",host->h_name);
+	object->std.handlers = &krb5_negotiate_auth_handlers;
 
-			status = gss_import_name(&minor_status, &nametmp,
-							GSS_C_NT_HOSTBASED_SERVICE, &object->servname);
+	return &object->std;
+} /* }}} */
 
-			if(GSS_ERROR(status)) {
-				php_krb5_gssapi_handle_error(status, minor_status TSRMLS_CC);
-				php_error_docref(NULL TSRMLS_CC, E_ERROR, "Could not parse server name");
-			}
+/* {{{ */
+static void php_krb5_negotiate_result_object_dtor(zend_object *obj)
+{
+	krb5_negotiate_result_object *object = php_krb5_negotiate_result_object(obj);
+	OM_uint32 minor_status = 0;
 
-			efree(nametmp.value);
-		} else {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Failed to get server FQDN");
-		}
+	if(object->delegated != GSS_C_NO_CREDENTIAL) {
+		gss_release_cred(&minor_status, &object->delegated);
+	}
+
+	if(object->name != GSS_C_NO_NAME) {
+		gss_release_name(&minor_status, &object->name);
+	}
+
+	if(object->context != GSS_C_NO_CONTEXT) {
+		gss_delete_sec_context(&minor_status, &object->context, GSS_C_NO_BUFFER);
 	}
 
+	if(object->group_sids) php_krb5_group_sids_free(object->group_sids);
+	if(object->principal) zend_string_release(object->principal);
+	if(object->token) zend_string_release(object->token);
+	if(object->session_token) zend_string_release(object->session_token);
+
+	zend_object_std_dtor(&object->std);
+} /* }}} */
+
+/* {{{ */
+static zend_object *php_krb5_negotiate_result_object_new(zend_class_entry *ce)
+{
+	krb5_negotiate_result_object *object;
+
+	object = ecalloc(1, sizeof(krb5_negotiate_result_object) + zend_object_properties_size(ce));
+
+	object->delegated = GSS_C_NO_CREDENTIAL;
+	object->name = GSS_C_NO_NAME;
+	object->context = GSS_C_NO_CONTEXT;
+
 	zend_object_std_init(&object->std, ce TSRMLS_CC);
 
 	object_properties_init(&(object->std), ce);
 
-	krb5_negotiate_auth_handlers.offset = XtOffsetOf(krb5_negotiate_auth_object, std);
-	object->std.handlers = &krb5_negotiate_auth_handlers;
+	object->std.handlers = &krb5_negotiate_result_handlers;
 
 	return &object->std;
 } /* }}} */
@@ -139,246 +280,1288 @@ zend_object *php_krb5_negotiate_auth_object_new(zend_class_entry *ce)
 /* {{{ */
 int php_krb5_negotiate_auth_register_classes(TSRMLS_D) {
 	zend_class_entry negotiate_auth;
+	zend_class_entry negotiate_result;
 
 	INIT_CLASS_ENTRY(negotiate_auth, "KRB5NegotiateAuth", krb5_negotiate_auth_functions);
 
 	krb5_ce_negotiate_auth = zend_register_internal_class(&negotiate_auth);
 	krb5_ce_negotiate_auth->create_object = php_krb5_negotiate_auth_object_new;
 
+	memcpy(&krb5_negotiate_auth_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	krb5_negotiate_auth_handlers.offset = XtOffsetOf(krb5_negotiate_auth_object, std);
 	krb5_negotiate_auth_handlers.free_obj = php_krb5_negotiate_auth_object_dtor;
 
-	memcpy(&krb5_negotiate_auth_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	INIT_CLASS_ENTRY(negotiate_result, "KRB5NegotiateResult", krb5_negotiate_result_functions);
+
+	krb5_ce_negotiate_result = zend_register_internal_class(&negotiate_result);
+	krb5_ce_negotiate_result->create_object = php_krb5_negotiate_result_object_new;
+	krb5_ce_negotiate_result->ce_flags |= ZEND_ACC_FINAL;
+
+	memcpy(&krb5_negotiate_result_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	krb5_negotiate_result_handlers.offset = XtOffsetOf(krb5_negotiate_result_object, std);
+	krb5_negotiate_result_handlers.free_obj = php_krb5_negotiate_result_object_dtor;
+	krb5_negotiate_result_handlers.clone_obj = NULL;
 
 	return SUCCESS;
 } /* }}} */
 
 
-/** KRB5NegotiateAuth Methods **/
-/* {{{ proto bool KRB5NegotiateAuth::__construct( string $keytab )
-   Initialize KRB5NegotitateAuth object with a keytab to use  */
-PHP_METHOD(KRB5NegotiateAuth, __construct)
+/** Acceptor host name cache **/
+typedef struct _php_krb5_negotiate_name {
+	char *fqdn;
+	time_t expires;
+} php_krb5_negotiate_name;
+
+/* bounds the cache should SERVER_NAME follow the client's Host header */
+#define PHP_KRB5_NEGOTIATE_NAMES_MAX 64
+
+/* {{{ */
+void php_krb5_negotiate_name_dtor(zval *zv)
 {
-	char *keytab;
-	int keytab_len;
+	php_krb5_negotiate_name *entry = Z_PTR_P(zv);
 
-	KRB5_SET_ERROR_HANDLING(EH_THROW);
-	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, ARG_PATH, &keytab, &keytab_len) == FAILURE) {
-		RETURN_FALSE;
-	}
-	KRB5_SET_ERROR_HANDLING(EH_NORMAL);
+	pefree(entry->fqdn, 1);
+	pefree(entry, 1);
+} /* }}} */
 
-	if(krb5_gss_register_acceptor_identity(keytab) != GSS_S_COMPLETE) {
-		zend_throw_exception(NULL, "Failed to use credential cache", 0 TSRMLS_CC);
-		return;
+/* {{{ Makes room for one more host name: drops an expired entry if there
+       is one, otherwise the oldest */
+static void php_krb5_negotiate_name_evict(time_t now TSRMLS_DC)
+{
+	php_krb5_negotiate_name *entry;
+	zend_string *key, *oldest = NULL;
+
+	ZEND_HASH_FOREACH_STR_KEY_PTR(&KRB5_G(negotiate_names), key, entry) {
+		if(entry->expires <= now) {
+			zend_hash_del(&KRB5_G(negotiate_names), key);
+			return;
+		}
+		if(!oldest) {
+			oldest = key;
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	/* insertion order, the first entry is the oldest */
+	if(oldest) {
+		zend_hash_del(&KRB5_G(negotiate_names), oldest);
 	}
 } /* }}} */
 
-/* {{{ proto bool KRB5NegotiateAuth::doAuthentication(  )
-   Performs Negotiate/GSSAPI authentication  */
-PHP_METHOD(KRB5NegotiateAuth, doAuthentication)
+/* {{{ Imports HTTP@<FQDN of hostname>, which is returned in *service. The
+       FQDN is kept per worker for krb5.negotiate_name_ttl seconds so DNS is
+       not queried on every request, a failed lookup only for
+       krb5.negotiate_name_negative_ttl seconds. The imported name comes
+       from the shared name cache */
+static OM_uint32 php_krb5_negotiate_lookup_name(OM_uint32 *minor_status, const char *hostname, size_t hostname_len, gss_name_t *name, zend_string **service TSRMLS_DC)
 {
-	zend_string *token = NULL;
-	krb5_negotiate_auth_object *object = Z_KRB5_NEGOTIATE_AUTH_OBJ_P(getThis());
+	php_krb5_negotiate_name *entry;
+	struct addrinfo hints, *res = NULL;
+	const char *fqdn = hostname;
+	OM_uint32 status;
+	time_t now = time(NULL);
+	zend_long ttl = KRB5_G(negotiate_name_ttl);
+
+	entry = zend_hash_str_find_ptr(&KRB5_G(negotiate_names), hostname, hostname_len);
+	if(entry && entry->expires > now) {
+		KRB5_G(negotiate_name_hits)++;
+		fqdn = entry->fqdn;
+	} else {
+		KRB5_G(negotiate_name_misses)++;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_CANONNAME;
+
+		if(getaddrinfo(hostname, NULL, &hints, &res) == 0 && res->ai_canonname) {
+			fqdn = res->ai_canonname;
+		} else {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Failed to get server FQDN - Lookup failure");
+			/* a short DNS outage must not stick for the whole TTL */
+			ttl = MIN(ttl, KRB5_G(negotiate_name_negative_ttl));
+		}
 
-	OM_uint32 status = 0;
-	OM_uint32 minor_status = 0;
-	OM_uint32 flags;
-	gss_ctx_id_t gss_context = GSS_C_NO_CONTEXT;
-	gss_buffer_t input_token = GSS_C_NO_BUFFER;
-	gss_buffer_desc output_token;
-	gss_cred_id_t server_creds = GSS_C_NO_CREDENTIAL;
+		/* the refreshed entry moves to the end of the insertion order */
+		if(entry) {
+			zend_hash_str_del(&KRB5_G(negotiate_names), hostname, hostname_len);
+		}
 
-	if (zend_parse_parameters_none() == FAILURE) {
-		RETURN_FALSE;
+		if(ttl > 0) {
+			if(zend_hash_num_elements(&KRB5_G(negotiate_names)) >= PHP_KRB5_NEGOTIATE_NAMES_MAX) {
+				php_krb5_negotiate_name_evict(now TSRMLS_CC);
+			}
+
+			entry = pemalloc(sizeof(php_krb5_negotiate_name), 1);
+			entry->fqdn = pestrdup(fqdn, 1);
+			entry->expires = now + ttl;
+			zend_hash_str_add_ptr(&KRB5_G(negotiate_names), hostname, hostname_len, entry);
+		}
 	}
 
-	if(!object) {
-		RETURN_FALSE;
+	*service = strpprintf(0, "HTTP@%s", fqdn);
+	if(res) freeaddrinfo(res);
+
+	return php_krb5_name_cache_import(minor_status, ZSTR_VAL(*service), ZSTR_LEN(*service), GSS_C_NT_HOSTBASED_SERVICE, 0, name TSRMLS_CC);
+} /* }}} */
+
+
+/** Acceptor credential cache **/
+typedef struct _php_krb5_negotiate_cred {
+	gss_cred_id_t cred;
+	char *ktname;
+	zend_bool rcache_shm;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+} php_krb5_negotiate_cred;
+
+/* bounds the cache as well, one entry per keytab and canonical service name */
+#define PHP_KRB5_NEGOTIATE_CREDS_MAX 64
+
+/* {{{ */
+void php_krb5_negotiate_cred_dtor(zval *zv)
+{
+	php_krb5_negotiate_cred *entry = Z_PTR_P(zv);
+	OM_uint32 minor_status = 0;
+
+	if(entry->cred != GSS_C_NO_CREDENTIAL) {
+		gss_release_cred(&minor_status, &entry->cred);
 	}
+	pefree(entry->ktname, 1);
+	pefree(entry, 1);
+} /* }}} */
 
+/* {{{ Returns the acceptor credentials for the object's keytab and service name.
+       They are acquired once per worker and reacquired only when the keytab
+       changes: either the keytab cache switched to a new copy, or, with the
+       cache disabled, the file itself changed. *owned tells whether the
+       caller has to release them */
+static OM_uint32 php_krb5_negotiate_acceptor_cred(OM_uint32 *minor_status, krb5_negotiate_auth_object *object, gss_cred_id_t *cred, int *owned TSRMLS_DC)
+{
+	php_krb5_negotiate_cred *entry = NULL;
+	const char *ktname = NULL;
+	struct stat st;
+	int cacheable = 0;
+	OM_uint32 status;
 
-	/* get authentication data */
-	zval *auth_header;
+	*owned = 1;
+	memset(&st, 0, sizeof(st));
 
-	if (Z_TYPE(PG(http_globals)[TRACK_VARS_SERVER]) == IS_ARRAY || zend_is_auto_global_str(ZEND_STRL("_SERVER"))) {
-		auth_header = zend_hash_str_find(Z_ARRVAL(PG(http_globals)[TRACK_VARS_SERVER]), "HTTP_AUTHORIZATION", sizeof("HTTP_AUTHORIZATION") - 1);
-		if (auth_header != NULL) {
-			if(!strncasecmp(Z_STRVAL_P(auth_header), "negotiate", 9) == 0) {
-				// user agent did not provide negotiate authentication data
-				RETURN_FALSE;
-			}
-	 
-			if(Z_STRLEN_P(auth_header) < 11) {
-				// user agent gave negotiate header but no data
-				zend_throw_exception(NULL, "Invalid negotiate authentication data given", 0 TSRMLS_CC);
-				return;
-			}
-	 
-			token = php_base64_decode_ex((unsigned char*) Z_STRVAL_P(auth_header)+10, Z_STRLEN_P(auth_header) - 10, 1);
+	if(object->keytab) {
+		ktname = php_krb5_keytab_cache_name(object->keytab TSRMLS_CC);
+	}
+
+	if(ktname && object->cred_key) {
+		if(ktname != object->keytab) {
+			/* in-memory copy, the keytab cache watches the file */
+			cacheable = 1;
+		} else if(php_krb5_keytab_stat(object->keytab, &st) == SUCCESS) {
+			cacheable = 1;
 		}
- 	} else {
-		// No authentication data given by the user agent
-		sapi_header_line ctr = {0};
+	}
 
-		ctr.line = "WWW-Authenticate: Negotiate";
-		ctr.line_len = strlen("WWW-Authenticate: Negotiate");
-		ctr.response_code = 401;
-		sapi_header_op(SAPI_HEADER_ADD, &ctr TSRMLS_CC);
-		RETURN_FALSE;
+	if(cacheable) {
+		entry = zend_hash_find_ptr(&KRB5_G(negotiate_creds), object->cred_key);
+		if(entry && strcmp(entry->ktname, ktname) == 0 && entry->rcache_shm == object->rcache_shm && entry->dev == st.st_dev && entry->ino == st.st_ino &&
+				entry->size == st.st_size && entry->mtime == st.st_mtime) {
+			*cred = entry->cred;
+			*owned = 0;
+			return GSS_S_COMPLETE;
+		}
 	}
 
-	if(!token) {
-        	zend_throw_exception(NULL, "Failed to decode token data", 0 TSRMLS_CC);
-		return;
+	/* the credentials keep the keytab and replay cache they were acquired with */
+	status = php_krb5_gssapi_acquire_cred(minor_status, object->servname, GSS_C_ACCEPT, NULL, ktname, object->rcache_shm, cred TSRMLS_CC);
+
+	if(GSS_ERROR(status) || !cacheable) {
+		return status;
 	}
 
-	status = gss_acquire_cred(&minor_status,
-			object->servname,
-			0,
-			GSS_C_NO_OID_SET,
-			GSS_C_ACCEPT,
-			&server_creds,
-			NULL,
-			NULL);
+	if(zend_hash_num_elements(&KRB5_G(negotiate_creds)) >= PHP_KRB5_NEGOTIATE_CREDS_MAX &&
+			!zend_hash_exists(&KRB5_G(negotiate_creds), object->cred_key)) {
+		zend_string *oldest = NULL;
 
-	if(GSS_ERROR(status)) {
-		efree(token);
-		php_krb5_gssapi_handle_error(status, minor_status TSRMLS_CC);
-		zend_throw_exception(NULL, "Error while obtaining server credentials", status TSRMLS_CC);
-		RETURN_FALSE;
+		/* insertion order, the first entry is the oldest */
+		ZEND_HASH_FOREACH_STR_KEY(&KRB5_G(negotiate_creds), oldest) {
+			break;
+		} ZEND_HASH_FOREACH_END();
+		if(oldest) {
+			zend_hash_del(&KRB5_G(negotiate_creds), oldest);
+		}
 	}
-	minor_status = 0;
 
-	input_token = emalloc(sizeof(gss_buffer_desc));
-	input_token->length = ZSTR_LEN(token);
-	input_token->value = ZSTR_VAL(token);
+	entry = pemalloc(sizeof(php_krb5_negotiate_cred), 1);
+	entry->cred = *cred;
+	entry->ktname = pestrdup(ktname, 1);
+	entry->rcache_shm = object->rcache_shm;
+	entry->dev = st.st_dev;
+	entry->ino = st.st_ino;
+	entry->size = st.st_size;
+	entry->mtime = st.st_mtime;
+	zend_hash_str_update_ptr(&KRB5_G(negotiate_creds), ZSTR_VAL(object->cred_key), ZSTR_LEN(object->cred_key), entry);
+
+	*owned = 0;
+	return status;
+} /* }}} */
 
-	status = gss_accept_sec_context(   &minor_status,
-                                       &gss_context,
-                                       server_creds,
-                                       input_token,
-                                       GSS_C_NO_CHANNEL_BINDINGS,
-                                       &object->authed_user,
-                                       NULL,
-                                       &output_token,
-                                       &flags,
-                                       NULL,
-                                       &object->delegated);
 
+/** Session tokens **/
+/* "<key id>.<expires>.<principal>.<mac>", principal and mac base64url encoded,
+   mac = HMAC-SHA256(key, "<key id>.<expires>.<principal>") */
+#define PHP_KRB5_SESSION_KEYID_MAX 32
+#define PHP_KRB5_SESSION_KEY_MIN   16
+#define PHP_KRB5_SESSION_MAC_LEN   32
 
-	if(!(flags & GSS_C_DELEG_FLAG)) {
-		object->delegated = GSS_C_NO_CREDENTIAL;
+/* {{{ */
+static void php_krb5_session_hmac(const char *key, size_t key_len, const char *data, size_t len, unsigned char *mac)
+{
+	PHP_SHA256_CTX sha;
+	unsigned char k[64], pad[64];
+	int i;
+
+	memset(k, 0, sizeof(k));
+	if(key_len > sizeof(k)) {
+		PHP_SHA256Init(&sha);
+		PHP_SHA256Update(&sha, (const unsigned char*) key, key_len);
+		PHP_SHA256Final(k, &sha);
+	} else {
+		memcpy(k, key, key_len);
 	}
 
-	efree(input_token->value);
-	efree(input_token);
+	for(i = 0; i < sizeof(pad); i++) pad[i] = k[i] ^ 0x36;
+	PHP_SHA256Init(&sha);
+	PHP_SHA256Update(&sha, pad, sizeof(pad));
+	PHP_SHA256Update(&sha, (const unsigned char*) data, len);
+	PHP_SHA256Final(mac, &sha);
 
-	if(GSS_ERROR(status)) {
-		php_krb5_gssapi_handle_error(status, minor_status TSRMLS_CC);
-		zend_throw_exception(NULL, "Error while accepting security context", status TSRMLS_CC);
-		RETURN_FALSE;
+	for(i = 0; i < sizeof(pad); i++) pad[i] = k[i] ^ 0x5c;
+	PHP_SHA256Init(&sha);
+	PHP_SHA256Update(&sha, pad, sizeof(pad));
+	PHP_SHA256Update(&sha, mac, PHP_KRB5_SESSION_MAC_LEN);
+	PHP_SHA256Final(mac, &sha);
+
+	ZEND_SECURE_ZERO(k, sizeof(k));
+	ZEND_SECURE_ZERO(pad, sizeof(pad));
+} /* }}} */
+
+/* {{{ */
+static void php_krb5_session_encode(smart_str *out, const unsigned char *data, size_t len)
+{
+	smart_str_alloc(out, php_krb5_base64_encoded_len(len), 0);
+	ZSTR_LEN(out->s) += php_krb5_base64url_encode(data, len, ZSTR_VAL(out->s) + ZSTR_LEN(out->s));
+} /* }}} */
+
+/* {{{ */
+static zend_string *php_krb5_session_decode(const char *data, size_t len)
+{
+	zend_string *result = zend_string_alloc(php_krb5_base64_decoded_len(len), 0);
+
+	if(php_krb5_base64url_decode(data, len, (unsigned char*) ZSTR_VAL(result), &ZSTR_LEN(result)) == FAILURE) {
+		zend_string_free(result);
+		return NULL;
 	}
 
-	if(gss_context != GSS_C_NO_CONTEXT) {
-		gss_delete_sec_context(&minor_status, &gss_context, GSS_C_NO_BUFFER);
+	ZSTR_VAL(result)[ZSTR_LEN(result)] = '\0';
+	return result;
+} /* }}} */
+
+/* {{{ Issues a token for principal with the first session key */
+static zend_string *php_krb5_session_issue(krb5_negotiate_auth_object *object, const char *principal, size_t principal_len, time_t expires)
+{
+	zend_string *key_id;
+	zend_ulong key_idx;
+	zval *key = NULL;
+	unsigned char mac[PHP_KRB5_SESSION_MAC_LEN];
+	smart_str buf = {0};
+
+	ZEND_HASH_FOREACH_KEY_VAL(Z_ARRVAL(object->session_keys), key_idx, key_id, key) {
+		break;
+	} ZEND_HASH_FOREACH_END();
+
+	if(!key) {
+		return NULL;
 	}
 
-	if(output_token.length > 0) {
-		zend_string *encoded = php_base64_encode(output_token.value, output_token.length);
+	if(key_id) {
+		smart_str_append(&buf, key_id);
+	} else {
+		smart_str_append_long(&buf, (zend_long) key_idx);
+	}
+	smart_str_appendc(&buf, '.');
+	smart_str_append_long(&buf, (zend_long) expires);
+	smart_str_appendc(&buf, '.');
+	php_krb5_session_encode(&buf, (const unsigned char*) principal, principal_len);
 
-		sapi_header_line ctr = {0};
+	php_krb5_session_hmac(Z_STRVAL_P(key), Z_STRLEN_P(key), ZSTR_VAL(buf.s), ZSTR_LEN(buf.s), mac);
+	smart_str_appendc(&buf, '.');
+	php_krb5_session_encode(&buf, mac, sizeof(mac));
+	smart_str_0(&buf);
 
-		ctr.line = emalloc(sizeof("WWW-Authenticate: ")+ZSTR_LEN(encoded));
-		strcpy(ctr.line, "WWW-Authenticate: ");
-		strcpy(ctr.line + strlen("WWW-Authenticate: "), (char*) ZSTR_VAL(encoded));
-		ctr.response_code = 200;
-		sapi_header_op(SAPI_HEADER_ADD, &ctr TSRMLS_CC);
+	return buf.s;
+} /* }}} */
 
-		efree(ctr.line);
-		gss_release_buffer(&minor_status, &output_token);
+/* {{{ Checks the signature and expiry of token, returns the principal it was issued for */
+static zend_string *php_krb5_session_validate(krb5_negotiate_auth_object *object, const char *token, size_t token_len)
+{
+	const char *end = token + token_len, *expires_str, *principal_str, *mac_str;
+	unsigned char mac[PHP_KRB5_SESSION_MAC_LEN];
+	zend_string *given, *principal;
+	zend_long expires = 0;
+	zval *key;
+	unsigned char diff = 0;
+	int i;
+
+	if(!(expires_str = memchr(token, '.', token_len)) || expires_str - token > PHP_KRB5_SESSION_KEYID_MAX) return NULL;
+	expires_str++;
+	if(!(principal_str = memchr(expires_str, '.', end - expires_str))) return NULL;
+	principal_str++;
+	if(!(mac_str = memchr(principal_str, '.', end - principal_str))) return NULL;
+	mac_str++;
+
+	for(i = 0; expires_str + i < principal_str - 1; i++) {
+		if(expires_str[i] < '0' || expires_str[i] > '9' || i > 18) return NULL;
+		expires = expires * 10 + (expires_str[i] - '0');
 	}
-	RETURN_TRUE;
+	if(i == 0 || expires <= (zend_long) time(NULL)) return NULL;
+
+	key = zend_symtable_str_find(Z_ARRVAL(object->session_keys), token, expires_str - token - 1);
+	if(!key || Z_TYPE_P(key) != IS_STRING) return NULL;
+
+	given = php_krb5_session_decode(mac_str, end - mac_str);
+	if(!given) return NULL;
+	if(ZSTR_LEN(given) != sizeof(mac)) {
+		zend_string_release(given);
+		return NULL;
+	}
+
+	php_krb5_session_hmac(Z_STRVAL_P(key), Z_STRLEN_P(key), token, mac_str - token - 1, mac);
+	for(i = 0; i < sizeof(mac); i++) {
+		diff |= mac[i] ^ (unsigned char) ZSTR_VAL(given)[i];
+	}
+	zend_string_release(given);
+
+	if(diff) return NULL;
+
+	principal = php_krb5_session_decode(principal_str, mac_str - principal_str - 1);
+	if(principal && ZSTR_LEN(principal) == 0) {
+		zend_string_release(principal);
+		principal = NULL;
+	}
+
+	return principal;
 } /* }}} */
 
-/* {{{ proto string KRB5NegotiateAuth::getAuthenticatedUser(  )
-   Gets the principal name of the authenticated user  */
-PHP_METHOD(KRB5NegotiateAuth, getAuthenticatedUser)
+
+/** Name attributes of the authenticated client **/
+/* {{{ Returns the (lazily decoded) group SIDs of name, NULL after throwing */
+static HashTable *php_krb5_negotiate_group_sids(gss_name_t name, HashTable **cache TSRMLS_DC)
 {
-	OM_uint32 status, minor_status;
-	krb5_negotiate_auth_object *object = Z_KRB5_NEGOTIATE_AUTH_OBJ_P(getThis());
+	if(!*cache) {
+		if(name == GSS_C_NO_NAME) {
+			zend_throw_exception(NULL, "No authenticated client name available", 0 TSRMLS_CC);
+			return NULL;
+		}
+		*cache = php_krb5_name_group_sids(name TSRMLS_CC);
+	}
+
+	return *cache;
+} /* }}} */
 
+/* {{{ */
+static void php_krb5_negotiate_name_attributes(gss_name_t name, INTERNAL_FUNCTION_PARAMETERS)
+{
 	if (zend_parse_parameters_none() == FAILURE) {
 		RETURN_FALSE;
 	}
 
-	if(!object || !object->authed_user || object->authed_user == GSS_C_NO_NAME) {
+	if(name == GSS_C_NO_NAME) {
 		RETURN_FALSE;
 	}
 
-	gss_buffer_desc username_tmp;
-	status = gss_display_name(&minor_status, object->authed_user, &username_tmp, NULL);
+	php_krb5_name_get_attributes(name, return_value TSRMLS_CC);
+} /* }}} */
 
-	if(GSS_ERROR(status)) {
-		php_krb5_gssapi_handle_error(status, minor_status TSRMLS_CC);
+/* {{{ */
+static void php_krb5_negotiate_name_attribute(gss_name_t name, INTERNAL_FUNCTION_PARAMETERS)
+{
+	char *attr;
+	size_t attr_len;
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &attr, &attr_len) == FAILURE) {
 		RETURN_FALSE;
 	}
 
-	ZVAL_STRINGL(return_value, username_tmp.value, username_tmp.length);
-	gss_release_buffer(&minor_status, &username_tmp);
+	if(name == GSS_C_NO_NAME) {
+		RETURN_FALSE;
+	}
+
+	php_krb5_name_get_attribute(name, attr, attr_len, return_value TSRMLS_CC);
 } /* }}} */
 
-/* {{{ proto void KRB5NegotiateAuth::getDelegatedCredentials( KRB5CCache $ccache )
-   Fills a credential cache with the delegated credentials  */
-PHP_METHOD(KRB5NegotiateAuth, getDelegatedCredentials)
+/* {{{ */
+static void php_krb5_negotiate_get_group_sids(gss_name_t name, HashTable **cache, INTERNAL_FUNCTION_PARAMETERS)
 {
-	OM_uint32 status, minor_status;
-	krb5_negotiate_auth_object *object = Z_KRB5_NEGOTIATE_AUTH_OBJ_P(getThis());
-	zval *zticket;
-	krb5_ccache_object *ticket;
-	krb5_error_code retval = 0;
-	krb5_principal princ;
+	HashTable *sids;
 
-	if(object->delegated == GSS_C_NO_CREDENTIAL) {
-		zend_throw_exception(NULL, "No delegated credentials available", 0 TSRMLS_CC);
-		return;
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_FALSE;
 	}
 
-	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "O", &zticket, krb5_ce_ccache) == FAILURE) {
-		return;
-	}
-	ticket = Z_KRB5_CCACHE_OBJ_P(zticket);
-	if(!ticket) {
-		zend_throw_exception(NULL, "Invalid KRB5CCache object given", 0 TSRMLS_CC);
+	if(!(sids = php_krb5_negotiate_group_sids(name, cache TSRMLS_CC))) {
 		return;
 	}
 
+	php_krb5_group_sids_to_array(sids, return_value);
+} /* }}} */
 
-	/* use principal name for ccache initialization */
-	gss_buffer_desc nametmp;
-	status = gss_display_name(&minor_status, object->authed_user, &nametmp, NULL);
-	if(GSS_ERROR(status)) {
-		php_krb5_gssapi_handle_error(status, minor_status TSRMLS_CC);
-		return;
-	}
+/* {{{ */
+static void php_krb5_negotiate_has_group(gss_name_t name, HashTable **cache, INTERNAL_FUNCTION_PARAMETERS)
+{
+	HashTable *sids;
+	zval *zset;
 
-	if((retval = krb5_parse_name(ticket->ctx, nametmp.value, &princ))) {
-		php_krb5_display_error(ticket->ctx, retval,  "Failed to parse principal name (%s)" TSRMLS_CC);
-		return;
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "O", &zset, krb5_ce_sid_set) == FAILURE) {
+		RETURN_FALSE;
 	}
 
-	if((retval = krb5_cc_initialize(ticket->ctx, ticket->cc, princ))) {
-		krb5_free_principal(ticket->ctx,princ);
-		php_krb5_display_error(ticket->ctx, retval,  "Failed to initialize credential cache (%s)" TSRMLS_CC);
+	if(!(sids = php_krb5_negotiate_group_sids(name, cache TSRMLS_CC))) {
 		return;
 	}
 
-	/* copy credentials to ccache */ 
-	status = gss_krb5_copy_ccache(&minor_status, object->delegated, ticket->cc);
+	RETURN_BOOL(php_krb5_group_sids_intersect(sids, zset));
+} /* }}} */
 
-	if(GSS_ERROR(status)) {
-		php_krb5_gssapi_handle_error(status, minor_status TSRMLS_CC);
-		zend_throw_exception(NULL, "Failure while imporing delegated ticket", 0 TSRMLS_CC);
-		return;
-	}
 
+/** KRB5NegotiateAuth Methods **/
+/* {{{ proto bool KRB5NegotiateAuth::__construct( string $keytab [, string $spn ] )
+   Initialize KRB5NegotitateAuth object with a keytab to use, and optionally
+   the service principal to accept for instead of HTTP@<FQDN of SERVER_NAME> */
+PHP_METHOD(KRB5NegotiateAuth, __construct)
+{
+	krb5_negotiate_auth_object *object = Z_KRB5_NEGOTIATE_AUTH_OBJ_P(getThis());
+	OM_uint32 status = 0, minor_status = 0;
+	char *keytab;
+	size_t keytab_len;
+	char *spn = NULL;
+	size_t spn_len = 0;
+	zval *server_name = NULL;
+	zend_string *service = NULL;
+
+	KRB5_SET_ERROR_HANDLING(EH_THROW);
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, ARG_PATH "|s", &keytab, &keytab_len, &spn, &spn_len) == FAILURE) {
+		RETURN_FALSE;
+	}
+	KRB5_SET_ERROR_HANDLING(EH_NORMAL);
+
+	/* fail here rather than on the first authentication */
+	if(php_krb5_keytab_cache_check(keytab TSRMLS_CC)) {
+		zend_throw_exception(NULL, "Failed to use credential cache", 0 TSRMLS_CC);
+		return;
+	}
+
+	if(object->servname != GSS_C_NO_NAME) {
+		gss_release_name(&minor_status, &object->servname);
+	}
+
+	if(object->keytab) efree(object->keytab);
+	if(object->cred_key) zend_string_release(object->cred_key);
+	object->keytab = estrndup(keytab, keytab_len);
+	object->cred_key = NULL;
+
+	if(spn_len > 0) {
+		/* "service@host" or a Kerberos principal name, no DNS involved */
+		object->cred_key = strpprintf(0, "%s\n%s", keytab, spn);
+		status = php_krb5_name_cache_import(&minor_status, spn, spn_len,
+				strchr(spn, '/') ? (gss_OID) GSS_KRB5_NT_PRINCIPAL_NAME : GSS_C_NT_HOSTBASED_SERVICE, 0,
+				&object->servname TSRMLS_CC);
+	} else {
+		/* lookup server's FQDN */
+		if (Z_TYPE(PG(http_globals)[TRACK_VARS_SERVER]) == IS_ARRAY || zend_is_auto_global_str(ZEND_STRL("_SERVER"))) {
+			server_name = zend_hash_str_find(Z_ARRVAL(PG(http_globals)[TRACK_VARS_SERVER]), "SERVER_NAME", sizeof("SERVER_NAME") - 1);
+		}
+
+		if(server_name == NULL || Z_TYPE_P(server_name) != IS_STRING) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Failed to get server FQDN");
+			return;
+		}
+
+		/* keyed by the resolved name, not by SERVER_NAME which may follow the Host header */
+		status = php_krb5_negotiate_lookup_name(&minor_status, Z_STRVAL_P(server_name), Z_STRLEN_P(server_name), &object->servname, &service TSRMLS_CC);
+		object->cred_key = strpprintf(0, "%s\n%s", keytab, ZSTR_VAL(service));
+		zend_string_release(service);
+	}
+
+	if(GSS_ERROR(status)) {
+		object->servname = GSS_C_NO_NAME;
+		php_krb5_throw_gssapi_exception(status, minor_status, "Could not parse server name" TSRMLS_CC);
+		return;
+	}
+} /* }}} */
+
+/* {{{ Locates the token in a "Negotiate <token>" header value, FAILURE for other schemes */
+static int php_krb5_negotiate_header_token(const char *header, size_t header_len, const char **data, size_t *data_len)
+{
+	/* credentials = auth-scheme [ 1*SP token68 ] */
+	if(header_len < 9 || strncasecmp(header, "negotiate", 9) != 0 || (header_len > 9 && header[9] != ' ')) {
+		return FAILURE;
+	}
+
+	*data = header + 9;
+	*data_len = header_len - 9;
+	while(*data_len > 0 && (**data == ' ' || **data == '\t')) {
+		(*data)++;
+		(*data_len)--;
+	}
+	while(*data_len > 0 && ((*data)[*data_len - 1] == ' ' || (*data)[*data_len - 1] == '\t')) {
+		(*data_len)--;
+	}
+
+	return SUCCESS;
+} /* }}} */
+
+/* {{{ Accepts the base64 encoded token data with the object's (cached) acceptor
+       credentials. Neither reads nor changes request state, throws on failure.
+       *pending is the context to continue, it is taken over and replaced by
+       the context if another token from the client is needed */
+static int php_krb5_negotiate_accept(krb5_negotiate_auth_object *object, const char *data, size_t data_len, gss_ctx_id_t *pending,
+		gss_name_t *user, gss_cred_id_t *delegated, OM_uint32 *time_rec, gss_buffer_t output_token TSRMLS_DC)
+{
+	OM_uint32 status = 0;
+	OM_uint32 minor_status = 0;
+	OM_uint32 tmp_status = 0;
+	OM_uint32 flags = 0;
+	gss_ctx_id_t gss_context = GSS_C_NO_CONTEXT;
+	gss_buffer_desc input_token;
+	gss_cred_id_t server_creds = GSS_C_NO_CREDENTIAL;
+	int server_creds_owned = 0;
+
+	*user = GSS_C_NO_NAME;
+	*delegated = GSS_C_NO_CREDENTIAL;
+	output_token->length = 0;
+	output_token->value = NULL;
+
+	if(data_len == 0) {
+		// user agent gave negotiate header but no data
+		zend_throw_exception(NULL, "Invalid negotiate authentication data given", 0 TSRMLS_CC);
+		return FAILURE;
+	}
+
+	/* decode straight into the GSS input token */
+	input_token.value = emalloc(php_krb5_base64_decoded_len(data_len));
+	if(php_krb5_base64_decode(data, data_len, input_token.value, &input_token.length) == FAILURE) {
+		efree(input_token.value);
+		zend_throw_exception(NULL, "Failed to decode token data", 0 TSRMLS_CC);
+		return FAILURE;
+	}
+
+	status = php_krb5_negotiate_acceptor_cred(&minor_status, object, &server_creds, &server_creds_owned TSRMLS_CC);
+
+	if(GSS_ERROR(status)) {
+		efree(input_token.value);
+		php_krb5_throw_gssapi_exception(status, minor_status, "Error while obtaining server credentials" TSRMLS_CC);
+		return FAILURE;
+	}
+	minor_status = 0;
+
+	gss_context = *pending;
+	*pending = GSS_C_NO_CONTEXT;
+
+	status = gss_accept_sec_context(   &minor_status,
+                                       &gss_context,
+                                       server_creds,
+                                       &input_token,
+                                       GSS_C_NO_CHANNEL_BINDINGS,
+                                       user,
+                                       NULL,
+                                       output_token,
+                                       &flags,
+                                       time_rec,
+                                       delegated);
+
+
+	if(!(flags & GSS_C_DELEG_FLAG)) {
+		*delegated = GSS_C_NO_CREDENTIAL;
+	}
+
+	if(server_creds_owned) {
+		gss_release_cred(&tmp_status, &server_creds);
+	}
+
+	if(!GSS_ERROR(status) && (status & GSS_S_CONTINUE_NEEDED)) {
+		*pending = gss_context;
+	} else if(gss_context != GSS_C_NO_CONTEXT) {
+		gss_delete_sec_context(&tmp_status, &gss_context, GSS_C_NO_BUFFER);
+	}
+
+	if(GSS_ERROR(status)) {
+		efree(input_token.value);
+		php_krb5_throw_gssapi_exception(status, minor_status, "Error while accepting security context" TSRMLS_CC);
+		return FAILURE;
+	}
+
+	if(object->rcache_shm) {
+		krb5_error_code retval = php_krb5_rcache_store(input_token.value, input_token.length, !(status & GSS_S_CONTINUE_NEEDED) TSRMLS_CC);
+
+		if(retval) {
+			efree(input_token.value);
+			if(*pending != GSS_C_NO_CONTEXT) {
+				gss_delete_sec_context(&tmp_status, pending, GSS_C_NO_BUFFER);
+			}
+			gss_release_name(&tmp_status, user);
+			if(*delegated != GSS_C_NO_CREDENTIAL) {
+				gss_release_cred(&tmp_status, delegated);
+			}
+			gss_release_buffer(&tmp_status, output_token);
+			php_krb5_throw_krb5_exception(NULL, retval, retval == KRB5_RC_REPLAY ? "Replayed authentication data (%s)" : "Replay cache unavailable (%s)" TSRMLS_CC);
+			return FAILURE;
+		}
+	}
+
+	efree(input_token.value);
+	return SUCCESS;
+} /* }}} */
+
+/* {{{ Issues a session token for user if session keys are set; valid until
+       the ticket ends, or for the configured lifetime if shorter */
+static zend_string *php_krb5_negotiate_session_token(krb5_negotiate_auth_object *object, gss_name_t user, OM_uint32 time_rec TSRMLS_DC)
+{
+	OM_uint32 status, minor_status = 0;
+	gss_buffer_desc nametmp;
+	zend_string *token;
+	time_t now = time(NULL);
+	time_t expires = now + (time_rec == GSS_C_INDEFINITE ? 86400 : time_rec);
+
+	if(Z_TYPE(object->session_keys) != IS_ARRAY) {
+		return NULL;
+	}
+
+	if(object->session_lifetime > 0 && now + object->session_lifetime < expires) {
+		expires = now + object->session_lifetime;
+	}
+
+	status = gss_display_name(&minor_status, user, &nametmp, NULL);
+	if(GSS_ERROR(status)) {
+		php_krb5_gssapi_handle_error(status, minor_status TSRMLS_CC);
+		return NULL;
+	}
+
+	token = php_krb5_session_issue(object, nametmp.value, nametmp.length, expires);
+	gss_release_buffer(&minor_status, &nametmp);
+
+	return token;
+} /* }}} */
+
+/* {{{ proto bool KRB5NegotiateAuth::doAuthentication(  )
+   Performs Negotiate/GSSAPI authentication  */
+PHP_METHOD(KRB5NegotiateAuth, doAuthentication)
+{
+	krb5_negotiate_auth_object *object = Z_KRB5_NEGOTIATE_AUTH_OBJ_P(getThis());
+	const char *data;
+	size_t data_len;
+
+	OM_uint32 minor_status = 0;
+	OM_uint32 time_rec = 0;
+	gss_buffer_desc output_token;
+	gss_ctx_id_t pending = GSS_C_NO_CONTEXT;
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if(!object) {
+		RETURN_FALSE;
+	}
+
+
+	/* get authentication data */
+	zval *auth_header;
+
+	if (Z_TYPE(PG(http_globals)[TRACK_VARS_SERVER]) == IS_ARRAY || zend_is_auto_global_str(ZEND_STRL("_SERVER"))) {
+		auth_header = zend_hash_str_find(Z_ARRVAL(PG(http_globals)[TRACK_VARS_SERVER]), "HTTP_AUTHORIZATION", sizeof("HTTP_AUTHORIZATION") - 1);
+		if (auth_header == NULL) {
+			zend_throw_exception(NULL, "Failed to decode token data", 0 TSRMLS_CC);
+			return;
+		}
+
+		if(php_krb5_negotiate_header_token(Z_STRVAL_P(auth_header), Z_STRLEN_P(auth_header), &data, &data_len) == FAILURE) {
+			// user agent did not provide negotiate authentication data
+			RETURN_FALSE;
+		}
+ 	} else {
+		// No authentication data given by the user agent
+		sapi_header_line ctr = {0};
+
+		ctr.line = "WWW-Authenticate: Negotiate";
+		ctr.line_len = strlen("WWW-Authenticate: Negotiate");
+		ctr.response_code = 401;
+		sapi_header_op(SAPI_HEADER_ADD, &ctr TSRMLS_CC);
+		RETURN_FALSE;
+	}
+
+	/* results of an earlier call */
+	if(object->authed_user != GSS_C_NO_NAME) {
+		gss_release_name(&minor_status, &object->authed_user);
+	}
+	if(object->group_sids) {
+		php_krb5_group_sids_free(object->group_sids);
+		object->group_sids = NULL;
+	}
+	if(object->delegated != GSS_C_NO_CREDENTIAL) {
+		gss_release_cred(&minor_status, &object->delegated);
+	}
+	if(object->session_token) {
+		zend_string_release(object->session_token);
+		object->session_token = NULL;
+	}
+	if(object->session_user) {
+		zend_string_release(object->session_user);
+		object->session_user = NULL;
+	}
+
+	if(php_krb5_negotiate_accept(object, data, data_len, &pending, &object->authed_user, &object->delegated, &time_rec, &output_token TSRMLS_CC) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	/* the context does not outlive the request, the client starts over */
+	if(pending != GSS_C_NO_CONTEXT) {
+		gss_delete_sec_context(&minor_status, &pending, GSS_C_NO_BUFFER);
+		RETVAL_FALSE;
+	} else {
+		object->session_token = php_krb5_negotiate_session_token(object, object->authed_user, time_rec TSRMLS_CC);
+		RETVAL_TRUE;
+	}
+
+	if(output_token.length > 0) {
+		sapi_header_line ctr = {0};
+
+		/* encode straight into the header line */
+		ctr.line = emalloc(sizeof("WWW-Authenticate: Negotiate ") + php_krb5_base64_encoded_len(output_token.length));
+		memcpy(ctr.line, "WWW-Authenticate: Negotiate ", sizeof("WWW-Authenticate: Negotiate ") - 1);
+		ctr.line_len = sizeof("WWW-Authenticate: Negotiate ") - 1;
+		ctr.line_len += php_krb5_base64_encode(output_token.value, output_token.length, ctr.line + ctr.line_len);
+		ctr.line[ctr.line_len] = '\0';
+		ctr.response_code = Z_TYPE_P(return_value) == IS_TRUE ? 200 : 401;
+		sapi_header_op(SAPI_HEADER_ADD, &ctr TSRMLS_CC);
+
+		efree(ctr.line);
+		gss_release_buffer(&minor_status, &output_token);
+	}
+} /* }}} */
+
+/* {{{ proto KRB5NegotiateResult KRB5NegotiateAuth::authenticate( string $authorizationHeader [, KRB5NegotiateResult $previous ] )
+   Performs Negotiate/GSSAPI authentication for the given Authorization header
+   value. Does not read or change request globals or the state of this
+   object, so one instance can serve any number of (concurrent) requests.
+   An incomplete result carries the token to send back to the client, its
+   next header is then passed along with that result as $previous */
+PHP_METHOD(KRB5NegotiateAuth, authenticate)
+{
+	krb5_negotiate_auth_object *object = Z_KRB5_NEGOTIATE_AUTH_OBJ_P(getThis());
+	krb5_negotiate_result_object *result;
+	char *header;
+	size_t header_len;
+	const char *data;
+	size_t data_len;
+	zval *zprevious = NULL;
+	gss_ctx_id_t pending = GSS_C_NO_CONTEXT;
+
+	OM_uint32 minor_status = 0;
+	OM_uint32 time_rec = 0;
+	gss_name_t user = GSS_C_NO_NAME;
+	gss_cred_id_t delegated = GSS_C_NO_CREDENTIAL;
+	gss_buffer_desc output_token;
+	gss_buffer_desc nametmp;
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s|O!", &header, &header_len, &zprevious, krb5_ce_negotiate_result) == FAILURE) {
+		return;
+	}
+
+	if(php_krb5_negotiate_header_token(header, header_len, &data, &data_len) == FAILURE) {
+		zend_throw_exception(NULL, "Authorization header does not use the Negotiate scheme", 0 TSRMLS_CC);
+		return;
+	}
+
+	if(zprevious) {
+		krb5_negotiate_result_object *previous = KRB5_NEGOTIATE_RESULT_OBJ_P(zprevious);
+
+		if(previous->context == GSS_C_NO_CONTEXT) {
+			zend_throw_exception(NULL, "The previous authentication is not awaiting a token", 0 TSRMLS_CC);
+			return;
+		}
+		/* the context moves on to the new result */
+		pending = previous->context;
+		previous->context = GSS_C_NO_CONTEXT;
+	}
+
+	if(php_krb5_negotiate_accept(object, data, data_len, &pending, &user, &delegated, &time_rec, &output_token TSRMLS_CC) == FAILURE) {
+		if(pending != GSS_C_NO_CONTEXT) {
+			gss_delete_sec_context(&minor_status, &pending, GSS_C_NO_BUFFER);
+		}
+		return;
+	}
+
+	if(pending != GSS_C_NO_CONTEXT) {
+		/* another leg follows, there is no client name yet */
+		object_init_ex(return_value, krb5_ce_negotiate_result);
+		result = KRB5_NEGOTIATE_RESULT_OBJ_P(return_value);
+		result->context = pending;
+		if(user != GSS_C_NO_NAME) {
+			gss_release_name(&minor_status, &user);
+		}
+		if(delegated != GSS_C_NO_CREDENTIAL) {
+			gss_release_cred(&minor_status, &delegated);
+		}
+		if(output_token.length > 0) {
+			result->token = zend_string_alloc(php_krb5_base64_encoded_len(output_token.length), 0);
+			ZSTR_LEN(result->token) = php_krb5_base64_encode(output_token.value, output_token.length, ZSTR_VAL(result->token));
+			ZSTR_VAL(result->token)[ZSTR_LEN(result->token)] = '\0';
+		}
+		gss_release_buffer(&minor_status, &output_token);
+		return;
+	}
+
+	if(GSS_ERROR(gss_display_name(&minor_status, user, &nametmp, NULL))) {
+		gss_release_name(&minor_status, &user);
+		if(delegated != GSS_C_NO_CREDENTIAL) {
+			gss_release_cred(&minor_status, &delegated);
+		}
+		gss_release_buffer(&minor_status, &output_token);
+		zend_throw_exception(NULL, "Failed to display client name", 0 TSRMLS_CC);
+		return;
+	}
+
+	object_init_ex(return_value, krb5_ce_negotiate_result);
+	result = KRB5_NEGOTIATE_RESULT_OBJ_P(return_value);
+	result->principal = zend_string_init(nametmp.value, nametmp.length, 0);
+	result->delegated = delegated;
+	result->expires = time_rec == GSS_C_INDEFINITE ? 0 : time(NULL) + time_rec;
+	gss_release_buffer(&minor_status, &nametmp);
+
+	if(output_token.length > 0) {
+		result->token = zend_string_alloc(php_krb5_base64_encoded_len(output_token.length), 0);
+		ZSTR_LEN(result->token) = php_krb5_base64_encode(output_token.value, output_token.length, ZSTR_VAL(result->token));
+		ZSTR_VAL(result->token)[ZSTR_LEN(result->token)] = '\0';
+	}
+	gss_release_buffer(&minor_status, &output_token);
+
+	result->session_token = php_krb5_negotiate_session_token(object, user, time_rec TSRMLS_CC);
+	result->name = user;
+} /* }}} */
+
+/* {{{ proto string KRB5NegotiateAuth::getAuthenticatedUser(  )
+   Gets the principal name of the authenticated user  */
+PHP_METHOD(KRB5NegotiateAuth, getAuthenticatedUser)
+{
+	OM_uint32 status, minor_status;
+	krb5_negotiate_auth_object *object = Z_KRB5_NEGOTIATE_AUTH_OBJ_P(getThis());
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if(object && object->session_user) {
+		RETURN_STR_COPY(object->session_user);
+	}
+
+	if(!object || !object->authed_user || object->authed_user == GSS_C_NO_NAME) {
+		RETURN_FALSE;
+	}
+
+	gss_buffer_desc username_tmp;
+	status = gss_display_name(&minor_status, object->authed_user, &username_tmp, NULL);
+
+	if(GSS_ERROR(status)) {
+		php_krb5_gssapi_handle_error(status, minor_status TSRMLS_CC);
+		RETURN_FALSE;
+	}
+
+	ZVAL_STRINGL(return_value, username_tmp.value, username_tmp.length);
+	gss_release_buffer(&minor_status, &username_tmp);
+} /* }}} */
+
+/* {{{ proto array KRB5NegotiateAuth::getNameAttributes(  )
+   Lists the name attributes (e.g. urn:mspac:logon-info) of the authenticated user  */
+PHP_METHOD(KRB5NegotiateAuth, getNameAttributes)
+{
+	krb5_negotiate_auth_object *object = Z_KRB5_NEGOTIATE_AUTH_OBJ_P(getThis());
+
+	php_krb5_negotiate_name_attributes(object->authed_user, INTERNAL_FUNCTION_PARAM_PASSTHRU);
+} /* }}} */
+
+/* {{{ proto array KRB5NegotiateAuth::getNameAttribute( string $attribute )
+   Gets the values of a name attribute of the authenticated user, each as
+   array(value, display, authenticated, complete)  */
+PHP_METHOD(KRB5NegotiateAuth, getNameAttribute)
+{
+	krb5_negotiate_auth_object *object = Z_KRB5_NEGOTIATE_AUTH_OBJ_P(getThis());
+
+	php_krb5_negotiate_name_attribute(object->authed_user, INTERNAL_FUNCTION_PARAM_PASSTHRU);
+} /* }}} */
+
+/* {{{ proto array KRB5NegotiateAuth::getGroupSids(  )
+   Gets the group SIDs from the PAC of the authenticated user  */
+PHP_METHOD(KRB5NegotiateAuth, getGroupSids)
+{
+	krb5_negotiate_auth_object *object = Z_KRB5_NEGOTIATE_AUTH_OBJ_P(getThis());
+
+	php_krb5_negotiate_get_group_sids(object->authed_user, &object->group_sids, INTERNAL_FUNCTION_PARAM_PASSTHRU);
+} /* }}} */
+
+/* {{{ proto bool KRB5NegotiateAuth::hasGroup( KRB5SidSet $groups )
+   Checks whether the authenticated user is member of any of the groups  */
+PHP_METHOD(KRB5NegotiateAuth, hasGroup)
+{
+	krb5_negotiate_auth_object *object = Z_KRB5_NEGOTIATE_AUTH_OBJ_P(getThis());
+
+	php_krb5_negotiate_has_group(object->authed_user, &object->group_sids, INTERNAL_FUNCTION_PARAM_PASSTHRU);
+} /* }}} */
+
+/* {{{ Initializes the cache of zticket for principal and copies the delegated credentials into it */
+static void php_krb5_negotiate_copy_delegated(gss_cred_id_t delegated, const char *principal, zval *zticket TSRMLS_DC)
+{
+	OM_uint32 status, minor_status;
+	krb5_ccache_object *ticket = Z_KRB5_CCACHE_OBJ_P(zticket);
+	krb5_error_code retval = 0;
+	krb5_principal princ;
+
+	if(!ticket) {
+		zend_throw_exception(NULL, "Invalid KRB5CCache object given", 0 TSRMLS_CC);
+		return;
+	}
+
+	/* use principal name for ccache initialization */
+	if((retval = krb5_parse_name(ticket->ctx, principal, &princ))) {
+		php_krb5_display_error(ticket->ctx, retval,  "Failed to parse principal name (%s)" TSRMLS_CC);
+		return;
+	}
+
+	if((retval = krb5_cc_initialize(ticket->ctx, ticket->cc, princ))) {
+		krb5_free_principal(ticket->ctx,princ);
+		php_krb5_display_error(ticket->ctx, retval,  "Failed to initialize credential cache (%s)" TSRMLS_CC);
+		return;
+	}
+	krb5_free_principal(ticket->ctx, princ);
+
+	/* copy credentials to ccache */ 
+	status = gss_krb5_copy_ccache(&minor_status, delegated, ticket->cc);
+	php_krb5_ccache_invalidate(ticket);
+
+	if(GSS_ERROR(status)) {
+		php_krb5_throw_gssapi_exception(status, minor_status, "Failure while imporing delegated ticket" TSRMLS_CC);
+		return;
+	}
+} /* }}} */
+
+/* {{{ proto void KRB5NegotiateAuth::getDelegatedCredentials( KRB5CCache $ccache )
+   Fills a credential cache with the delegated credentials  */
+PHP_METHOD(KRB5NegotiateAuth, getDelegatedCredentials)
+{
+	OM_uint32 status, minor_status;
+	krb5_negotiate_auth_object *object = Z_KRB5_NEGOTIATE_AUTH_OBJ_P(getThis());
+	zval *zticket;
+	gss_buffer_desc nametmp;
+	char *principal;
+
+	if(object->delegated == GSS_C_NO_CREDENTIAL) {
+		zend_throw_exception(NULL, "No delegated credentials available", 0 TSRMLS_CC);
+		return;
+	}
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "O", &zticket, krb5_ce_ccache) == FAILURE) {
+		return;
+	}
+
+	status = gss_display_name(&minor_status, object->authed_user, &nametmp, NULL);
+	if(GSS_ERROR(status)) {
+		php_krb5_gssapi_handle_error(status, minor_status TSRMLS_CC);
+		return;
+	}
+
+	principal = estrndup(nametmp.value, nametmp.length);
+	gss_release_buffer(&minor_status, &nametmp);
+
+	php_krb5_negotiate_copy_delegated(object->delegated, principal, zticket TSRMLS_CC);
+	efree(principal);
+} /* }}} */
+
+/* {{{ proto void KRB5NegotiateAuth::setReplayCache( string $type )
+   Selects the replay cache for this acceptor, "default" for the one of the
+   Kerberos library or "shm" for the shared memory cache */
+PHP_METHOD(KRB5NegotiateAuth, setReplayCache)
+{
+	krb5_negotiate_auth_object *object = Z_KRB5_NEGOTIATE_AUTH_OBJ_P(getThis());
+	char *type;
+	size_t type_len;
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &type, &type_len) == FAILURE) {
+		return;
+	}
+
+	if(strcmp(type, PHP_KRB5_RCACHE_SHM) == 0) {
+		if(!php_krb5_rcache_enabled()) {
+			zend_throw_exception(NULL, "Shared memory replay cache is not enabled (krb5.rcache_shm_size)", 0 TSRMLS_CC);
+			return;
+		}
+		object->rcache_shm = 1;
+	} else if(strcmp(type, "default") == 0) {
+		object->rcache_shm = 0;
+	} else {
+		zend_throw_exception_ex(NULL, 0 TSRMLS_CC, "Unknown replay cache type %s", type);
+		return;
+	}
+} /* }}} */
+
+/* {{{ proto void KRB5NegotiateAuth::setSessionKeys( array $keys [, int $lifetime = 0 ] )
+   Enables session tokens signed with the first of keys (id => secret), all
+   of them are accepted by validateSessionToken() to allow key rotation.
+   Tokens expire with the client's ticket or after lifetime seconds if shorter */
+PHP_METHOD(KRB5NegotiateAuth, setSessionKeys)
+{
+	krb5_negotiate_auth_object *object = Z_KRB5_NEGOTIATE_AUTH_OBJ_P(getThis());
+	zval *keys, *key;
+	zend_string *key_id;
+	zend_long lifetime = 0;
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "a|l", &keys, &lifetime) == FAILURE) {
+		return;
+	}
+
+	if(zend_hash_num_elements(Z_ARRVAL_P(keys)) == 0) {
+		zend_throw_exception(NULL, "At least one session key is required", 0 TSRMLS_CC);
+		return;
+	}
+
+	ZEND_HASH_FOREACH_STR_KEY_VAL(Z_ARRVAL_P(keys), key_id, key) {
+		if(key_id && (ZSTR_LEN(key_id) == 0 || ZSTR_LEN(key_id) > PHP_KRB5_SESSION_KEYID_MAX || memchr(ZSTR_VAL(key_id), '.', ZSTR_LEN(key_id)))) {
+			zend_throw_exception(NULL, "Invalid session key id", 0 TSRMLS_CC);
+			return;
+		}
+
+		if(Z_TYPE_P(key) != IS_STRING || Z_STRLEN_P(key) < PHP_KRB5_SESSION_KEY_MIN) {
+			zend_throw_exception_ex(NULL, 0 TSRMLS_CC, "Session keys must be strings of at least %d bytes", PHP_KRB5_SESSION_KEY_MIN);
+			return;
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	zval_ptr_dtor(&object->session_keys);
+	ZVAL_ARR(&object->session_keys, zend_array_dup(Z_ARRVAL_P(keys)));
+	object->session_lifetime = lifetime;
+} /* }}} */
+
+/* {{{ proto string KRB5NegotiateAuth::getSessionToken(  )
+   Gets the session token issued by the last successful doAuthentication() */
+PHP_METHOD(KRB5NegotiateAuth, getSessionToken)
+{
+	krb5_negotiate_auth_object *object = Z_KRB5_NEGOTIATE_AUTH_OBJ_P(getThis());
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if(!object->session_token) {
+		RETURN_FALSE;
+	}
+
+	RETURN_STR_COPY(object->session_token);
+} /* }}} */
+
+/* {{{ proto bool KRB5NegotiateAuth::validateSessionToken( string $token )
+   Authenticates the request with a session token instead of Negotiate,
+   getAuthenticatedUser() returns the principal it was issued for.
+   No delegated credentials are available this way */
+PHP_METHOD(KRB5NegotiateAuth, validateSessionToken)
+{
+	krb5_negotiate_auth_object *object = Z_KRB5_NEGOTIATE_AUTH_OBJ_P(getThis());
+	OM_uint32 minor_status = 0;
+	char *token;
+	size_t token_len;
+	zend_string *principal;
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &token, &token_len) == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if(Z_TYPE(object->session_keys) != IS_ARRAY) {
+		zend_throw_exception(NULL, "No session keys set", 0 TSRMLS_CC);
+		return;
+	}
+
+	/* results of an earlier call, a rejected token leaves nobody authenticated */
+	if(object->authed_user != GSS_C_NO_NAME) {
+		gss_release_name(&minor_status, &object->authed_user);
+	}
+	if(object->delegated != GSS_C_NO_CREDENTIAL) {
+		gss_release_cred(&minor_status, &object->delegated);
+	}
+	if(object->group_sids) {
+		php_krb5_group_sids_free(object->group_sids);
+		object->group_sids = NULL;
+	}
+	if(object->session_token) {
+		zend_string_release(object->session_token);
+		object->session_token = NULL;
+	}
+	if(object->session_user) {
+		zend_string_release(object->session_user);
+		object->session_user = NULL;
+	}
+
+	principal = php_krb5_session_validate(object, token, token_len);
+	if(!principal) {
+		RETURN_FALSE;
+	}
+
+	object->session_user = principal;
+
+	RETURN_TRUE;
+} /* }}} */
+
+
+/** KRB5NegotiateResult Methods **/
+/* {{{ proto string KRB5NegotiateResult::getPrincipal(  )
+   Gets the principal name of the authenticated user  */
+PHP_METHOD(KRB5NegotiateResult, getPrincipal)
+{
+	krb5_negotiate_result_object *object = KRB5_NEGOTIATE_RESULT_OBJ_P(getThis());
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if(!object->principal) {
+		RETURN_FALSE;
+	}
+
+	RETURN_STR_COPY(object->principal);
+} /* }}} */
+
+/* {{{ proto bool KRB5NegotiateResult::isComplete(  )
+   Whether the client is authenticated, otherwise the response token has to
+   be sent back with a 401 status and the client's next token passed to
+   KRB5NegotiateAuth::authenticate() along with this result */
+PHP_METHOD(KRB5NegotiateResult, isComplete)
+{
+	krb5_negotiate_result_object *object = KRB5_NEGOTIATE_RESULT_OBJ_P(getThis());
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	RETURN_BOOL(object->principal != NULL);
+} /* }}} */
+
+/* {{{ proto string KRB5NegotiateResult::getResponseToken(  )
+   Gets the base64 encoded token to return in "WWW-Authenticate: Negotiate <token>",
+   NULL if there is none */
+PHP_METHOD(KRB5NegotiateResult, getResponseToken)
+{
+	krb5_negotiate_result_object *object = KRB5_NEGOTIATE_RESULT_OBJ_P(getThis());
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if(!object->token) {
+		RETURN_NULL();
+	}
+
+	RETURN_STR_COPY(object->token);
+} /* }}} */
+
+/* {{{ proto string KRB5NegotiateResult::getSessionToken(  )
+   Gets the session token issued for this authentication, see KRB5NegotiateAuth::setSessionKeys() */
+PHP_METHOD(KRB5NegotiateResult, getSessionToken)
+{
+	krb5_negotiate_result_object *object = KRB5_NEGOTIATE_RESULT_OBJ_P(getThis());
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	if(!object->session_token) {
+		RETURN_FALSE;
+	}
+
+	RETURN_STR_COPY(object->session_token);
+} /* }}} */
+
+/* {{{ proto int KRB5NegotiateResult::getExpires(  )
+   Gets the time the client's ticket expires, 0 if unknown */
+PHP_METHOD(KRB5NegotiateResult, getExpires)
+{
+	krb5_negotiate_result_object *object = KRB5_NEGOTIATE_RESULT_OBJ_P(getThis());
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	RETURN_LONG((zend_long) object->expires);
+} /* }}} */
+
+/* {{{ proto bool KRB5NegotiateResult::hasDelegatedCredentials(  )
+   Checks whether the client delegated credentials */
+PHP_METHOD(KRB5NegotiateResult, hasDelegatedCredentials)
+{
+	krb5_negotiate_result_object *object = KRB5_NEGOTIATE_RESULT_OBJ_P(getThis());
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		RETURN_FALSE;
+	}
+
+	RETURN_BOOL(object->delegated != GSS_C_NO_CREDENTIAL);
+} /* }}} */
+
+/* {{{ proto void KRB5NegotiateResult::getDelegatedCredentials( KRB5CCache $ccache )
+   Fills a credential cache with the delegated credentials  */
+PHP_METHOD(KRB5NegotiateResult, getDelegatedCredentials)
+{
+	krb5_negotiate_result_object *object = KRB5_NEGOTIATE_RESULT_OBJ_P(getThis());
+	zval *zticket;
+
+	if(object->delegated == GSS_C_NO_CREDENTIAL) {
+		zend_throw_exception(NULL, "No delegated credentials available", 0 TSRMLS_CC);
+		return;
+	}
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "O", &zticket, krb5_ce_ccache) == FAILURE) {
+		return;
+	}
+
+	php_krb5_negotiate_copy_delegated(object->delegated, ZSTR_VAL(object->principal), zticket TSRMLS_CC);
+} /* }}} */
+
+/* {{{ proto array KRB5NegotiateResult::getNameAttributes(  )
+   Lists the name attributes of the authenticated client  */
+PHP_METHOD(KRB5NegotiateResult, getNameAttributes)
+{
+	krb5_negotiate_result_object *object = KRB5_NEGOTIATE_RESULT_OBJ_P(getThis());
+
+	php_krb5_negotiate_name_attributes(object->name, INTERNAL_FUNCTION_PARAM_PASSTHRU);
+} /* }}} */
+
+/* {{{ proto array KRB5NegotiateResult::getNameAttribute( string $attribute )
+   Gets the values of a name attribute of the authenticated client  */
+PHP_METHOD(KRB5NegotiateResult, getNameAttribute)
+{
+	krb5_negotiate_result_object *object = KRB5_NEGOTIATE_RESULT_OBJ_P(getThis());
+
+	php_krb5_negotiate_name_attribute(object->name, INTERNAL_FUNCTION_PARAM_PASSTHRU);
+} /* }}} */
+
+/* {{{ proto array KRB5NegotiateResult::getGroupSids(  )
+   Gets the group SIDs from the PAC of the authenticated client  */
+PHP_METHOD(KRB5NegotiateResult, getGroupSids)
+{
+	krb5_negotiate_result_object *object = KRB5_NEGOTIATE_RESULT_OBJ_P(getThis());
+
+	php_krb5_negotiate_get_group_sids(object->name, &object->group_sids, INTERNAL_FUNCTION_PARAM_PASSTHRU);
+} /* }}} */
+
+/* {{{ proto bool KRB5NegotiateResult::hasGroup( KRB5SidSet $groups )
+   Checks whether the authenticated client is member of any of the groups  */
+PHP_METHOD(KRB5NegotiateResult, hasGroup)
+{
+	krb5_negotiate_result_object *object = KRB5_NEGOTIATE_RESULT_OBJ_P(getThis());
+
+	php_krb5_negotiate_has_group(object->name, &object->group_sids, INTERNAL_FUNCTION_PARAM_PASSTHRU);
 } /* }}} */
@@ -29,6 +29,7 @@
 
 #include "php.h"
 #include "Zend/zend_exceptions.h"
+#include "Zend/zend_smart_str.h"
 #include "php_krb5_gssapi.h"
 
 #ifdef HAVE_KADM5
@@ -39,6 +40,8 @@
 
 #define KRB5_PRIVATE 1
 
+#include <sys/stat.h>
+#include <sys/socket.h>
 #include <krb5.h>
 #include <gssapi/gssapi.h>
 #include <gssapi/gssapi_krb5.h>
@@ -61,12 +64,89 @@ PHP_MINIT_FUNCTION(krb5);
 PHP_MSHUTDOWN_FUNCTION(krb5);
 PHP_MINFO_FUNCTION(krb5);
 
+/* Module globals (per process, per thread under ZTS) */
+ZEND_BEGIN_MODULE_GLOBALS(krb5)
+	/* idle krb5 contexts available for borrowing */
+	krb5_context *context_pool;
+	zend_long context_pool_size;
+	int context_pool_used;
+	unsigned long context_pool_generation;
+	time_t context_pool_mtime;
+	zend_long context_pool_hits;
+	zend_long context_pool_misses;
+	/* credential caches surviving across requests, keyed by id */
+	HashTable persistent_ccaches;
+	zend_long persistent_renew_threshold;
+	zend_long shm_ccache_size;
+	/* imported acceptor names of KRB5NegotiateAuth, keyed by SERVER_NAME */
+	HashTable negotiate_names;
+	zend_long negotiate_name_ttl;
+	zend_long negotiate_name_negative_ttl;
+	zend_long negotiate_name_hits;
+	zend_long negotiate_name_misses;
+	/* acceptor credentials of KRB5NegotiateAuth, keyed by keytab and name */
+	HashTable negotiate_creds;
+	/* in-memory copies of file keytabs, keyed by keytab name */
+	zend_bool keytab_cache;
+	zend_long keytab_cache_interval;
+	HashTable keytab_cache_entries;
+	/* imported and canonicalised GSS names, see name_cache.c */
+	HashTable name_cache;
+	zend_long name_cache_size;
+	zend_long name_cache_ttl;
+	zend_long name_cache_hits;
+	zend_long name_cache_misses;
+	/* established initiator contexts, keyed by client, target and flags */
+	HashTable initiator_pool;
+	zend_long initiator_pool_size;
+	zend_long initiator_pool_min_lifetime;
+	zend_long initiator_pool_hits;
+	zend_long initiator_pool_misses;
+	/* replay cache used by acceptors: "default" or "shm" */
+	char *rcache;
+	zend_long rcache_shm_size;
+ZEND_END_MODULE_GLOBALS(krb5)
+
+ZEND_EXTERN_MODULE_GLOBALS(krb5)
+#define KRB5_G(v) ZEND_MODULE_GLOBALS_ACCESSOR(krb5, v)
+
+#if defined(ZTS) && defined(COMPILE_DL_KRB5)
+ZEND_TSRMLS_CACHE_EXTERN()
+#endif
+
 zend_class_entry *krb5_ce_ccache;
 
+typedef struct _php_krb5_persistent_ccache {
+	krb5_context ctx;
+	krb5_ccache cc;
+	char *keytab;
+	unsigned long generation;
+} php_krb5_persistent_ccache;
+
+/* parsed cache contents, see php_krb5_ccache_invalidate() */
+typedef struct _php_krb5_ccache_snapshot {
+	unsigned long generation;
+	int have_tgt;
+	krb5_ticket_times tgt_times;
+	zval entries;
+	krb5_error_code entries_retval;
+	char *entries_errstr;
+	zval tktattrs;
+	krb5_error_code tktattrs_retval;
+	char *tktattrs_errstr;
+} php_krb5_ccache_snapshot;
+
 typedef struct _krb5_ccache_object {
 	krb5_context ctx;
+	unsigned long ctx_generation;
 	krb5_ccache cc;
 	char *keytab;
+	php_krb5_persistent_ccache *persistent;
+	double renew_threshold;
+	krb5_timestamp renew_attempt;
+	zval init_opts;
+	unsigned long generation;
+	php_krb5_ccache_snapshot snapshot;
 	zend_object std;
 } krb5_ccache_object;
 
@@ -76,9 +156,108 @@ static inline krb5_ccache_object *php_krb5_ccache_fetch_object(zend_object *obj)
 #define Z_KRB5_CCACHE_OBJ_P(zv) php_krb5_ccache_fetch_object(Z_OBJ_P(zv));
 
 krb5_error_code php_krb5_display_error(krb5_context ctx, krb5_error_code code, char* str TSRMLS_DC);
+void php_krb5_ccache_auto_renew(krb5_ccache_object *ccache TSRMLS_DC);
+void php_krb5_ccache_invalidate(krb5_ccache_object *ccache);
+int php_krb5_parse_init_creds_opts(zval *opts, krb5_get_init_creds_opt *cred_opts, char **in_tkt_svc, char **vfy_keytab TSRMLS_DC);
+krb5_error_code php_krb5_verify_tgt(krb5_ccache_object *ccache, krb5_creds *creds, char *vfy_keytab TSRMLS_DC);
+
+/* krb5_context pool */
+krb5_error_code php_krb5_context_acquire(krb5_context *ctx, unsigned long *generation TSRMLS_DC);
+void php_krb5_context_release(krb5_context ctx, unsigned long generation TSRMLS_DC);
+
+/* FILE ccache format (de)serialisation */
+krb5_error_code php_krb5_ccache_serialize(krb5_context ctx, krb5_ccache cc, smart_str *out TSRMLS_DC);
+krb5_error_code php_krb5_ccache_unserialize(krb5_context ctx, const char *buf, size_t len, krb5_ccache cc TSRMLS_DC);
+krb5_error_code php_krb5_ccache_file_load(krb5_context ctx, const char *path, krb5_ccache cc TSRMLS_DC);
+krb5_error_code php_krb5_ccache_file_store(krb5_context ctx, krb5_ccache cc, const char *path TSRMLS_DC);
+
+/* Shared memory ccaches ("SHM:name") */
+#define PHP_KRB5_SHM_CCACHE_PREFIX "SHM:"
+int php_krb5_shm_ccache_init(TSRMLS_D);
+int php_krb5_shm_ccache_shutdown(TSRMLS_D);
+int php_krb5_shm_ccache_enabled();
+size_t php_krb5_shm_ccache_slot_size();
+krb5_error_code php_krb5_shm_ccache_load(krb5_context ctx, const char *name, krb5_ccache cc TSRMLS_DC);
+krb5_error_code php_krb5_shm_ccache_store(krb5_context ctx, krb5_ccache cc, const char *name TSRMLS_DC);
+
+/* Shared memory replay cache */
+#define PHP_KRB5_RCACHE_SHM "shm"
+#define PHP_KRB5_RCACHE_NONE "none"
+int php_krb5_rcache_init(TSRMLS_D);
+int php_krb5_rcache_shutdown(TSRMLS_D);
+int php_krb5_rcache_enabled();
+size_t php_krb5_rcache_capacity();
+int php_krb5_rcache_configured(TSRMLS_D);
+krb5_error_code php_krb5_rcache_store(const void *token, size_t length, int complete TSRMLS_DC);
+
+/* Base64 for Negotiate headers */
+#define php_krb5_base64_encoded_len(len) (((len) + 2) / 3 * 4)
+#define php_krb5_base64_decoded_len(len) (((len) + 3) / 4 * 3)
+void php_krb5_base64_init();
+size_t php_krb5_base64_encode(const unsigned char *in, size_t len, char *out);
+int php_krb5_base64_decode(const char *in, size_t len, unsigned char *out, size_t *out_len);
+size_t php_krb5_base64url_encode(const unsigned char *in, size_t len, char *out);
+int php_krb5_base64url_decode(const char *in, size_t len, unsigned char *out, size_t *out_len);
+
+/* KRB5Exception / GSSAPIException */
+extern zend_class_entry *krb5_ce_exception;
+extern zend_class_entry *krb5_ce_gssapi_exception;
+int php_krb5_exception_register_classes(TSRMLS_D);
+void php_krb5_throw_krb5_exception(krb5_context ctx, krb5_error_code code, const char *str TSRMLS_DC);
+void php_krb5_throw_gssapi_exception(OM_uint32 major, OM_uint32 minor, const char *context TSRMLS_DC);
+
+/* Name attributes and PAC group SIDs */
+extern zend_class_entry *krb5_ce_sid_set;
+int php_krb5_name_attributes_register_classes(TSRMLS_D);
+void php_krb5_name_get_attributes(gss_name_t name, zval *return_value TSRMLS_DC);
+void php_krb5_name_get_attribute(gss_name_t name, const char *attr, size_t attr_len, zval *return_value TSRMLS_DC);
+HashTable *php_krb5_name_group_sids(gss_name_t name TSRMLS_DC);
+void php_krb5_group_sids_free(HashTable *sids);
+void php_krb5_group_sids_to_array(HashTable *sids, zval *return_value);
+int php_krb5_group_sids_intersect(HashTable *sids, zval *zset);
+
+/* Keytab cache */
+int php_krb5_keytab_stat(const char *keytab, struct stat *st);
+void php_krb5_keytab_entry_dtor(zval *zv);
+const char *php_krb5_keytab_cache_name(const char *keytab TSRMLS_DC);
+OM_uint32 php_krb5_keytab_cache_register_acceptor(const char *keytab TSRMLS_DC);
+krb5_error_code php_krb5_keytab_cache_check(const char *keytab TSRMLS_DC);
+krb5_error_code php_krb5_keytab_cache_resolve(krb5_context ctx, const char *keytab, krb5_keytab *kt TSRMLS_DC);
+
+/* GSS name cache */
+void php_krb5_name_cache_clear(HashTable *cache);
+OM_uint32 php_krb5_name_cache_import(OM_uint32 *minor_status, const char *str, size_t len, gss_OID type, int canonicalize, gss_name_t *name TSRMLS_DC);
+
+/* Non-blocking KDC exchanges */
+typedef struct _php_krb5_kdc_addr {
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+} php_krb5_kdc_addr;
+
+typedef struct _php_krb5_kdc_list {
+	char *realm;
+	size_t realm_len;
+	php_krb5_kdc_addr *addrs;
+	int count;
+} php_krb5_kdc_list;
+
+krb5_error_code php_krb5_kdc_resolve(krb5_context ctx, const krb5_data *realm, php_krb5_kdc_list *list);
+void php_krb5_kdc_list_free(php_krb5_kdc_list *list);
+int php_krb5_kdc_connect(const php_krb5_kdc_list *list, int *index);
+krb5_error_code php_krb5_kdc_send(int fd, const krb5_data *request);
+krb5_error_code php_krb5_kdc_recv(int fd, krb5_data *reply);
+krb5_error_code php_krb5_prefetch_service_tickets(krb5_context ctx, krb5_ccache cc, HashTable *spns, zval *status TSRMLS_DC);
+
+/* KRB5InitCredsOperation / KRB5TktCredsOperation */
+int php_krb5_creds_operation_register_classes(TSRMLS_D);
+
+/* KRB5SaslGssapi */
+int php_krb5_sasl_gssapi_register_classes(TSRMLS_D);
 
 /* KRB5NegotiateAuth Object */
 int php_krb5_negotiate_auth_register_classes(TSRMLS_D);
+void php_krb5_negotiate_name_dtor(zval *zv);
+void php_krb5_negotiate_cred_dtor(zval *zv);
 
 /* KADM5 glue */
 #ifdef HAVE_KADM5
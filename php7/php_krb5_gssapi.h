@@ -27,8 +27,11 @@
 #include <Zend/zend_objects_API.h>
 
 void php_krb5_gssapi_handle_error(OM_uint32 major, OM_uint32 minor TSRMLS_DC);
+OM_uint32 php_krb5_gssapi_acquire_cred(OM_uint32 *minor_status, gss_name_t name, gss_cred_usage_t usage,
+		const char *ccname, const char *ktname, int skip_rcache, gss_cred_id_t *cred TSRMLS_DC);
 int php_krb5_gssapi_register_classes(TSRMLS_D);
 int php_krb5_gssapi_shutdown(TSRMLS_D);
+void php_krb5_initiator_pool_dtor(zval *zv);
 
 extern void php_krb5_gssapi_context_object_dtor(zend_object *obj);
 zend_object *php_krb5_gssapi_context_object_new(zend_class_entry *ce TSRMLS_DC);
@@ -0,0 +1,787 @@
+/**
+* Copyright (c) 2008 Moritz Bechler
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+**/
+
+
+
+/*
+ * SASL GSSAPI mechanism (RFC 4752), client side
+ *
+ * KRB5SaslGssapi runs the Kerberos context establishment and the security
+ * layer negotiation in C. Protocols that carry SASL messages in their own
+ * PDUs (LDAP bind, IMAP AUTHENTICATE) feed the server challenges to step();
+ * negotiate() runs the complete exchange over a stream where every message
+ * is prefixed with its length as a 4 octet big endian integer (the framing
+ * of Kafka's GSSAPI handshake and of the security layer itself).
+ *
+ * Once complete, wrapStream() attaches stream filters applying the
+ * negotiated layer (RFC 4422 3.7): writes are split into chunks that wrap
+ * to at most the server's maximum buffer size (gss_wrap_size_limit), each
+ * wrapped and sent with a length prefix; reads are reassembled into frames
+ * of at most our maximum buffer size and unwrapped.
+ */
+
+#include "php_krb5.h"
+
+#define PHP_KRB5_SASL_LAYER_NONE 1
+#define PHP_KRB5_SASL_LAYER_INTEGRITY 2
+#define PHP_KRB5_SASL_LAYER_CONFIDENTIALITY 4
+#define PHP_KRB5_SASL_LAYER_ALL 7
+
+/* largest size expressible in the 3 octet maximum buffer size */
+#define PHP_KRB5_SASL_MAX_BUFFER 0xFFFFFF
+/* bound for tokens read by negotiate(), tickets with a PAC can be large */
+#define PHP_KRB5_SASL_MAX_TOKEN (1 << 20)
+
+#define PHP_KRB5_SASL_ESTABLISH 0
+#define PHP_KRB5_SASL_LAYER 1
+#define PHP_KRB5_SASL_COMPLETE 2
+
+/* Class definition */
+zend_object_handlers krb5_sasl_gssapi_handlers;
+
+zend_class_entry *krb5_ce_sasl_gssapi;
+
+typedef struct _krb5_sasl_gssapi_object {
+	gss_cred_id_t creds;
+	gss_name_t target;
+	gss_ctx_id_t context;
+	int state;
+	/* acceptable layers, then the negotiated one */
+	int layers;
+	int layer;
+	/* largest wrapped frame we receive, largest plaintext chunk we send */
+	OM_uint32 max_buffer;
+	OM_uint32 max_send;
+	zend_string *authzid;
+	/* KRB5CCache the service ticket is stored in */
+	zval ccache;
+	zend_object std;
+} krb5_sasl_gssapi_object;
+
+static inline krb5_sasl_gssapi_object *php_krb5_sasl_gssapi_object(zend_object *obj) {
+	return (krb5_sasl_gssapi_object *)((char*)(obj) - XtOffsetOf(krb5_sasl_gssapi_object, std));
+}
+#define Z_KRB5_SASL_GSSAPI_OBJ_P(zv) php_krb5_sasl_gssapi_object(Z_OBJ_P(zv))
+
+static void php_krb5_sasl_gssapi_object_dtor(zend_object *obj);
+zend_object *php_krb5_sasl_gssapi_object_new(zend_class_entry *ce);
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5SaslGssapi_none, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5SaslGssapi__construct, 0, 0, 2)
+	ZEND_ARG_OBJ_INFO(0, ccache, KRB5CCache, 0)
+	ZEND_ARG_INFO(0, service)
+	ZEND_ARG_INFO(0, layers)
+	ZEND_ARG_INFO(0, max_buffer)
+	ZEND_ARG_INFO(0, authzid)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5SaslGssapi_step, 0, 0, 0)
+	ZEND_ARG_INFO(0, challenge)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_KRB5SaslGssapi_stream, 0, 0, 1)
+	ZEND_ARG_INFO(0, stream)
+ZEND_END_ARG_INFO()
+
+PHP_METHOD(KRB5SaslGssapi, __construct);
+PHP_METHOD(KRB5SaslGssapi, step);
+PHP_METHOD(KRB5SaslGssapi, isComplete);
+PHP_METHOD(KRB5SaslGssapi, negotiate);
+PHP_METHOD(KRB5SaslGssapi, getLayer);
+PHP_METHOD(KRB5SaslGssapi, getMaxSendSize);
+PHP_METHOD(KRB5SaslGssapi, wrapStream);
+
+static zend_function_entry krb5_sasl_gssapi_functions[] = {
+	PHP_ME(KRB5SaslGssapi, __construct,    arginfo_KRB5SaslGssapi__construct, ZEND_ACC_PUBLIC | ZEND_ACC_CTOR)
+	PHP_ME(KRB5SaslGssapi, step,           arginfo_KRB5SaslGssapi_step,       ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5SaslGssapi, isComplete,     arginfo_KRB5SaslGssapi_none,       ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5SaslGssapi, negotiate,      arginfo_KRB5SaslGssapi_stream,     ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5SaslGssapi, getLayer,       arginfo_KRB5SaslGssapi_none,       ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5SaslGssapi, getMaxSendSize, arginfo_KRB5SaslGssapi_none,       ZEND_ACC_PUBLIC)
+	PHP_ME(KRB5SaslGssapi, wrapStream,     arginfo_KRB5SaslGssapi_stream,     ZEND_ACC_PUBLIC)
+	PHP_FE_END
+};
+
+
+/** Registration **/
+/* {{{ */
+static void php_krb5_sasl_gssapi_object_dtor(zend_object *obj)
+{
+	krb5_sasl_gssapi_object *object = php_krb5_sasl_gssapi_object(obj);
+	OM_uint32 minor_status = 0;
+
+	if(object->context != GSS_C_NO_CONTEXT) {
+		gss_delete_sec_context(&minor_status, &object->context, GSS_C_NO_BUFFER);
+	}
+	if(object->creds != GSS_C_NO_CREDENTIAL) {
+		gss_release_cred(&minor_status, &object->creds);
+	}
+	if(object->target != GSS_C_NO_NAME) {
+		gss_release_name(&minor_status, &object->target);
+	}
+	if(object->authzid) {
+		zend_string_release(object->authzid);
+	}
+	zval_ptr_dtor(&object->ccache);
+
+	zend_object_std_dtor(&object->std);
+} /* }}} */
+
+/* {{{ */
+zend_object *php_krb5_sasl_gssapi_object_new(zend_class_entry *ce)
+{
+	krb5_sasl_gssapi_object *object;
+
+	object = ecalloc(1, sizeof(krb5_sasl_gssapi_object) + zend_object_properties_size(ce));
+
+	object->creds = GSS_C_NO_CREDENTIAL;
+	object->target = GSS_C_NO_NAME;
+	object->context = GSS_C_NO_CONTEXT;
+	object->state = PHP_KRB5_SASL_ESTABLISH;
+
+	zend_object_std_init(&object->std, ce TSRMLS_CC);
+	object_properties_init(&(object->std), ce);
+
+	object->std.handlers = &krb5_sasl_gssapi_handlers;
+	return &object->std;
+} /* }}} */
+
+/* {{{ */
+int php_krb5_sasl_gssapi_register_classes(TSRMLS_D) {
+	zend_class_entry sasl_gssapi;
+
+	INIT_CLASS_ENTRY(sasl_gssapi, "KRB5SaslGssapi", krb5_sasl_gssapi_functions);
+	krb5_ce_sasl_gssapi = zend_register_internal_class(&sasl_gssapi);
+	krb5_ce_sasl_gssapi->create_object = php_krb5_sasl_gssapi_object_new;
+	krb5_ce_sasl_gssapi->ce_flags |= ZEND_ACC_FINAL;
+
+	zend_declare_class_constant_long(krb5_ce_sasl_gssapi, "LAYER_NONE", sizeof("LAYER_NONE") - 1, PHP_KRB5_SASL_LAYER_NONE TSRMLS_CC);
+	zend_declare_class_constant_long(krb5_ce_sasl_gssapi, "LAYER_INTEGRITY", sizeof("LAYER_INTEGRITY") - 1, PHP_KRB5_SASL_LAYER_INTEGRITY TSRMLS_CC);
+	zend_declare_class_constant_long(krb5_ce_sasl_gssapi, "LAYER_CONFIDENTIALITY", sizeof("LAYER_CONFIDENTIALITY") - 1, PHP_KRB5_SASL_LAYER_CONFIDENTIALITY TSRMLS_CC);
+	zend_declare_class_constant_long(krb5_ce_sasl_gssapi, "LAYER_ALL", sizeof("LAYER_ALL") - 1, PHP_KRB5_SASL_LAYER_ALL TSRMLS_CC);
+
+	memcpy(&krb5_sasl_gssapi_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	krb5_sasl_gssapi_handlers.offset = XtOffsetOf(krb5_sasl_gssapi_object, std);
+	krb5_sasl_gssapi_handlers.free_obj = php_krb5_sasl_gssapi_object_dtor;
+	krb5_sasl_gssapi_handlers.clone_obj = NULL;
+
+	return SUCCESS;
+} /* }}} */
+
+
+/** Negotiation **/
+/* {{{ */
+static inline void php_krb5_sasl_put32(unsigned char *buf, OM_uint32 val)
+{
+	buf[0] = (val >> 24) & 0xFF;
+	buf[1] = (val >> 16) & 0xFF;
+	buf[2] = (val >> 8) & 0xFF;
+	buf[3] = val & 0xFF;
+}
+/* }}} */
+
+/* {{{ */
+static inline OM_uint32 php_krb5_sasl_get32(const unsigned char *buf)
+{
+	return ((OM_uint32) buf[0] << 24) | ((OM_uint32) buf[1] << 16) | ((OM_uint32) buf[2] << 8) | buf[3];
+}
+/* }}} */
+
+/* {{{ Unwraps the server's offer, picks the strongest common layer and
+       wraps our choice, maximum buffer size and authorization identity */
+static int php_krb5_sasl_negotiate_layer(krb5_sasl_gssapi_object *object, gss_buffer_t challenge, gss_buffer_t response TSRMLS_DC)
+{
+	OM_uint32 status, minor_status = 0, tmp_status = 0;
+	gss_buffer_desc offer, choice;
+	unsigned char *buf;
+	OM_uint32 server_max;
+	int offered;
+	size_t authzid_len = object->authzid ? ZSTR_LEN(object->authzid) : 0;
+
+	status = gss_unwrap(&minor_status, object->context, challenge, &offer, NULL, NULL);
+	if(GSS_ERROR(status)) {
+		php_krb5_throw_gssapi_exception(status, minor_status, "Cannot unwrap SASL security layer offer" TSRMLS_CC);
+		return FAILURE;
+	}
+
+	if(offer.length != 4) {
+		gss_release_buffer(&tmp_status, &offer);
+		zend_throw_exception(NULL, "Malformed SASL security layer offer", 0 TSRMLS_CC);
+		return FAILURE;
+	}
+
+	buf = offer.value;
+	offered = buf[0] & object->layers;
+	server_max = php_krb5_sasl_get32(buf) & PHP_KRB5_SASL_MAX_BUFFER;
+	gss_release_buffer(&tmp_status, &offer);
+
+	if(offered & PHP_KRB5_SASL_LAYER_CONFIDENTIALITY) {
+		object->layer = PHP_KRB5_SASL_LAYER_CONFIDENTIALITY;
+	} else if(offered & PHP_KRB5_SASL_LAYER_INTEGRITY) {
+		object->layer = PHP_KRB5_SASL_LAYER_INTEGRITY;
+	} else if(offered & PHP_KRB5_SASL_LAYER_NONE) {
+		object->layer = PHP_KRB5_SASL_LAYER_NONE;
+	} else {
+		zend_throw_exception(NULL, "No common SASL security layer", 0 TSRMLS_CC);
+		return FAILURE;
+	}
+
+	if(object->layer == PHP_KRB5_SASL_LAYER_NONE) {
+		object->max_buffer = 0;
+	} else {
+		status = gss_wrap_size_limit(&minor_status, object->context,
+				object->layer == PHP_KRB5_SASL_LAYER_CONFIDENTIALITY, GSS_C_QOP_DEFAULT,
+				server_max ? server_max : PHP_KRB5_SASL_MAX_BUFFER, &object->max_send);
+		if(GSS_ERROR(status)) {
+			php_krb5_throw_gssapi_exception(status, minor_status, "Cannot determine SASL security layer chunk size" TSRMLS_CC);
+			return FAILURE;
+		}
+		if(object->max_send == 0) {
+			zend_throw_exception(NULL, "SASL server buffer too small for the security layer", 0 TSRMLS_CC);
+			return FAILURE;
+		}
+	}
+
+	choice.length = 4 + authzid_len;
+	choice.value = buf = emalloc(choice.length);
+	php_krb5_sasl_put32(buf, object->max_buffer);
+	buf[0] = object->layer;
+	if(authzid_len) {
+		memcpy(buf + 4, ZSTR_VAL(object->authzid), authzid_len);
+	}
+
+	status = gss_wrap(&minor_status, object->context, 0, GSS_C_QOP_DEFAULT, &choice, NULL, response);
+	efree(choice.value);
+	if(GSS_ERROR(status)) {
+		php_krb5_throw_gssapi_exception(status, minor_status, "Cannot wrap SASL security layer choice" TSRMLS_CC);
+		return FAILURE;
+	}
+
+	object->state = PHP_KRB5_SASL_COMPLETE;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ Processes one server challenge, response is to be released with
+       gss_release_buffer() and may be empty */
+static int php_krb5_sasl_step(krb5_sasl_gssapi_object *object, gss_buffer_t challenge, gss_buffer_t response TSRMLS_DC)
+{
+	OM_uint32 status, minor_status = 0, tmp_status = 0;
+	OM_uint32 req_flags = GSS_C_MUTUAL_FLAG | GSS_C_SEQUENCE_FLAG;
+	OM_uint32 ret_flags = 0;
+
+	response->length = 0;
+	response->value = NULL;
+
+	switch(object->state) {
+		case PHP_KRB5_SASL_ESTABLISH:
+			if(object->layers & PHP_KRB5_SASL_LAYER_INTEGRITY) {
+				req_flags |= GSS_C_INTEG_FLAG;
+			}
+			if(object->layers & PHP_KRB5_SASL_LAYER_CONFIDENTIALITY) {
+				req_flags |= GSS_C_INTEG_FLAG | GSS_C_CONF_FLAG;
+			}
+
+			status = gss_init_sec_context(&minor_status, object->creds, &object->context,
+					object->target, (gss_OID) gss_mech_krb5, req_flags, 0, GSS_C_NO_CHANNEL_BINDINGS,
+					object->context == GSS_C_NO_CONTEXT ? GSS_C_NO_BUFFER : challenge,
+					NULL, response, &ret_flags, NULL);
+			/* the first call stores the service ticket in the cache */
+			if(Z_TYPE(object->ccache) == IS_OBJECT) {
+				krb5_ccache_object *ccache = Z_KRB5_CCACHE_OBJ_P(&object->ccache);
+				php_krb5_ccache_invalidate(ccache);
+			}
+			if(GSS_ERROR(status)) {
+				gss_release_buffer(&tmp_status, response);
+				php_krb5_throw_gssapi_exception(status, minor_status, "SASL GSSAPI authentication failed" TSRMLS_CC);
+				return FAILURE;
+			}
+
+			if(!(status & GSS_S_CONTINUE_NEEDED)) {
+				/* layers the context cannot provide are not acceptable */
+				if(!(ret_flags & GSS_C_CONF_FLAG)) {
+					object->layers &= ~PHP_KRB5_SASL_LAYER_CONFIDENTIALITY;
+				}
+				if(!(ret_flags & GSS_C_INTEG_FLAG)) {
+					object->layers &= ~(PHP_KRB5_SASL_LAYER_INTEGRITY | PHP_KRB5_SASL_LAYER_CONFIDENTIALITY);
+				}
+				object->state = PHP_KRB5_SASL_LAYER;
+			}
+			return SUCCESS;
+
+		case PHP_KRB5_SASL_LAYER:
+			/* an empty challenge after the final context token gets an empty response */
+			if(challenge->length == 0) {
+				return SUCCESS;
+			}
+			return php_krb5_sasl_negotiate_layer(object, challenge, response TSRMLS_CC);
+
+		default:
+			zend_throw_exception(NULL, "SASL negotiation is already complete", 0 TSRMLS_CC);
+			return FAILURE;
+	}
+}
+/* }}} */
+
+/* {{{ Reads exactly len bytes */
+static int php_krb5_sasl_read(php_stream *stream, char *buf, size_t len)
+{
+	size_t got = 0, n;
+
+	while(got < len) {
+		n = php_stream_read(stream, buf + got, len - got);
+		if(n == 0 || n == (size_t) -1) {
+			return FAILURE;
+		}
+		got += n;
+	}
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ Reads a length prefixed token */
+static int php_krb5_sasl_read_token(php_stream *stream, gss_buffer_t token TSRMLS_DC)
+{
+	unsigned char len[4];
+
+	token->length = 0;
+	token->value = NULL;
+
+	if(php_krb5_sasl_read(stream, (char*) len, sizeof(len)) != SUCCESS) {
+		zend_throw_exception(NULL, "Connection closed during SASL negotiation", 0 TSRMLS_CC);
+		return FAILURE;
+	}
+
+	token->length = php_krb5_sasl_get32(len);
+	if(token->length > PHP_KRB5_SASL_MAX_TOKEN) {
+		zend_throw_exception(NULL, "SASL negotiation token too large", 0 TSRMLS_CC);
+		return FAILURE;
+	}
+	if(token->length == 0) {
+		return SUCCESS;
+	}
+
+	token->value = emalloc(token->length);
+	if(php_krb5_sasl_read(stream, token->value, token->length) != SUCCESS) {
+		efree(token->value);
+		token->value = NULL;
+		zend_throw_exception(NULL, "Connection closed during SASL negotiation", 0 TSRMLS_CC);
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ Writes a length prefixed token */
+static int php_krb5_sasl_write_token(php_stream *stream, gss_buffer_t token TSRMLS_DC)
+{
+	unsigned char len[4];
+
+	php_krb5_sasl_put32(len, token->length);
+	if(php_stream_write(stream, (char*) len, sizeof(len)) != sizeof(len) ||
+			php_stream_write(stream, token->value, token->length) != token->length) {
+		zend_throw_exception(NULL, "Cannot send SASL negotiation token", 0 TSRMLS_CC);
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+/* }}} */
+
+
+/** Security layer stream filters **/
+typedef struct _php_krb5_sasl_filter {
+	/* the KRB5SaslGssapi owning the context */
+	zval sasl;
+	/* read side: incomplete frame */
+	smart_str pending;
+} php_krb5_sasl_filter;
+
+/* {{{ Drops the buckets a failing filter call has already produced */
+static void php_krb5_sasl_brigade_free(php_stream_bucket_brigade *brigade)
+{
+	php_stream_bucket *bucket;
+
+	while((bucket = brigade->head)) {
+		php_stream_bucket_unlink(bucket);
+		php_stream_bucket_delref(bucket);
+	}
+}
+/* }}} */
+
+/* {{{ Wraps every write in chunks of at most max_send bytes */
+static php_stream_filter_status_t php_krb5_sasl_wrap_filter(php_stream *stream, php_stream_filter *thisfilter,
+		php_stream_bucket_brigade *buckets_in, php_stream_bucket_brigade *buckets_out, size_t *bytes_consumed, int flags)
+{
+	php_krb5_sasl_filter *filter = Z_PTR(thisfilter->abstract);
+	krb5_sasl_gssapi_object *object = Z_KRB5_SASL_GSSAPI_OBJ_P(&filter->sasl);
+	php_stream_bucket *bucket;
+	size_t consumed = 0, offset, chunk;
+	OM_uint32 status, minor_status = 0, tmp_status = 0;
+	gss_buffer_desc input, output;
+	char *frame;
+
+	while(buckets_in->head) {
+		bucket = buckets_in->head;
+		php_stream_bucket_unlink(bucket);
+
+		for(offset = 0; offset < bucket->buflen; offset += chunk) {
+			chunk = MIN(bucket->buflen - offset, object->max_send);
+			input.value = bucket->buf + offset;
+			input.length = chunk;
+
+			status = gss_wrap(&minor_status, object->context,
+					object->layer == PHP_KRB5_SASL_LAYER_CONFIDENTIALITY, GSS_C_QOP_DEFAULT,
+					&input, NULL, &output);
+			if(GSS_ERROR(status)) {
+				php_stream_bucket_delref(bucket);
+				/* no partial write of the frames before */
+				php_krb5_sasl_brigade_free(buckets_out);
+				php_krb5_throw_gssapi_exception(status, minor_status, "Cannot wrap SASL security layer frame" TSRMLS_CC);
+				return PSFS_ERR_FATAL;
+			}
+
+			frame = emalloc(4 + output.length);
+			php_krb5_sasl_put32((unsigned char*) frame, output.length);
+			memcpy(frame + 4, output.value, output.length);
+			php_stream_bucket_append(buckets_out, php_stream_bucket_new(stream, frame, 4 + output.length, 1, 0));
+			gss_release_buffer(&tmp_status, &output);
+		}
+
+		consumed += bucket->buflen;
+		php_stream_bucket_delref(bucket);
+	}
+
+	if(bytes_consumed) {
+		*bytes_consumed = consumed;
+	}
+
+	return buckets_out->head ? PSFS_PASS_ON : PSFS_FEED_ME;
+}
+/* }}} */
+
+/* {{{ Reassembles length prefixed frames and unwraps them */
+static php_stream_filter_status_t php_krb5_sasl_unwrap_filter(php_stream *stream, php_stream_filter *thisfilter,
+		php_stream_bucket_brigade *buckets_in, php_stream_bucket_brigade *buckets_out, size_t *bytes_consumed, int flags)
+{
+	php_krb5_sasl_filter *filter = Z_PTR(thisfilter->abstract);
+	krb5_sasl_gssapi_object *object = Z_KRB5_SASL_GSSAPI_OBJ_P(&filter->sasl);
+	php_stream_bucket *bucket;
+	size_t consumed = 0, length, offset = 0;
+	OM_uint32 status, minor_status = 0, tmp_status = 0;
+	gss_buffer_desc input, output;
+	int conf_state = 0;
+	char *data;
+
+	while(buckets_in->head) {
+		bucket = buckets_in->head;
+		php_stream_bucket_unlink(bucket);
+		smart_str_appendl(&filter->pending, bucket->buf, bucket->buflen);
+		consumed += bucket->buflen;
+		php_stream_bucket_delref(bucket);
+	}
+
+	length = filter->pending.s ? ZSTR_LEN(filter->pending.s) : 0;
+	while(length - offset >= 4) {
+		input.length = php_krb5_sasl_get32((unsigned char*) ZSTR_VAL(filter->pending.s) + offset);
+		if(input.length > object->max_buffer) {
+			php_krb5_sasl_brigade_free(buckets_out);
+			zend_throw_exception(NULL, "SASL security layer frame exceeds the maximum buffer size", 0 TSRMLS_CC);
+			return PSFS_ERR_FATAL;
+		}
+		if(length - offset - 4 < input.length) {
+			break;
+		}
+		input.value = ZSTR_VAL(filter->pending.s) + offset + 4;
+
+		status = gss_unwrap(&minor_status, object->context, &input, &output, &conf_state, NULL);
+		if(GSS_ERROR(status)) {
+			php_krb5_sasl_brigade_free(buckets_out);
+			php_krb5_throw_gssapi_exception(status, minor_status, "Cannot unwrap SASL security layer frame" TSRMLS_CC);
+			return PSFS_ERR_FATAL;
+		}
+		if(object->layer == PHP_KRB5_SASL_LAYER_CONFIDENTIALITY && !conf_state) {
+			gss_release_buffer(&tmp_status, &output);
+			php_krb5_sasl_brigade_free(buckets_out);
+			zend_throw_exception(NULL, "Unencrypted SASL security layer frame", 0 TSRMLS_CC);
+			return PSFS_ERR_FATAL;
+		}
+
+		if(output.length) {
+			data = emalloc(output.length);
+			memcpy(data, output.value, output.length);
+			php_stream_bucket_append(buckets_out, php_stream_bucket_new(stream, data, output.length, 1, 0));
+		}
+		gss_release_buffer(&tmp_status, &output);
+
+		offset += 4 + input.length;
+	}
+
+	/* keep the incomplete rest */
+	if(offset) {
+		memmove(ZSTR_VAL(filter->pending.s), ZSTR_VAL(filter->pending.s) + offset, length - offset);
+		ZSTR_LEN(filter->pending.s) = length - offset;
+	}
+
+	if(bytes_consumed) {
+		*bytes_consumed = consumed;
+	}
+
+	return buckets_out->head ? PSFS_PASS_ON : PSFS_FEED_ME;
+}
+/* }}} */
+
+/* {{{ */
+static void php_krb5_sasl_filter_dtor(php_stream_filter *thisfilter)
+{
+	php_krb5_sasl_filter *filter = Z_PTR(thisfilter->abstract);
+
+	zval_ptr_dtor(&filter->sasl);
+	smart_str_free(&filter->pending);
+	efree(filter);
+}
+/* }}} */
+
+static php_stream_filter_ops php_krb5_sasl_wrap_ops = {
+	php_krb5_sasl_wrap_filter,
+	php_krb5_sasl_filter_dtor,
+	"krb5.sasl-wrap"
+};
+
+static php_stream_filter_ops php_krb5_sasl_unwrap_ops = {
+	php_krb5_sasl_unwrap_filter,
+	php_krb5_sasl_filter_dtor,
+	"krb5.sasl-unwrap"
+};
+
+/* {{{ */
+static php_stream_filter *php_krb5_sasl_filter_new(php_stream_filter_ops *ops, zval *sasl)
+{
+	php_krb5_sasl_filter *filter = ecalloc(1, sizeof(php_krb5_sasl_filter));
+
+	ZVAL_COPY(&filter->sasl, sasl);
+	return php_stream_filter_alloc(ops, filter, 0);
+}
+/* }}} */
+
+
+/** KRB5SaslGssapi Methods **/
+/* {{{ proto KRB5SaslGssapi::__construct( KRB5CCache $ccache, string $service [, int $layers = KRB5SaslGssapi::LAYER_ALL [, int $max_buffer = 65536 [, string $authzid ]]] )
+   Prepares an exchange with service ("ldap@host.example.com") using the default credentials of ccache */
+PHP_METHOD(KRB5SaslGssapi, __construct)
+{
+	krb5_sasl_gssapi_object *object = Z_KRB5_SASL_GSSAPI_OBJ_P(getThis());
+	OM_uint32 status, minor_status = 0;
+	zval *zccache = NULL;
+	krb5_ccache_object *ccache;
+	char *service = NULL;
+	size_t service_len = 0;
+	zend_long layers = PHP_KRB5_SASL_LAYER_ALL;
+	zend_long max_buffer = 65536;
+	zend_string *authzid = NULL;
+	char *ccname = NULL;
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "Os|llS", &zccache, krb5_ce_ccache,
+			&service, &service_len, &layers, &max_buffer, &authzid) == FAILURE) {
+		zend_throw_exception(NULL, "Failed to parse arguments", 0 TSRMLS_CC);
+		return;
+	}
+
+	if(layers <= 0 || (layers & ~PHP_KRB5_SASL_LAYER_ALL)) {
+		zend_throw_exception(NULL, "Invalid SASL security layers", 0 TSRMLS_CC);
+		return;
+	}
+
+	if(max_buffer <= 0 || max_buffer > PHP_KRB5_SASL_MAX_BUFFER) {
+		zend_throw_exception(NULL, "Maximum buffer size must be between 1 and 16777215", 0 TSRMLS_CC);
+		return;
+	}
+
+	object->layers = layers;
+	object->max_buffer = max_buffer;
+	if(authzid && ZSTR_LEN(authzid)) {
+		object->authzid = zend_string_copy(authzid);
+	}
+
+	ccache = Z_KRB5_CCACHE_OBJ_P(zccache);
+	php_krb5_ccache_auto_renew(ccache TSRMLS_CC);
+	zval_ptr_dtor(&object->ccache);
+	ZVAL_COPY(&object->ccache, zccache);
+
+	status = php_krb5_name_cache_import(&minor_status, service, service_len, GSS_C_NT_HOSTBASED_SERVICE, 1, &object->target TSRMLS_CC);
+	if(GSS_ERROR(status)) {
+		php_krb5_throw_gssapi_exception(status, minor_status, "Could not parse service name" TSRMLS_CC);
+		return;
+	}
+
+	spprintf(&ccname, 0, "%s:%s", krb5_cc_get_type(ccache->ctx, ccache->cc), krb5_cc_get_name(ccache->ctx, ccache->cc));
+	status = php_krb5_gssapi_acquire_cred(&minor_status, GSS_C_NO_NAME, GSS_C_INITIATE, ccname, NULL, 0, &object->creds TSRMLS_CC);
+	efree(ccname);
+
+	if(GSS_ERROR(status)) {
+		php_krb5_throw_gssapi_exception(status, minor_status, "Error while obtaining client credentials" TSRMLS_CC);
+		return;
+	}
+} /* }}} */
+
+/* {{{ proto string KRB5SaslGssapi::step( [string $challenge = ''] )
+   Processes a server challenge (none for the initial response), returns the response to send */
+PHP_METHOD(KRB5SaslGssapi, step)
+{
+	krb5_sasl_gssapi_object *object = Z_KRB5_SASL_GSSAPI_OBJ_P(getThis());
+	OM_uint32 minor_status = 0;
+	gss_buffer_desc challenge, response;
+
+	memset(&challenge, 0, sizeof(challenge));
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|s", &(challenge.value), &(challenge.length)) == FAILURE) {
+		return;
+	}
+
+	if(php_krb5_sasl_step(object, &challenge, &response TSRMLS_CC) != SUCCESS) {
+		return;
+	}
+
+	RETVAL_STRINGL(response.value ? response.value : "", response.length);
+	gss_release_buffer(&minor_status, &response);
+} /* }}} */
+
+/* {{{ proto bool KRB5SaslGssapi::isComplete( )
+   Whether the security layer has been negotiated */
+PHP_METHOD(KRB5SaslGssapi, isComplete)
+{
+	krb5_sasl_gssapi_object *object = Z_KRB5_SASL_GSSAPI_OBJ_P(getThis());
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		return;
+	}
+
+	RETURN_BOOL(object->state == PHP_KRB5_SASL_COMPLETE);
+} /* }}} */
+
+/* {{{ proto bool KRB5SaslGssapi::negotiate( resource $stream )
+   Runs the complete exchange over stream, every message prefixed with its 4 octet length. Empty responses are sent as empty frames */
+PHP_METHOD(KRB5SaslGssapi, negotiate)
+{
+	krb5_sasl_gssapi_object *object = Z_KRB5_SASL_GSSAPI_OBJ_P(getThis());
+	OM_uint32 minor_status = 0;
+	gss_buffer_desc challenge, response;
+	zval *zstream;
+	php_stream *stream;
+	int retval = SUCCESS;
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r", &zstream) == FAILURE) {
+		return;
+	}
+
+	php_stream_from_zval(stream, zstream);
+
+	memset(&challenge, 0, sizeof(challenge));
+
+	while(retval == SUCCESS) {
+		retval = php_krb5_sasl_step(object, &challenge, &response TSRMLS_CC);
+		if(challenge.value) {
+			efree(challenge.value);
+			challenge.value = NULL;
+		}
+		if(retval != SUCCESS) {
+			break;
+		}
+
+		/* the server waits for a frame even if the response is empty */
+		retval = php_krb5_sasl_write_token(stream, &response TSRMLS_CC);
+		gss_release_buffer(&minor_status, &response);
+
+		if(retval != SUCCESS || object->state == PHP_KRB5_SASL_COMPLETE) {
+			break;
+		}
+
+		retval = php_krb5_sasl_read_token(stream, &challenge TSRMLS_CC);
+	}
+
+	RETURN_BOOL(retval == SUCCESS);
+} /* }}} */
+
+/* {{{ proto int KRB5SaslGssapi::getLayer( )
+   Returns the negotiated security layer (KRB5SaslGssapi::LAYER_*), 0 before completion */
+PHP_METHOD(KRB5SaslGssapi, getLayer)
+{
+	krb5_sasl_gssapi_object *object = Z_KRB5_SASL_GSSAPI_OBJ_P(getThis());
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		return;
+	}
+
+	RETURN_LONG(object->layer);
+} /* }}} */
+
+/* {{{ proto int KRB5SaslGssapi::getMaxSendSize( )
+   Returns the number of plaintext bytes carried per security layer frame */
+PHP_METHOD(KRB5SaslGssapi, getMaxSendSize)
+{
+	krb5_sasl_gssapi_object *object = Z_KRB5_SASL_GSSAPI_OBJ_P(getThis());
+
+	if (zend_parse_parameters_none() == FAILURE) {
+		return;
+	}
+
+	RETURN_LONG(object->max_send);
+} /* }}} */
+
+/* {{{ proto bool KRB5SaslGssapi::wrapStream( resource $stream )
+   Applies the negotiated security layer to everything read from and written to stream */
+PHP_METHOD(KRB5SaslGssapi, wrapStream)
+{
+	krb5_sasl_gssapi_object *object = Z_KRB5_SASL_GSSAPI_OBJ_P(getThis());
+	zval *zstream;
+	php_stream *stream;
+
+	if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r", &zstream) == FAILURE) {
+		return;
+	}
+
+	php_stream_from_zval(stream, zstream);
+
+	if(object->state != PHP_KRB5_SASL_COMPLETE) {
+		zend_throw_exception(NULL, "SASL negotiation is not complete", 0 TSRMLS_CC);
+		return;
+	}
+
+	if(stream->is_persistent) {
+		zend_throw_exception(NULL, "Persistent streams cannot carry a SASL security layer", 0 TSRMLS_CC);
+		return;
+	}
+
+	if(object->layer == PHP_KRB5_SASL_LAYER_NONE) {
+		RETURN_TRUE;
+	}
+
+	/* data already buffered by the stream is passed through the read filter */
+	php_stream_filter_append(&stream->readfilters, php_krb5_sasl_filter_new(&php_krb5_sasl_unwrap_ops, getThis()));
+	php_stream_filter_append(&stream->writefilters, php_krb5_sasl_filter_new(&php_krb5_sasl_wrap_ops, getThis()));
+
+	RETURN_TRUE;
+} /* }}} */
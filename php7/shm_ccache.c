@@ -0,0 +1,338 @@
+/**
+* Copyright (c) 2008 Moritz Bechler
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+**/
+
+/*
+ * "SHM:" credential caches
+ *
+ * A shared anonymous mapping is created at MINIT (i.e. in the FPM master)
+ * and inherited by every forked worker. It holds a fixed number of named
+ * slots, each containing a serialised (FILE format) credential cache.
+ * Access is serialised by a process-shared, robust mutex.
+ *
+ * Slots whose tickets have all expired are released when they are next
+ * looked up. Should every slot be taken, a new cache replaces an empty or
+ * expired one, otherwise the one least recently used.
+ */
+
+#include "php_krb5.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define PHP_KRB5_SHM_MAGIC   0x6b726235
+#define PHP_KRB5_SHM_SLOTS   32
+#define PHP_KRB5_SHM_NAMELEN 64
+
+typedef struct _php_krb5_shm_slot {
+	char name[PHP_KRB5_SHM_NAMELEN];
+	size_t length;
+	/* end time of the longest lived ticket, 0 if unknown */
+	time_t expires;
+	time_t used;
+} php_krb5_shm_slot;
+
+typedef struct _php_krb5_shm_segment {
+	uint32_t magic;
+	pthread_mutex_t lock;
+	size_t slot_size;
+	php_krb5_shm_slot slots[PHP_KRB5_SHM_SLOTS];
+} php_krb5_shm_segment;
+
+/* process wide, shared by all threads and inherited across fork */
+static php_krb5_shm_segment *shm_segment = NULL;
+static size_t shm_segment_size = 0;
+
+#define PHP_KRB5_SHM_DATA(i) \
+	((char*) shm_segment + ZEND_MM_ALIGNED_SIZE(sizeof(php_krb5_shm_segment)) + (i) * shm_segment->slot_size)
+
+/* {{{ */
+static int php_krb5_shm_lock()
+{
+	int rc = pthread_mutex_lock(&shm_segment->lock);
+
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+	if(rc == EOWNERDEAD) {
+		/* a worker died while holding the lock; slots it was writing
+		 * have their length zeroed, so the data is consistent */
+		pthread_mutex_consistent(&shm_segment->lock);
+		rc = 0;
+	}
+#endif
+
+	return rc;
+}
+/* }}} */
+
+/* {{{ */
+static void php_krb5_shm_unlock()
+{
+	pthread_mutex_unlock(&shm_segment->lock);
+}
+/* }}} */
+
+/* {{{ */
+static inline int php_krb5_shm_slot_stale(php_krb5_shm_slot *slot, time_t now)
+{
+	return slot->length == 0 || (slot->expires && slot->expires <= now);
+}
+/* }}} */
+
+/* {{{ must be called with the lock held. Without create, a stale slot
+       called name is released and not found */
+static int php_krb5_shm_find_slot(const char *name, int create)
+{
+	int i, free_slot = -1, victim = -1, stale, victim_stale = 0;
+	time_t now = time(NULL);
+	php_krb5_shm_slot *slot;
+
+	for(i = 0; i < PHP_KRB5_SHM_SLOTS; i++) {
+		slot = &shm_segment->slots[i];
+
+		if(!slot->name[0]) {
+			if(free_slot < 0) free_slot = i;
+			continue;
+		}
+
+		if(strcmp(slot->name, name) == 0) {
+			if(!create && php_krb5_shm_slot_stale(slot, now)) {
+				memset(slot, 0, sizeof(*slot));
+				return -1;
+			}
+			slot->used = now;
+			return i;
+		}
+
+		/* stale slots first, then the least recently used one */
+		stale = php_krb5_shm_slot_stale(slot, now);
+		if(victim < 0 || stale > victim_stale || (stale == victim_stale && slot->used < shm_segment->slots[victim].used)) {
+			victim = i;
+			victim_stale = stale;
+		}
+	}
+
+	if(!create) {
+		return -1;
+	}
+
+	if(free_slot < 0) {
+		free_slot = victim;
+	}
+
+	slot = &shm_segment->slots[free_slot];
+	memset(slot, 0, sizeof(*slot));
+	strcpy(slot->name, name);
+	slot->used = now;
+
+	return free_slot;
+}
+/* }}} */
+
+/* {{{ Latest end time of the tickets in cc, 0 if there are none */
+static time_t php_krb5_shm_ccache_endtime(krb5_context ctx, krb5_ccache cc)
+{
+	krb5_cc_cursor cursor;
+	krb5_creds creds;
+	time_t endtime = 0;
+
+	if(krb5_cc_start_seq_get(ctx, cc, &cursor)) {
+		return 0;
+	}
+
+	while(krb5_cc_next_cred(ctx, cc, &cursor, &creds) == 0) {
+		if(!krb5_is_config_principal(ctx, creds.server) && (time_t) creds.times.endtime > endtime) {
+			endtime = creds.times.endtime;
+		}
+		krb5_free_cred_contents(ctx, &creds);
+	}
+	krb5_cc_end_seq_get(ctx, cc, &cursor);
+
+	return endtime;
+}
+/* }}} */
+
+/* {{{ Creates the shared segment, called from MINIT */
+int php_krb5_shm_ccache_init(TSRMLS_D)
+{
+	pthread_mutexattr_t attr;
+	size_t header = ZEND_MM_ALIGNED_SIZE(sizeof(php_krb5_shm_segment));
+	zend_long size = KRB5_G(shm_ccache_size);
+	void *mem;
+
+	if(size <= 0) {
+		return SUCCESS;
+	}
+
+	if((size_t) size < header + PHP_KRB5_SHM_SLOTS * 1024) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "krb5.shm_ccache_size is too small, shared credential caches disabled");
+		return SUCCESS;
+	}
+
+	mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(mem == MAP_FAILED) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Failed to map shared credential cache segment (%s)", strerror(errno));
+		return SUCCESS;
+	}
+
+	shm_segment = mem;
+	shm_segment_size = size;
+	memset(shm_segment, 0, header);
+	shm_segment->slot_size = (size - header) / PHP_KRB5_SHM_SLOTS;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+	if(pthread_mutex_init(&shm_segment->lock, &attr)) {
+		pthread_mutexattr_destroy(&attr);
+		munmap(shm_segment, shm_segment_size);
+		shm_segment = NULL;
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Failed to initialize shared credential cache lock");
+		return SUCCESS;
+	}
+	pthread_mutexattr_destroy(&attr);
+
+	shm_segment->magic = PHP_KRB5_SHM_MAGIC;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ */
+int php_krb5_shm_ccache_shutdown(TSRMLS_D)
+{
+	if(shm_segment) {
+		munmap(shm_segment, shm_segment_size);
+		shm_segment = NULL;
+	}
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ */
+int php_krb5_shm_ccache_enabled()
+{
+	return shm_segment != NULL;
+}
+/* }}} */
+
+/* {{{ */
+size_t php_krb5_shm_ccache_slot_size()
+{
+	return shm_segment ? shm_segment->slot_size : 0;
+}
+/* }}} */
+
+/* {{{ Replaces the contents of cc with the shared cache called name */
+krb5_error_code php_krb5_shm_ccache_load(krb5_context ctx, const char *name, krb5_ccache cc TSRMLS_DC)
+{
+	krb5_error_code retval = 0;
+	char *buf;
+	size_t len;
+	int slot;
+
+	if(!shm_segment) {
+		return KRB5_CC_NOSUPP;
+	}
+
+	if(!*name || strlen(name) >= PHP_KRB5_SHM_NAMELEN) {
+		return KRB5_CC_BADNAME;
+	}
+
+	if(php_krb5_shm_lock()) {
+		return KRB5_CC_IO;
+	}
+
+	slot = php_krb5_shm_find_slot(name, 0);
+	if(slot < 0 || shm_segment->slots[slot].length == 0) {
+		php_krb5_shm_unlock();
+		return KRB5_FCC_NOFILE;
+	}
+
+	len = shm_segment->slots[slot].length;
+	buf = emalloc(len);
+	memcpy(buf, PHP_KRB5_SHM_DATA(slot), len);
+	php_krb5_shm_unlock();
+
+	retval = php_krb5_ccache_unserialize(ctx, buf, len, cc TSRMLS_CC);
+	efree(buf);
+
+	return retval;
+}
+/* }}} */
+
+/* {{{ Stores the contents of cc as the shared cache called name */
+krb5_error_code php_krb5_shm_ccache_store(krb5_context ctx, krb5_ccache cc, const char *name TSRMLS_DC)
+{
+	krb5_error_code retval = 0;
+	smart_str buf = {0};
+	time_t expires;
+	int slot;
+
+	if(!shm_segment) {
+		return KRB5_CC_NOSUPP;
+	}
+
+	if(!*name || strlen(name) >= PHP_KRB5_SHM_NAMELEN) {
+		return KRB5_CC_BADNAME;
+	}
+
+	/* serialise outside of the lock */
+	if((retval = php_krb5_ccache_serialize(ctx, cc, &buf TSRMLS_CC))) {
+		smart_str_free(&buf);
+		return retval;
+	}
+
+	if(ZSTR_LEN(buf.s) > shm_segment->slot_size) {
+		smart_str_free(&buf);
+		return KRB5_CC_NOMEM;
+	}
+
+	expires = php_krb5_shm_ccache_endtime(ctx, cc);
+
+	if(php_krb5_shm_lock()) {
+		smart_str_free(&buf);
+		return KRB5_CC_IO;
+	}
+
+	slot = php_krb5_shm_find_slot(name, 1);
+	if(slot < 0) {
+		retval = KRB5_CC_NOMEM;
+	} else {
+		/* zero length first so a writer dying mid-copy leaves an empty slot */
+		shm_segment->slots[slot].length = 0;
+		memcpy(PHP_KRB5_SHM_DATA(slot), ZSTR_VAL(buf.s), ZSTR_LEN(buf.s));
+		shm_segment->slots[slot].length = ZSTR_LEN(buf.s);
+		shm_segment->slots[slot].expires = expires;
+	}
+
+	php_krb5_shm_unlock();
+	smart_str_free(&buf);
+
+	return retval;
+}
+/* }}} */
@@ -0,0 +1,361 @@
+/**
+* Copyright (c) 2008 Moritz Bechler
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+**/
+
+
+/*
+ * Shared memory replay cache
+ *
+ * Replaces the library's file replay cache for acceptors which opt in
+ * (krb5.rcache = shm). Like MIT krb5 >= 1.18 it records a hash of the
+ * authenticator ciphertext of each accepted AP-REQ. The table lives in a
+ * shared anonymous mapping created at MINIT and inherited by all workers;
+ * it is split into stripes with a process-shared mutex each, so workers
+ * only contend when their tags fall into the same stripe. Entries expire
+ * after twice the default clock skew and are then reused.
+ */
+
+#include "php_krb5.h"
+#include "ext/standard/sha1.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define PHP_KRB5_RCACHE_MAGIC    0x6b726372
+#define PHP_KRB5_RCACHE_STRIPES  64
+#define PHP_KRB5_RCACHE_TAGLEN   20
+#define PHP_KRB5_RCACHE_PROBES   32
+#define PHP_KRB5_RCACHE_LIFETIME 600 /* 2 * default clockskew */
+
+typedef struct _php_krb5_rcache_entry {
+	unsigned char tag[PHP_KRB5_RCACHE_TAGLEN];
+	uint32_t expires; /* 0: never used */
+} php_krb5_rcache_entry;
+
+typedef struct _php_krb5_rcache_stripe {
+	pthread_mutex_t lock;
+	char pad[64 - sizeof(pthread_mutex_t) % 64]; /* keep locks on separate cache lines */
+} php_krb5_rcache_stripe;
+
+typedef struct _php_krb5_rcache_segment {
+	uint32_t magic;
+	size_t stripe_entries;
+	php_krb5_rcache_stripe stripes[PHP_KRB5_RCACHE_STRIPES];
+} php_krb5_rcache_segment;
+
+/* process wide, shared by all threads and inherited across fork */
+static php_krb5_rcache_segment *rcache_segment = NULL;
+static size_t rcache_segment_size = 0;
+
+#define PHP_KRB5_RCACHE_ENTRIES(i) \
+	((php_krb5_rcache_entry*) ((char*) rcache_segment + ZEND_MM_ALIGNED_SIZE(sizeof(php_krb5_rcache_segment))) + (i) * rcache_segment->stripe_entries)
+
+/* {{{ Creates the shared table, called from MINIT */
+int php_krb5_rcache_init(TSRMLS_D)
+{
+	pthread_mutexattr_t attr;
+	size_t header = ZEND_MM_ALIGNED_SIZE(sizeof(php_krb5_rcache_segment));
+	zend_long size = KRB5_G(rcache_shm_size);
+	void *mem;
+	int i;
+
+	if(size <= 0) {
+		return SUCCESS;
+	}
+
+	if((size_t) size < header + PHP_KRB5_RCACHE_STRIPES * PHP_KRB5_RCACHE_PROBES * sizeof(php_krb5_rcache_entry)) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "krb5.rcache_shm_size is too small, shared replay cache disabled");
+		return SUCCESS;
+	}
+
+	mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(mem == MAP_FAILED) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Failed to map shared replay cache segment (%s)", strerror(errno));
+		return SUCCESS;
+	}
+
+	rcache_segment = mem;
+	rcache_segment_size = size;
+	memset(rcache_segment, 0, header); /* entries are zero filled by mmap */
+	rcache_segment->stripe_entries = (size - header) / sizeof(php_krb5_rcache_entry) / PHP_KRB5_RCACHE_STRIPES;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+	for(i = 0; i < PHP_KRB5_RCACHE_STRIPES; i++) {
+		if(pthread_mutex_init(&rcache_segment->stripes[i].lock, &attr)) {
+			pthread_mutexattr_destroy(&attr);
+			munmap(rcache_segment, rcache_segment_size);
+			rcache_segment = NULL;
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Failed to initialize shared replay cache lock");
+			return SUCCESS;
+		}
+	}
+	pthread_mutexattr_destroy(&attr);
+
+	rcache_segment->magic = PHP_KRB5_RCACHE_MAGIC;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ */
+int php_krb5_rcache_shutdown(TSRMLS_D)
+{
+	if(rcache_segment) {
+		munmap(rcache_segment, rcache_segment_size);
+		rcache_segment = NULL;
+	}
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ */
+int php_krb5_rcache_enabled()
+{
+	return rcache_segment != NULL;
+}
+/* }}} */
+
+/* {{{ Whether acceptors should use the shared replay cache per krb5.rcache */
+int php_krb5_rcache_configured(TSRMLS_D)
+{
+	return KRB5_G(rcache) && strcmp(KRB5_G(rcache), PHP_KRB5_RCACHE_SHM) == 0;
+}
+/* }}} */
+
+/* {{{ */
+size_t php_krb5_rcache_capacity()
+{
+	return rcache_segment ? rcache_segment->stripe_entries * PHP_KRB5_RCACHE_STRIPES : 0;
+}
+/* }}} */
+
+/* {{{ Reads a DER element with a single byte tag, advancing *p past it */
+static int php_krb5_der_next(const unsigned char **p, const unsigned char *end, unsigned char *tag, const unsigned char **content, size_t *len)
+{
+	const unsigned char *q = *p;
+	size_t l = 0;
+	int n;
+
+	if(end - q < 2) return FAILURE;
+
+	*tag = *q++;
+	if(*q & 0x80) {
+		n = *q++ & 0x7f;
+		if(n == 0 || n > 4 || end - q < n) return FAILURE;
+		while(n-- > 0) l = (l << 8) | *q++;
+	} else {
+		l = *q++;
+	}
+
+	if((size_t) (end - q) < l) return FAILURE;
+
+	*content = q;
+	*len = l;
+	*p = q + l;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ Finds the element tagged tag within the constructed content [p, end) */
+static int php_krb5_der_find(const unsigned char *p, const unsigned char *end, unsigned char tag, const unsigned char **content, size_t *len)
+{
+	unsigned char t;
+
+	while(p < end) {
+		if(php_krb5_der_next(&p, end, &t, content, len) == FAILURE) return FAILURE;
+		if(t == tag) return SUCCESS;
+	}
+
+	return FAILURE;
+}
+/* }}} */
+
+static const unsigned char php_krb5_oid_spnego[] = { 0x2b, 0x06, 0x01, 0x05, 0x05, 0x02 };
+static const unsigned char php_krb5_oid_krb5[] = { 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x12, 0x01, 0x02, 0x02 };
+
+static int php_krb5_rcache_authenticator(const unsigned char *token, size_t length, const unsigned char **cipher, size_t *cipher_len, int depth);
+
+/* {{{ Extracts the mechToken of a SPNEGO NegTokenInit [0] / NegTokenResp [1] */
+static int php_krb5_rcache_spnego(const unsigned char *p, const unsigned char *end, const unsigned char **cipher, size_t *cipher_len, int depth)
+{
+	const unsigned char *c;
+	unsigned char tag;
+	size_t len;
+
+	if(php_krb5_der_next(&p, end, &tag, &c, &len) == FAILURE || (tag != 0xa0 && tag != 0xa1)) return FAILURE;
+	p = c;
+	end = c + len;
+	if(php_krb5_der_next(&p, end, &tag, &c, &len) == FAILURE || tag != 0x30) return FAILURE;
+	if(php_krb5_der_find(c, c + len, 0xa2, &c, &len) == FAILURE) return FAILURE;
+	p = c;
+	end = c + len;
+	if(php_krb5_der_next(&p, end, &tag, &c, &len) == FAILURE || tag != 0x04) return FAILURE;
+
+	return php_krb5_rcache_authenticator(c, len, cipher, cipher_len, depth + 1);
+}
+/* }}} */
+
+/* {{{ Locates the authenticator ciphertext of the AP-REQ within a (SPNEGO wrapped) Kerberos token */
+static int php_krb5_rcache_authenticator(const unsigned char *token, size_t length, const unsigned char **cipher, size_t *cipher_len, int depth)
+{
+	const unsigned char *p = token, *end = token + length, *c, *oid;
+	size_t len, oid_len;
+	unsigned char tag;
+
+	if(depth > 1) return FAILURE;
+
+	/* unframed SPNEGO NegTokenResp */
+	if(depth == 0 && length > 0 && token[0] == 0xa1) {
+		return php_krb5_rcache_spnego(token, token + length, cipher, cipher_len, depth);
+	}
+
+	/* InitialContextToken ::= [APPLICATION 0] IMPLICIT SEQUENCE { thisMech, innerToken } */
+	if(php_krb5_der_next(&p, end, &tag, &c, &len) == FAILURE || tag != 0x60) return FAILURE;
+	p = c;
+	end = c + len;
+	if(php_krb5_der_next(&p, end, &tag, &oid, &oid_len) == FAILURE || tag != 0x06) return FAILURE;
+
+	if(oid_len == sizeof(php_krb5_oid_spnego) && memcmp(oid, php_krb5_oid_spnego, oid_len) == 0) {
+		return php_krb5_rcache_spnego(p, end, cipher, cipher_len, depth);
+	}
+
+	if(oid_len != sizeof(php_krb5_oid_krb5) || memcmp(oid, php_krb5_oid_krb5, oid_len) != 0) return FAILURE;
+
+	/* TOK_ID KRB_AP_REQ */
+	if(end - p < 2 || p[0] != 0x01 || p[1] != 0x00) return FAILURE;
+	p += 2;
+
+	/* AP-REQ ::= [APPLICATION 14] SEQUENCE { ..., authenticator [4] EncryptedData } */
+	if(php_krb5_der_next(&p, end, &tag, &c, &len) == FAILURE || tag != 0x6e) return FAILURE;
+	p = c;
+	end = c + len;
+	if(php_krb5_der_next(&p, end, &tag, &c, &len) == FAILURE || tag != 0x30) return FAILURE;
+	if(php_krb5_der_find(c, c + len, 0xa4, &c, &len) == FAILURE) return FAILURE;
+	p = c;
+	end = c + len;
+
+	/* EncryptedData ::= SEQUENCE { etype [0], kvno [1] OPTIONAL, cipher [2] OCTET STRING } */
+	if(php_krb5_der_next(&p, end, &tag, &c, &len) == FAILURE || tag != 0x30) return FAILURE;
+	if(php_krb5_der_find(c, c + len, 0xa2, &c, &len) == FAILURE) return FAILURE;
+	p = c;
+	end = c + len;
+	if(php_krb5_der_next(&p, end, &tag, &c, &len) == FAILURE || tag != 0x04) return FAILURE;
+
+	*cipher = c;
+	*cipher_len = len;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ Records an accepted context token, fails with KRB5_RC_REPLAY if it was seen before.
+       Tokens without an AP-REQ are only recorded (as a whole) once the context is complete,
+       a SPNEGO negotiation token alone is not unique */
+krb5_error_code php_krb5_rcache_store(const void *token, size_t length, int complete TSRMLS_DC)
+{
+	unsigned char tag[PHP_KRB5_RCACHE_TAGLEN];
+	const unsigned char *cipher;
+	size_t cipher_len;
+	PHP_SHA1_CTX sha;
+	php_krb5_rcache_stripe *stripe;
+	php_krb5_rcache_entry *entries, *e, *slot = NULL;
+	uint32_t now = (uint32_t) time(NULL);
+	uint32_t hash;
+	size_t pos, i;
+	krb5_error_code retval = 0;
+	int rc;
+
+	if(!rcache_segment) {
+		return KRB5_RC_NOIO;
+	}
+
+	/* hash the authenticator if it can be found, otherwise the whole token */
+	if(php_krb5_rcache_authenticator(token, length, &cipher, &cipher_len, 0) == FAILURE) {
+		if(!complete) {
+			return 0;
+		}
+		cipher = token;
+		cipher_len = length;
+	}
+
+	PHP_SHA1Init(&sha);
+	PHP_SHA1Update(&sha, cipher, cipher_len);
+	PHP_SHA1Final(tag, &sha);
+
+	memcpy(&hash, tag, sizeof(hash));
+	stripe = &rcache_segment->stripes[hash % PHP_KRB5_RCACHE_STRIPES];
+	entries = PHP_KRB5_RCACHE_ENTRIES(hash % PHP_KRB5_RCACHE_STRIPES);
+	pos = (hash / PHP_KRB5_RCACHE_STRIPES) % rcache_segment->stripe_entries;
+
+	rc = pthread_mutex_lock(&stripe->lock);
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+	if(rc == EOWNERDEAD) {
+		/* entries are written with a single memcpy, at worst one is lost */
+		pthread_mutex_consistent(&stripe->lock);
+		rc = 0;
+	}
+#endif
+	if(rc) {
+		return KRB5_RC_IO;
+	}
+
+	for(i = 0; i < PHP_KRB5_RCACHE_PROBES && i < rcache_segment->stripe_entries; i++) {
+		e = &entries[(pos + i) % rcache_segment->stripe_entries];
+
+		if(e->expires == 0) {
+			/* end of the probe sequence */
+			if(!slot) slot = e;
+			break;
+		}
+
+		if(e->expires <= now) {
+			if(!slot) slot = e;
+			continue;
+		}
+
+		if(memcmp(e->tag, tag, sizeof(tag)) == 0) {
+			retval = KRB5_RC_REPLAY;
+			break;
+		}
+	}
+
+	if(!retval) {
+		if(slot) {
+			memcpy(slot->tag, tag, sizeof(tag));
+			slot->expires = now + PHP_KRB5_RCACHE_LIFETIME;
+		} else {
+			/* fail closed rather than dropping live entries */
+			retval = KRB5_RC_IO_SPACE;
+		}
+	}
+
+	pthread_mutex_unlock(&stripe->lock);
+	return retval;
+}
+/* }}} */
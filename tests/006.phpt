@@ -0,0 +1,33 @@
+--TEST--
+Testing for worker-persistent credential caches
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+
+$ccache = KRB5CCache::persistent('test');
+var_dump($ccache instanceof KRB5CCache);
+var_dump($ccache->initKeytab($server_principal, $server_keytab));
+$lifetime = $ccache->getLifetime();
+unset($ccache);
+
+$ccache2 = KRB5CCache::persistent('test');
+var_dump($ccache2->isValid());
+var_dump($ccache2->initKeytab($server_principal, $server_keytab));
+// TGT was still fresh, so no new ticket has been requested
+var_dump($ccache2->getLifetime() == $lifetime);
+
+$other = KRB5CCache::persistent('other');
+var_dump($other->getName() != $ccache2->getName());
+?>
+--EXPECTF--
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
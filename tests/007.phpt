@@ -0,0 +1,50 @@
+--TEST--
+Testing for shared memory credential caches
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--INI--
+krb5.shm_ccache_size=1048576
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+
+$ccache = new KRB5CCache();
+$ccache->initKeytab($server_principal, $server_keytab);
+var_dump($ccache->save('SHM:service'));
+
+$ccache2 = new KRB5CCache();
+var_dump($ccache2->open('SHM:service'));
+var_dump($ccache2->getEntries() == $ccache->getEntries());
+var_dump($ccache2->getLifetime() == $ccache->getLifetime());
+var_dump($ccache2->isValid());
+
+try {
+	$ccache2->open('SHM:missing');
+} catch(Exception $e) {
+	echo "caught\n";
+}
+
+// with all 32 slots taken the least recently used cache makes room
+for($i = 0; $i < 32; $i++) {
+	$ccache->save('SHM:cache' . $i);
+}
+$ccache3 = new KRB5CCache();
+var_dump($ccache3->open('SHM:cache31'));
+try {
+	$ccache3->open('SHM:service');
+} catch(Exception $e) {
+	echo "evicted\n";
+}
+?>
+--EXPECTF--
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+caught
+bool(true)
+evicted
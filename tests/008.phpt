@@ -0,0 +1,31 @@
+--TEST--
+Testing the lazy ticket iterator
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+
+$ccache = new KRB5CCache();
+$ccache->initKeytab($server_principal, $server_keytab);
+
+$tickets = $ccache->tickets();
+var_dump($tickets instanceof Iterator);
+var_dump(iterator_to_array($tickets) == $ccache->getTktAttrs());
+
+foreach($ccache->tickets('krbtgt/') as $idx => $tkt) {
+	var_dump($idx);
+	var_dump(strpos($tkt['server'], 'krbtgt/') === 0);
+}
+
+var_dump(iterator_count($ccache->tickets('nonexistent/')));
+?>
+--EXPECTF--
+bool(true)
+bool(true)
+int(0)
+bool(true)
+int(0)
@@ -0,0 +1,30 @@
+--TEST--
+Testing concurrent service ticket prefetch
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+
+$ccache = new KRB5CCache();
+$ccache->initPassword($client_principal, $client_password);
+
+$status = $ccache->prefetchServiceTickets(array($server_principal, 'unknown/nonexistent@' . $ccache->getRealm()));
+var_dump($status[$server_principal]);
+var_dump(is_string($status['unknown/nonexistent@' . $ccache->getRealm()]));
+var_dump(iterator_count($ccache->tickets($server_principal)) == 1);
+
+// served from the cache this time
+var_dump($ccache->prefetchServiceTickets(array($server_principal)));
+?>
+--EXPECTF--
+bool(true)
+bool(true)
+bool(true)
+array(1) {
+  [%s]=>
+  bool(true)
+}
@@ -0,0 +1,46 @@
+--TEST--
+Testing step driven AS and TGS exchanges
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+if(empty($kdc_address)) { echo "skip no KDC address configured"; return; }
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+
+function exchange($op, $kdc) {
+	$sock = stream_socket_client($kdc);
+	while(!$op->isComplete()) {
+		fwrite($sock, $op->getRequest());
+		$op->step(fread($sock, 65536));
+	}
+	fclose($sock);
+}
+
+$ccache = new KRB5CCache();
+$op = new KRB5InitCredsOperation($ccache, $client_principal, array('password' => $client_password));
+var_dump($op->isComplete());
+var_dump(strlen($op->getRealm()) > 0);
+exchange($op, $kdc_address);
+var_dump($op->getRequest());
+var_dump($ccache->isValid());
+
+$op = new KRB5TktCredsOperation($ccache, $server_principal);
+exchange($op, $kdc_address);
+var_dump(iterator_count($ccache->tickets($server_principal)));
+
+try {
+	new KRB5InitCredsOperation($ccache, $client_principal);
+} catch(Exception $e) {
+	echo $e->getMessage(), "\n";
+}
+?>
+--EXPECT--
+bool(false)
+bool(true)
+NULL
+bool(true)
+int(1)
+Either a password or a keytab option is required
@@ -0,0 +1,36 @@
+--TEST--
+Testing atomic FILE credential cache save and open
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+$file = dirname(__FILE__) . '/ccache3.tmp';
+
+$ccache = new KRB5CCache();
+$ccache->initPassword($client_principal, $client_password);
+$ccache->prefetchServiceTickets(array($server_principal));
+
+file_put_contents($file, 'garbage');
+var_dump($ccache->save('FILE:' . $file));
+var_dump($ccache->save('FILE:' . $file)); // replacing an existing cache
+var_dump(count(glob($file . '.*')));
+printf("%o\n", fileperms($file) & 0777);
+
+$ccache2 = new KRB5CCache();
+var_dump($ccache2->open('FILE:' . $file));
+var_dump($ccache2->getPrincipal() == $ccache->getPrincipal());
+var_dump($ccache2->getEntries() == $ccache->getEntries());
+@unlink($file);
+?>
+--EXPECT--
+bool(true)
+bool(true)
+int(0)
+600
+bool(true)
+bool(true)
+bool(true)
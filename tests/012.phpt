@@ -0,0 +1,33 @@
+--TEST--
+Testing the in-memory keytab cache
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--INI--
+krb5.keytab_cache=1
+krb5.keytab_cache_interval=0
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+$copy = dirname(__FILE__) . '/keytab.tmp';
+copy($server_keytab, $copy);
+
+$ccache = new KRB5CCache();
+var_dump($ccache->initKeytab($server_principal, $copy));
+
+// a rotation in progress (truncated file) keeps the last good copy in use
+$contents = file_get_contents($copy);
+file_put_contents($copy, '');
+clearstatcache();
+var_dump($ccache->initKeytab($server_principal, $copy));
+
+file_put_contents($copy, $contents);
+var_dump($ccache->initKeytab($server_principal, $copy));
+@unlink($copy);
+?>
+--EXPECT--
+bool(true)
+bool(true)
+bool(true)
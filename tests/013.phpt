@@ -0,0 +1,71 @@
+--TEST--
+Testing the shared memory replay cache
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--INI--
+krb5.rcache=shm
+krb5.rcache_shm_size=1048576
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+$client = new KRB5CCache();
+if($use_config) {
+	$client->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+
+$client->initPassword($client_principal, $client_password);
+
+$server = new KRB5CCache();
+if($use_config) {
+	$server->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+
+$server->initKeytab($server_principal, $server_keytab);
+
+$cgssapi = new GSSAPIContext();
+$cgssapi->acquireCredentials($client, $client_principal, GSS_C_INITIATE);
+
+$token = '';
+var_dump($cgssapi->initSecContext($server_principal, null, null, null, $token));
+
+$sgssapi = new GSSAPIContext();
+$sgssapi->acquireCredentials($server, $server_principal, GSS_C_ACCEPT);
+var_dump($sgssapi->acceptSecContext($token));
+
+// the same token presented to a fresh acceptor
+$replay = new GSSAPIContext();
+$replay->acquireCredentials($server, $server_principal, GSS_C_ACCEPT);
+try {
+	$replay->acceptSecContext($token);
+} catch(KRB5Exception $e) {
+	echo get_class($e), ': ', $e->getMessage(), "\n";
+	var_dump($e->getKrb5Code() == KRB5_RC_REPLAY);
+}
+
+$auth = new KRB5NegotiateAuth($server_keytab, $server_principal);
+try {
+	$auth->authenticate('Negotiate ' . base64_encode($token));
+} catch(KRB5Exception $e) {
+	echo get_class($e), ': ', $e->getMessage(), "\n";
+	var_dump($e->getKrb5Code() == KRB5_RC_REPLAY);
+}
+
+try {
+	$auth->setReplayCache('file');
+} catch(Exception $e) {
+	echo $e->getMessage(), "\n";
+}
+$auth->setReplayCache('default');
+$auth->setReplayCache('shm');
+?>
+--EXPECTF--
+bool(true)
+bool(true)
+KRB5Exception: Replayed context token (%s)
+bool(true)
+KRB5Exception: Replayed authentication data (%s)
+bool(true)
+Unknown replay cache type file
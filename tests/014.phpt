@@ -0,0 +1,65 @@
+--TEST--
+Testing KRB5NegotiateAuth session tokens
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+
+function b64url($data) {
+	return rtrim(strtr(base64_encode($data), '+/', '-_'), '=');
+}
+
+function token($kid, $key, $expires, $principal) {
+	$payload = $kid . '.' . $expires . '.' . b64url($principal);
+	return $payload . '.' . b64url(hash_hmac('sha256', $payload, $key, true));
+}
+
+$auth = new KRB5NegotiateAuth($server_keytab, $server_principal);
+var_dump($auth->getSessionToken());
+
+try {
+	$auth->setSessionKeys(array('new' => 'short'));
+} catch(Exception $e) {
+	echo $e->getMessage(), "\n";
+}
+
+$old = str_repeat('a', 32);
+$new = str_repeat('b', 32);
+$auth->setSessionKeys(array('new' => $new, 'old' => $old), 3600);
+
+// tokens signed with a retired key stay valid until it is removed
+var_dump($auth->validateSessionToken(token('old', $old, time() + 60, 'user@EXAMPLE.COM')));
+var_dump($auth->getAuthenticatedUser());
+var_dump($auth->validateSessionToken(token('new', $new, time() + 60, 'other@EXAMPLE.COM')));
+var_dump($auth->getAuthenticatedUser());
+
+var_dump($auth->validateSessionToken(token('new', $old, time() + 60, 'user@EXAMPLE.COM')));
+var_dump($auth->validateSessionToken(token('gone', $old, time() + 60, 'user@EXAMPLE.COM')));
+var_dump($auth->validateSessionToken(token('new', $new, time() - 1, 'user@EXAMPLE.COM')));
+var_dump($auth->validateSessionToken(substr(token('new', $new, time() + 60, 'user@EXAMPLE.COM'), 0, -1)));
+var_dump($auth->validateSessionToken('garbage'));
+// padding is not part of base64url, even under a valid MAC
+$payload = 'new.' . (time() + 60) . '.' . base64_encode('user@EXAMPLE.COM');
+var_dump($auth->validateSessionToken($payload . '.' . b64url(hash_hmac('sha256', $payload, $new, true))));
+
+// a rejected token does not leave the previous user authenticated
+var_dump($auth->getAuthenticatedUser());
+?>
+--EXPECT--
+bool(false)
+Session keys must be strings of at least 16 bytes
+bool(true)
+string(16) "user@EXAMPLE.COM"
+bool(true)
+string(17) "other@EXAMPLE.COM"
+bool(false)
+bool(false)
+bool(false)
+bool(false)
+bool(false)
+bool(false)
+bool(false)
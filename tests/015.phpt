@@ -0,0 +1,56 @@
+--TEST--
+Testing KRB5NegotiateAuth::authenticate()
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+$client = new KRB5CCache();
+if($use_config) {
+	$client->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+
+$client->initPassword($client_principal, $client_password);
+
+$auth = new KRB5NegotiateAuth($server_keytab, $server_principal);
+
+try {
+	$auth->authenticate('Basic dXNlcjpwYXNz');
+} catch(Exception $e) {
+	echo $e->getMessage(), "\n";
+}
+
+// one instance serves many requests
+for($i = 0; $i < 2; $i++) {
+	$cgssapi = new GSSAPIContext();
+	$cgssapi->acquireCredentials($client, $client_principal, GSS_C_INITIATE);
+	$token = '';
+	$cgssapi->initSecContext($server_principal, null, GSS_C_MUTUAL_FLAG, null, $token);
+
+	$result = $auth->authenticate('Negotiate ' . base64_encode($token));
+	var_dump(get_class($result));
+	var_dump($result->getPrincipal() === $client_principal);
+	var_dump($result->getExpires() > time());
+	var_dump($result->hasDelegatedCredentials());
+	var_dump($cgssapi->initSecContext($server_principal, base64_decode($result->getResponseToken()), GSS_C_MUTUAL_FLAG));
+}
+
+// request globals are left alone
+var_dump($auth->getAuthenticatedUser());
+?>
+--EXPECT--
+Authorization header does not use the Negotiate scheme
+string(19) "KRB5NegotiateResult"
+bool(true)
+bool(true)
+bool(false)
+bool(true)
+string(19) "KRB5NegotiateResult"
+bool(true)
+bool(true)
+bool(false)
+bool(true)
+bool(false)
@@ -0,0 +1,49 @@
+--TEST--
+Testing KRB5SidSet and name attributes
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+
+$set = new KRB5SidSet(array('S-1-5-21-1004336348-1177238915-682003330-512', 'S-1-5-32-544', 's-1-18-1'));
+var_dump($set->count());
+var_dump($set->contains('S-1-5-32-544'));
+var_dump($set->contains('S-1-18-1'));
+var_dump($set->contains('S-1-5-32-545'));
+var_dump($set->contains('not a sid'));
+
+try {
+	new KRB5SidSet(array('S-1-5-32-'));
+} catch(Exception $e) {
+	echo $e->getMessage(), "\n";
+}
+
+$client = new KRB5CCache();
+if($use_config) {
+	$client->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$client->initPassword($client_principal, $client_password);
+
+$cgssapi = new GSSAPIContext();
+$cgssapi->acquireCredentials($client, $client_principal, GSS_C_INITIATE);
+$token = '';
+$cgssapi->initSecContext($server_principal, null, null, null, $token);
+
+$auth = new KRB5NegotiateAuth($server_keytab, $server_principal);
+$result = $auth->authenticate('Negotiate ' . base64_encode($token));
+var_dump(is_array($result->getNameAttributes()));
+var_dump(is_array($result->getNameAttribute('urn:example:none')));
+?>
+--EXPECT--
+int(3)
+bool(true)
+bool(true)
+bool(false)
+bool(false)
+Invalid SID given
+bool(true)
+bool(true)
@@ -0,0 +1,64 @@
+--TEST--
+Testing that acquireCredentials leaves the environment alone
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+
+// neither of these may be picked up or changed
+putenv('KRB5CCNAME=FILE:/nonexistent/krb5cc');
+putenv('KRB5_KTNAME=FILE:/nonexistent/krb5.keytab');
+
+$client = new KRB5CCache();
+if($use_config) {
+	$client->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$client->initPassword($client_principal, $client_password);
+
+$server = new KRB5CCache();
+if($use_config) {
+	$server->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$server->initKeytab($server_principal, $server_keytab);
+
+$cgssapi = new GSSAPIContext();
+$cgssapi->acquireCredentials($client, $client_principal, GSS_C_INITIATE);
+$sgssapi = new GSSAPIContext();
+$sgssapi->acquireCredentials($server, $server_principal, GSS_C_ACCEPT);
+
+var_dump(getenv('KRB5CCNAME'));
+var_dump(getenv('KRB5_KTNAME'));
+
+$token = '';
+var_dump($cgssapi->initSecContext($server_principal, null, null, null, $token));
+var_dump($sgssapi->acceptSecContext($token));
+
+$auth = new KRB5NegotiateAuth($server_keytab, $server_principal);
+$cgssapi = new GSSAPIContext();
+$cgssapi->acquireCredentials($client, $client_principal, GSS_C_INITIATE);
+$token = '';
+$cgssapi->initSecContext($server_principal, null, null, null, $token);
+var_dump($auth->authenticate('Negotiate ' . base64_encode($token)) instanceof KRB5NegotiateResult);
+
+try {
+	new KRB5NegotiateAuth('FILE:/nonexistent/krb5.keytab', $server_principal);
+} catch(Exception $e) {
+	echo $e->getMessage(), "\n";
+}
+
+var_dump(getenv('KRB5CCNAME'));
+var_dump(getenv('KRB5_KTNAME'));
+?>
+--EXPECT--
+string(24) "FILE:/nonexistent/krb5cc"
+string(29) "FILE:/nonexistent/krb5.keytab"
+bool(true)
+bool(true)
+bool(true)
+Failed to use credential cache
+string(24) "FILE:/nonexistent/krb5cc"
+string(29) "FILE:/nonexistent/krb5.keytab"
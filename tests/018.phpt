@@ -0,0 +1,80 @@
+--TEST--
+Testing scatter-gather wrapIov/unwrapIov/getMicIov
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+if(!method_exists('GSSAPIContext', 'wrapIov') || !method_exists('GSSAPIContext', 'getMicIov')) { echo "skip IOV functions not available"; return; }
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+$client = new KRB5CCache();
+if($use_config) {
+	$client->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$client->initPassword($client_principal, $client_password);
+
+$server = new KRB5CCache();
+if($use_config) {
+	$server->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$server->initKeytab($server_principal, $server_keytab);
+
+$cgssapi = new GSSAPIContext();
+$cgssapi->acquireCredentials($client, $client_principal, GSS_C_INITIATE);
+$sgssapi = new GSSAPIContext();
+$sgssapi->acquireCredentials($server, $server_principal, GSS_C_ACCEPT);
+
+$token = '';
+$cgssapi->initSecContext($server_principal, null, null, null, $token);
+$sgssapi->acceptSecContext($token);
+
+$header = "Content-Type: text/plain\r\n\r\n";
+$body = str_repeat('0123456789abcdef', 65536);
+
+foreach(array(false, true) as $encrypt) {
+	$wrapped = null;
+	var_dump($cgssapi->wrapIov(array($header, '', $body), $wrapped, $encrypt));
+
+	$output = null;
+	var_dump($sgssapi->unwrap($wrapped, $output));
+	var_dump($output === $header . $body);
+
+	$output = null;
+	var_dump($sgssapi->unwrapIov($wrapped, $output));
+	var_dump($output === $header . $body);
+
+	// and the other way round
+	$sgssapi->wrap($header . $body, $wrapped, $encrypt);
+	$output = null;
+	var_dump($cgssapi->unwrapIov($wrapped, $output));
+	var_dump($output === $header . $body);
+}
+
+$mic = $cgssapi->getMicIov(array($header, $body));
+var_dump($sgssapi->verifyMic($header . $body, $mic));
+
+try {
+	$cgssapi->getMicIov(array($header, 42));
+} catch(Exception $e) {
+	echo $e->getMessage(), "\n";
+}
+?>
+--EXPECT--
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+Buffers must be strings
@@ -0,0 +1,76 @@
+--TEST--
+Testing GSSAPIContext export/import
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+$client = new KRB5CCache();
+if($use_config) {
+	$client->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$client->initPassword($client_principal, $client_password);
+
+$server = new KRB5CCache();
+if($use_config) {
+	$server->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$server->initKeytab($server_principal, $server_keytab);
+
+$cgssapi = new GSSAPIContext();
+$cgssapi->acquireCredentials($client, $client_principal, GSS_C_INITIATE);
+$sgssapi = new GSSAPIContext();
+$sgssapi->acquireCredentials($server, $server_principal, GSS_C_ACCEPT);
+
+try {
+	$cgssapi->export();
+} catch(Exception $e) {
+	echo $e->getMessage(), "\n";
+}
+
+$token = '';
+$cgssapi->initSecContext($server_principal, null, null, null, $token);
+$sgssapi->acceptSecContext($token);
+
+$cexported = $cgssapi->export();
+$sexported = $sgssapi->export();
+var_dump(is_string($cexported) && is_string($sexported));
+var_dump($cgssapi->getTimeRemaining());
+
+// as if restored by another request
+$cresumed = new GSSAPIContext();
+$cresumed->import($cexported);
+$sresumed = new GSSAPIContext();
+$sresumed->import($sexported);
+var_dump($cresumed->getTimeRemaining() > 0);
+
+$message = 'resumed without another AP-REQ';
+$enc = '';
+var_dump($cresumed->wrap($message, $enc, true));
+$decoded = '';
+var_dump($sresumed->unwrap($enc, $decoded));
+var_dump($decoded === $message);
+var_dump($cresumed->verifyMic($message, $sresumed->getMic($message)));
+
+// a failed import keeps the current context
+try {
+	$sresumed->import('garbage');
+} catch(GSSAPIException $e) {
+	echo get_class($e), "\n";
+}
+var_dump($sresumed->getTimeRemaining() > 0);
+?>
+--EXPECT--
+No security context to export
+bool(true)
+int(0)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+GSSAPIException
+bool(true)
@@ -0,0 +1,80 @@
+--TEST--
+Testing the initiator context pool
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--INI--
+krb5.initiator_pool_size=2
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+$client = new KRB5CCache();
+if($use_config) {
+	$client->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$client->initPassword($client_principal, $client_password);
+
+$server = new KRB5CCache();
+if($use_config) {
+	$server->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$server->initKeytab($server_principal, $server_keytab);
+
+$cgssapi = new GSSAPIContext();
+var_dump($cgssapi->checkoutContext($client, $server_principal));
+// nothing established yet
+var_dump($cgssapi->returnContext());
+
+$cgssapi->acquireCredentials($client, $client_principal, GSS_C_INITIATE);
+$token = '';
+$cgssapi->initSecContext($server_principal, null, null, null, $token);
+$sgssapi = new GSSAPIContext();
+$sgssapi->acquireCredentials($server, $server_principal, GSS_C_ACCEPT);
+$sgssapi->acceptSecContext($token);
+
+var_dump($cgssapi->returnContext());
+var_dump($cgssapi->getTimeRemaining());
+
+// different flags are a different key
+$other = new GSSAPIContext();
+var_dump($other->checkoutContext($client, $server_principal, GSS_C_MUTUAL_FLAG));
+
+$pooled = new GSSAPIContext();
+var_dump($pooled->checkoutContext($client, $server_principal));
+$enc = '';
+$pooled->wrap('no new AP-REQ', $enc, true);
+$decoded = '';
+$sgssapi->unwrap($enc, $decoded);
+var_dump($decoded);
+var_dump($pooled->returnContext());
+
+// a context established for another target is not pooled under this key
+$wrong = new GSSAPIContext();
+var_dump($wrong->checkoutContext($client, 'host@nonexistent.example'));
+$wrong->acquireCredentials($client, $client_principal, GSS_C_INITIATE);
+$token = '';
+$wrong->initSecContext($server_principal, null, null, null, $token);
+$swrong = new GSSAPIContext();
+$swrong->acquireCredentials($server, $server_principal, GSS_C_ACCEPT);
+$swrong->acceptSecContext($token);
+var_dump($wrong->returnContext());
+
+// contexts too close to expiry are evicted on checkout
+ini_set('krb5.initiator_pool_min_lifetime', 100000000);
+$expired = new GSSAPIContext();
+var_dump($expired->checkoutContext($client, $server_principal));
+?>
+--EXPECT--
+bool(false)
+bool(false)
+bool(true)
+int(0)
+bool(false)
+bool(true)
+string(13) "no new AP-REQ"
+bool(true)
+bool(false)
+bool(false)
+bool(false)
@@ -0,0 +1,70 @@
+--TEST--
+Testing the GSS name cache
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--INI--
+krb5.name_cache_size=1
+krb5.name_cache_ttl=300
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+
+function name_cache_stats() {
+	ob_start();
+	phpinfo(INFO_MODULES);
+	preg_match_all('/Name cache (hits|misses) => (\d+)/', ob_get_clean(), $m);
+	return array_combine($m[1], $m[2]);
+}
+
+$client = new KRB5CCache();
+if($use_config) {
+	$client->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$client->initPassword($client_principal, $client_password);
+
+$server = new KRB5CCache();
+if($use_config) {
+	$server->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$server->initKeytab($server_principal, $server_keytab);
+
+function handshake($client, $server, $server_principal) {
+	$cgssapi = new GSSAPIContext();
+	$cgssapi->acquireCredentials($client);
+	$token = '';
+	$cgssapi->initSecContext($server_principal, null, null, null, $token);
+	$sgssapi = new GSSAPIContext();
+	$sgssapi->acquireCredentials($server);
+	return $sgssapi->acceptSecContext($token);
+}
+
+var_dump(handshake($client, $server, $server_principal));
+var_dump(handshake($client, $server, $server_principal));
+var_dump(handshake($client, $server, $server_principal));
+var_dump(name_cache_stats());
+
+// evicts the target name, the cache holds a single entry
+$auth = new KRB5NegotiateAuth($server_keytab, $server_principal);
+var_dump(handshake($client, $server, $server_principal));
+var_dump(name_cache_stats());
+?>
+--EXPECT--
+bool(true)
+bool(true)
+bool(true)
+array(2) {
+  ["hits"]=>
+  string(1) "2"
+  ["misses"]=>
+  string(1) "1"
+}
+bool(true)
+array(2) {
+  ["hits"]=>
+  string(1) "2"
+  ["misses"]=>
+  string(1) "3"
+}
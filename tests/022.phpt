@@ -0,0 +1,67 @@
+--TEST--
+Testing KRB5Exception and GSSAPIException
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+$client = new KRB5CCache();
+if($use_config) {
+	$client->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+
+try {
+	$client->initPassword($client_principal, $client_password . '-wrong');
+} catch(KRB5Exception $e) {
+	var_dump(get_class($e));
+	var_dump($e->getKrb5Code() != 0);
+	var_dump(strlen($e->getMessage()) > 0);
+}
+
+$client->initPassword($client_principal, $client_password);
+
+$server = new KRB5CCache();
+if($use_config) {
+	$server->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$server->initKeytab($server_principal, $server_keytab);
+
+$sgssapi = new GSSAPIContext();
+$sgssapi->acquireCredentials($server, $server_principal, GSS_C_ACCEPT);
+try {
+	$sgssapi->acceptSecContext('garbage');
+} catch(GSSAPIException $e) {
+	var_dump($e instanceof KRB5Exception);
+	var_dump($e->getMajorStatus() != 0);
+	var_dump($e->getCode() == $e->getMajorStatus());
+	$message = $e->getMessage();
+	var_dump(strlen($message) > 0);
+	var_dump($message === $e->getMessage());
+	var_dump(strpos((string) $e, $message) !== false);
+}
+
+$cgssapi = new GSSAPIContext();
+$cgssapi->acquireCredentials($client, $client_principal, GSS_C_INITIATE);
+$token = '';
+$cgssapi->initSecContext($server_principal, null, null, null, $token);
+$sgssapi = new GSSAPIContext();
+$sgssapi->acquireCredentials($server, $server_principal, GSS_C_ACCEPT);
+$sgssapi->acceptSecContext($token);
+
+// a bad MIC is a result, neither a warning nor an exception
+var_dump($cgssapi->verifyMic('message', $sgssapi->getMic('message') . '-'));
+?>
+--EXPECT--
+string(13) "KRB5Exception"
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(false)
@@ -0,0 +1,91 @@
+--TEST--
+Testing KRB5SaslGssapi
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+if(!function_exists('stream_socket_pair')) { echo "skip stream_socket_pair missing"; return; }
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+$client = new KRB5CCache();
+if($use_config) {
+	$client->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$client->initPassword($client_principal, $client_password);
+
+$server = new KRB5CCache();
+if($use_config) {
+	$server->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$server->initKeytab($server_principal, $server_keytab);
+
+// "service/host@REALM" as hostbased "service@host"
+list($service, $host) = explode('/', strtok($server_principal, '@'), 2);
+$sasl = new KRB5SaslGssapi($client, $service . '@' . $host);
+
+$sgssapi = new GSSAPIContext();
+$sgssapi->acquireCredentials($server, $server_principal, GSS_C_ACCEPT);
+
+// context establishment, the server side in PHP
+$response = $sasl->step();
+$challenge = '';
+$sgssapi->acceptSecContext($response, $challenge);
+var_dump($sasl->step($challenge));
+
+// security layer offer: all layers, 4096 bytes maximum buffer
+$offer = '';
+$sgssapi->wrap(chr(7) . "\x00\x10\x00", $offer, false);
+$choice = '';
+$sgssapi->unwrap($sasl->step($offer), $choice);
+var_dump(ord($choice[0]) == KRB5SaslGssapi::LAYER_CONFIDENTIALITY);
+var_dump($sasl->isComplete());
+var_dump($sasl->getLayer() == KRB5SaslGssapi::LAYER_CONFIDENTIALITY);
+var_dump($sasl->getMaxSendSize() > 0 && $sasl->getMaxSendSize() < 4096);
+
+list($a, $b) = stream_socket_pair(STREAM_PF_UNIX, STREAM_SOCK_STREAM, STREAM_IPPROTO_IP);
+var_dump($sasl->wrapStream($a));
+
+// writes are split into frames the server can take
+$message = str_repeat('x', 10000);
+fwrite($a, $message);
+$received = '';
+$fits = true;
+while(strlen($received) < strlen($message)) {
+	$length = unpack('N', fread($b, 4));
+	$frame = '';
+	while(strlen($frame) < $length[1]) {
+		$frame .= fread($b, $length[1] - strlen($frame));
+	}
+	$fits = $fits && $length[1] <= 4096;
+	$plain = '';
+	$sgssapi->unwrap($frame, $plain);
+	$received .= $plain;
+}
+var_dump($fits);
+var_dump($received === $message);
+
+// reads are unwrapped
+$enc = '';
+$sgssapi->wrap('reply', $enc, true);
+fwrite($b, pack('N', strlen($enc)) . $enc);
+var_dump(fread($a, 100));
+
+try {
+	$sasl->step('');
+} catch(Exception $e) {
+	echo $e->getMessage(), "\n";
+}
+?>
+--EXPECT--
+string(0) ""
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+string(5) "reply"
+SASL negotiation is already complete
@@ -0,0 +1,58 @@
+--TEST--
+Testing the krb5 context pool
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--INI--
+krb5.context_pool_size=2
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+
+function context_pool_stats() {
+	ob_start();
+	phpinfo(INFO_MODULES);
+	preg_match_all('/Context pool (hits|misses) => (\d+)/', ob_get_clean(), $m);
+	return array_combine($m[1], $m[2]);
+}
+
+// the first object creates a context, it is returned to the pool on destruction
+$before = context_pool_stats();
+$ccache = new KRB5CCache();
+unset($ccache);
+$first = context_pool_stats();
+var_dump($first['misses'] - $before['misses'] <= 1);
+
+// following objects borrow it again
+for($i = 0; $i < 5; $i++) {
+	$ccache = new KRB5CCache();
+	if($use_config) {
+		$ccache->setConfig(dirname(__FILE__) . '/krb5.ini');
+	}
+	$ccache->initPassword($client_principal, $client_password);
+	unset($ccache);
+}
+$after = context_pool_stats();
+var_dump($after['hits'] - $first['hits']);
+var_dump($after['misses'] - $first['misses']);
+
+// never more than krb5.context_pool_size idle contexts
+$objects = array();
+for($i = 0; $i < 4; $i++) {
+	$objects[] = new KRB5CCache();
+}
+$objects = array();
+$objects[] = new KRB5CCache();
+$objects[] = new KRB5CCache();
+$full = context_pool_stats();
+$objects[] = new KRB5CCache();
+$overflow = context_pool_stats();
+var_dump($overflow['misses'] - $full['misses']);
+?>
+--EXPECT--
+bool(true)
+int(5)
+int(0)
+int(1)
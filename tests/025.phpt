@@ -0,0 +1,73 @@
+--TEST--
+Testing automatic renewal of a TGT without a separate start time
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+$file = dirname(__FILE__) . '/ccache4.tmp';
+
+function skip_data($buf, $pos) {
+	$len = unpack('N', substr($buf, $pos, 4))[1];
+	return $pos + 4 + $len;
+}
+
+function skip_principal($buf, $pos, &$first = null) {
+	$count = unpack('N', substr($buf, $pos + 4, 4))[1];
+	$pos = skip_data($buf, $pos + 8);
+	for($i = 0; $i < $count; $i++) {
+		if($i == 0) $first = substr($buf, $pos + 4, unpack('N', substr($buf, $pos, 4))[1]);
+		$pos = skip_data($buf, $pos);
+	}
+	return $pos;
+}
+
+/* clear the starttime of the TGT in a version 4 FILE cache */
+function clear_tgt_starttime($file) {
+	$buf = file_get_contents($file);
+	$pos = 4 + unpack('n', substr($buf, 2, 2))[1];
+	$pos = skip_principal($buf, $pos);
+	while($pos < strlen($buf)) {
+		$pos = skip_principal($buf, $pos);
+		$pos = skip_principal($buf, $pos, $service);
+		$pos = skip_data($buf, $pos + 2);
+		if($service == 'krbtgt') {
+			$buf = substr_replace($buf, "\0\0\0\0", $pos + 4, 4);
+		}
+		$pos += 16 + 1 + 4;
+		for($j = 0; $j < 2; $j++) {
+			$count = unpack('N', substr($buf, $pos, 4))[1];
+			$pos += 4;
+			for($i = 0; $i < $count; $i++) $pos = skip_data($buf, $pos + 2);
+		}
+		$pos = skip_data($buf, $pos);
+		$pos = skip_data($buf, $pos);
+	}
+	file_put_contents($file, $buf);
+}
+
+$ccache = new KRB5CCache();
+$ccache->initKeytab($server_principal, $server_keytab);
+var_dump($ccache->save('FILE:' . $file));
+clear_tgt_starttime($file);
+var_dump($ccache->open('FILE:' . $file));
+
+$tgt = $ccache->getTktAttrs('krbtgt');
+var_dump($tgt[0]['starttime']);
+
+// a fresh ticket is well above the threshold and must not be re-acquired
+$ccache->setRenewThreshold(0.5);
+var_dump($ccache->getLifetime()['endtime'] > time());
+$tgt = $ccache->getTktAttrs('krbtgt');
+var_dump($tgt[0]['starttime']);
+@unlink($file);
+?>
+--EXPECT--
+bool(true)
+bool(true)
+int(0)
+bool(true)
+int(0)
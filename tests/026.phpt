@@ -0,0 +1,32 @@
+--TEST--
+Testing that cache listings include tickets stored by initSecContext
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+$client = new KRB5CCache();
+$client->initPassword($client_principal, $client_password);
+
+$cgssapi = new GSSAPIContext();
+$cgssapi->acquireCredentials($client, $client_principal, GSS_C_INITIATE);
+
+// taken before the service ticket is requested
+$before = $client->getEntries();
+var_dump(count($before) > 0);
+
+$token = '';
+var_dump($cgssapi->initSecContext($server_principal, null, null, null, $token));
+
+$after = $client->getEntries();
+var_dump(count($after) > count($before));
+var_dump(count($client->getTktAttrs()) == count($after));
+?>
+--EXPECT--
+bool(true)
+bool(true)
+bool(true)
+bool(true)
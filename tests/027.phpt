@@ -0,0 +1,42 @@
+--TEST--
+Testing the KRB5NegotiateAuth host name cache
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--ENV--
+SERVER_NAME=localhost
+--INI--
+krb5.negotiate_name_ttl=300
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+
+function negotiate_name_stats() {
+	ob_start();
+	phpinfo(INFO_MODULES);
+	preg_match_all('/Negotiate host name cache (hits|misses) => (\d+)/', ob_get_clean(), $m);
+	return array_combine($m[1], $m[2]);
+}
+
+// the first object looks the host name up
+$before = negotiate_name_stats();
+$auth = @new KRB5NegotiateAuth($server_keytab);
+$first = negotiate_name_stats();
+var_dump($first['misses'] - $before['misses']);
+var_dump($first['hits'] - $before['hits']);
+
+// following ones reuse the cached FQDN
+for($i = 0; $i < 3; $i++) {
+	$auth = @new KRB5NegotiateAuth($server_keytab);
+}
+$after = negotiate_name_stats();
+var_dump($after['misses'] - $first['misses']);
+var_dump($after['hits'] - $first['hits']);
+?>
+--EXPECT--
+int(1)
+int(0)
+int(0)
+int(3)
@@ -0,0 +1,44 @@
+--TEST--
+Testing the bound on cached KRB5NegotiateAuth acceptor credentials
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+
+function negotiate_creds() {
+	ob_start();
+	phpinfo(INFO_MODULES);
+	preg_match('/Negotiate acceptor credentials => (\d+)/', ob_get_clean(), $m);
+	return (int) $m[1];
+}
+
+// every keytab is a separate cache key, credentials are acquired before the token is accepted
+$copies = array();
+for($i = 0; $i < 70; $i++) {
+	$copy = dirname(__FILE__) . '/keytab' . $i . '.tmp';
+	copy($server_keytab, $copy);
+	$copies[] = $copy;
+
+	$auth = new KRB5NegotiateAuth($copy, $server_principal);
+	try {
+		$auth->authenticate('Negotiate AAAA');
+	} catch(Exception $e) {
+	}
+
+	if($i == 9) {
+		var_dump(negotiate_creds());
+	}
+}
+var_dump(negotiate_creds());
+
+foreach($copies as $copy) {
+	@unlink($copy);
+}
+?>
+--EXPECT--
+int(10)
+int(64)
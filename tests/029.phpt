@@ -0,0 +1,42 @@
+--TEST--
+Testing a registered acceptor identity across keytab cache reloads
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--INI--
+krb5.keytab_cache=1
+krb5.keytab_cache_interval=0
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+$copy = dirname(__FILE__) . '/keytab2.tmp';
+copy($server_keytab, $copy);
+
+$identity = new GSSAPIContext();
+$identity->registerAcceptorIdentity($copy);
+
+// a rewritten keytab replaces the in-memory copy the identity was registered with
+touch($copy, time() + 10);
+clearstatcache();
+$server = new KRB5CCache();
+var_dump($server->initKeytab($server_principal, $copy));
+
+$client = new KRB5CCache();
+$client->initPassword($client_principal, $client_password);
+$cgssapi = new GSSAPIContext();
+$cgssapi->acquireCredentials($client, $client_principal, GSS_C_INITIATE);
+
+$token = '';
+var_dump($cgssapi->initSecContext($server_principal, null, null, null, $token));
+
+// no credentials acquired, the registered identity is used
+$sgssapi = new GSSAPIContext();
+var_dump($sgssapi->acceptSecContext($token));
+@unlink($copy);
+?>
+--EXPECT--
+bool(true)
+bool(true)
+bool(true)
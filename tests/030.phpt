@@ -0,0 +1,65 @@
+--TEST--
+Testing the shared memory replay cache with an AP-REQ in a later SPNEGO leg
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--INI--
+krb5.rcache=shm
+krb5.rcache_shm_size=1048576
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+
+function der($tag, $content) {
+	$len = strlen($content);
+	if($len < 0x80) {
+		return chr($tag) . chr($len) . $content;
+	}
+	$bytes = ltrim(pack('N', $len), "\0");
+	return chr($tag) . chr(0x80 | strlen($bytes)) . $bytes . $content;
+}
+
+$oid_spnego = der(0x06, "\x2b\x06\x01\x05\x05\x02");
+$oid_krb5 = der(0x06, "\x2a\x86\x48\x86\xf7\x12\x01\x02\x02");
+
+// NegTokenInit proposing Kerberos without an optimistic mechToken
+$init = der(0x60, $oid_spnego . der(0xa0, der(0x30, der(0xa0, der(0x30, $oid_krb5)))));
+
+$client = new KRB5CCache();
+$client->initPassword($client_principal, $client_password);
+$server = new KRB5CCache();
+$server->initKeytab($server_principal, $server_keytab);
+
+$cgssapi = new GSSAPIContext();
+$cgssapi->acquireCredentials($client, $client_principal, GSS_C_INITIATE);
+$token = '';
+var_dump($cgssapi->initSecContext($server_principal, null, null, null, $token));
+
+// NegTokenResp carrying the AP-REQ as its responseToken
+$resp = der(0xa1, der(0x30, der(0xa2, der(0x04, $token))));
+
+$sgssapi = new GSSAPIContext();
+$sgssapi->acquireCredentials($server, $server_principal, GSS_C_ACCEPT);
+var_dump($sgssapi->acceptSecContext($init));
+var_dump($sgssapi->acceptSecContext($resp));
+
+// both legs presented to a fresh acceptor
+$replay = new GSSAPIContext();
+$replay->acquireCredentials($server, $server_principal, GSS_C_ACCEPT);
+var_dump($replay->acceptSecContext($init));
+try {
+	$replay->acceptSecContext($resp);
+} catch(KRB5Exception $e) {
+	echo get_class($e), ': ', $e->getMessage(), "\n";
+	var_dump($e->getKrb5Code() == KRB5_RC_REPLAY);
+}
+?>
+--EXPECTF--
+bool(true)
+bool(false)
+bool(true)
+bool(false)
+KRB5Exception: Replayed context token (%s)
+bool(true)
@@ -0,0 +1,72 @@
+--TEST--
+Testing Negotiate header parsing and token decoding
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+$client = new KRB5CCache();
+$client->initPassword($client_principal, $client_password);
+
+$auth = new KRB5NegotiateAuth($server_keytab, $server_principal);
+
+function outcome($auth, $header) {
+	try {
+		$auth->authenticate($header);
+		return 'accepted';
+	} catch(GSSAPIException $e) {
+		// decoded, but not a valid context token
+		return 'decoded';
+	} catch(Exception $e) {
+		return $e->getMessage();
+	}
+}
+
+// the scheme has to be followed by a space
+$cgssapi = new GSSAPIContext();
+$cgssapi->acquireCredentials($client, $client_principal, GSS_C_INITIATE);
+$token = '';
+$cgssapi->initSecContext($server_principal, null, null, null, $token);
+echo outcome($auth, 'Negotiate' . base64_encode($token)), "\n";
+echo outcome($auth, "Negotiate\t" . base64_encode($token)), "\n";
+echo outcome($auth, 'NegotiateX'), "\n";
+echo outcome($auth, 'negotiate  ' . rtrim(base64_encode($token), '=')), "\n";
+
+// random data around the 45 character vector threshold and beyond, padded and unpadded
+mt_srand(1234);
+$results = array();
+for($len = 1; $len < 200; $len++) {
+	$data = '';
+	for($i = 0; $i < $len; $i++) {
+		$data .= chr(mt_rand(0, 255));
+	}
+	$encoded = base64_encode($data);
+	if($len % 2) {
+		$encoded = rtrim($encoded, '=');
+	}
+	$results[outcome($auth, 'Negotiate ' . $encoded)] = true;
+
+	// one character outside the alphabet anywhere is rejected
+	$bad = $encoded;
+	$bad[mt_rand(0, strlen(rtrim($bad, '=')) - 1)] = substr(" \n!*-_.:\x80\xff", mt_rand(0, 9), 1);
+	$results[outcome($auth, 'Negotiate ' . $bad)] = true;
+}
+print_r(array_keys($results));
+
+// an impossible length
+echo outcome($auth, 'Negotiate AAAAA'), "\n";
+?>
+--EXPECT--
+Authorization header does not use the Negotiate scheme
+Authorization header does not use the Negotiate scheme
+Authorization header does not use the Negotiate scheme
+accepted
+Array
+(
+    [0] => decoded
+    [1] => Failed to decode token data
+)
+Failed to decode token data
@@ -0,0 +1,60 @@
+--TEST--
+Testing multi-leg KRB5NegotiateAuth::authenticate()
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+
+function der($tag, $content) {
+	$len = strlen($content);
+	if($len < 0x80) {
+		return chr($tag) . chr($len) . $content;
+	}
+	$bytes = ltrim(pack('N', $len), "\0");
+	return chr($tag) . chr(0x80 | strlen($bytes)) . $bytes . $content;
+}
+
+$oid_spnego = der(0x06, "\x2b\x06\x01\x05\x05\x02");
+$oid_krb5 = der(0x06, "\x2a\x86\x48\x86\xf7\x12\x01\x02\x02");
+
+$client = new KRB5CCache();
+$client->initPassword($client_principal, $client_password);
+$cgssapi = new GSSAPIContext();
+$cgssapi->acquireCredentials($client, $client_principal, GSS_C_INITIATE);
+$token = '';
+$cgssapi->initSecContext($server_principal, null, null, null, $token);
+
+$auth = new KRB5NegotiateAuth($server_keytab, $server_principal);
+
+// a NegTokenInit without an optimistic token needs a second leg
+$init = der(0x60, $oid_spnego . der(0xa0, der(0x30, der(0xa0, der(0x30, $oid_krb5)))));
+$first = $auth->authenticate('Negotiate ' . base64_encode($init));
+var_dump($first->isComplete());
+var_dump($first->getPrincipal());
+var_dump(strlen($first->getResponseToken()) > 0);
+
+$resp = der(0xa1, der(0x30, der(0xa2, der(0x04, $token))));
+$second = $auth->authenticate('Negotiate ' . base64_encode($resp), $first);
+var_dump($second->isComplete());
+var_dump($second->getPrincipal() === $client_principal);
+var_dump($second->getExpires() > time());
+
+// the context moved on to the second result
+try {
+	$auth->authenticate('Negotiate ' . base64_encode($resp), $first);
+} catch(Exception $e) {
+	echo $e->getMessage(), "\n";
+}
+?>
+--EXPECT--
+bool(false)
+bool(false)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+The previous authentication is not awaiting a token
@@ -0,0 +1,117 @@
+--TEST--
+Testing PAC logon info group decoding
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+
+function sid($sub) {
+	return pack('V', count($sub)) . pack('CC', 1, count($sub)) . "\0\0\0\0\0\x05" . call_user_func_array('pack', array_merge(array('V*'), $sub));
+}
+
+/* NDR serialised KERB_VALIDATION_INFO (MS-PAC 2.5) */
+function logon_info($user_flags) {
+	$domain = array(21, 1004336348, 1177238915, 682003330);
+	$b = pack('CCvV', 1, 0x10, 8, 0xcccccccc) . pack('VV', 0, 0);
+	$b .= pack('V', 0x20000);
+	$b .= str_repeat("\0", 6 * 8);
+	$b .= str_repeat(pack('VV', 0, 0), 6);
+	$b .= pack('vvV', 0, 0, 1104);
+	$b .= pack('VVV', 513, 2, 0x20004);
+	$b .= pack('V', $user_flags) . str_repeat("\0", 16);
+	$b .= pack('VVVV', 0, 0, 0, 0);
+	$b .= pack('V', 0x20008);
+	$b .= str_repeat("\0", 44);
+	$b .= pack('VV', 1, 0x2000c);
+	$b .= pack('VVV', 0x20010, 1, 0x20014);
+	/* deferred: GroupIds, LogonDomainId, ExtraSids, ResourceGroupDomainSid, ResourceGroupIds */
+	$b .= pack('V', 2) . pack('VV', 512, 7) . pack('VV', 1105, 7);
+	$b .= sid($domain);
+	$b .= pack('V', 1) . pack('VV', 0x20018, 7) . sid(array(1));
+	$b .= sid(array(21, 1, 2, 3));
+	$b .= pack('V', 1) . pack('VV', 1000, 7);
+	return $b;
+}
+
+$groups = array(
+	'S-1-5-21-1004336348-1177238915-682003330-513',
+	'S-1-5-21-1004336348-1177238915-682003330-512',
+	'S-1-5-21-1004336348-1177238915-682003330-1105',
+	'S-1-5-1',
+);
+
+$set = KRB5SidSet::fromLogonInfo(logon_info(0x20));
+var_dump($set->count());
+foreach($groups as $g) {
+	var_dump($set->contains($g));
+}
+var_dump($set->contains('S-1-5-21-1-2-3-1000'));
+
+$set = KRB5SidSet::fromLogonInfo(logon_info(0x220));
+var_dump($set->count());
+var_dump($set->contains('S-1-5-21-1-2-3-1000'));
+
+foreach(array('', substr(logon_info(0x220), 0, 200), "\x01\x10" . str_repeat("\0", 18)) as $bad) {
+	try {
+		KRB5SidSet::fromLogonInfo($bad);
+	} catch(Exception $e) {
+		echo $e->getMessage(), "\n";
+	}
+}
+
+/* the authenticated name has to give the same groups as its logon info buffer */
+$client = new KRB5CCache();
+if($use_config) {
+	$client->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$client->initPassword($client_principal, $client_password);
+
+$cgssapi = new GSSAPIContext();
+$cgssapi->acquireCredentials($client, $client_principal, GSS_C_INITIATE);
+$token = '';
+$cgssapi->initSecContext($server_principal, null, null, null, $token);
+
+$auth = new KRB5NegotiateAuth($server_keytab, $server_principal);
+$result = $auth->authenticate('Negotiate ' . base64_encode($token));
+
+$info = $result->getNameAttribute('urn:mspac:logon-info');
+if(empty($info) || !$info[0]['authenticated']) {
+	try {
+		$result->getGroupSids();
+	} catch(Exception $e) {
+		var_dump(true);
+	}
+	try {
+		$result->hasGroup(new KRB5SidSet($groups));
+	} catch(Exception $e) {
+		var_dump(true);
+	}
+} else {
+	$set = KRB5SidSet::fromLogonInfo($info[0]['value']);
+	$sids = $result->getGroupSids();
+	$same = count($sids) == $set->count();
+	foreach($sids as $sid) {
+		$same = $same && $set->contains($sid);
+	}
+	var_dump($same);
+	var_dump($result->hasGroup($set) == ($set->count() > 0));
+}
+?>
+--EXPECT--
+int(4)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(false)
+int(5)
+bool(true)
+Failed to decode PAC logon information
+Failed to decode PAC logon information
+Failed to decode PAC logon information
+bool(true)
+bool(true)
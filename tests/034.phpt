@@ -0,0 +1,104 @@
+--TEST--
+Testing KRB5SaslGssapi::negotiate() over a stream
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+if(!function_exists('stream_socket_pair')) { echo "skip stream_socket_pair missing"; return; }
+if(!function_exists('pcntl_fork')) { echo "skip pcntl missing"; return; }
+?>
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+$client = new KRB5CCache();
+if($use_config) {
+	$client->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$client->initPassword($client_principal, $client_password);
+
+$server = new KRB5CCache();
+if($use_config) {
+	$server->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$server->initKeytab($server_principal, $server_keytab);
+
+function read_frame($s) {
+	$data = '';
+	while(strlen($data) < 4 && !feof($s)) {
+		$data .= fread($s, 4 - strlen($data));
+	}
+	$length = unpack('N', $data);
+	$data = '';
+	while(strlen($data) < $length[1] && !feof($s)) {
+		$data .= fread($s, $length[1] - strlen($data));
+	}
+	return $data;
+}
+
+function write_frame($s, $data) {
+	fwrite($s, pack('N', strlen($data)) . $data);
+}
+
+list($service, $host) = explode('/', strtok($server_principal, '@'), 2);
+list($a, $b) = stream_socket_pair(STREAM_PF_UNIX, STREAM_SOCK_STREAM, STREAM_IPPROTO_IP);
+
+$pid = pcntl_fork();
+if($pid == 0) {
+	// the server, reporting back over the stream once the exchange is done
+	fclose($a);
+	$sgssapi = new GSSAPIContext();
+	$sgssapi->acquireCredentials($server, $server_principal, GSS_C_ACCEPT);
+
+	$challenge = '';
+	$sgssapi->acceptSecContext(read_frame($b), $challenge);
+	write_frame($b, $challenge);
+
+	// the empty response to the final context token is framed as well
+	$report = array('empty' => strlen(read_frame($b)));
+
+	$offer = '';
+	$sgssapi->wrap(chr(KRB5SaslGssapi::LAYER_INTEGRITY | KRB5SaslGssapi::LAYER_CONFIDENTIALITY) . "\x00\x10\x00", $offer, false);
+	write_frame($b, $offer);
+
+	$choice = '';
+	$sgssapi->unwrap(read_frame($b), $choice);
+	$report['layer'] = ord($choice[0]);
+
+	$plain = '';
+	$sgssapi->unwrap(read_frame($b), $plain);
+	$report['request'] = $plain;
+
+	$enc = '';
+	$sgssapi->wrap(serialize($report), $enc, true);
+	write_frame($b, $enc);
+	fclose($b);
+	exit(0);
+}
+fclose($b);
+
+$sasl = new KRB5SaslGssapi($client, $service . '@' . $host);
+var_dump($sasl->negotiate($a));
+var_dump($sasl->isComplete());
+var_dump($sasl->getLayer() == KRB5SaslGssapi::LAYER_CONFIDENTIALITY);
+
+var_dump($sasl->wrapStream($a));
+fwrite($a, 'request');
+$reply = '';
+while(!feof($a)) {
+	$reply .= fread($a, 8192);
+}
+pcntl_waitpid($pid, $status);
+
+$report = unserialize($reply);
+var_dump($report['empty']);
+var_dump($report['layer'] == KRB5SaslGssapi::LAYER_CONFIDENTIALITY);
+var_dump($report['request']);
+?>
+--EXPECT--
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+int(0)
+bool(true)
+string(7) "request"
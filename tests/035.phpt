@@ -0,0 +1,68 @@
+--TEST--
+Testing that a KDC time offset does not leak to pooled contexts
+--SKIPIF--
+<?php 
+if(!file_exists(dirname(__FILE__) . '/config.php')) { echo "skip config missing"; return; }
+if(!include(dirname(__FILE__) . '/config.php')) return; 
+?>
+--INI--
+krb5.context_pool_size=8
+--FILE--
+<?php
+include(dirname(__FILE__) . '/config.php');
+$file = dirname(__FILE__) . '/ccache_offset.tmp';
+$saved = dirname(__FILE__) . '/ccache_offset_saved.tmp';
+
+/* header tags of a version 4 FILE cache */
+function header_tags($file) {
+	$buf = file_get_contents($file);
+	$len = unpack('n', substr($buf, 2, 2))[1];
+	$tags = array();
+	for($pos = 4; $pos < 4 + $len; $pos += 4 + $tlen) {
+		list(, $tag, $tlen) = unpack('n2', substr($buf, $pos, 4));
+		$tags[$tag] = substr($buf, $pos + 4, $tlen);
+	}
+	return $tags;
+}
+
+$ccache = new KRB5CCache();
+if($use_config) {
+	$ccache->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$ccache->initKeytab($server_principal, $server_keytab);
+var_dump($ccache->save('FILE:' . $file));
+var_dump(header_tags($file));
+
+// a KDC an hour ahead
+$buf = file_get_contents($file);
+$buf = substr($buf, 0, 2) . pack('nnnNN', 12, 1, 8, 3600, 0) . substr($buf, 4);
+file_put_contents($file, $buf);
+
+$skewed = new KRB5CCache();
+var_dump($skewed->open('FILE:' . $file));
+$skewed->save('FILE:' . $saved);
+$tags = header_tags($saved);
+var_dump(unpack('N', $tags[1])[1] >= 3599);
+unset($skewed);
+
+// the next object must not inherit the offset through the context pool
+$fresh = new KRB5CCache();
+if($use_config) {
+	$fresh->setConfig(dirname(__FILE__) . '/krb5.ini');
+}
+$fresh->initKeytab($server_principal, $server_keytab);
+var_dump($fresh->save('FILE:' . $saved));
+var_dump(header_tags($saved));
+
+@unlink($file);
+@unlink($saved);
+?>
+--EXPECT--
+bool(true)
+array(0) {
+}
+bool(true)
+bool(true)
+bool(true)
+array(0) {
+}